@@ -39,7 +39,7 @@
  * or modified, or when the user-mapped driver- and endpoint-descriptors
  * are modified.
  */
-#define OMX_DRIVER_ABI_VERSION		0x20f
+#define OMX_DRIVER_ABI_VERSION		0x211
 
 /************************
  * Common parameters or IOCTL subtypes
@@ -149,6 +149,15 @@ struct omx_driver_desc {
 
 #define OMX_DRIVER_FEATURE_SHARED		(1<<1)
 #define OMX_DRIVER_FEATURE_PIN_INVALIDATE	(1<<2)
+#define OMX_DRIVER_FEATURE_RELEASE_INDEX	(1<<3)
+#define OMX_DRIVER_FEATURE_SEND_MEDIUMSQ	(1<<4)
+#define OMX_DRIVER_FEATURE_SUBMIT_BATCH		(1<<5)
+#define OMX_DRIVER_FEATURE_CMDQ			(1<<6)
+#define OMX_DRIVER_FEATURE_CMDQ_POLL		(1<<7) /* the command queue is drained by a kernel thread */
+#define OMX_DRIVER_FEATURE_POLL			(1<<8)
+#define OMX_DRIVER_FEATURE_AGGREGATE		(1<<9)
+#define OMX_DRIVER_FEATURE_PUSH			(1<<10)
+#define OMX_DRIVER_FEATURE_RNDV_EAGER		(1<<11)
 
 /* endpoint desc */
 struct omx_endpoint_desc {
@@ -159,6 +168,23 @@ struct omx_endpoint_desc {
 	uint32_t session_id;
 	uint32_t user_event_index;
 	/* 24 */
+	uint64_t partners_memory; /* set by the library, reported by get_endpoint_info */
+	/* 32 */
+	uint32_t partners_nr; /* set by the library, reported by get_endpoint_info */
+	uint32_t user_features; /* set by the library */
+	/* 40 */
+	omx_eventq_index_t released_exp_eventq_index; /* set by the library if USER_FEATURE_RELEASE_INDEX */
+	omx_eventq_index_t released_unexp_eventq_index; /* set by the library if USER_FEATURE_RELEASE_INDEX */
+	/* 48 */
+	uint32_t cmdq_submitted_index; /* set by the library if USER_FEATURE_CMDQ */
+	uint32_t cmdq_consumed_index; /* set by the driver */
+	/* 56 */
+	omx_eventq_index_t poll_exp_event_index; /* set by the library when arming poll() */
+	omx_eventq_index_t poll_unexp_event_index; /* set by the library when arming poll() */
+	/* 64 */
+	uint32_t poll_user_event_index; /* set by the library when arming poll() */
+	uint32_t pad2;
+	/* 72 */
 };
 
 #define OMX_ENDPOINT_DESC_SIZE	sizeof(struct omx_endpoint_desc)
@@ -170,9 +196,15 @@ struct omx_endpoint_desc {
 #define OMX_UNEXP_EVENTQ_FILE_OFFSET	(3*1024*1024)
 #define OMX_DRIVER_DESC_FILE_OFFSET	(4*1024*1024)
 #define OMX_ENDPOINT_DESC_FILE_OFFSET	(5*1024*1024)
+#define OMX_CMDQ_FILE_OFFSET		(6*1024*1024)
 
 #define OMX_NO_WAKEUP_JIFFIES 0
 
+/* the library releases event slots by updating released_*_eventq_index instead of ioctls */
+#define OMX_ENDPOINT_DESC_USER_FEATURE_RELEASE_INDEX (1U << 0)
+/* the library submits some commands through the command queue */
+#define OMX_ENDPOINT_DESC_USER_FEATURE_CMDQ (1U << 1)
+
 #define OMX_ENDPOINT_DESC_STATUS_EXP_EVENTQ_FULL (1ULL << 0)
 #define OMX_ENDPOINT_DESC_STATUS_UNEXP_EVENTQ_FULL (1ULL << 1)
 #define OMX_ENDPOINT_DESC_STATUS_IFACE_DOWN (1ULL << 2)
@@ -224,8 +256,13 @@ struct omx_cmd_get_endpoint_info {
 		/* 8 */
 		char command[OMX_COMMAND_LEN_MAX];
 		/* 40 */
+		uint64_t partners_memory;
+		/* 48 */
+		uint32_t partners_nr;
+		uint32_t pad;
+		/* 56 */
 	} info;
-	/* 48 */
+	/* 64 */
 };
 
 struct omx_cmd_get_counters {
@@ -366,6 +403,30 @@ struct omx_cmd_send_mediumsq_frag {
 	/* 40 */
 };
 
+#define OMX_CMD_SEND_MEDIUMSQ_FRAGS_MAX 32
+
+struct omx_cmd_send_mediumsq {
+	uint16_t peer_index;
+	uint8_t dest_endpoint;
+	uint8_t shared;
+	uint32_t session_id;
+	/* 8 */
+	uint16_t seqnum;
+	uint16_t piggyack;
+	uint32_t msg_length;
+	/* 16 */
+	uint16_t checksum;
+	uint8_t frags_nr;
+	uint8_t frag_pipeline;
+	uint32_t pad;
+	/* 24 */
+	uint64_t match_info;
+	/* 32 */
+	/* sendq entry of each fragment, all of them are OMX_MEDIUM_FRAG_LENGTH_MAX long except the last one */
+	uint16_t sendq_index[OMX_CMD_SEND_MEDIUMSQ_FRAGS_MAX];
+	/* 96 */
+};
+
 struct omx_cmd_send_mediumva {
 	uint16_t peer_index;
 	uint8_t dest_endpoint;
@@ -394,7 +455,8 @@ struct omx_cmd_send_rndv {
 	/* 8 */
 	uint16_t seqnum;
 	uint16_t piggyack;
-	uint32_t pad1;
+	uint16_t eager_length; /* beginning of the message to send within the rndv, up to OMX_RNDV_EAGER_LENGTH_MAX */
+	uint16_t pad1;
 	/* 16 */
 	uint64_t match_info;
 	/* 24 */
@@ -418,7 +480,8 @@ struct omx_cmd_send_connect_request {
 	/* 16 */
 	uint16_t target_recv_seqnum_start;
 	uint8_t connect_seqnum;
-	uint8_t pad2[5];
+	uint8_t features; /* OMX_PKT_CONNECT_FEATURE_* */
+	uint8_t pad2[4];
 	/* 24 */
 };
 
@@ -436,7 +499,8 @@ struct omx_cmd_send_connect_reply {
 	uint16_t target_recv_seqnum_start;
 	uint8_t connect_seqnum;
 	uint8_t connect_status_code;
-	uint32_t pad2;
+	uint8_t features; /* OMX_PKT_CONNECT_FEATURE_* */
+	uint8_t pad2[3];
 	/* 24 */
 };
 
@@ -457,8 +521,18 @@ struct omx_cmd_pull {
 	/* 32 */
 	uint64_t lib_cookie;
 	/* 40 */
+	uint32_t flags; /* OMX_CMD_PULL_FLAG_* */
+	uint32_t puller_rdma_offset; /* where to start writing in the local region */
+	/* 48 */
 };
 
+/*
+ * Ask the sender to push the whole message at once instead of replying
+ * to one pull request per block, see OMX_PULL_PUSH_REPLIES_MAX.
+ * Only set if the partner advertised OMX_PKT_CONNECT_FEATURE_PUSH.
+ */
+#define OMX_CMD_PULL_FLAG_PUSH	(1<<0)
+
 struct omx_cmd_send_notify {
 	uint16_t peer_index;
 	uint8_t dest_endpoint;
@@ -490,6 +564,65 @@ struct omx_cmd_send_liback {
 	/* 24 */
 };
 
+/*
+ * The batch buffer contains nr entries, each made of an entry header
+ * followed by the parameter of a tiny, small, notify or liback command,
+ * padded to a multiple of 8 bytes.
+ */
+#define OMX_CMD_SUBMIT_BATCH_LENGTH_MAX	4096
+
+struct omx_cmd_submit_batch {
+	uint32_t nr;
+	uint32_t length;
+	/* 8 */
+	uint64_t buffer;
+	/* 16 */
+};
+
+struct omx_cmd_submit_batch_entry {
+	uint8_t epcmd; /* OMX_EPCMD_SEND_{TINY,SMALL,NOTIFY,LIBACK} */
+	uint8_t flags; /* OMX_CMD_SUBMIT_BATCH_ENTRY_FLAG_* */
+	uint16_t length; /* of the parameter, without the entry header and padding */
+	uint32_t pad2;
+	/* 8 */
+};
+
+#define OMX_CMD_SUBMIT_BATCH_ENTRY_ALIGN(len) (((len)+7) & ~7)
+
+/*
+ * The tiny/small message may be coalesced with the neighbour entries
+ * to the same partner into an aggregate packet.
+ * Only set if the partner advertised OMX_PKT_CONNECT_FEATURE_AGGREGATE.
+ */
+#define OMX_CMD_SUBMIT_BATCH_ENTRY_FLAG_AGGREGATE	(1<<0)
+
+/*
+ * The command queue is a ring of entries that the library fills and
+ * the driver drains without any ioctl. Entries up to cmdq_submitted_index
+ * in the endpoint desc are valid. Small message data is stored in the entry
+ * since the driver may not be able to access the application memory.
+ */
+#define OMX_CMDQ_ENTRY_SHIFT	8
+#define OMX_CMDQ_ENTRY_SIZE	(1UL << OMX_CMDQ_ENTRY_SHIFT)
+#define OMX_CMDQ_ENTRY_NR	256UL
+#define OMX_CMDQ_SIZE		(OMX_CMDQ_ENTRY_NR << OMX_CMDQ_ENTRY_SHIFT)
+
+struct omx_cmdq_entry {
+	struct omx_cmd_submit_batch_entry hdr;
+	/* 8 */
+	union {
+		struct omx_cmd_send_tiny tiny;
+		struct omx_cmd_send_small small; /* vaddr is ignored, data is in small_data */
+		struct omx_cmd_send_notify notify;
+		struct omx_cmd_send_liback liback;
+	} cmd;
+	/* 64 */
+	char small_data[OMX_SMALL_MSG_LENGTH_MAX];
+	/* 192 */
+	char pad[64];
+	/* 256 */
+};
+
 struct omx_cmd_create_user_region {
 	uint32_t nr_segments;
 	uint32_t id;
@@ -602,6 +735,8 @@ struct omx_cmd_bench {
 #define OMX_EPCMD_WAKEUP		0xe
 #define OMX_EPCMD_RELEASE_EXP_SLOTS	0xf
 #define OMX_EPCMD_RELEASE_UNEXP_SLOTS	0x10
+#define OMX_EPCMD_SEND_MEDIUMSQ		0x11
+#define OMX_EPCMD_SUBMIT_BATCH		0x12
 #define OMX_CMD_BENCH			_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_BENCH, struct omx_cmd_bench)
 #define OMX_CMD_SEND_TINY		_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_SEND_TINY, struct omx_cmd_send_tiny)
 #define OMX_CMD_SEND_SMALL		_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_SEND_SMALL, struct omx_cmd_send_small)
@@ -619,6 +754,8 @@ struct omx_cmd_bench {
 #define OMX_CMD_WAKEUP			_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_WAKEUP, struct omx_cmd_wakeup)
 #define OMX_CMD_RELEASE_EXP_SLOTS	_IO(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_RELEASE_EXP_SLOTS)
 #define OMX_CMD_RELEASE_UNEXP_SLOTS	_IO(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_RELEASE_UNEXP_SLOTS)
+#define OMX_CMD_SEND_MEDIUMSQ		_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_SEND_MEDIUMSQ, struct omx_cmd_send_mediumsq)
+#define OMX_CMD_SUBMIT_BATCH		_IOR(OMX_CMD_MAGIC, 0x80 + OMX_EPCMD_SUBMIT_BATCH, struct omx_cmd_submit_batch)
 
 static inline __pure const char *
 omx_strcmd(unsigned cmd)
@@ -692,6 +829,10 @@ omx_strcmd(unsigned cmd)
 		return "Release Expected Event Slots";
 	case OMX_CMD_RELEASE_UNEXP_SLOTS:
 		return "Release Unexpected Event Slots";
+	case OMX_CMD_SEND_MEDIUMSQ:
+		return "Send MediumSQ";
+	case OMX_CMD_SUBMIT_BATCH:
+		return "Submit Batch";
 	default:
 		return "** Unknown **";
 	}
@@ -714,6 +855,7 @@ omx_strcmd(unsigned cmd)
 #define OMX_EVT_RECV_NACK_LIB		0x19
 #define OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE	0x20
 #define OMX_EVT_PULL_DONE		0x21
+#define OMX_EVT_SEND_MEDIUMSQ_DONE	0x22
 
 #define OMX_EVT_NACK_LIB_BAD_ENDPT	0x01
 #define OMX_EVT_NACK_LIB_ENDPT_CLOSED	0x02
@@ -760,6 +902,8 @@ omx_strevt(unsigned type)
 		return "Send MediumSQ Fragment Done";
 	case OMX_EVT_PULL_DONE:
 		return "Pull Done";
+	case OMX_EVT_SEND_MEDIUMSQ_DONE:
+		return "Send MediumSQ Done";
 	default:
 		return "** Unknown **";
 	}
@@ -787,6 +931,16 @@ union omx_evt {
 		/* 64 */
 	} send_mediumsq_frag_done;
 
+	/* send whole medium done */
+	struct omx_evt_send_mediumsq_done {
+		uint32_t sendq_offset; /* offset of the first fragment */
+		uint8_t frags_nr;
+		uint8_t pad[57];
+		uint8_t type;
+		uint8_t id;
+		/* 64 */
+	} send_mediumsq_done;
+
 	struct omx_evt_pull_done {
 		uint64_t lib_cookie;
 		/* 8 */
@@ -812,7 +966,8 @@ union omx_evt {
 		/* 16 */
 		uint16_t target_recv_seqnum_start;
 		uint8_t connect_seqnum;
-		uint8_t pad2[5];
+		uint8_t features;
+		uint8_t pad2[4];
 		/* 24 */
 		uint8_t pad3[38];
 		uint8_t type;
@@ -833,7 +988,8 @@ union omx_evt {
 		uint16_t target_recv_seqnum_start;
 		uint8_t connect_seqnum;
 		uint8_t connect_status_code;
-		uint32_t pad2;
+		uint8_t features;
+		uint8_t pad2[3];
 		/* 24 */
 		uint8_t pad3[38];
 		uint8_t type;
@@ -917,7 +1073,10 @@ union omx_evt {
 				uint16_t pulled_rdma_offset;
 				/* 8 */
 				uint16_t checksum;
-				uint16_t pad2[15];
+				uint16_t eager_length; /* checked by the driver, 0 if no eager prefix */
+				uint32_t recvq_offset; /* eager prefix of eager_length bytes, if any */
+				/* 16 */
+				uint32_t pad2[6];
 				/* 40 */
 			} rndv;
 
@@ -963,6 +1122,7 @@ enum omx_counter_index {
 	OMX_COUNTER_SEND_RAW,
 	OMX_COUNTER_SEND_HOST_QUERY,
 	OMX_COUNTER_SEND_HOST_REPLY,
+	OMX_COUNTER_SEND_AGGREGATE,
 
 	OMX_COUNTER_RECV_TINY,
 	OMX_COUNTER_RECV_SMALL,
@@ -979,6 +1139,7 @@ enum omx_counter_index {
 	OMX_COUNTER_RECV_RAW,
 	OMX_COUNTER_RECV_HOST_QUERY,
 	OMX_COUNTER_RECV_HOST_REPLY,
+	OMX_COUNTER_RECV_AGGREGATE,
 
 	OMX_COUNTER_DMARECV_MEDIUM_FRAG,
 	OMX_COUNTER_DMARECV_PARTIAL_MEDIUM_FRAG,
@@ -987,6 +1148,8 @@ enum omx_counter_index {
 	OMX_COUNTER_DMARECV_PULL_REPLY_WAIT_DEFERRED,
 
 	OMX_COUNTER_RECV_NONLINEAR_HEADER,
+	OMX_COUNTER_RECV_LIST,
+	OMX_COUNTER_RECV_DEFERRED_WAKEUP,
 	OMX_COUNTER_EXP_EVENTQ_FULL,
 	OMX_COUNTER_UNEXP_EVENTQ_FULL,
 	OMX_COUNTER_SEND_NOMEM_SKB,
@@ -997,6 +1160,14 @@ enum omx_counter_index {
 	OMX_COUNTER_PULL_TIMEOUT_HANDLER_FIRST_BLOCK,
 	OMX_COUNTER_PULL_TIMEOUT_HANDLER_NONFIRST_BLOCK,
 	OMX_COUNTER_PULL_TIMEOUT_ABORT,
+	OMX_COUNTER_PULL_WINDOW_GROW,
+	OMX_COUNTER_PULL_WINDOW_SHRINK,
+	OMX_COUNTER_PULL_PUSH,
+	OMX_COUNTER_PULL_PUSH_RESEND,
+	OMX_COUNTER_PULL_PUSH_TIMEOUT_HANDLER,
+	OMX_COUNTER_SEND_RNDV_EAGER,
+	OMX_COUNTER_RECV_RNDV_EAGER,
+	OMX_COUNTER_PULL_REQ_DEFERRED_PINNING,
 	OMX_COUNTER_PULL_REPLY_SEND_LINEAR,
 	OMX_COUNTER_PULL_REPLY_FILL_FAILED,
 
@@ -1078,6 +1249,8 @@ omx_strcounter(enum omx_counter_index index)
 		return "Send Host Query";
 	case OMX_COUNTER_SEND_HOST_REPLY:
 		return "Send Host Reply";
+	case OMX_COUNTER_SEND_AGGREGATE:
+		return "Send Aggregate";
 	case OMX_COUNTER_RECV_TINY:
 		return "Recv Tiny";
 	case OMX_COUNTER_RECV_SMALL:
@@ -1108,6 +1281,8 @@ omx_strcounter(enum omx_counter_index index)
 		return "Recv Host Query";
 	case OMX_COUNTER_RECV_HOST_REPLY:
 		return "Recv Host Reply";
+	case OMX_COUNTER_RECV_AGGREGATE:
+		return "Recv Aggregate";
 	case OMX_COUNTER_DMARECV_MEDIUM_FRAG:
 		return "DMA Recv Medium Frag";
 	case OMX_COUNTER_DMARECV_PARTIAL_MEDIUM_FRAG:
@@ -1120,6 +1295,10 @@ omx_strcounter(enum omx_counter_index index)
 		return "DMA Recv Pull Reply with Deferred Wait";
 	case OMX_COUNTER_RECV_NONLINEAR_HEADER:
 		return "Recv Open-MX Header as Non-Linear";
+	case OMX_COUNTER_RECV_LIST:
+		return "Recv Packet List";
+	case OMX_COUNTER_RECV_DEFERRED_WAKEUP:
+		return "Recv Event Wakeup Deferred to End of List";
 	case OMX_COUNTER_EXP_EVENTQ_FULL:
 		return "Expected Event Queue Full";
 	case OMX_COUNTER_UNEXP_EVENTQ_FULL:
@@ -1140,6 +1319,22 @@ omx_strcounter(enum omx_counter_index index)
 		return "Pull Timeout Handler Requests Non-First Block";
 	case OMX_COUNTER_PULL_TIMEOUT_ABORT:
 		return "Pull Timeout Abort";
+	case OMX_COUNTER_PULL_WINDOW_GROW:
+		return "Pull Window Increased";
+	case OMX_COUNTER_PULL_WINDOW_SHRINK:
+		return "Pull Window Decreased on Loss";
+	case OMX_COUNTER_PULL_PUSH:
+		return "Pull in Push Mode";
+	case OMX_COUNTER_PULL_PUSH_RESEND:
+		return "Pull in Push Mode Missing Frames Requested Again";
+	case OMX_COUNTER_PULL_PUSH_TIMEOUT_HANDLER:
+		return "Pull Timeout Handler Requests Pushed Frames";
+	case OMX_COUNTER_SEND_RNDV_EAGER:
+		return "Send Rndv with Eager Prefix";
+	case OMX_COUNTER_RECV_RNDV_EAGER:
+		return "Recv Rndv with Eager Prefix";
+	case OMX_COUNTER_PULL_REQ_DEFERRED_PINNING:
+		return "Pull Request Deferred Until Region Pinned";
 	case OMX_COUNTER_PULL_REPLY_SEND_LINEAR:
 		return "Pull Reply Sent as Linear";
 	case OMX_COUNTER_PULL_REPLY_FILL_FAILED:
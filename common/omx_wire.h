@@ -30,6 +30,7 @@
 
 /* simplified max macros for constants */
 #define omx_constant_max(x, y) (x > y ? x : y)
+#define omx_constant_min(x, y) (x < y ? x : y)
 
 
 /************
@@ -141,6 +142,7 @@ enum omx_pkt_type {
 	OMX_PKT_TYPE_NOTIFY,
 	OMX_PKT_TYPE_NACK_LIB,
 	OMX_PKT_TYPE_NACK_MCP,
+	OMX_PKT_TYPE_AGGREGATE,
 
 	OMX_PKT_TYPE_MAX=255
 };
@@ -189,6 +191,8 @@ omx_strpkttype(enum omx_pkt_type ptype)
 		return "Nack Lib";
 	case OMX_PKT_TYPE_NACK_MCP:
 		return "Nack MCP";
+	case OMX_PKT_TYPE_AGGREGATE:
+		return "Aggregate";
 	default:
 		return "** Unknown **";
 	}
@@ -320,7 +324,9 @@ struct omx_pkt_connect { /* MX's pkt_connect + MX's lib connect_data */
 			uint16_t target_recv_seqnum_start; /* the target next recv seqnum (so the connected knows our next send seqnum) */
 			uint8_t is_reply;
 			uint8_t connect_seqnum; /* sequence number of this connect request (in case multiple have been sent/lost) */
-			uint32_t pad;
+			uint8_t features; /* OMX_PKT_CONNECT_FEATURE_* supported by the sender */
+			uint8_t pad;
+			uint16_t features_magic; /* OMX_PKT_CONNECT_FEATURES_MAGIC if features is valid */
 			/* 32 */
 		} request;
 		struct omx_pkt_connect_reply_data {
@@ -331,7 +337,8 @@ struct omx_pkt_connect { /* MX's pkt_connect + MX's lib connect_data */
 			uint8_t is_reply;
 			uint8_t connect_seqnum; /* sequence number of this connect request (in case multiple have been sent/lost) */
 			uint8_t connect_status_code; /* the status code to return in the connecter request */
-			uint8_t pad[3];
+			uint8_t features; /* OMX_PKT_CONNECT_FEATURE_* supported by the sender */
+			uint16_t features_magic; /* OMX_PKT_CONNECT_FEATURES_MAGIC if features is valid */
 			/* 32 */
 		} reply;
 	};
@@ -344,6 +351,18 @@ enum omx_pkt_connect_status_code {
   OMX_PKT_CONNECT_STATUS_BAD_KEY = 11 /* enforced by wire compatibility */
 };
 
+/*
+ * Optional wire features, only used when the peer advertised them in its connect.
+ * MX and older Open-MX peers did not clear the padding where features are stored,
+ * so features are ignored unless the magic is set next to them.
+ */
+enum omx_pkt_connect_feature {
+  OMX_PKT_CONNECT_FEATURE_AGGREGATE = (1<<0), /* may receive OMX_PKT_TYPE_AGGREGATE packets */
+  OMX_PKT_CONNECT_FEATURE_PUSH = (1<<1), /* may receive pull requests with OMX_PKT_PULL_REQUEST_FLAG_PUSH */
+  OMX_PKT_CONNECT_FEATURE_RNDV_EAGER = (1<<2) /* may receive RNDV packets with an eager prefix */
+};
+#define OMX_PKT_CONNECT_FEATURES_MAGIC 0x4f46
+
 struct omx_pkt_msg {
 	omx_packet_type_t ptype;
 	uint8_t dst_endpoint;
@@ -361,6 +380,46 @@ struct omx_pkt_msg {
 	/* 24 */
 };
 
+/*
+ * Several tiny/small messages to the same endpoint may be coalesced into
+ * a single aggregate packet. Each message header is followed by its data,
+ * padded to a multiple of 8 bytes.
+ */
+struct omx_pkt_aggregate {
+	omx_packet_type_t ptype;
+	uint8_t dst_endpoint;
+	uint8_t src_endpoint;
+	uint8_t pad1;
+	uint16_t length; /* of all messages after this header */
+	uint8_t nr; /* number of messages */
+	uint8_t pad2;
+	/* 8 */
+	uint32_t session;
+	uint32_t pad3;
+	/* 16 */
+};
+
+struct omx_pkt_aggregate_msg {
+	omx_packet_type_t ptype; /* OMX_PKT_TYPE_TINY or OMX_PKT_TYPE_SMALL */
+	uint8_t pad1;
+	uint16_t length;
+	uint16_t checksum;
+	uint16_t lib_seqnum;
+	/* 8 */
+	uint16_t lib_piggyack;
+	uint16_t pad2;
+	uint32_t match_a;
+	/* 16 */
+	uint32_t match_b;
+	uint32_t pad3;
+	/* 24 */
+};
+
+#define OMX_PKT_AGGREGATE_MSG_ALIGN(len) (((len)+7) & ~7)
+/* keep aggregates as small as medium frags so that they fit in any MTU and recvq slot */
+#define OMX_PKT_AGGREGATE_LENGTH_MAX OMX_MEDIUM_FRAG_LENGTH_MAX
+#define OMX_PKT_AGGREGATE_NR_MAX 64
+
 struct omx_pkt_medium_frag { /* similar to MX's pkt_msg_t + pkt_frame_t, contains omx_pkt_msg with extended length field */
 	omx_packet_type_t ptype;
 	uint8_t dst_endpoint;
@@ -402,6 +461,19 @@ struct omx_pkt_rndv { /* similar to MX's pkt_msg_t + MX's lib rndv data */
 };
 #define OMX_PKT_RNDV_DATA_LENGTH (sizeof(struct omx_pkt_rndv) - sizeof(struct omx_pkt_msg))
 
+#ifndef OMX_MX_WIRE_COMPAT
+/*
+ * A RNDV may carry the beginning of the message after its header,
+ * msg.length then covers the rndv data and this eager prefix.
+ * pulled_rdma_offset is set to the prefix length so that the receiver
+ * only pulls what follows.
+ * The prefix must fit in the packet and in a recvq slot.
+ */
+#define OMX_RNDV_EAGER_LENGTH_MAX ((unsigned)					\
+  omx_constant_min(OMX_MTU - sizeof(struct omx_pkt_head) - sizeof(struct omx_pkt_rndv),	\
+		   OMX_MEDIUM_FRAG_LENGTH_MAX))
+#endif
+
 #ifdef OMX_MX_WIRE_COMPAT
 struct omx_pkt_pull_request {
 	omx_packet_type_t ptype;
@@ -435,7 +507,8 @@ struct omx_pkt_pull_request {
 	uint32_t pulled_rdma_id;
 	/* 16 */
 	uint8_t pulled_rdma_seqnum; /* FIXME: unused ? */
-	uint8_t pad1[3];
+	uint8_t flags; /* OMX_PKT_PULL_REQUEST_FLAG_*, garbage from older peers */
+	uint8_t pad1[2];
 	uint32_t pulled_rdma_offset; /* FIXME: we could use 64bits ? */
 	/* 24 */
 	uint32_t src_pull_handle; /* sender's handle id, MX's src_send_handle */
@@ -466,6 +539,15 @@ struct omx_pkt_pull_request {
 
 #define OMX_PULL_BLOCK_LENGTH_MAX (OMX_PULL_REPLY_LENGTH_MAX*OMX_PULL_REPLY_PER_BLOCK)
 
+/*
+ * A pull request with the push flag may ask for up to OMX_PULL_PUSH_REPLIES_MAX
+ * replies instead of OMX_PULL_REPLY_PER_BLOCK, so that the whole message is
+ * pushed at once. Their frame seqnum wraps around, the puller only looks at
+ * their msg_offset.
+ */
+#define OMX_PKT_PULL_REQUEST_FLAG_PUSH (1<<0)
+#define OMX_PULL_PUSH_REPLIES_MAX 256
+
 /* OMX_PULL_REPLY_LENGTH_MAX must fit inside pull_request.first_frame_offset */
 /* OMX_PULL_BLOCK_LENGTH_MAX must fit inside pull_request.block_length */
 
@@ -535,6 +617,7 @@ struct omx_hdr {
 		struct omx_pkt_msg generic;
 		struct omx_pkt_msg tiny;
 		struct omx_pkt_msg small;
+		struct omx_pkt_aggregate aggregate;
 		struct omx_pkt_medium_frag medium;
 		struct omx_pkt_rndv rndv;
 		struct omx_pkt_pull_request pull;
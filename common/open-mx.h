@@ -132,7 +132,9 @@ enum omx_endpoint_param_key
 {
   OMX_ENDPOINT_PARAM_ERROR_HANDLER = 0,
   OMX_ENDPOINT_PARAM_UNEXP_QUEUE_MAX = 1,
-  OMX_ENDPOINT_PARAM_CONTEXT_ID = 2
+  OMX_ENDPOINT_PARAM_CONTEXT_ID = 2,
+  OMX_ENDPOINT_PARAM_PROGRESS_THREAD = 3,
+  OMX_ENDPOINT_PARAM_CMDQ = 4
 };
 typedef enum omx_endpoint_param_key omx_endpoint_param_key_t;
 
@@ -155,6 +157,8 @@ typedef struct {
       uint8_t bits;
       uint8_t shift;
     } context_id;
+    uint32_t progress_thread;
+    uint32_t cmdq;
   } val;
 } omx_endpoint_param_t;
 
@@ -169,6 +173,17 @@ omx_close_endpoint(omx_endpoint_t ep);
 omx_return_t
 omx_wakeup(omx_endpoint_t ep);
 
+/*
+ * The endpoint file descriptor may be given to poll(), select() or epoll.
+ * It becomes readable once something happened after omx_arm_endpoint_fd(),
+ * which must be called again after processing the endpoint.
+ */
+omx_return_t
+omx_get_endpoint_fd(omx_endpoint_t ep, int *fd);
+
+omx_return_t
+omx_arm_endpoint_fd(omx_endpoint_t ep, uint32_t *result);
+
 omx_return_t
 omx_get_endpoint_addr(omx_endpoint_t endpoint,
 		      omx_endpoint_addr_t *endpoint_addr);
@@ -254,6 +269,67 @@ omx_irecvv(omx_endpoint_t ep,
 	   uint64_t match_info, uint64_t match_mask,
 	   void *context, omx_request_t * request);
 
+struct omx_send_desc {
+  void *buffer;
+  size_t length;
+  omx_endpoint_addr_t dest_endpoint;
+  uint64_t match_info;
+  void *context;
+};
+typedef struct omx_send_desc omx_send_desc_t;
+
+struct omx_recv_desc {
+  void *buffer;
+  size_t length;
+  uint64_t match_info;
+  uint64_t match_mask;
+  void *context;
+};
+typedef struct omx_recv_desc omx_recv_desc_t;
+
+/*
+ * Post count sends or receives at once and progress only once.
+ * If one fails, the following ones are not posted and their request is NULL.
+ */
+omx_return_t
+omx_isend_many(omx_endpoint_t ep,
+	       omx_send_desc_t *descs, uint32_t count,
+	       omx_request_t *requests);
+
+omx_return_t
+omx_irecv_many(omx_endpoint_t ep,
+	       omx_recv_desc_t *descs, uint32_t count,
+	       omx_request_t *requests);
+
+/*
+ * Persistent requests prepare a send or a receive once and let omx_start
+ * post it many times with less overhead. Each start returns a usual request
+ * that must be completed with omx_test/wait/... (or forgotten) as usual.
+ * The buffer contents may change between starts, but the buffer must remain
+ * valid until the persistent request is released with omx_persistent_free.
+ */
+typedef struct omx_persistent_request * omx_persistent_request_t;
+
+omx_return_t
+omx_send_init(omx_endpoint_t ep,
+	      void *buffer, size_t length,
+	      omx_endpoint_addr_t dest_endpoint,
+	      uint64_t match_info,
+	      void * context, omx_persistent_request_t * persistentp);
+
+omx_return_t
+omx_recv_init(omx_endpoint_t ep,
+	      void *buffer, size_t length,
+	      uint64_t match_info, uint64_t match_mask,
+	      void *context, omx_persistent_request_t * persistentp);
+
+omx_return_t
+omx_start(omx_endpoint_t ep, omx_persistent_request_t persistent,
+	  omx_request_t * request);
+
+omx_return_t
+omx_persistent_free(omx_endpoint_t ep, omx_persistent_request_t persistent);
+
 omx_return_t
 omx_context(omx_request_t *request, void ** context);
 
@@ -279,6 +355,21 @@ omx_wait_any(omx_endpoint_t ep,
 	     omx_status_t *status, uint32_t *result,
 	     uint32_t timeout);
 
+/*
+ * Complete up to max requests matching at once and return their status.
+ * The number of completed requests is returned in count.
+ */
+omx_return_t
+omx_test_many(omx_endpoint_t ep,
+	      uint64_t match_info, uint64_t match_mask,
+	      omx_status_t *statuses, uint32_t max, uint32_t *count);
+
+omx_return_t
+omx_wait_many(omx_endpoint_t ep,
+	      uint64_t match_info, uint64_t match_mask,
+	      omx_status_t *statuses, uint32_t max, uint32_t *count,
+	      uint32_t timeout);
+
 omx_return_t
 omx_ipeek(omx_endpoint_t ep, omx_request_t * request,
 	  uint32_t *result);
@@ -316,6 +407,21 @@ omx_register_unexp_handler(omx_endpoint_t ep,
 			   omx_unexp_handler_t handler,
 			   void *context);
 
+/*
+ * The completion handler receives the status of every completed request
+ * instead of queueing them for omx_test/wait/test_any/peek. The request is
+ * released once the handler returns, it must not be tested or forgotten.
+ * The handler is called from the progression with the endpoint lock held,
+ * it must not call any Open-MX function on this endpoint.
+ */
+typedef void
+(*omx_completion_handler_t)(void *context, omx_status_t *status);
+
+omx_return_t
+omx_register_completion_handler(omx_endpoint_t ep,
+				omx_completion_handler_t handler,
+				void *context);
+
 enum omx_info_key {
   /* return the maximum number of boards */
   OMX_INFO_BOARD_MAX,
@@ -375,6 +481,10 @@ omx_nic_id_to_hostname(uint64_t board_addr,
 omx_return_t
 omx_progress(omx_endpoint_t ep);
 
+/* submit the commands that the library may have batched or queued (see OMX_SUBMIT_BATCH and OMX_CMDQ) */
+omx_return_t
+omx_flush(omx_endpoint_t ep);
+
 omx_return_t
 omx_set_request_timeout(omx_endpoint_t endpoint,
 			omx_request_t request, uint32_t milliseconds);
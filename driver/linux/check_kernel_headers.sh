@@ -316,6 +316,25 @@ else
   echo no
 fi
 
+# packet_type.list_func added in 4.19
+echo -n "  checking (in kernel headers) list_func availability in packet_type ... "
+if sed -ne '/^struct packet_type {/,/^};/p' ${LINUX_HDR}/include/linux/netdevice.h \
+  | grep list_func > /dev/null ; then
+  echo "#define OMX_HAVE_PACKET_TYPE_LIST_FUNC 1" >> ${TMP_CHECKS_NAME}
+  echo yes
+else
+  echo no
+fi
+
+# vma_kernel_pagesize added in 2.6.29, moved to mm.h in 4.15
+echo -n "  checking (in kernel headers) vma_kernel_pagesize availability ... "
+if grep vma_kernel_pagesize ${LINUX_HDR}/include/linux/hugetlb.h ${LINUX_HDR}/include/linux/mm.h > /dev/null 2>&1 ; then
+  echo "#define OMX_HAVE_VMA_KERNEL_PAGESIZE 1" >> ${TMP_CHECKS_NAME}
+  echo yes
+else
+  echo no
+fi
+
 # add the footer
 echo "" >> ${TMP_CHECKS_NAME}
 echo "#endif /* __omx_checks_h__ */" >> ${TMP_CHECKS_NAME}
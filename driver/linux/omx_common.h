@@ -25,10 +25,13 @@
 struct omx_iface;
 struct omx_iface_raw;
 struct omx_endpoint;
+struct omx_user_region;
 struct sk_buff;
+struct file;
+struct poll_table_struct;
 
 /* constants */
-#define OMX_PULL_BLOCK_DESCS_NR 4
+#define OMX_PULL_BLOCK_DESCS_NR 16 /* maximal number of pull blocks requested in parallel */
 #define OMX_IFACE_RX_USECS_WARN_MIN 13
 
 /* globals */
@@ -46,27 +49,36 @@ extern int omx_pin_chunk_pages_min;
 extern int omx_pin_chunk_pages_max;
 extern int omx_pin_invalidate;
 extern unsigned long omx_user_rights;
+extern int omx_cmdq_poll;
+extern int omx_pull_window_max;
 
 /* events */
 extern int omx_event_delivery_check(void);
 extern void omx_endpoint_queues_init(struct omx_endpoint *endpoint);
+extern void omx_endpoint_queues_exit(struct omx_endpoint *endpoint);
 extern int omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int length);
 extern int omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int length);
 extern int omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint, unsigned long *recvq_offset);
 extern int omx_prepare_notify_unexp_events_with_recvq(struct omx_endpoint *endpoint, int nr, unsigned long *recvq_offset);
 extern void omx_commit_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint, const void *event, int length);
 extern void omx_cancel_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint);
+#ifdef OMX_HAVE_PACKET_TYPE_LIST_FUNC
+extern void omx_recv_burst_start(void);
+extern void omx_recv_burst_end(void);
+#endif
 extern int omx_ioctl_wait_event(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_wakeup(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_release_exp_slots(struct omx_endpoint *endpoint, void __user * uparam);
 extern int omx_ioctl_release_unexp_slots(struct omx_endpoint *endpoint, void __user * uparam);
 extern void omx_wakeup_endpoint_on_close(struct omx_endpoint * endpoint);
+extern unsigned int omx_endpoint_poll(struct omx_endpoint * endpoint, struct file *file, struct poll_table_struct *wait);
 
 /* sending */
 extern struct sk_buff * omx_new_skb(unsigned long len);
 extern int omx_ioctl_send_tiny(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_small(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint, void __user * uparam);
+extern int omx_ioctl_send_mediumsq(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_mediumva(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_rndv(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_pull(struct omx_endpoint * endpoint, void __user * uparam);
@@ -75,6 +87,25 @@ extern int omx_ioctl_send_connect_request(struct omx_endpoint * endpoint, void _
 extern int omx_ioctl_send_connect_reply(struct omx_endpoint * endpoint, void __user * uparam);
 extern int omx_ioctl_send_liback(struct omx_endpoint * endpoint, void __user * uparam);
 extern void omx_send_nack_lib(struct omx_iface * iface, uint32_t peer_index, enum omx_nack_type nack_type, uint8_t src_endpoint, uint8_t dst_endpoint, uint16_t lib_seqnum);
+extern int omx_endpoint_cmdq_drain(struct omx_endpoint * endpoint);
+
+/* tiny/small messages being aggregated while draining a batch or the cmdq */
+struct omx_aggregate {
+	struct omx_endpoint * endpoint;
+	struct sk_buff * skb; /* only allocated once a second message joins the first one */
+	unsigned nr;
+	uint32_t length; /* of all pending messages in the aggregate packet */
+	/* the first pending message, it also gives the destination of the next ones */
+	uint8_t first_ptype;
+	struct omx_cmd_send_small first_cmd;
+	char first_data[OMX_SMALL_MSG_LENGTH_MAX];
+};
+extern void omx_aggregate_init(struct omx_aggregate * agg, struct omx_endpoint * endpoint);
+extern int omx_aggregate_flush(struct omx_aggregate * agg);
+extern int omx_aggregate_ioctl_send_tiny(struct omx_aggregate * agg, void __user * uparam);
+extern int omx_aggregate_ioctl_send_small(struct omx_aggregate * agg, void __user * uparam);
+extern int omx_cmdq_poll_init(void);
+extern void omx_cmdq_poll_exit(void);
 extern void omx_send_nack_mcp(struct omx_iface * iface, uint32_t peer_index, enum omx_nack_type nack_type, uint8_t src_endpoint, uint32_t src_pull_handle, uint32_t src_magic);
 
 /* receiving */
@@ -87,6 +118,7 @@ extern int omx_recv_nack_mcp(struct omx_iface * iface, struct omx_hdr * mh, stru
 /* pull */
 extern int omx_endpoint_pull_handles_init(struct omx_endpoint * endpoint);
 extern void omx_endpoint_pull_handles_exit(struct omx_endpoint * endpoint);
+extern void omx_pull_serve_deferred_requests(struct omx_user_region * region);
 
 /* device */
 extern int omx_dev_init(void);
@@ -21,6 +21,7 @@
 #include <linux/miscdevice.h>
 #include <linux/device.h>
 #include <linux/fs.h>
+#include <linux/poll.h>
 #include <linux/slab.h>
 #include <linux/vmalloc.h>
 #include <linux/mm.h>
@@ -85,11 +86,18 @@ omx_endpoint_alloc_resources(struct omx_endpoint * endpoint)
 		printk(KERN_ERR "Open-MX: failed to allocate unexp eventq\n");
 		goto out_with_exp_eventq;
 	}
+	endpoint->cmdq = omx_vmalloc_user(OMX_CMDQ_SIZE);
+	if (!endpoint->cmdq) {
+		printk(KERN_ERR "Open-MX: failed to allocate cmdq\n");
+		goto out_with_unexp_eventq;
+	}
+	endpoint->cmdq_consumed_index = 0;
+	spin_lock_init(&endpoint->cmdq_lock);
 
 	sendq_pages = kmalloc(OMX_SENDQ_SIZE/PAGE_SIZE * sizeof(struct page *), GFP_KERNEL);
 	if (!sendq_pages) {
 		printk(KERN_ERR "Open-MX: failed to allocate sendq pages array\n");
-		goto out_with_unexp_eventq;
+		goto out_with_cmdq;
 	}
 	for(i=0; i<OMX_SENDQ_SIZE/PAGE_SIZE; i++) {
 		struct page * page;
@@ -130,6 +138,8 @@ omx_endpoint_alloc_resources(struct omx_endpoint * endpoint)
 
  out_with_sendq_pages:
 	kfree(endpoint->sendq_pages);
+ out_with_cmdq:
+	vfree(endpoint->cmdq);
  out_with_unexp_eventq:
 	vfree(endpoint->unexp_eventq);
  out_with_exp_eventq:
@@ -152,10 +162,13 @@ omx_endpoint_free_resources(struct omx_endpoint * endpoint)
 	/* destroy all pending pull handles */
 	omx_endpoint_pull_handles_exit(endpoint);
 
+	omx_endpoint_queues_exit(endpoint);
+
 	omx_endpoint_user_regions_exit(endpoint);
 
 	kfree(endpoint->recvq_pages);
 	kfree(endpoint->sendq_pages);
+	vfree(endpoint->cmdq);
 	vfree(endpoint->unexp_eventq);
 	vfree(endpoint->exp_eventq);
 	vfree(endpoint->recvq);
@@ -414,6 +427,132 @@ omx_miscdev_release(struct inode * inode, struct file * file)
 	return 0;
 }
 
+/*
+ * Submit a batch of small commands in a single kernel entry.
+ * Each entry parameter is passed to the regular handler as a user pointer
+ * inside the batch buffer. Failing entries do not stop the batch since
+ * user-space handles them as lost packets anyway.
+ * Consecutive tiny/small entries flagged for aggregation may be sent
+ * in a single packet.
+ */
+static int
+omx_ioctl_submit_batch(struct omx_endpoint * endpoint,
+		       void __user * uparam)
+{
+	struct omx_cmd_submit_batch cmd;
+	struct omx_aggregate agg;
+	char __user * buffer;
+	uint32_t offset;
+	unsigned i;
+	int ret;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read submit batch cmd hdr\n");
+		return -EFAULT;
+	}
+
+	if (unlikely(cmd.length > OMX_CMD_SUBMIT_BATCH_LENGTH_MAX)) {
+		printk(KERN_ERR "Open-MX: Cannot submit a batch of %ld bytes (max %ld)\n",
+		       (unsigned long) cmd.length, (unsigned long) OMX_CMD_SUBMIT_BATCH_LENGTH_MAX);
+		return -EINVAL;
+	}
+
+	buffer = (char __user *)(unsigned long) cmd.buffer;
+	offset = 0;
+	omx_aggregate_init(&agg, endpoint);
+	for(i=0; i<cmd.nr; i++) {
+		struct omx_cmd_submit_batch_entry entry;
+		void __user * param;
+		size_t param_length;
+		int err;
+
+		if (unlikely(offset + sizeof(entry) > cmd.length)) {
+			printk(KERN_ERR "Open-MX: Truncated batch entry #%d\n", i);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		err = copy_from_user(&entry, buffer + offset, sizeof(entry));
+		if (unlikely(err != 0)) {
+			printk(KERN_ERR "Open-MX: Failed to read batch entry #%d hdr\n", i);
+			ret = -EFAULT;
+			goto out;
+		}
+		param = buffer + offset + sizeof(entry);
+		offset += sizeof(entry) + OMX_CMD_SUBMIT_BATCH_ENTRY_ALIGN(entry.length);
+		if (unlikely(offset > cmd.length)) {
+			printk(KERN_ERR "Open-MX: Truncated batch entry #%d parameter\n", i);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		switch (entry.epcmd) {
+		case OMX_EPCMD_SEND_TINY:
+			/* the tiny data length is variable */
+			param_length = sizeof(struct omx_cmd_send_tiny_hdr);
+			break;
+		case OMX_EPCMD_SEND_SMALL:
+			param_length = sizeof(struct omx_cmd_send_small);
+			break;
+		case OMX_EPCMD_SEND_NOTIFY:
+			param_length = sizeof(struct omx_cmd_send_notify);
+			break;
+		case OMX_EPCMD_SEND_LIBACK:
+			param_length = sizeof(struct omx_cmd_send_liback);
+			break;
+		default:
+			printk(KERN_ERR "Open-MX: Cannot submit command %d in a batch\n", entry.epcmd);
+			ret = -EINVAL;
+			goto out;
+		}
+		if (unlikely(entry.length < param_length)) {
+			printk(KERN_ERR "Open-MX: Batch entry #%d command %d parameter too short (%ld bytes instead of %ld)\n",
+			       i, entry.epcmd, (unsigned long) entry.length, (unsigned long) param_length);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		if (!(entry.flags & OMX_CMD_SUBMIT_BATCH_ENTRY_FLAG_AGGREGATE))
+			/* keep the submission order */
+			omx_aggregate_flush(&agg);
+
+		switch (entry.epcmd) {
+		case OMX_EPCMD_SEND_TINY:
+			if (entry.flags & OMX_CMD_SUBMIT_BATCH_ENTRY_FLAG_AGGREGATE)
+				err = omx_aggregate_ioctl_send_tiny(&agg, param);
+			else
+				err = omx_ioctl_send_tiny(endpoint, param);
+			break;
+		case OMX_EPCMD_SEND_SMALL:
+			if (entry.flags & OMX_CMD_SUBMIT_BATCH_ENTRY_FLAG_AGGREGATE)
+				err = omx_aggregate_ioctl_send_small(&agg, param);
+			else
+				err = omx_ioctl_send_small(endpoint, param);
+			break;
+		case OMX_EPCMD_SEND_NOTIFY:
+			err = omx_ioctl_send_notify(endpoint, param);
+			break;
+		case OMX_EPCMD_SEND_LIBACK:
+			err = omx_ioctl_send_liback(endpoint, param);
+			break;
+		default:
+			printk(KERN_ERR "Open-MX: Cannot submit command %d in a batch\n", entry.epcmd);
+			ret = -EINVAL;
+			goto out;
+		}
+
+		/* report the last failure, but keep going */
+		if (unlikely(err < 0))
+			ret = err;
+	}
+
+ out:
+	/* send the pending aggregate, even if the end of the batch is invalid */
+	omx_aggregate_flush(&agg);
+	return ret;
+}
+
 /*
  * Common command handlers.
  * Use OMX_CMD_INDEX() to only keep the 8 latest bits of the 32bits command flags.
@@ -442,6 +581,8 @@ static int (*omx_ioctl_with_endpoint_handlers[])(struct omx_endpoint * endpoint,
 	[OMX_EPCMD_WAKEUP]			= omx_ioctl_wakeup,
 	[OMX_EPCMD_RELEASE_EXP_SLOTS]		= omx_ioctl_release_exp_slots,
 	[OMX_EPCMD_RELEASE_UNEXP_SLOTS]		= omx_ioctl_release_unexp_slots,
+	[OMX_EPCMD_SEND_MEDIUMSQ]		= omx_ioctl_send_mediumsq,
+	[OMX_EPCMD_SUBMIT_BATCH]		= omx_ioctl_submit_batch,
 };
 
 /*
@@ -465,6 +606,10 @@ omx_miscdev_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 		if (unlikely(endpoint->status != OMX_ENDPOINT_STATUS_OK))
 			return -EINVAL;
 
+		/* process commands queued before this ioctl so that they remain ordered */
+		if (endpoint->userdesc->user_features & OMX_ENDPOINT_DESC_USER_FEATURE_CMDQ)
+			omx_endpoint_cmdq_drain(endpoint);
+
 		/* omx_dev_init() takes care fo checking that the handler isn't NULL */
 		return omx_ioctl_with_endpoint_handlers[(unsigned char) handler_offset](endpoint, (void __user *) arg);
 	}
@@ -737,6 +882,8 @@ omx_miscdev_ioctl(struct file *file, unsigned cmd, unsigned long arg)
 	case OMX_CMD_WAKEUP:
 	case OMX_CMD_RELEASE_EXP_SLOTS:
 	case OMX_CMD_RELEASE_UNEXP_SLOTS:
+	case OMX_CMD_SEND_MEDIUMSQ:
+	case OMX_CMD_SUBMIT_BATCH:
 		/* this should be handled in the fast path */
 		BUG();
 
@@ -796,12 +943,27 @@ omx_miscdev_mmap(struct file * file, struct vm_area_struct * vma)
 			return -EPERM;
 		return omx_remap_vmalloc_range(vma, endpoint->unexp_eventq, 0);
 
+	} else if (offset == OMX_CMDQ_FILE_OFFSET && size == OMX_CMDQ_SIZE) { /* page-alignment enforced at init */
+		return omx_remap_vmalloc_range(vma, endpoint->cmdq, 0);
+
 	} else {
 		printk(KERN_ERR "Open-MX: Cannot mmap 0x%lx at 0x%lx\n", size, offset);
 		return -EINVAL;
 	}
 }
 
+static unsigned int
+omx_miscdev_poll(struct file *file, struct poll_table_struct *wait)
+{
+	struct omx_endpoint * endpoint = file->private_data;
+
+	/* the endpoint is already acquired by the file, just check its status */
+	if (unlikely(endpoint->status != OMX_ENDPOINT_STATUS_OK))
+		return POLLERR;
+
+	return omx_endpoint_poll(endpoint, file, wait);
+}
+
 ssize_t
 static omx_miscdev_read(struct file* filp, char __user * buff, size_t count, loff_t* offp)
 {
@@ -839,6 +1001,7 @@ omx_miscdev_fops = {
 	.open = omx_miscdev_open,
 	.release = omx_miscdev_release,
 	.mmap = omx_miscdev_mmap,
+	.poll = omx_miscdev_poll,
 	.read = omx_miscdev_read,
 	.unlocked_ioctl = omx_miscdev_ioctl,
 #ifdef CONFIG_COMPAT
@@ -889,6 +1052,11 @@ omx_dev_init(void)
 		printk(KERN_ERR "Open-MX: Cannot use unexp eventq with non-page-aligned size %lx\n", OMX_UNEXP_EVENTQ_SIZE);
 		return -EINVAL;
 	}
+	if (OMX_CMDQ_SIZE & ~PAGE_MASK) {
+		printk(KERN_ERR "Open-MX: Cannot use cmdq with non-page-aligned size %lx\n", OMX_CMDQ_SIZE);
+		return -EINVAL;
+	}
+	BUILD_BUG_ON(sizeof(struct omx_cmdq_entry) != OMX_CMDQ_ENTRY_SIZE);
 
 	ret = misc_register(&omx_miscdev);
 	if (ret < 0) {
@@ -25,6 +25,7 @@
 #include <linux/kref.h>
 #include <linux/list.h>
 #include <linux/wait.h>
+#include <linux/timer.h>
 #include <linux/idr.h>
 #include <linux/mm.h>
 #ifdef CONFIG_MMU_NOTIFIER
@@ -67,6 +68,11 @@ struct omx_endpoint {
 	void * sendq;
 	struct page ** sendq_pages;
 
+	/* command queue stuff, filled by user-space, drained by whoever gets the lock first */
+	void * cmdq;
+	uint32_t cmdq_consumed_index;
+	spinlock_t cmdq_lock;
+
 	/* descriptor exported to user-space, modified by user-space and the driver,
 	 * so we can export some info to user-space by writing into it, but we
 	 * cannot rely on reading from it
@@ -76,6 +82,8 @@ struct omx_endpoint {
 	/* common event queues stuff */
 	struct list_head waiters;
 	spinlock_t waiters_lock;
+	wait_queue_head_t poll_wq;
+	struct timer_list poll_timer;
 
 	/* expected event queue stuff */
 	void * exp_eventq;
@@ -103,6 +111,9 @@ struct omx_endpoint {
 	struct list_head pull_handle_slots_free_list;
 	void * pull_handle_slots_array;
 	spinlock_t pull_handles_lock;
+	/* pull window and block size learned from previous pulls, updated without locking */
+	uint32_t pull_window;
+	uint32_t pull_block_frames;
 
 #ifdef CONFIG_MMU_NOTIFIER
 	struct mmu_notifier mmu_notifier;
@@ -21,6 +21,9 @@
 #include <linux/timer.h>
 #include <linux/list.h>
 #include <linux/rcupdate.h>
+#include <linux/poll.h>
+#include <linux/percpu.h>
+#include <linux/hardirq.h>
 #include <asm/atomic.h>
 
 #include "omx_io.h"
@@ -101,6 +104,108 @@ omx_wakeup_waiter_list(struct omx_endpoint *endpoint,
 		wake_up_process(waiter->task);
 	}
 	rcu_read_unlock();
+
+	/* wake up poll() on the endpoint file too, the event must be visible first */
+	smp_mb();
+	if (waitqueue_active(&endpoint->poll_wq))
+		wake_up_interruptible(&endpoint->poll_wq);
+}
+
+/*
+ * Receive bursts.
+ *
+ * When the receive path gets a whole list of packets from the stack,
+ * waking up the endpoint waiters after each event is wasted since
+ * they won't get to run before the end of the list anyway.
+ * Wakeups are thus recorded in a per-cpu burst and each endpoint
+ * is only woken up once when the list has been processed.
+ * Only the softirq processing the list ever touches the burst
+ * since nothing else may run on this cpu in the meantime.
+ */
+#ifdef OMX_HAVE_PACKET_TYPE_LIST_FUNC
+
+#define OMX_RECV_BURST_ENDPOINT_MAX 8
+
+struct omx_recv_burst {
+	int active;
+	int nr_endpoints;
+	struct omx_endpoint *endpoints[OMX_RECV_BURST_ENDPOINT_MAX];
+};
+
+static DEFINE_PER_CPU(struct omx_recv_burst, omx_recv_burst);
+
+void
+omx_recv_burst_start(void)
+{
+	struct omx_recv_burst *burst = this_cpu_ptr(&omx_recv_burst);
+
+	burst->active = 1;
+	burst->nr_endpoints = 0;
+}
+
+void
+omx_recv_burst_end(void)
+{
+	struct omx_recv_burst *burst = this_cpu_ptr(&omx_recv_burst);
+	int i;
+
+	burst->active = 0;
+	for(i=0; i<burst->nr_endpoints; i++) {
+		struct omx_endpoint *endpoint = burst->endpoints[i];
+		omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+		/* release the reference acquired in omx_recv_burst_defer_wakeup() */
+		omx_endpoint_release(endpoint);
+	}
+	burst->nr_endpoints = 0;
+}
+
+/* returns 1 if the wakeup has been deferred to the end of the current burst */
+static INLINE int
+omx_recv_burst_defer_wakeup(struct omx_endpoint *endpoint)
+{
+	struct omx_recv_burst *burst;
+	int i;
+
+	if (!in_serving_softirq())
+		return 0;
+
+	burst = this_cpu_ptr(&omx_recv_burst);
+	if (!burst->active)
+		return 0;
+
+	for(i=0; i<burst->nr_endpoints; i++)
+		if (burst->endpoints[i] == endpoint)
+			goto deferred;
+
+	if (burst->nr_endpoints == OMX_RECV_BURST_ENDPOINT_MAX)
+		/* too many endpoints in this burst, wakeup now */
+		return 0;
+
+	/* keep the endpoint alive until the end of the burst */
+	omx_endpoint_reacquire(endpoint);
+	burst->endpoints[burst->nr_endpoints++] = endpoint;
+
+ deferred:
+	omx_counter_inc(endpoint->iface, RECV_DEFERRED_WAKEUP);
+	return 1;
+}
+
+#else /* !OMX_HAVE_PACKET_TYPE_LIST_FUNC */
+
+static INLINE int
+omx_recv_burst_defer_wakeup(struct omx_endpoint *endpoint)
+{
+	return 0;
+}
+
+#endif /* !OMX_HAVE_PACKET_TYPE_LIST_FUNC */
+
+/* wake up the endpoint waiters after a new event, unless a receive burst defers it */
+static INLINE void
+omx_wakeup_event(struct omx_endpoint *endpoint)
+{
+	if (!omx_recv_burst_defer_wakeup(endpoint))
+		omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
 }
 
 static void
@@ -123,6 +228,15 @@ omx_wakeup_on_progress_timeout_handler(unsigned long data)
 	wake_up_process(waiter->task);
 }
 
+static void
+omx_wakeup_poll_on_progress_timeout_handler(unsigned long data)
+{
+	struct omx_endpoint *endpoint = (struct omx_endpoint *) data;
+
+	/* poll() will notice that the library progression wakeup has passed */
+	wake_up_interruptible(&endpoint->poll_wq);
+}
+
 /*****************
  * Initialization
  */
@@ -167,11 +281,89 @@ omx_endpoint_queues_init(struct omx_endpoint *endpoint)
 
 	INIT_LIST_HEAD(&endpoint->waiters);
 	spin_lock_init(&endpoint->waiters_lock);
+	init_waitqueue_head(&endpoint->poll_wq);
+	setup_timer(&endpoint->poll_timer, omx_wakeup_poll_on_progress_timeout_handler, (unsigned long) endpoint);
 	spin_lock_init(&endpoint->unexp_lock);
 	spin_lock_init(&endpoint->release_exp_lock);
 	spin_lock_init(&endpoint->release_unexp_lock);
 }
 
+void
+omx_endpoint_queues_exit(struct omx_endpoint *endpoint)
+{
+	del_timer_sync(&endpoint->poll_timer);
+}
+
+/**********************************************
+ * Slots released through the endpoint descriptor
+ */
+
+/*
+ * When the library publishes its consumer indexes in the endpoint descriptor
+ * instead of calling the RELEASE_*_SLOTS ioctls, only look at them when the
+ * queue looks full. The library value is validated just like the ioctl does
+ * since it comes from user-space.
+ */
+static void
+omx_refresh_released_exp_eventq_index(struct omx_endpoint *endpoint)
+{
+	omx_eventq_index_t released;
+
+	if (!(endpoint->userdesc->user_features & OMX_ENDPOINT_DESC_USER_FEATURE_RELEASE_INDEX))
+		return;
+
+	spin_lock_bh(&endpoint->release_exp_lock);
+	released = endpoint->userdesc->released_exp_eventq_index;
+	/* make sure the library was done reading the slots before we reuse them */
+	smp_mb();
+	if (released - endpoint->nextreleased_exp_eventq_index
+	    <= endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index)
+		endpoint->nextreleased_exp_eventq_index = released;
+	spin_unlock_bh(&endpoint->release_exp_lock);
+}
+
+static void
+omx_refresh_released_unexp_eventq_index(struct omx_endpoint *endpoint)
+{
+	omx_eventq_index_t released;
+
+	if (!(endpoint->userdesc->user_features & OMX_ENDPOINT_DESC_USER_FEATURE_RELEASE_INDEX))
+		return;
+
+	spin_lock_bh(&endpoint->release_unexp_lock);
+	released = endpoint->userdesc->released_unexp_eventq_index;
+	/* make sure the library was done reading the slots before we reuse them */
+	smp_mb();
+	if (released - endpoint->nextreleased_unexp_eventq_index
+	    <= endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index)
+		endpoint->nextreleased_unexp_eventq_index = released;
+	spin_unlock_bh(&endpoint->release_unexp_lock);
+}
+
+static inline int
+omx_exp_eventq_full(struct omx_endpoint *endpoint)
+{
+	if (likely(endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
+		   <= OMX_EXP_EVENTQ_ENTRY_NR))
+		return 0;
+
+	omx_refresh_released_exp_eventq_index(endpoint);
+	return endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
+		> OMX_EXP_EVENTQ_ENTRY_NR;
+}
+
+static inline int
+omx_unexp_eventq_full(struct omx_endpoint *endpoint)
+{
+	if (likely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
+		   <= OMX_UNEXP_EVENTQ_ENTRY_NR))
+		return 0;
+
+	omx_refresh_released_unexp_eventq_index(endpoint);
+	return endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
+		> OMX_UNEXP_EVENTQ_ENTRY_NR;
+}
+
 /******************************************
  * Report an expected event to users-space
  */
@@ -185,8 +377,7 @@ omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int lengt
 	/* take the next slot and update the queue */
 	index = atomic_inc_return((atomic_t *) &endpoint->nextfree_exp_eventq_index) - 1;
 
-	if (unlikely(endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
-		     > OMX_EXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_exp_eventq_full(endpoint))) {
 		/* we went too far, rollback */
 		atomic_dec((atomic_t *) &endpoint->nextfree_exp_eventq_index);
 		/* the application sucks, it did not check
@@ -210,7 +401,7 @@ omx_notify_exp_event(struct omx_endpoint *endpoint, const void *event, int lengt
 	/* wake up waiters */
 	dprintk(EVENT, "notify_exp waking up everybody\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_event(endpoint);
 
 	return 0;
 }
@@ -232,8 +423,7 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 	index = endpoint->nextreserved_unexp_eventq_index++;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_full(endpoint))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index--;
@@ -258,7 +448,7 @@ omx_notify_unexp_event(struct omx_endpoint *endpoint, const void *event, int len
 	/* wake up waiters */
 	dprintk(EVENT, "notify_unexp waking up everybody\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_event(endpoint);
 
 	return 0;
 }
@@ -289,8 +479,7 @@ omx_prepare_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 	recvq_index = endpoint->next_recvq_index++;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_full(endpoint))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index--;
@@ -324,8 +513,7 @@ omx_prepare_notify_unexp_events_with_recvq(struct omx_endpoint *endpoint,
 	endpoint->next_recvq_index += nr;
 	spin_unlock_bh(&endpoint->unexp_lock);
 
-	if (unlikely(endpoint->nextfree_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
-		     > OMX_UNEXP_EVENTQ_ENTRY_NR)) {
+	if (unlikely(omx_unexp_eventq_full(endpoint))) {
 		/* we went too far, rollback */
 		spin_lock_bh(&endpoint->unexp_lock);
 		endpoint->nextfree_unexp_eventq_index -= nr;
@@ -378,7 +566,7 @@ omx_commit_notify_unexp_event_with_recvq(struct omx_endpoint *endpoint,
 	/* wake up waiters */
 	dprintk(EVENT, "commit_notify_unexp waking up everybody\n");
 
-	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+	omx_wakeup_event(endpoint);
 }
 
 /*
@@ -573,13 +761,13 @@ int
 omx_ioctl_release_exp_slots(struct omx_endpoint *endpoint, void __user *uparam)
 {
 	int err = 0;
-	spin_lock(&endpoint->release_exp_lock);
+	spin_lock_bh(&endpoint->release_exp_lock);
 	if (endpoint->nextfree_exp_eventq_index - endpoint->nextreleased_exp_eventq_index
 	    < OMX_EXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_exp_eventq_index += OMX_EXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_exp_lock);
+	spin_unlock_bh(&endpoint->release_exp_lock);
 	return err;
 }
 
@@ -587,13 +775,13 @@ int
 omx_ioctl_release_unexp_slots(struct omx_endpoint *endpoint, void __user *uparam)
 {
 	int err = 0;
-	spin_lock(&endpoint->release_unexp_lock);
+	spin_lock_bh(&endpoint->release_unexp_lock);
 	if (endpoint->nextreserved_unexp_eventq_index - endpoint->nextreleased_unexp_eventq_index
 	    < OMX_UNEXP_RELEASE_SLOTS_BATCH_NR)
 		err = -EINVAL;
 	else
 		endpoint->nextreleased_unexp_eventq_index += OMX_UNEXP_RELEASE_SLOTS_BATCH_NR;
-	spin_unlock(&endpoint->release_unexp_lock);
+	spin_unlock_bh(&endpoint->release_unexp_lock);
 	return err;
 }
 
@@ -624,6 +812,38 @@ omx_wakeup_endpoint_on_close(struct omx_endpoint * endpoint)
 	omx_wakeup_waiter_list(endpoint, OMX_CMD_WAIT_EVENT_STATUS_WAKEUP);
 }
 
+/*
+ * poll() on the endpoint file.
+ * The library arms it by publishing the indexes of the events it has
+ * already processed in the endpoint descriptor, just like it passes
+ * them to the WAIT_EVENT ioctl. The file is readable as soon as a new
+ * event arrives or when the library progression wakeup time passes.
+ */
+unsigned int
+omx_endpoint_poll(struct omx_endpoint * endpoint, struct file *file, struct poll_table_struct *wait)
+{
+	struct omx_endpoint_desc * userdesc = endpoint->userdesc;
+	uint64_t wakeup_jiffies;
+
+	poll_wait(file, &endpoint->poll_wq, wait);
+
+	/* no need to lock exp_lock and unexp_lock since we are simply reading their single values */
+	if (endpoint->nextfree_exp_eventq_index != userdesc->poll_exp_event_index
+	    || endpoint->nextreserved_unexp_eventq_index != userdesc->poll_unexp_event_index
+	    || userdesc->user_event_index != userdesc->poll_user_event_index)
+		return POLLIN | POLLRDNORM;
+
+	/* lib-progression-requested timeout */
+	wakeup_jiffies = userdesc->wakeup_jiffies;
+	if (wakeup_jiffies != OMX_NO_WAKEUP_JIFFIES) {
+		if (time_after_eq64(get_jiffies_64(), wakeup_jiffies))
+			return POLLIN | POLLRDNORM;
+		mod_timer(&endpoint->poll_timer, wakeup_jiffies);
+	}
+
+	return 0;
+}
+
 /*
  * Local variables:
  *  tab-width: 8
@@ -340,6 +340,17 @@ static inline struct page *skb_frag_page(const skb_frag_t *frag) { return frag->
 #include <linux/sched/signal.h>
 #endif
 
+/*
+ * hugetlb pages are pinned, attached and copied as a whole,
+ * which requires them to be permanently mapped in the kernel
+ * and skb frag offsets to be 32bits
+ */
+#if defined(CONFIG_HUGETLB_PAGE) && !defined(CONFIG_HIGHMEM) && BITS_PER_LONG > 32 \
+    && defined(OMX_HAVE_VMA_KERNEL_PAGESIZE)
+#define OMX_HAVE_HUGE_PAGE_PINNING 1
+#include <linux/hugetlb.h>
+#endif
+
 #endif /* __omx_hal_h__ */
 
 /*
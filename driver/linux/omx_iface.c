@@ -949,6 +949,8 @@ omx_endpoint_get_info(uint32_t board_index, uint32_t endpoint_index,
 			info->pid = raw->opener_pid;
 			strncpy(info->command, raw->opener_comm, OMX_COMMAND_LEN_MAX);
 			info->command[OMX_COMMAND_LEN_MAX-1] = '\0';
+			info->partners_memory = 0;
+			info->partners_nr = 0;
 		} else {
 			info->closed = 1;
 		}
@@ -964,6 +966,9 @@ omx_endpoint_get_info(uint32_t board_index, uint32_t endpoint_index,
 			info->pid = endpoint->opener_pid;
 			strncpy(info->command, endpoint->opener_comm, OMX_COMMAND_LEN_MAX);
 			info->command[OMX_COMMAND_LEN_MAX-1] = '\0';
+			/* maintained by the library in the user-mapped descriptor */
+			info->partners_memory = endpoint->userdesc->partners_memory;
+			info->partners_nr = endpoint->userdesc->partners_nr;
 		} else {
 			info->closed = 1;
 		}
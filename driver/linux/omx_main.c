@@ -107,6 +107,14 @@ unsigned long omx_user_rights = 0;
 module_param_named(userrights, omx_user_rights, ulong, S_IRUGO|S_IWUSR);
 MODULE_PARM_DESC(userrights, "Mask of privileged operation rights that are granted regular users");
 
+int omx_cmdq_poll = 0;
+module_param_named(cmdqpoll, omx_cmdq_poll, uint, S_IRUGO); /* not writable to simplify things */
+MODULE_PARM_DESC(cmdqpoll, "Drain endpoint command queues from a busy-polling kernel thread");
+
+int omx_pull_window_max = OMX_PULL_BLOCK_DESCS_NR;
+module_param_named(pullwindow, omx_pull_window_max, uint, S_IRUGO|S_IWUSR);
+MODULE_PARM_DESC(pullwindow, "Maximum number of pull block requests in parallel");
+
 #ifdef OMX_HAVE_DMA_ENGINE
 int omx_dmaengine = 0; /* disabled by default for now */
 module_param_named(dmaengine, omx_dmaengine, uint, S_IRUGO|S_IWUSR);
@@ -286,7 +294,7 @@ omx_get_driver_string(unsigned int *lenp)
 	buflen += len;
 
 	len = snprintf(tmp, OMX_DRIVER_STRING_LEN-buflen,
-		       " LargeMessages: %ld requests in parallel, %ld x %ldB pull replies per request\n",
+		       " LargeMessages: up to %ld requests in parallel, up to %ld x %ldB pull replies per request\n",
 		       (unsigned long) OMX_PULL_BLOCK_DESCS_NR,
 		       (unsigned long) OMX_PULL_REPLY_PER_BLOCK,
 		       (unsigned long) OMX_PULL_REPLY_LENGTH_MAX);
@@ -421,6 +429,19 @@ omx_init(void)
 	omx_driver_userdesc->abi_config = omx_get_abi_config();
 	omx_driver_userdesc->features = 0;
 	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_SHARED;
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_RELEASE_INDEX;
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_SEND_MEDIUMSQ;
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_SUBMIT_BATCH;
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_CMDQ;
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_POLL;
+#ifndef OMX_MX_WIRE_COMPAT
+	/* aggregates are not part of the MX wire protocol */
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_AGGREGATE;
+	/* neither is sender-push of large messages */
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_PUSH;
+	/* nor rndv eager prefixes */
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_RNDV_EAGER;
+#endif
 #ifdef CONFIG_MMU_NOTIFIER
 	if (omx_pin_invalidate && !omx_pin_synchronous)
 		omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_PIN_INVALIDATE;
@@ -472,9 +493,16 @@ omx_init(void)
 	if (ret < 0)
 		goto out_with_raw;
 
+	/* sets OMX_DRIVER_FEATURE_CMDQ_POLL if the thread is started */
+	ret = omx_cmdq_poll_init();
+	if (ret < 0)
+		goto out_with_dev;
+
 	printk(KERN_INFO "Open-MX initialized\n");
 	return 0;
 
+ out_with_dev:
+	omx_dev_exit();
  out_with_raw:
 	omx_raw_exit();
  out_with_net:
@@ -497,6 +525,7 @@ static __exit void
 omx_exit(void)
 {
 	printk(KERN_INFO "Open-MX terminating...\n");
+	omx_cmdq_poll_exit();
 	omx_dev_exit();
 	omx_raw_exit();
 	omx_net_exit();
@@ -48,6 +48,23 @@ omx_get_skb_destructor_data(const struct sk_buff *skb)
 #endif
 }
 
+/* prepare a mediumsq frag command from a whole mediumsq command, only the frag fields remain to set */
+static inline void
+omx_mediumsq_frag_cmd_init(struct omx_cmd_send_mediumsq_frag *frag_cmd,
+			   const struct omx_cmd_send_mediumsq *cmd)
+{
+	frag_cmd->peer_index = cmd->peer_index;
+	frag_cmd->dest_endpoint = cmd->dest_endpoint;
+	frag_cmd->shared = cmd->shared;
+	frag_cmd->session_id = cmd->session_id;
+	frag_cmd->seqnum = cmd->seqnum;
+	frag_cmd->piggyack = cmd->piggyack;
+	frag_cmd->checksum = cmd->checksum;
+	frag_cmd->msg_length = cmd->msg_length;
+	frag_cmd->frag_pipeline = cmd->frag_pipeline;
+	frag_cmd->match_info = cmd->match_info;
+}
+
 /* queue a skb for xmit, account it, and eventually actually drop it for debugging */
 #define __omx_queue_xmit(iface, skb, type)	\
 do {						\
@@ -22,6 +22,7 @@
 #include <linux/kref.h>
 #include <linux/timer.h>
 #include <linux/workqueue.h>
+#include <linux/log2.h>
 
 #include "omx_misc.h"
 #include "omx_hal.h"
@@ -49,6 +50,13 @@
 
 #define OMX_ENDPOINT_PULL_MAGIC_XOR 0x21071980
 
+/* number of blocks requested in parallel by the first pull of an endpoint */
+#define OMX_PULL_WINDOW_INIT 4
+/* blocks may shrink down to a quarter of their maximal size on lossy links */
+#define OMX_PULL_BLOCK_FRAMES_MIN (OMX_PULL_REPLY_PER_BLOCK/4 ? OMX_PULL_REPLY_PER_BLOCK/4 : 1)
+/* never request more frames than the 8-bit frame seqnum can distinguish */
+#define OMX_PULL_WINDOW_FRAMES_MAX 255
+
 /**********************
  * Pull-specific Types
  */
@@ -114,6 +122,7 @@ struct omx_pull_handle {
 	struct omx_user_region * region;
 	uint32_t total_length;
 	uint32_t pulled_rdma_offset;
+	uint32_t puller_rdma_offset; /* local region offset where msg_offset 0 is written */
 
 	/* current status */
 	spinlock_t lock;
@@ -127,6 +136,19 @@ struct omx_pull_handle {
 	uint32_t already_rerequested_blocks; /* amount of first blocks that were requested again since the last timer */
 	struct omx_pull_block_desc block_desc[OMX_PULL_BLOCK_DESCS_NR];
 
+	/* adaptive window */
+	uint32_t block_frames; /* frames per block, a power of two that does not change during the pull */
+	uint32_t block_frames_shift;
+	uint32_t window; /* number of blocks that may be requested in parallel */
+	uint32_t window_done_blocks; /* blocks completed since the window last changed */
+	uint32_t window_losses; /* losses detected during this pull */
+
+	/* push mode, the whole message is requested at once, block descs are unused */
+	int push;
+	uint32_t push_nr_frames;
+	int push_rerequested; /* missing frames requested again early since the last timer */
+	DECLARE_BITMAP(push_missing_frames, OMX_PULL_PUSH_REPLIES_MAX);
+
 	/* synchronous host copies */
 	uint32_t host_copy_nr_frames; /* frames received but not copied yet*/
 
@@ -185,8 +207,9 @@ static void omx_pull_handle_deferred_dma_completions_wait_workfunc(omx_work_stru
 /*
  * Notes about retransmission:
  *
- * The puller requests OMX_PULL_BLOCK_DESCS_NR blocks of data, and waits for
- * OMX_PULL_REPLY_PER_BLOCK replies for each of them.
+ * The puller requests a window of blocks of data, and waits for
+ * one reply per frame of each of them (see the notes about the
+ * adaptive window below).
  *
  * A timer is set to detect when nothing has been received for a while.  It is
  * updated every time a new reply is received. This timer repost requests to
@@ -203,6 +226,43 @@ static void omx_pull_handle_deferred_dma_completions_wait_workfunc(omx_work_stru
  * So the timeout doesn't need to be short, 1 second is enough.
  */
 
+/*
+ * Notes about the adaptive window:
+ *
+ * The replier sends whatever block is requested as long as it does not
+ * contain more than OMX_PULL_REPLY_PER_BLOCK frames, so the block size
+ * and the number of blocks requested in parallel are only chosen by
+ * the puller, without any wire change.
+ *
+ * The window starts with the value learned by the previous pulls of the
+ * endpoint. It grows by one block each time a whole window of blocks
+ * completed without loss (roughly once per round-trip), and it is halved
+ * when a later block completes before the first one, or reset to a single
+ * block when the timeout expires.
+ *
+ * The block size is fixed during each pull since the reply seqnums are
+ * mapped onto block descriptors with it. When a pull completes, the next
+ * pulls of the endpoint use blocks twice smaller if some loss was detected
+ * (so that less data is requested again after a loss), or twice larger
+ * otherwise, up to OMX_PULL_REPLY_PER_BLOCK frames.
+ */
+
+/*
+ * Notes about push mode:
+ *
+ * When the library asks for it and the message is not larger than
+ * OMX_PULL_PUSH_REPLIES_MAX frames, a single pull request with the push
+ * flag covers the whole message, and the sender streams all the replies
+ * at once instead of waiting for one request per block.
+ * Since frame seqnums wrap around, replies are identified by their msg_offset
+ * and tracked in a bitmap covering the whole message.
+ *
+ * Retransmission is still driven by the puller: when the last frame arrives
+ * while some are missing, the range between the first and last missing
+ * frames is requested again once, with another push request. The timeout
+ * handler does the same if nothing arrived for a while.
+ */
+
 #ifdef OMX_DRIVER_DEBUG
 /* defined as module parameters */
 extern unsigned long omx_PULL_REQ_packet_loss;
@@ -256,6 +316,83 @@ omx_pull_handle_release(struct omx_pull_handle * handle)
 	kref_put(&handle->refcount, __omx_pull_handle_last_release);
 }
 
+/*****************
+ * Adaptive window
+ */
+
+static INLINE uint32_t
+omx_pull_handle_block_length_max(const struct omx_pull_handle * handle)
+{
+	return handle->block_frames * OMX_PULL_REPLY_LENGTH_MAX;
+}
+
+static INLINE uint32_t
+omx_pull_handle_window_max(const struct omx_pull_handle * handle)
+{
+	uint32_t max = OMX_PULL_WINDOW_FRAMES_MAX / handle->block_frames;
+
+	if (max > OMX_PULL_BLOCK_DESCS_NR)
+		max = OMX_PULL_BLOCK_DESCS_NR;
+	if (max > (uint32_t) omx_pull_window_max)
+		max = omx_pull_window_max;
+
+	return max ? max : 1;
+}
+
+/* grow the window by one block once a whole window completed without loss */
+static INLINE void
+omx_pull_handle_window_blocks_done(struct omx_iface * iface,
+				   struct omx_pull_handle * handle,
+				   uint32_t nr)
+{
+	handle->window_done_blocks += nr;
+	if (handle->window_done_blocks < handle->window)
+		return;
+
+	handle->window_done_blocks = 0;
+	if (handle->window < omx_pull_handle_window_max(handle)) {
+		handle->window++;
+		omx_counter_inc(iface, PULL_WINDOW_GROW);
+		dprintk(PULL, "pull handle %p window increased to %ld blocks\n",
+			handle, (unsigned long) handle->window);
+	}
+}
+
+/* shrink the window after a loss, down to a single block after a timeout */
+static INLINE void
+omx_pull_handle_window_loss(struct omx_iface * iface,
+			    struct omx_pull_handle * handle,
+			    int timeout)
+{
+	handle->window = timeout ? 1 : handle->window / 2;
+	if (!handle->window)
+		handle->window = 1;
+	handle->window_done_blocks = 0;
+	handle->window_losses++;
+	omx_counter_inc(iface, PULL_WINDOW_SHRINK);
+	dprintk(PULL, "pull handle %p window decreased to %ld blocks\n",
+		handle, (unsigned long) handle->window);
+}
+
+/* save the window and adapt the block size for the next pulls of the endpoint */
+static INLINE void
+omx_pull_handle_window_save(const struct omx_pull_handle * handle)
+{
+	struct omx_endpoint * endpoint = handle->endpoint;
+	uint32_t block_frames = handle->block_frames;
+
+	if (handle->window_losses) {
+		if (block_frames > OMX_PULL_BLOCK_FRAMES_MIN)
+			block_frames /= 2;
+	} else {
+		if (block_frames < OMX_PULL_REPLY_PER_BLOCK)
+			block_frames *= 2;
+	}
+
+	endpoint->pull_block_frames = block_frames;
+	endpoint->pull_window = handle->window;
+}
+
 /**************************
  * Pull Handle Index Table
  */
@@ -437,6 +574,8 @@ omx_endpoint_pull_handles_init(struct omx_endpoint * endpoint)
 	INIT_LIST_HEAD(&endpoint->pull_handles_list);
 	omx_pull_handle_slots_init(endpoint);
 	spin_lock_init(&endpoint->pull_handles_lock);
+	endpoint->pull_window = OMX_PULL_WINDOW_INIT;
+	endpoint->pull_block_frames = OMX_PULL_REPLY_PER_BLOCK;
 	return 0;
 }
 
@@ -609,6 +748,7 @@ omx_pull_handle_create(struct omx_endpoint * endpoint,
 	handle->region = (struct omx_user_region *) region;
 	handle->total_length = cmd->length;
 	handle->pulled_rdma_offset = cmd->pulled_rdma_offset;
+	handle->puller_rdma_offset = cmd->puller_rdma_offset;
 
 	/* initialize variable stuff */
 	handle->status = OMX_PULL_HANDLE_STATUS_OK;
@@ -618,9 +758,35 @@ omx_pull_handle_create(struct omx_endpoint * endpoint,
 	handle->nr_requested_frames = 0;
 	handle->nr_missing_frames = 0;
 	handle->nr_valid_block_descs = 0;
-	for(i=0; i<OMX_PULL_BLOCK_DESCS_NR-1; i++)
+	for(i=0; i<OMX_PULL_BLOCK_DESCS_NR; i++)
 		handle->block_desc[i].frames_missing_bitmap = 0; /* make sure the invalid block descs are easy to check */
 	handle->already_rerequested_blocks = 0;
+
+	/* start with what the previous pulls learned */
+	handle->block_frames = endpoint->pull_block_frames;
+	handle->block_frames_shift = ilog2(handle->block_frames);
+	handle->window = min(endpoint->pull_window, omx_pull_handle_window_max(handle));
+	handle->window_done_blocks = 0;
+	handle->window_losses = 0;
+
+	handle->push = 0;
+#ifndef OMX_MX_WIRE_COMPAT
+	if (cmd->flags & OMX_CMD_PULL_FLAG_PUSH) {
+		uint32_t nr_frames = (cmd->pulled_rdma_offset % OMX_PULL_REPLY_LENGTH_MAX + cmd->length
+				      + OMX_PULL_REPLY_LENGTH_MAX-1) / OMX_PULL_REPLY_LENGTH_MAX;
+		/* too large messages are pulled as usual */
+		if (nr_frames && nr_frames <= OMX_PULL_PUSH_REPLIES_MAX) {
+			handle->push = 1;
+			handle->push_nr_frames = nr_frames;
+			handle->push_rerequested = 0;
+			bitmap_fill(handle->push_missing_frames, nr_frames);
+			/* everything is requested at once */
+			handle->remaining_length = 0;
+			handle->nr_requested_frames = nr_frames;
+			handle->nr_missing_frames = nr_frames;
+		}
+	}
+#endif
 	handle->last_retransmit_jiffies = get_jiffies_64() + cmd->resend_timeout_jiffies;
 
 	handle->host_copy_nr_frames = 0;
@@ -770,6 +936,7 @@ omx_pull_handle_append_needed_frames(struct omx_pull_handle * handle,
 		      + OMX_PULL_REPLY_LENGTH_MAX-1) / OMX_PULL_REPLY_LENGTH_MAX;
 	new_mask = ((omx_block_frame_bitmask_t) -1) >> (OMX_PULL_REPLY_PER_BLOCK-new_frames);
 
+	BUG_ON(handle->nr_valid_block_descs >= OMX_PULL_BLOCK_DESCS_NR);
 	desc = &handle->block_desc[handle->nr_valid_block_descs];
 	desc->frame_index = handle->next_frame_index;
 	desc->block_length = block_length;
@@ -790,7 +957,7 @@ omx_pull_handle_append_needed_frames(struct omx_pull_handle * handle,
 static INLINE void
 omx_pull_handle_first_block_done(struct omx_pull_handle * handle)
 {
-	uint32_t first_block_frames = min(handle->nr_requested_frames, (uint32_t) OMX_PULL_REPLY_PER_BLOCK);
+	uint32_t first_block_frames = min(handle->nr_requested_frames, handle->block_frames);
 
 	handle->frame_index += first_block_frames;
 	handle->nr_requested_frames -= first_block_frames;
@@ -799,7 +966,7 @@ omx_pull_handle_first_block_done(struct omx_pull_handle * handle)
 		handle->already_rerequested_blocks--;
 	memmove(&handle->block_desc[0], &handle->block_desc[1],
 		sizeof(struct omx_pull_block_desc) * handle->nr_valid_block_descs);
-	handle->block_desc[OMX_PULL_BLOCK_DESCS_NR-1].frames_missing_bitmap = 0; /* make sure the invalid block descs are easy to check */
+	handle->block_desc[handle->nr_valid_block_descs].frames_missing_bitmap = 0; /* make sure the invalid block descs are easy to check */
 
 	dprintk(PULL, "first block of pull handle %p done, removing %d requested frames, now requested %ld-%ld\n",
 		handle, first_block_frames,
@@ -812,13 +979,11 @@ omx_pull_handle_first_block_done(struct omx_pull_handle * handle)
 
 /* Called with the handle acquired and locked */
 static INLINE struct sk_buff *
-omx_fill_pull_block_request(const struct omx_pull_handle * handle, int desc_nr)
+omx_fill_pull_request(const struct omx_pull_handle * handle,
+		      uint32_t frame_index, uint32_t block_length,
+		      uint32_t first_frame_offset, uint8_t flags)
 {
-	const struct omx_pull_block_desc * desc = &handle->block_desc[desc_nr];
 	struct omx_iface * iface = handle->endpoint->iface;
-	uint32_t frame_index = desc->frame_index;
-	uint32_t block_length = desc->block_length;
-	uint32_t first_frame_offset = desc->first_frame_offset;
 	struct sk_buff * skb;
 	struct omx_hdr * mh;
 	struct omx_pkt_pull_request * pull_n;
@@ -845,20 +1010,69 @@ omx_fill_pull_block_request(const struct omx_pull_handle * handle, int desc_nr)
 #else
 	OMX_HTON_32(pull_n->block_length, block_length);
 	OMX_HTON_32(pull_n->first_frame_offset, first_frame_offset);
+	OMX_HTON_8(pull_n->flags, flags);
 #endif
 	OMX_HTON_32(pull_n->frame_index, frame_index);
 
-	omx_send_dprintk(&mh->head.eth, "PULL handle %lx magic %lx length %ld out of %ld, frame index %ld first_frame_offset %ld",
+	omx_send_dprintk(&mh->head.eth, "PULL handle %lx magic %lx length %ld out of %ld, frame index %ld first_frame_offset %ld flags %x",
 			 (unsigned long) OMX_NTOH_32(pull_n->src_pull_handle),
 			 (unsigned long) OMX_NTOH_32(pull_n->src_magic),
 			 (unsigned long) block_length,
 			 (unsigned long) OMX_NTOH_32(pull_n->total_length),
 			 (unsigned long) frame_index,
-			 (unsigned long) first_frame_offset);
+			 (unsigned long) first_frame_offset,
+			 (unsigned) flags);
 
 	return skb;
 }
 
+/* Called with the handle acquired and locked */
+static INLINE struct sk_buff *
+omx_fill_pull_block_request(const struct omx_pull_handle * handle, int desc_nr)
+{
+	const struct omx_pull_block_desc * desc = &handle->block_desc[desc_nr];
+
+	return omx_fill_pull_request(handle, desc->frame_index, desc->block_length,
+				     desc->first_frame_offset, 0);
+}
+
+/* Request frames first to last of a pushed message, called with the handle acquired and locked */
+static INLINE struct sk_buff *
+omx_fill_pull_push_request(const struct omx_pull_handle * handle,
+			   uint32_t first, uint32_t last)
+{
+	uint32_t offset_in_frame = handle->pulled_rdma_offset % OMX_PULL_REPLY_LENGTH_MAX;
+	uint32_t start, end;
+
+	/* same msg offsets as the replies to the corresponding pull block requests */
+	start = first ? first * OMX_PULL_REPLY_LENGTH_MAX - offset_in_frame : 0;
+	end = (last+1) * OMX_PULL_REPLY_LENGTH_MAX - offset_in_frame;
+	if (end > handle->total_length)
+		end = handle->total_length;
+
+	return omx_fill_pull_request(handle, first, end - start,
+				     first ? 0 : offset_in_frame,
+				     OMX_PKT_PULL_REQUEST_FLAG_PUSH);
+}
+
+/* Request the range of missing frames of a pushed message again */
+static INLINE struct sk_buff *
+omx_fill_pull_push_missing_request(struct omx_iface * iface,
+				   const struct omx_pull_handle * handle)
+{
+	uint32_t first, last;
+
+	first = find_first_bit(handle->push_missing_frames, handle->push_nr_frames);
+	BUG_ON(first >= handle->push_nr_frames);
+	for(last = handle->push_nr_frames-1; !test_bit(last, handle->push_missing_frames); last--);
+
+	omx_counter_inc(iface, PULL_PUSH_RESEND);
+	dprintk(PULL, "pull handle %p requesting pushed frames %ld-%ld again\n",
+		handle, (unsigned long) first, (unsigned long) last);
+
+	return omx_fill_pull_push_request(handle, first, last);
+}
+
 int
 omx_ioctl_pull(struct omx_endpoint * endpoint,
 	       void __user * uparam)
@@ -916,23 +1130,33 @@ omx_ioctl_pull(struct omx_endpoint * endpoint,
 	/* tell the sparse checker that the lock has been taken by omx_pull_handle_create() */
 	__acquire(&handle->lock);
 
+	if (handle->push) {
+		/* request the whole message at once */
+		omx_counter_inc(iface, PULL_PUSH);
+		skb = omx_fill_pull_push_request(handle, 0, handle->push_nr_frames-1);
+		if (likely(!IS_ERR(skb)))
+			skbs[0] = skb;
+		/* otherwise let the timeout expire and resend */
+		goto skbs_ready;
+	}
+
 	/* send a first pull block request,
 	 * ignoring the frames that are before the pull request beginning
 	 * since we want to manipulate an actual msg offset
 	 * and we want some full blocks
 	 */
 	pulled_rdma_offset_in_frame = handle->pulled_rdma_offset % OMX_PULL_REPLY_LENGTH_MAX;
-	block_length = OMX_PULL_BLOCK_LENGTH_MAX - pulled_rdma_offset_in_frame;
+	block_length = omx_pull_handle_block_length_max(handle) - pulled_rdma_offset_in_frame;
 	if (block_length > handle->remaining_length)
 		block_length = handle->remaining_length;
 
 	omx_pull_handle_append_needed_frames(handle, block_length, pulled_rdma_offset_in_frame);
 
-	/* prepare as many new blocks as needed */
-	while (handle->nr_valid_block_descs < OMX_PULL_BLOCK_DESCS_NR
+	/* prepare as many new blocks as the window allows */
+	while (handle->nr_valid_block_descs < handle->window
 	       && handle->remaining_length) {
 		/* prepare the next block */
-		block_length = OMX_PULL_BLOCK_LENGTH_MAX;
+		block_length = omx_pull_handle_block_length_max(handle);
 		if (block_length > handle->remaining_length)
 			block_length = handle->remaining_length;
 		omx_pull_handle_append_needed_frames(handle, block_length, 0);
@@ -996,6 +1220,9 @@ omx_progress_pull_on_handle_timeout_handle_locked(struct omx_iface * iface,
 	/* request the first block again */
 	omx_counter_inc(iface, PULL_TIMEOUT_HANDLER_FIRST_BLOCK);
 
+	/* the link is lossy or congested, restart with a single block */
+	omx_pull_handle_window_loss(iface, handle, 1);
+
 	skb = omx_fill_pull_block_request(handle, 0);
 	if (unlikely(IS_ERR(skb))) {
 		BUG_ON(PTR_ERR(skb) != -ENOMEM);
@@ -1011,7 +1238,7 @@ omx_progress_pull_on_handle_timeout_handle_locked(struct omx_iface * iface,
 	 * This shouldn't happen often since it means a packet has been lost
 	 * in each block.
 	 */
-	for(i=1; i<OMX_PULL_BLOCK_DESCS_NR; i++) {
+	for(i=1; i<handle->nr_valid_block_descs; i++) {
 		if (handle->block_desc[i].frames_missing_bitmap) {
 			omx_counter_inc(iface, PULL_TIMEOUT_HANDLER_NONFIRST_BLOCK);
 
@@ -1045,6 +1272,40 @@ omx_progress_pull_on_handle_timeout_handle_locked(struct omx_iface * iface,
 			omx_queue_xmit(iface, skbs[i], PULL_REQ);
 }
 
+static INLINE void
+omx_progress_push_on_handle_timeout_handle_locked(struct omx_iface * iface,
+						  struct omx_pull_handle * handle)
+{
+	struct sk_buff *skb = NULL;
+
+	/* tell the sparse checker that the lock has been taken by the caller */
+	__acquire(&handle->lock);
+
+	/* request all missing frames again, if any (some copies may still be pending) */
+	if (handle->nr_missing_frames) {
+		omx_counter_inc(iface, PULL_PUSH_TIMEOUT_HANDLER);
+		skb = omx_fill_pull_push_missing_request(iface, handle);
+		handle->push_rerequested = 0;
+	}
+
+	/* cleanup a bit of dma-offloaded copies */
+	omx_pull_handle_poll_dma_completions(handle);
+
+	/* reschedule another timeout handler */
+	/* timer already expired, use the regular mod_timer() */
+	mod_timer(&handle->retransmit_timer,
+		  get_jiffies_64() + OMX_PULL_RETRANSMIT_TIMEOUT_JIFFIES);
+
+	/*
+	 * do not keep the lock while sending
+	 * since the loopback device may cause reentrancy
+	 */
+	spin_unlock(&handle->lock);
+
+	if (likely(skb && !IS_ERR(skb)))
+		omx_queue_xmit(iface, skb, PULL_REQ);
+}
+
 /*
  * Retransmission callback, owns a reference on the handle and endpoint.
  * Running as long as status is OMX_PULL_HANDLE_STATUS_OK.
@@ -1102,6 +1363,14 @@ omx_pull_handle_timeout_handler(unsigned long data)
 		return; /* timer will never be called again (status is TIMER_EXITED) */
 	}
 
+	if (handle->push) {
+		/* request the missing frames again if necessary */
+		omx_progress_push_on_handle_timeout_handle_locked(iface, handle);
+		/* tell sparse checker that the lock has been released by omx_progress_push_on_handle_timeout_handle_locked() */
+		__release(&handle->lock);
+		return;
+	}
+
 	BUG_ON(!handle->block_desc[0].frames_missing_bitmap);
 
 	/* request more replies if necessary */
@@ -1122,6 +1391,82 @@ omx_send_pull_reply_skb_destructor(struct sk_buff *skb)
 	omx_user_region_release(region);
 }
 
+/*
+ * When the sender region is pinned on demand, the rndv is posted before
+ * the pinning is complete. Pull requests for blocks that are not covered
+ * yet are queued in the region until the sender pins the missing chunks.
+ * Returns 1 if the request was deferred, 0 if the block may be served
+ * now, or -EFAULT if the pinning failed.
+ * Blocks beyond the end of the region are never deferred, the caller
+ * drops them when checking the offset and length.
+ */
+static int
+omx_pull_request_defer_until_pinned(struct omx_user_region *region,
+				    struct sk_buff *skb,
+				    unsigned long needed)
+{
+	int ret = 0;
+
+	if (likely(region->total_registered_length >= needed))
+		return 0;
+
+	if (unlikely(needed > region->total_length))
+		return 0;
+
+	spin_lock(&region->deferred_pull_requests.lock);
+	/* check again now that the pinner cannot flush the queue behind our back */
+	if (region->status == OMX_USER_REGION_STATUS_FAILED) {
+		ret = -EFAULT;
+	} else if (region->status == OMX_USER_REGION_STATUS_PINNED
+		   && region->total_registered_length < needed) {
+		__skb_queue_tail(&region->deferred_pull_requests, skb);
+		ret = 1;
+	}
+	spin_unlock(&region->deferred_pull_requests.lock);
+
+	return ret;
+}
+
+/*
+ * Replay the pull requests that were deferred because the region
+ * was not pinned enough yet. Called by the pinner after each chunk,
+ * from process context. The requests that are still not covered are
+ * queued again.
+ */
+void
+omx_pull_serve_deferred_requests(struct omx_user_region *region)
+{
+	struct omx_iface *iface = region->endpoint->iface;
+	int nr;
+
+	/* take the lock so that a request queued against an old pinned length is seen */
+	spin_lock_bh(&region->deferred_pull_requests.lock);
+	nr = skb_queue_len(&region->deferred_pull_requests);
+	spin_unlock_bh(&region->deferred_pull_requests.lock);
+	if (likely(!nr))
+		return;
+
+	local_bh_disable();
+	while (nr--) {
+		struct omx_hdr linear_header;
+		struct sk_buff *skb;
+
+		skb = skb_dequeue(&region->deferred_pull_requests);
+		if (!skb)
+			break;
+
+		/* the receive path may have passed a header copied on its stack, copy it again */
+		if (unlikely(skb_copy_bits(skb, 0, &linear_header,
+					   sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_pull_request)) < 0)) {
+			dev_kfree_skb(skb);
+			continue;
+		}
+
+		omx_recv_pull_request(iface, &linear_header, skb);
+	}
+	local_bh_enable();
+}
+
 int
 omx_recv_pull_request(struct omx_iface * iface,
 		      struct omx_hdr * pull_mh,
@@ -1158,7 +1503,7 @@ omx_recv_pull_request(struct omx_iface * iface,
 	size_t reply_hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_pull_reply);
 	struct omx_user_region *region;
 	uint32_t current_frame_seqnum, current_msg_offset, block_remaining_length;
-	int replies, i;
+	int replies, replies_max, i;
 	int err = 0;
 
 	BUILD_BUG_ON(OMX_PULL_REPLY_PACKET_SIZE_OF_PAYLOAD(OMX_PULL_REPLY_LENGTH_MAX) > OMX_MTU);
@@ -1207,13 +1552,18 @@ omx_recv_pull_request(struct omx_iface * iface,
 			 (unsigned long) frame_index,
 			 (unsigned long) first_frame_offset);
 
-	/* compute and check the number of PULL_REPLY to send */
+	/* compute and check the number of PULL_REPLY to send, the whole message may be pushed at once */
+	replies_max = OMX_PULL_REPLY_PER_BLOCK;
+#ifndef OMX_MX_WIRE_COMPAT
+	if (OMX_NTOH_8(pull_request_n->flags) & OMX_PKT_PULL_REQUEST_FLAG_PUSH)
+		replies_max = OMX_PULL_PUSH_REPLIES_MAX;
+#endif
 	replies = (first_frame_offset + block_length
 		   + OMX_PULL_REPLY_LENGTH_MAX-1) / OMX_PULL_REPLY_LENGTH_MAX;
-	if (unlikely(replies > OMX_PULL_REPLY_PER_BLOCK)) {
+	if (unlikely(replies > replies_max)) {
 		omx_counter_inc(iface, DROP_PULL_BAD_REPLIES);
 		omx_drop_dprintk(pull_eh, "PULL packet for %d REPLY (%d max)",
-				 replies, OMX_PULL_REPLY_PER_BLOCK);
+				 replies, replies_max);
 		err = -EINVAL;
 		goto out_with_endpoint;
 	}
@@ -1236,6 +1586,26 @@ omx_recv_pull_request(struct omx_iface * iface,
 		+ first_frame_offset;
 	block_remaining_length = block_length;
 
+	if (!omx_pin_synchronous) {
+		/* the rndv may have been posted before the region was fully pinned */
+		err = omx_pull_request_defer_until_pinned(region, orig_skb,
+							  pulled_rdma_offset + current_msg_offset + block_length);
+		if (unlikely(err < 0)) {
+			omx_counter_inc(iface, DROP_PULL_BAD_REGION);
+			omx_drop_dprintk(pull_eh, "PULL packet with region that failed to be pinned");
+			omx_send_nack_mcp(iface, peer_index,
+					  OMX_NACK_TYPE_BAD_RDMAWIN,
+					  src_endpoint, src_pull_handle, src_magic);
+			goto out_with_region;
+		} else if (err > 0) {
+			/* the skb is kept in the region until the pinning covers the block */
+			omx_counter_inc(iface, PULL_REQ_DEFERRED_PINNING);
+			omx_user_region_release(region);
+			omx_endpoint_release(endpoint);
+			return 0;
+		}
+	}
+
 	/* initialize the region offset cache and check length/offset */
 	err = omx_user_region_offset_cache_init(region, &region_cache,
 						current_msg_offset + pulled_rdma_offset, block_length);
@@ -1584,6 +1954,7 @@ omx_progress_pull_on_recv_pull_reply_locked(struct omx_iface * iface,
 			 */
 
 			omx_counter_inc(iface, PULL_NONFIRST_BLOCK_DONE_EARLY);
+			omx_pull_handle_window_loss(iface, handle, 0);
 
 			dprintk(PULL, "pull handle %p second block done without first, requesting first block again\n",
 				handle);
@@ -1619,12 +1990,15 @@ omx_progress_pull_on_recv_pull_reply_locked(struct omx_iface * iface,
 		}
 		first_block = handle->nr_valid_block_descs;
 
-		/* prepare as many new blocks as needed */
-		while (handle->nr_valid_block_descs < OMX_PULL_BLOCK_DESCS_NR
+		/* i blocks are done, the window may grow */
+		omx_pull_handle_window_blocks_done(iface, handle, i);
+
+		/* prepare as many new blocks as the window allows */
+		while (handle->nr_valid_block_descs < handle->window
 		       && handle->remaining_length) {
 			uint32_t block_length;
 			/* prepare the next block */
-			block_length = OMX_PULL_BLOCK_LENGTH_MAX;
+			block_length = omx_pull_handle_block_length_max(handle);
 			if (block_length > handle->remaining_length)
 				block_length = handle->remaining_length;
 			omx_pull_handle_append_needed_frames(handle, block_length, 0);
@@ -1673,6 +2047,151 @@ omx_progress_pull_on_recv_pull_reply_locked(struct omx_iface * iface,
 			omx_queue_xmit(iface, skbs[i], PULL_REQ);
 }
 
+/*
+ * Check that a reply frame belongs to the current blocks and is not a duplicate,
+ * and mark it as received. Returns its block desc index.
+ *
+ * Called on a acquired and locked handle.
+ */
+static INLINE int
+omx_pull_handle_accept_block_reply(struct omx_iface * iface,
+				   struct omx_pull_handle * handle,
+				   struct ethhdr * eh,
+				   uint32_t frame_seqnum, uint32_t msg_offset)
+{
+	uint32_t frame_seqnum_offset; /* unsigned to make seqnum offset easy to check */
+	omx_block_frame_bitmask_t bitmap_mask;
+	int idesc;
+
+	/*
+	 * compute the frame seqnum offset:
+	 * frame_seqnum is already %256, so do the same for h->frame_index, compute the difference
+	 * and make sure %256 returns something>0 by adding another 256
+	 */
+	frame_seqnum_offset = (frame_seqnum - (handle->frame_index % 256) + 256) % 256;
+
+	/* check that the frame seqnum is correct for this msg offset */
+        if (unlikely((msg_offset+OMX_PULL_REPLY_LENGTH_MAX-1) / OMX_PULL_REPLY_LENGTH_MAX != handle->frame_index + frame_seqnum_offset)) {
+		omx_counter_inc(iface, DROP_PULL_REPLY_BAD_SEQNUM_WRAPAROUND);
+		omx_drop_dprintk(eh, "PULL REPLY packet with invalid seqnum %ld (offset %ld), should be %ld (msg offset %ld)",
+				 (unsigned long) frame_seqnum,
+				 (unsigned long) frame_seqnum_offset,
+				 (unsigned long) (msg_offset+OMX_PULL_REPLY_LENGTH_MAX-1) / OMX_PULL_REPLY_LENGTH_MAX,
+				 (unsigned long) msg_offset);
+		return -EINVAL;
+	}
+
+	/* check that the frame is from this block, and handle wrap around 256 */
+	if (unlikely(frame_seqnum_offset >= handle->nr_requested_frames)) {
+		omx_counter_inc(iface, DROP_PULL_REPLY_BAD_SEQNUM);
+		omx_drop_dprintk(eh, "PULL REPLY packet with invalid seqnum %ld (offset %ld), should be within %ld-%ld",
+				 (unsigned long) frame_seqnum,
+				 (unsigned long) frame_seqnum_offset,
+				 (unsigned long) handle->frame_index,
+				 (unsigned long) handle->frame_index + handle->nr_requested_frames);
+		return -EINVAL;
+	}
+
+	/* check that the frame is not a duplicate */
+	idesc = frame_seqnum_offset >> handle->block_frames_shift;
+	bitmap_mask = ((omx_block_frame_bitmask_t) 1) << (frame_seqnum_offset & (handle->block_frames-1));
+	if (unlikely((handle->block_desc[idesc].frames_missing_bitmap & bitmap_mask) == 0)) {
+		omx_counter_inc(iface, DROP_PULL_REPLY_DUPLICATE);
+		omx_drop_dprintk(eh, "PULL REPLY packet with duplicate seqnum %ld (offset %ld) in current block %ld-%ld",
+				 (unsigned long) frame_seqnum,
+				 (unsigned long) frame_seqnum_offset,
+				 (unsigned long) handle->frame_index,
+				 (unsigned long) handle->frame_index + handle->nr_requested_frames);
+		return -EINVAL;
+	}
+	handle->block_desc[idesc].frames_missing_bitmap &= ~bitmap_mask;
+
+	return idesc;
+}
+
+/*
+ * Check that a pushed reply frame is part of the message and is not a duplicate,
+ * and mark it as received. Returns its frame index.
+ *
+ * Called on a acquired and locked handle.
+ */
+static INLINE int
+omx_pull_handle_accept_push_reply(struct omx_iface * iface,
+				  struct omx_pull_handle * handle,
+				  struct ethhdr * eh,
+				  uint32_t msg_offset, uint32_t frame_length)
+{
+	uint32_t offset_in_frame = handle->pulled_rdma_offset % OMX_PULL_REPLY_LENGTH_MAX;
+	/* seqnums wrap around, use the msg offset instead */
+	uint32_t frame = (msg_offset + OMX_PULL_REPLY_LENGTH_MAX-1) / OMX_PULL_REPLY_LENGTH_MAX;
+
+	/* check that the frame is within the message and starts where expected */
+	if (unlikely(frame >= handle->push_nr_frames
+		     || msg_offset != (frame ? frame * OMX_PULL_REPLY_LENGTH_MAX - offset_in_frame : 0)
+		     || msg_offset + frame_length > handle->total_length)) {
+		omx_counter_inc(iface, DROP_PULL_REPLY_BAD_SEQNUM);
+		omx_drop_dprintk(eh, "PULL REPLY pushed packet with invalid msg offset %ld length %ld, should be within 0-%ld",
+				 (unsigned long) msg_offset,
+				 (unsigned long) frame_length,
+				 (unsigned long) handle->total_length);
+		return -EINVAL;
+	}
+
+	/* check that the frame is not a duplicate */
+	if (unlikely(!__test_and_clear_bit(frame, handle->push_missing_frames))) {
+		omx_counter_inc(iface, DROP_PULL_REPLY_DUPLICATE);
+		omx_drop_dprintk(eh, "PULL REPLY pushed packet with duplicate frame %ld (msg offset %ld)",
+				 (unsigned long) frame,
+				 (unsigned long) msg_offset);
+		return -EINVAL;
+	}
+
+	return frame;
+}
+
+/*
+ * Request the missing frames early if the last one arrived before them.
+ *
+ * Called on a acquired and locked handle. Unlocks it before sending and returning.
+ */
+static INLINE void
+omx_progress_push_on_recv_pull_reply_locked(struct omx_iface * iface,
+					    struct omx_pull_handle * handle,
+					    int frame)
+{
+	struct sk_buff * skb = NULL;
+
+	/* tell the sparse checker that the lock has been taken by the caller */
+	__acquire(&handle->lock);
+
+	if (frame == handle->push_nr_frames-1
+	    && handle->nr_missing_frames
+	    && !handle->push_rerequested) {
+		/* some frames got lost, no need to wait for the timeout */
+		skb = omx_fill_pull_push_missing_request(iface, handle);
+		handle->push_rerequested = 1;
+	}
+
+	if (!(frame & (OMX_PULL_REPLY_PER_BLOCK-1))) {
+		/* cleanup a bit of dma-offloaded copies once in a while */
+		omx_pull_handle_poll_dma_completions(handle);
+	}
+
+	/* reschedule the timeout handler */
+	/* timer still pending, use the mod_timer_pending() */
+	omx_mod_timer_pending(&handle->retransmit_timer,
+			      get_jiffies_64() + OMX_PULL_RETRANSMIT_TIMEOUT_JIFFIES);
+
+	/*
+	 * do not keep the lock while sending
+	 * since the loopback device may cause reentrancy
+	 */
+	spin_unlock(&handle->lock);
+
+	if (skb && likely(!IS_ERR(skb)))
+		omx_queue_xmit(iface, skb, PULL_REQ);
+}
+
 int
 omx_recv_pull_reply(struct omx_iface * iface,
 		    struct omx_hdr * mh,
@@ -1685,11 +2204,9 @@ omx_recv_pull_reply(struct omx_iface * iface,
 	uint32_t frame_length = OMX_NTOH_16(pull_reply_n->frame_length);
 	uint32_t frame_seqnum = OMX_NTOH_8(pull_reply_n->frame_seqnum);
 	uint32_t msg_offset = OMX_NTOH_32(pull_reply_n->msg_offset);
-	uint32_t frame_seqnum_offset; /* unsigned to make seqnum offset easy to check */
 	int idesc;
 	struct omx_endpoint * endpoint;
 	struct omx_pull_handle * handle;
-	omx_block_frame_bitmask_t bitmap_mask;
 	int remaining_copy = frame_length;
 	int err = 0;
 	int free_skb = 1;
@@ -1749,64 +2266,28 @@ omx_recv_pull_reply(struct omx_iface * iface,
 		goto out_with_endpoint;
 	}
 
-	/*
-	 * compute the frame seqnum offset:
-	 * frame_seqnum is already %256, so do the same for h->frame_index, compute the difference
-	 * and make sure %256 returns something>0 by adding another 256
-	 */
-	frame_seqnum_offset = (frame_seqnum - (handle->frame_index % 256) + 256) % 256;
-
-	/* check that the frame seqnum is correct for this msg offset */
-        if (unlikely((msg_offset+OMX_PULL_REPLY_LENGTH_MAX-1) / OMX_PULL_REPLY_LENGTH_MAX != handle->frame_index + frame_seqnum_offset)) {
-		omx_counter_inc(iface, DROP_PULL_REPLY_BAD_SEQNUM_WRAPAROUND);
-		omx_drop_dprintk(&mh->head.eth, "PULL REPLY packet with invalid seqnum %ld (offset %ld), should be %ld (msg offset %ld)",
-				 (unsigned long) frame_seqnum,
-				 (unsigned long) frame_seqnum_offset,
-				 (unsigned long) (msg_offset+OMX_PULL_REPLY_LENGTH_MAX-1) / OMX_PULL_REPLY_LENGTH_MAX,
-				 (unsigned long) msg_offset);
-		spin_unlock(&handle->lock);
-		omx_pull_handle_release(handle);
-		err = 0;
-		goto out_with_endpoint;
-	}
-
-	/* check that the frame is from this block, and handle wrap around 256 */
-	if (unlikely(frame_seqnum_offset >= handle->nr_requested_frames)) {
-		omx_counter_inc(iface, DROP_PULL_REPLY_BAD_SEQNUM);
-		omx_drop_dprintk(&mh->head.eth, "PULL REPLY packet with invalid seqnum %ld (offset %ld), should be within %ld-%ld",
-				 (unsigned long) frame_seqnum,
-				 (unsigned long) frame_seqnum_offset,
-				 (unsigned long) handle->frame_index,
-				 (unsigned long) handle->frame_index + handle->nr_requested_frames);
-		spin_unlock(&handle->lock);
-		omx_pull_handle_release(handle);
-		err = 0;
-		goto out_with_endpoint;
-	}
-
-	/* check that the frame is not a duplicate */
-	idesc = frame_seqnum_offset / OMX_PULL_REPLY_PER_BLOCK;
-	bitmap_mask = ((omx_block_frame_bitmask_t) 1) << (frame_seqnum_offset % OMX_PULL_REPLY_PER_BLOCK);
-	if (unlikely((handle->block_desc[idesc].frames_missing_bitmap & bitmap_mask) == 0)) {
-		omx_counter_inc(iface, DROP_PULL_REPLY_DUPLICATE);
-		omx_drop_dprintk(&mh->head.eth, "PULL REPLY packet with duplicate seqnum %ld (offset %ld) in current block %ld-%ld",
-				 (unsigned long) frame_seqnum,
-				 (unsigned long) frame_seqnum_offset,
-				 (unsigned long) handle->frame_index,
-				 (unsigned long) handle->frame_index + handle->nr_requested_frames);
+	/* check that the frame was requested and is not a duplicate, and mark it as received */
+	if (handle->push)
+		idesc = omx_pull_handle_accept_push_reply(iface, handle, &mh->head.eth,
+							  msg_offset, frame_length);
+	else
+		idesc = omx_pull_handle_accept_block_reply(iface, handle, &mh->head.eth,
+							   frame_seqnum, msg_offset);
+	if (unlikely(idesc < 0)) {
 		spin_unlock(&handle->lock);
 		omx_pull_handle_release(handle);
 		err = 0;
 		goto out_with_endpoint;
 	}
-	handle->block_desc[idesc].frames_missing_bitmap &= ~bitmap_mask;
 	handle->nr_missing_frames--;
 
 #if (defined OMX_HAVE_DMA_ENGINE) && !(defined OMX_NORECVCOPY)
 	if (omx_dmaengine
 	    && frame_length >= omx_dma_async_frag_min
 	    && handle->total_length >= omx_dma_async_min) {
-		remaining_copy = omx_pull_handle_reply_try_dma_copy(iface, handle, skb, msg_offset, frame_length);
+		remaining_copy = omx_pull_handle_reply_try_dma_copy(iface, handle, skb,
+								    handle->puller_rdma_offset + msg_offset,
+								    frame_length);
 		if (likely(remaining_copy != frame_length))
 			free_skb = 0;
 	}
@@ -1816,8 +2297,11 @@ omx_recv_pull_reply(struct omx_iface * iface,
 	handle->host_copy_nr_frames++;
 
 	/* request more replies if necessary */
-	omx_progress_pull_on_recv_pull_reply_locked(iface, handle, idesc);
-	/* tell the sparse checker that the lock has been released by omx_progress_pull_on_recv_pull_reply_locked() */
+	if (handle->push)
+		omx_progress_push_on_recv_pull_reply_locked(iface, handle, idesc);
+	else
+		omx_progress_pull_on_recv_pull_reply_locked(iface, handle, idesc);
+	/* tell the sparse checker that the lock has been released by omx_progress_*_on_recv_pull_reply_locked() */
 	__release(&handle->lock);
 
 #ifndef OMX_NORECVCOPY
@@ -1826,9 +2310,9 @@ omx_recv_pull_reply(struct omx_iface * iface,
 		dprintk(PULL, "copying PULL_REPLY %ld bytes for msg_offset %ld at region offset %ld\n",
 		       (unsigned long) frame_length,
 		       (unsigned long) msg_offset,
-		       (unsigned long) msg_offset);
+		       (unsigned long) handle->puller_rdma_offset + msg_offset);
 		err = omx_user_region_fill_pages(handle->region,
-						 msg_offset,
+						 handle->puller_rdma_offset + msg_offset,
 						 skb,
 						 frame_length);
 		if (unlikely(err < 0)) {
@@ -1866,6 +2350,8 @@ omx_recv_pull_reply(struct omx_iface * iface,
 	if (!handle->remaining_length && !handle->nr_missing_frames && !handle->host_copy_nr_frames) {
 		/* handle is done, notify the completion */
 		dprintk(PULL, "notifying pull completion\n");
+		if (!handle->push)
+			omx_pull_handle_window_save(handle);
 		omx_pull_handle_mark_completed(handle, OMX_EVT_PULL_DONE_SUCCESS);
 		/* nobody is going to use this handle, no need to lock anymore */
 		spin_unlock(&handle->lock);
@@ -114,6 +114,8 @@ omx_recv_connect(struct omx_iface * iface,
 		request_event.app_key = OMX_NTOH_32(connect_n->request.app_key);
 		request_event.target_recv_seqnum_start = OMX_NTOH_16(connect_n->request.target_recv_seqnum_start);
 		request_event.connect_seqnum = OMX_NTOH_8(connect_n->request.connect_seqnum);
+		request_event.features = OMX_NTOH_16(connect_n->request.features_magic) == OMX_PKT_CONNECT_FEATURES_MAGIC
+			? OMX_NTOH_8(connect_n->request.features) : 0;
 
 		/* notify the event */
 		err = omx_notify_unexp_event(endpoint, &request_event, sizeof(request_event));
@@ -132,6 +134,8 @@ omx_recv_connect(struct omx_iface * iface,
 		reply_event.target_recv_seqnum_start = OMX_NTOH_16(connect_n->reply.target_recv_seqnum_start);
 		reply_event.connect_seqnum = OMX_NTOH_8(connect_n->reply.connect_seqnum);
 		reply_event.connect_status_code = OMX_NTOH_8(connect_n->reply.connect_status_code);
+		reply_event.features = OMX_NTOH_16(connect_n->reply.features_magic) == OMX_PKT_CONNECT_FEATURES_MAGIC
+			? OMX_NTOH_8(connect_n->reply.features) : 0;
 		BUILD_BUG_ON(OMX_CONNECT_STATUS_SUCCESS != OMX_PKT_CONNECT_STATUS_SUCCESS);
 		BUILD_BUG_ON(OMX_CONNECT_STATUS_BAD_KEY != OMX_PKT_CONNECT_STATUS_BAD_KEY);
 
@@ -393,6 +397,249 @@ omx_recv_small(struct omx_iface * iface,
 	return err;
 }
 
+/*
+ * Read the header of the aggregated message at offset and check it.
+ * Returns the offset of the next message.
+ */
+static long
+omx_recv_aggregate_msg_hdr(const struct sk_buff * skb,
+			   size_t offset, size_t end,
+			   struct omx_pkt_aggregate_msg * msg_n)
+{
+	uint8_t ptype;
+	uint16_t length;
+	int err;
+
+	if (unlikely(offset + sizeof(*msg_n) > end))
+		return -EINVAL;
+
+	err = skb_copy_bits(skb, offset, msg_n, sizeof(*msg_n));
+	/* cannot fail since pages are allocated by us */
+	BUG_ON(err < 0);
+
+	ptype = OMX_NTOH_8(msg_n->ptype);
+	length = OMX_NTOH_16(msg_n->length);
+	if (unlikely(ptype == OMX_PKT_TYPE_TINY
+		     ? length > OMX_TINY_MSG_LENGTH_MAX
+		     : ptype != OMX_PKT_TYPE_SMALL || length > OMX_SMALL_MSG_LENGTH_MAX))
+		return -EINVAL;
+
+	offset += sizeof(*msg_n) + OMX_PKT_AGGREGATE_MSG_ALIGN(length);
+	if (unlikely(offset > end))
+		return -EINVAL;
+
+	return offset;
+}
+
+/* nack all messages of an aggregate */
+static void
+omx_recv_aggregate_nack(struct omx_iface * iface, const struct sk_buff * skb,
+			size_t hdr_len, unsigned nr, uint16_t peer_index,
+			enum omx_nack_type nack_type,
+			uint8_t dst_endpoint, uint8_t src_endpoint)
+{
+	struct omx_pkt_aggregate_msg msg_n;
+	long offset = hdr_len;
+	unsigned i;
+
+	for(i=0; i<nr; i++) {
+		size_t msg_offset = offset;
+		offset = omx_recv_aggregate_msg_hdr(skb, msg_offset, skb->len, &msg_n);
+		BUG_ON(offset < 0); /* already checked */
+		omx_send_nack_lib(iface, peer_index, nack_type,
+				  dst_endpoint, src_endpoint, OMX_NTOH_16(msg_n.lib_seqnum));
+	}
+}
+
+static int
+omx_recv_aggregate(struct omx_iface * iface,
+		   struct omx_hdr * mh,
+		   struct sk_buff * skb)
+{
+	struct omx_endpoint * endpoint;
+	struct ethhdr *eh = &mh->head.eth;
+	uint16_t peer_index = OMX_NTOH_16(mh->head.dst_src_peer_index);
+	struct omx_pkt_aggregate *aggregate_n = &mh->body.aggregate;
+	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_aggregate);
+	uint16_t length = OMX_NTOH_16(aggregate_n->length);
+	uint8_t nr = OMX_NTOH_8(aggregate_n->nr);
+	uint8_t dst_endpoint = OMX_NTOH_8(aggregate_n->dst_endpoint);
+	uint8_t src_endpoint = OMX_NTOH_8(aggregate_n->src_endpoint);
+	uint32_t session_id = OMX_NTOH_32(aggregate_n->session);
+	struct omx_pkt_aggregate_msg msg_n;
+	unsigned long recvq_offsets[OMX_PKT_AGGREGATE_NR_MAX];
+	unsigned nr_small = 0, nr_reserved = 0, next_reserved = 0;
+	long offset;
+	unsigned i;
+	int err = 0;
+
+	/* check packet length */
+	if (unlikely(length > OMX_PKT_AGGREGATE_LENGTH_MAX || !nr || nr > OMX_PKT_AGGREGATE_NR_MAX)) {
+		omx_counter_inc(iface, DROP_BAD_DATALEN);
+		omx_drop_dprintk(eh, "AGGREGATE packet too long (length %d with %d messages)",
+				 (unsigned) length, (unsigned) nr);
+		err = -EINVAL;
+		goto out;
+	}
+
+	/* check actual data length */
+	if (unlikely(length > skb->len - hdr_len)) {
+		omx_counter_inc(iface, DROP_BAD_SKBLEN);
+		omx_drop_dprintk(eh, "AGGREGATE packet with %ld bytes instead of %d",
+				 (unsigned long) skb->len - hdr_len,
+				 (unsigned) length);
+		err = -EINVAL;
+		goto out;
+	}
+
+	/* check the message headers before delivering anything */
+	offset = hdr_len;
+	for(i=0; i<nr; i++) {
+		offset = omx_recv_aggregate_msg_hdr(skb, offset, hdr_len + length, &msg_n);
+		if (unlikely(offset < 0)) {
+			omx_counter_inc(iface, DROP_BAD_DATALEN);
+			omx_drop_dprintk(eh, "AGGREGATE packet with invalid message #%d", i);
+			err = -EINVAL;
+			goto out;
+		}
+		if (OMX_NTOH_8(msg_n.ptype) == OMX_PKT_TYPE_SMALL)
+			nr_small++;
+	}
+
+	/* check the peer index */
+	err = omx_check_recv_peer_index(peer_index,
+					omx_board_addr_from_ethhdr_src(eh));
+	if (unlikely(err < 0)) {
+		omx_counter_inc(iface, DROP_BAD_PEER_INDEX);
+		omx_drop_dprintk(eh, "AGGREGATE packet with wrong peer index %d",
+				 (unsigned) peer_index);
+		goto out;
+	}
+
+	/* get the destination endpoint */
+	endpoint = omx_endpoint_acquire_by_iface_index(iface, dst_endpoint);
+	if (unlikely(IS_ERR(endpoint))) {
+		omx_counter_inc(iface, DROP_BAD_ENDPOINT);
+		omx_drop_dprintk(eh, "AGGREGATE packet for unknown endpoint %d",
+				 dst_endpoint);
+		omx_recv_aggregate_nack(iface, skb, hdr_len, nr, peer_index,
+					omx_endpoint_acquire_by_iface_index_error_to_nack_type(endpoint),
+					dst_endpoint, src_endpoint);
+		err = PTR_ERR(endpoint);
+		goto out;
+	}
+
+	/* check the session */
+	if (unlikely(session_id != endpoint->session_id)) {
+		omx_counter_inc(iface, DROP_BAD_SESSION);
+		omx_drop_dprintk(eh, "AGGREGATE packet with bad session");
+		omx_recv_aggregate_nack(iface, skb, hdr_len, nr, peer_index,
+					OMX_NACK_TYPE_BAD_SESSION,
+					dst_endpoint, src_endpoint);
+		err = -EINVAL;
+		goto out_with_endpoint;
+	}
+
+	omx_recv_dprintk(eh, "AGGREGATE of %d messages length %ld",
+			 (unsigned) nr, (unsigned long) length);
+	omx_counter_inc(iface, RECV_AGGREGATE);
+
+	/*
+	 * reserve the slots of all small messages at once,
+	 * or fallback to one at a time if they do not all fit
+	 */
+	if (nr_small > 1
+	    && !omx_prepare_notify_unexp_events_with_recvq(endpoint, nr_small, recvq_offsets))
+		nr_reserved = nr_small;
+
+	/* split into one tiny/small event per message */
+	offset = hdr_len;
+	for(i=0; i<nr; i++) {
+		struct omx_evt_recv_msg event;
+		size_t data_offset = offset + sizeof(msg_n);
+		uint16_t msg_length;
+
+		offset = omx_recv_aggregate_msg_hdr(skb, offset, hdr_len + length, &msg_n);
+		msg_length = OMX_NTOH_16(msg_n.length);
+
+		event.id = 0;
+		event.peer_index = peer_index;
+		event.src_endpoint = src_endpoint;
+		event.match_info = OMX_NTOH_MATCH_INFO(&msg_n);
+		event.seqnum = OMX_NTOH_16(msg_n.lib_seqnum);
+		event.piggyack = OMX_NTOH_16(msg_n.lib_piggyack);
+
+		if (OMX_NTOH_8(msg_n.ptype) == OMX_PKT_TYPE_TINY) {
+			event.type = OMX_EVT_RECV_TINY;
+			event.specific.tiny.length = msg_length;
+			event.specific.tiny.checksum = OMX_NTOH_16(msg_n.checksum);
+
+#ifndef OMX_NORECVCOPY
+			/* copy data in event data */
+			err = skb_copy_bits(skb, data_offset, event.specific.tiny.data, msg_length);
+			/* cannot fail since pages are allocated by us */
+			BUG_ON(err < 0);
+#endif
+
+			/* notify the event */
+			err = omx_notify_unexp_event(endpoint, &event, sizeof(event));
+			if (unlikely(err < 0))
+				break;
+
+			omx_counter_inc(iface, RECV_TINY);
+
+		} else {
+			unsigned long recvq_offset;
+
+			/* get the eventq slot */
+			if (next_reserved < nr_reserved) {
+				recvq_offset = recvq_offsets[next_reserved++];
+			} else {
+				err = omx_prepare_notify_unexp_event_with_recvq(endpoint, &recvq_offset);
+				if (unlikely(err < 0))
+					break;
+			}
+
+			event.type = OMX_EVT_RECV_SMALL;
+			event.specific.small.length = msg_length;
+			event.specific.small.recvq_offset = recvq_offset;
+			event.specific.small.checksum = OMX_NTOH_16(msg_n.checksum);
+
+#ifndef OMX_NORECVCOPY
+			/* copy data in recvq slot */
+			err = skb_copy_bits(skb, data_offset, endpoint->recvq + recvq_offset, msg_length);
+			/* cannot fail since pages are allocated by us */
+			BUG_ON(err < 0);
+#endif
+
+			/* notify the event */
+			omx_commit_notify_unexp_event_with_recvq(endpoint, &event, sizeof(event));
+
+			omx_counter_inc(iface, RECV_SMALL);
+		}
+	}
+
+	if (unlikely(err < 0)) {
+		/* no more unexpected eventq slot? just drop the remaining messages, they will be resent anyway */
+		omx_drop_dprintk(eh, "AGGREGATE packet messages #%d-%d because of unexpected event queue full",
+				 i, (unsigned) nr-1);
+		/* release the slots that were reserved for dropped small messages */
+		for(; next_reserved < nr_reserved; next_reserved++)
+			omx_cancel_notify_unexp_event_with_recvq(endpoint);
+		goto out_with_endpoint;
+	}
+
+	omx_endpoint_release(endpoint);
+	dev_kfree_skb(skb);
+	return 0;
+
+ out_with_endpoint:
+	omx_endpoint_release(endpoint);
+ out:
+	dev_kfree_skb(skb);
+	return err;
+}
+
 static int
 omx_recv_medium_frag(struct omx_iface * iface,
 		     struct omx_hdr * mh,
@@ -574,13 +821,17 @@ omx_recv_rndv(struct omx_iface * iface,
 	struct ethhdr *eh = &mh->head.eth;
 	uint16_t peer_index = OMX_NTOH_16(mh->head.dst_src_peer_index);
 	struct omx_pkt_rndv *rndv_n = &mh->body.rndv;
+	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_rndv);
 	uint16_t rndv_data_length = OMX_NTOH_16(rndv_n->msg.length);
 	uint8_t dst_endpoint = OMX_NTOH_8(rndv_n->msg.dst_endpoint);
 	uint8_t src_endpoint = OMX_NTOH_8(rndv_n->msg.src_endpoint);
 	uint32_t session_id = OMX_NTOH_32(rndv_n->msg.session);
 	uint16_t lib_seqnum = OMX_NTOH_16(rndv_n->msg.lib_seqnum);
 	uint16_t lib_piggyack = OMX_NTOH_16(rndv_n->msg.lib_piggyack);
+	uint16_t pulled_rdma_offset = OMX_NTOH_16(rndv_n->pulled_rdma_offset);
+	uint16_t eager_length = 0;
 	struct omx_evt_recv_msg event;
+	unsigned long recvq_offset = 0;
 	int err = 0;
 
 	/* check the rdnv data length */
@@ -592,6 +843,25 @@ omx_recv_rndv(struct omx_iface * iface,
 		goto out;
 	}
 
+#ifndef OMX_MX_WIRE_COMPAT
+	/*
+	 * check the eager prefix, if any.
+	 * the pulled rdma offset is only used to skip the prefix in native mode,
+	 * so it must match the prefix length even without any prefix.
+	 */
+	eager_length = rndv_data_length - OMX_PKT_RNDV_DATA_LENGTH;
+	if (unlikely(eager_length != pulled_rdma_offset
+		     || eager_length > OMX_RNDV_EAGER_LENGTH_MAX
+		     || eager_length > OMX_NTOH_32(rndv_n->msg_length)
+		     || eager_length > skb->len - hdr_len)) {
+		omx_counter_inc(iface, DROP_BAD_DATALEN);
+		omx_drop_dprintk(eh, "RNDV packet with invalid eager prefix length %d (pulled rdma offset %d)",
+				 (unsigned) eager_length, (unsigned) pulled_rdma_offset);
+		err = -EINVAL;
+		goto out;
+	}
+#endif
+
 	/* check the peer index */
 	err = omx_check_recv_peer_index(peer_index,
 					omx_board_addr_from_ethhdr_src(eh));
@@ -637,15 +907,40 @@ omx_recv_rndv(struct omx_iface * iface,
 	event.specific.rndv.msg_length = OMX_NTOH_32(rndv_n->msg_length);
 	event.specific.rndv.pulled_rdma_id = OMX_NTOH_8(rndv_n->pulled_rdma_id);
 	event.specific.rndv.pulled_rdma_seqnum = OMX_NTOH_8(rndv_n->pulled_rdma_seqnum);
-	event.specific.rndv.pulled_rdma_offset = OMX_NTOH_16(rndv_n->pulled_rdma_offset);
+	event.specific.rndv.pulled_rdma_offset = pulled_rdma_offset;
 	event.specific.rndv.checksum = OMX_NTOH_16(rndv_n->msg.checksum);
+	event.specific.rndv.eager_length = eager_length;
+	event.specific.rndv.recvq_offset = 0;
 
-	/* notify the event */
-	err = omx_notify_unexp_event(endpoint, &event, sizeof(event));
-	if (unlikely(err < 0)) {
-		/* no more unexpected eventq slot? just drop the packet, it will be resent anyway */
-		omx_drop_dprintk(eh, "RNDV packet because of unexpected event queue full");
-		goto out_with_endpoint;
+	if (eager_length) {
+		/* get the eventq slot and a recvq slot for the eager prefix */
+		err = omx_prepare_notify_unexp_event_with_recvq(endpoint, &recvq_offset);
+		if (unlikely(err < 0)) {
+			/* no more unexpected eventq slot? just drop the packet, it will be resent anyway */
+			omx_drop_dprintk(eh, "RNDV packet because of unexpected event queue full");
+			goto out_with_endpoint;
+		}
+		event.specific.rndv.recvq_offset = recvq_offset;
+
+#ifndef OMX_NORECVCOPY
+		/* copy the eager prefix in recvq slot */
+		err = skb_copy_bits(skb, hdr_len, endpoint->recvq + recvq_offset, eager_length);
+		/* cannot fail since pages are allocated by us */
+		BUG_ON(err < 0);
+#endif
+
+		/* notify the event */
+		omx_commit_notify_unexp_event_with_recvq(endpoint, &event, sizeof(event));
+		omx_counter_inc(iface, RECV_RNDV_EAGER);
+
+	} else {
+		/* notify the event */
+		err = omx_notify_unexp_event(endpoint, &event, sizeof(event));
+		if (unlikely(err < 0)) {
+			/* no more unexpected eventq slot? just drop the packet, it will be resent anyway */
+			omx_drop_dprintk(eh, "RNDV packet because of unexpected event queue full");
+			goto out_with_endpoint;
+		}
 	}
 
 	omx_counter_inc(iface, RECV_RNDV);
@@ -1019,6 +1314,7 @@ omx_pkt_types_init(void)
 	omx_pkt_type_handler[OMX_PKT_TYPE_NOTIFY] = omx_recv_notify;
 	omx_pkt_type_handler[OMX_PKT_TYPE_NACK_LIB] = omx_recv_nack_lib;
 	omx_pkt_type_handler[OMX_PKT_TYPE_NACK_MCP] = omx_recv_nack_mcp;
+	omx_pkt_type_handler[OMX_PKT_TYPE_AGGREGATE] = omx_recv_aggregate;
 
 	omx_pkt_type_hdr_len[OMX_PKT_TYPE_RAW] += 0; /* only user-space will dereference more than omx_pkt_head */
 	omx_pkt_type_hdr_len[OMX_PKT_TYPE_HOST_QUERY] += sizeof(struct omx_pkt_host_query);
@@ -1034,6 +1330,7 @@ omx_pkt_types_init(void)
 	omx_pkt_type_hdr_len[OMX_PKT_TYPE_NOTIFY] += sizeof(struct omx_pkt_notify);
 	omx_pkt_type_hdr_len[OMX_PKT_TYPE_NACK_LIB] += sizeof(struct omx_pkt_nack_lib);
 	omx_pkt_type_hdr_len[OMX_PKT_TYPE_NACK_MCP] += sizeof(struct omx_pkt_nack_mcp);
+	omx_pkt_type_hdr_len[OMX_PKT_TYPE_AGGREGATE] += sizeof(struct omx_pkt_aggregate);
 
 	/* make sure the packet is always large enough to contain the required headers */
 	BUILD_BUG_ON(sizeof(struct omx_hdr) > ETH_ZLEN);
@@ -1043,11 +1340,10 @@ omx_pkt_types_init(void)
  * Main receive routine
  */
 
-static int
-omx_recv(struct sk_buff *skb, struct net_device *ifp, struct packet_type *pt,
-	  struct net_device *orig_dev)
+/* process one packet once its iface has been found */
+static INLINE void
+omx_recv_one(struct omx_iface *iface, struct sk_buff *skb, struct net_device *ifp)
 {
-	struct omx_iface *iface;
 	struct omx_hdr linear_header;
 	struct omx_hdr *mh;
 	omx_packet_type_t ptype;
@@ -1056,12 +1352,11 @@ omx_recv(struct sk_buff *skb, struct net_device *ifp, struct packet_type *pt,
 
 	skb = skb_share_check(skb, GFP_ATOMIC);
 	if (unlikely(skb == NULL))
-		return 0;
+		return;
 
 	/* len doesn't include header */
 	skb_push(skb, ETH_HLEN);
 
-	iface = omx_iface_find_by_ifp(ifp);
 	if (unlikely(!iface)) {
 		/* at least the ethhdr is linear in the skb */
 		omx_drop_dprintk(&omx_skb_mac_header(skb)->head.eth, "packet on non-Open-MX interface %s",
@@ -1120,12 +1415,59 @@ omx_recv(struct sk_buff *skb, struct net_device *ifp, struct packet_type *pt,
 	omx_pkt_type_handler[ptype](iface, mh, skb);
 
  out:
+	return;
+}
+
+static int
+omx_recv(struct sk_buff *skb, struct net_device *ifp, struct packet_type *pt,
+	  struct net_device *orig_dev)
+{
+	omx_recv_one(omx_iface_find_by_ifp(ifp), skb, ifp);
 	return 0;
 }
 
+#ifdef OMX_HAVE_PACKET_TYPE_LIST_FUNC
+/*
+ * Process a whole list of packets received during the same NAPI poll.
+ * The iface is only looked up when the device changes, and event
+ * wakeups are deferred so that each endpoint is woken up only once
+ * at the end of the list.
+ */
+static void
+omx_recv_list(struct list_head *head, struct packet_type *pt,
+	      struct net_device *orig_dev)
+{
+	struct sk_buff *skb, *next;
+	struct net_device *ifp = NULL;
+	struct omx_iface *iface = NULL;
+
+	omx_recv_burst_start();
+
+	list_for_each_entry_safe(skb, next, head, list) {
+		/* unlink the skb since handlers may queue it somewhere else */
+		list_del(&skb->list);
+		skb->next = NULL;
+
+		if (skb->dev != ifp) {
+			ifp = skb->dev;
+			iface = omx_iface_find_by_ifp(ifp);
+			if (likely(iface))
+				omx_counter_inc(iface, RECV_LIST);
+		}
+
+		omx_recv_one(iface, skb, ifp);
+	}
+
+	omx_recv_burst_end();
+}
+#endif /* OMX_HAVE_PACKET_TYPE_LIST_FUNC */
+
 struct packet_type omx_pt = {
 	.type = __constant_htons(ETH_P_OMX),
 	.func = omx_recv,
+#ifdef OMX_HAVE_PACKET_TYPE_LIST_FUNC
+	.list_func = omx_recv_list,
+#endif
 };
 
 /*
@@ -24,6 +24,7 @@
 #include <linux/spinlock.h>
 #include <linux/rcupdate.h>
 #include <linux/hardirq.h>
+#include <linux/log2.h>
 
 #include "omx_hal.h"
 #include "omx_io.h"
@@ -45,6 +46,29 @@
 
 #define OMX_REGION_VMALLOC_NR_PAGES_THRESHOLD 4096
 
+#ifdef OMX_HAVE_HUGE_PAGE_PINNING
+/*
+ * Return the huge page shift if the whole segment is in a single hugetlb mapping,
+ * so that it is pinned and manipulated one huge page at a time.
+ */
+static unsigned
+omx_user_region_segment_find_page_shift(unsigned long vaddr, unsigned long len)
+{
+	struct mm_struct *mm = current->mm;
+	struct vm_area_struct *vma;
+	unsigned shift = PAGE_SHIFT;
+
+	down_read(&mm->mmap_sem);
+	vma = find_vma(mm, vaddr);
+	if (vma && vma->vm_start <= vaddr && vaddr + len <= vma->vm_end
+	    && is_vm_hugetlb_page(vma))
+		shift = ilog2(vma_kernel_pagesize(vma));
+	up_read(&mm->mmap_sem);
+
+	return shift;
+}
+#endif
+
 static int
 omx_user_region_add_segment(const struct omx_cmd_user_segment * useg,
 			    struct omx_user_region_segment * segment)
@@ -56,12 +80,18 @@ omx_user_region_add_segment(const struct omx_cmd_user_segment * useg,
 	unsigned long aligned_vaddr;
 	unsigned long aligned_len;
 	unsigned long nr_pages;
+	unsigned page_shift = PAGE_SHIFT;
 	int ret;
 
-	offset = usegvaddr & (~PAGE_MASK);
-	aligned_vaddr = usegvaddr & PAGE_MASK;
-	aligned_len = PAGE_ALIGN(offset + useglen);
-	nr_pages = aligned_len >> PAGE_SHIFT;
+#ifdef OMX_HAVE_HUGE_PAGE_PINNING
+	page_shift = omx_user_region_segment_find_page_shift(usegvaddr, useglen);
+	segment->page_shift = page_shift;
+#endif
+
+	offset = usegvaddr & ((1UL << page_shift) - 1);
+	aligned_vaddr = usegvaddr - offset;
+	aligned_len = ALIGN(offset + useglen, 1UL << page_shift);
+	nr_pages = aligned_len >> page_shift;
 
 	if (nr_pages > OMX_REGION_VMALLOC_NR_PAGES_THRESHOLD) {
 		pages = vmalloc(nr_pages * sizeof(struct page *));
@@ -152,14 +182,49 @@ omx__user_region_pin_new_segment(struct omx_user_region_pin_state *pinstate)
 	pinstate->chunk_offset = segment->first_page_offset;
 }
 
+#ifdef OMX_HAVE_HUGE_PAGE_PINNING
+/*
+ * Pin huge pages one at a time, only keeping a reference on the page
+ * that starts each of them, and make sure the mapping still uses huge pages.
+ */
+static int
+omx__user_region_pin_huge_pages(unsigned long aligned_vaddr, int nr_pages,
+				unsigned page_shift, struct page **pages)
+{
+	int i;
+
+	for(i=0; i<nr_pages; i++) {
+		struct page *page;
+		int ret;
+
+		ret = omx_get_user_pages_fast(aligned_vaddr + ((unsigned long) i << page_shift), 1, 1, &page);
+		if (unlikely(ret != 1))
+			return i ? i : ret;
+
+		if (unlikely(!PageCompound(page)
+			     || compound_order(compound_head(page)) + PAGE_SHIFT < page_shift)) {
+			/* the segment was remapped with smaller pages since it was created */
+			put_page(page);
+			return i;
+		}
+
+		pages[i] = page;
+	}
+
+	return nr_pages;
+}
+#endif
+
 static int
 omx__user_region_pin_add_chunk(struct omx_user_region_pin_state *pinstate)
 {
 	struct omx_user_region *region = pinstate->region;
 	struct omx_user_region_segment *seg = pinstate->segment;
+	unsigned page_shift = omx_user_region_segment_page_shift(seg);
 	unsigned long aligned_vaddr;
 	struct page ** pages;
 	unsigned long remaining;
+	unsigned long chunk_max;
 	int chunk_offset;
 	int chunk_length;
 	int chunk_pages;
@@ -182,16 +247,22 @@ omx__user_region_pin_add_chunk(struct omx_user_region_pin_state *pinstate)
 		pinstate->next_chunk_pages = next_chunk_pages;
 	}
 
-	/* compute the corresponding length */
-	if (chunk_offset + remaining <= chunk_pages<<PAGE_SHIFT)
+	/* compute the corresponding length, made of entire segment pages */
+	chunk_max = ALIGN((unsigned long) chunk_pages << PAGE_SHIFT, 1UL << page_shift);
+	if (chunk_offset + remaining <= chunk_max)
 		chunk_length = remaining;
 	else
-		chunk_length = (chunk_pages<<PAGE_SHIFT) - chunk_offset;
+		chunk_length = chunk_max - chunk_offset;
 
 	/* compute the actual corresponding number of pages to pin */
-	chunk_pages = (chunk_offset + chunk_length + PAGE_SIZE-1) >> PAGE_SHIFT;
+	chunk_pages = (chunk_offset + chunk_length + (1UL << page_shift)-1) >> page_shift;
 
-	ret = omx_get_user_pages_fast(aligned_vaddr, chunk_pages, 1, pages);
+#ifdef OMX_HAVE_HUGE_PAGE_PINNING
+	if (page_shift != PAGE_SHIFT)
+		ret = omx__user_region_pin_huge_pages(aligned_vaddr, chunk_pages, page_shift, pages);
+	else
+#endif
+		ret = omx_get_user_pages_fast(aligned_vaddr, chunk_pages, 1, pages);
 	if (unlikely(ret != chunk_pages)) {
 		printk(KERN_ERR "Open-MX: Failed to pin user buffer (%d pages at 0x%lx), get_user_pages returned %d\n",
 		       chunk_pages, aligned_vaddr, ret);
@@ -349,6 +420,7 @@ omx_ioctl_user_region_create(struct omx_endpoint * endpoint,
 	/* mark the region as non-registered yet */
 	region->status = OMX_USER_REGION_STATUS_NOT_PINNED;
 	region->total_registered_length = 0;
+	skb_queue_head_init(&region->deferred_pull_requests);
 
 	if (omx_pin_synchronous) {
 		/* pin the region */
@@ -413,6 +485,9 @@ __omx_user_region_last_release(struct kref * kref)
 	dprintk(KREF, "releasing the last reference on region %p\n",
 		region);
 
+	/* drop the pull requests that were still waiting for pinning */
+	skb_queue_purge(&region->deferred_pull_requests);
+
 	if (region->nr_vmalloc_segments && in_interrupt()) {
 		OMX_INIT_WORK(&region->destroy_work, omx_region_destroy_workfunc, region);
 		schedule_work(&region->destroy_work);
@@ -688,6 +763,7 @@ omx_user_region_offset_cache_contig_append_callback(struct omx_user_region_offse
 	unsigned long remaining = length;
 	struct page ** page = cache->page;
 	unsigned pageoff = cache->pageoff;
+	unsigned long pagesize = 1UL << omx_user_region_segment_page_shift(cache->seg);
 	int frags = 0;
 
 #ifdef OMX_DRIVER_DEBUG
@@ -703,8 +779,8 @@ omx_user_region_offset_cache_contig_append_callback(struct omx_user_region_offse
 
 		/* compute the chunk size */
 		chunk = remaining;
-		if (chunk > PAGE_SIZE - pageoff)
-			chunk = PAGE_SIZE - pageoff;
+		if (chunk > pagesize - pageoff)
+			chunk = pagesize - pageoff;
 
 		/* append the page */
 		get_page(*page);
@@ -715,7 +791,7 @@ omx_user_region_offset_cache_contig_append_callback(struct omx_user_region_offse
 		frags++;
 		remaining -= chunk;
 
-		if (pageoff + chunk == PAGE_SIZE) {
+		if (pageoff + chunk == pagesize) {
 			/* next page */
 			page++;
 			pageoff = 0;
@@ -750,6 +826,7 @@ omx_user_region_offset_cache_vect_append_callback(struct omx_user_region_offset_
 	unsigned long seglen = seg->length;
 	struct page ** page = cache->page;
 	unsigned pageoff = cache->pageoff;
+	unsigned long pagesize = 1UL << omx_user_region_segment_page_shift(cache->seg);
 	int frags = 0;
 
 #ifdef OMX_DRIVER_DEBUG
@@ -765,8 +842,8 @@ omx_user_region_offset_cache_vect_append_callback(struct omx_user_region_offset_
 
 		/* compute the chunk size */
 		chunk = remaining;
-		if (chunk > PAGE_SIZE - pageoff)
-			chunk = PAGE_SIZE - pageoff;
+		if (chunk > pagesize - pageoff)
+			chunk = pagesize - pageoff;
 		if (chunk > seglen - segoff)
 			chunk = seglen - segoff;
 
@@ -789,12 +866,13 @@ omx_user_region_offset_cache_vect_append_callback(struct omx_user_region_offset_
 				BUG_ON(remaining != 0);
 			} else {
 				seglen = seg->length;
+				pagesize = 1UL << omx_user_region_segment_page_shift(seg);
 				page = &seg->pages[0];
 				pageoff = seg->first_page_offset;
 				dprintk(REG, "switching offset cache to next segment #%ld\n",
 					(unsigned long) (seg - &region->segments[0]));
 			}
-		} else if (pageoff + chunk == PAGE_SIZE) {
+		} else if (pageoff + chunk == pagesize) {
 			/* next page in same segment */
 			segoff += chunk;
 			page++;
@@ -829,6 +907,7 @@ omx_user_region_offset_cache_contig_copy_callback(struct omx_user_region_offset_
 	unsigned long remaining = length;
 	struct page ** page = cache->page;
 	unsigned pageoff = cache->pageoff;
+	unsigned long pagesize = 1UL << omx_user_region_segment_page_shift(cache->seg);
 
 #ifdef OMX_DRIVER_DEBUG
 	BUG_ON(cache->current_offset + length > cache->max_offset);
@@ -840,8 +919,8 @@ omx_user_region_offset_cache_contig_copy_callback(struct omx_user_region_offset_
 
 		/* compute the chunk size */
 		chunk = remaining;
-		if (chunk > PAGE_SIZE - pageoff)
-			chunk = PAGE_SIZE - pageoff;
+		if (chunk > pagesize - pageoff)
+			chunk = pagesize - pageoff;
 
 		/* append the page */
 		kpaddr = omx_kmap_atomic(*page, KM_SKB_DATA_SOFTIRQ);
@@ -853,7 +932,7 @@ omx_user_region_offset_cache_contig_copy_callback(struct omx_user_region_offset_
 		remaining -= chunk;
 		buffer += chunk;
 
-		if (pageoff + chunk == PAGE_SIZE) {
+		if (pageoff + chunk == pagesize) {
 			/* next page */
 			page++;
 			pageoff = 0;
@@ -884,6 +963,7 @@ omx_user_region_offset_cache_vect_copy_callback(struct omx_user_region_offset_ca
 	unsigned long seglen = seg->length;
 	struct page ** page = cache->page;
 	unsigned pageoff = cache->pageoff;
+	unsigned long pagesize = 1UL << omx_user_region_segment_page_shift(cache->seg);
 
 #ifdef OMX_DRIVER_DEBUG
 	BUG_ON(cache->current_offset + length > cache->max_offset);
@@ -895,8 +975,8 @@ omx_user_region_offset_cache_vect_copy_callback(struct omx_user_region_offset_ca
 
 		/* compute the chunk size */
 		chunk = remaining;
-		if (chunk > PAGE_SIZE - pageoff)
-			chunk = PAGE_SIZE - pageoff;
+		if (chunk > pagesize - pageoff)
+			chunk = pagesize - pageoff;
 		if (chunk > seglen - segoff)
 			chunk = seglen - segoff;
 
@@ -920,12 +1000,13 @@ omx_user_region_offset_cache_vect_copy_callback(struct omx_user_region_offset_ca
 				BUG_ON(remaining != 0);
 			} else {
 				seglen = seg->length;
+				pagesize = 1UL << omx_user_region_segment_page_shift(seg);
 				page = &seg->pages[0];
 				pageoff = seg->first_page_offset;
 				dprintk(REG, "switching offset cache to next segment #%ld\n",
 					(unsigned long) (seg - &region->segments[0]));
 			}
-		} else if (pageoff + chunk == PAGE_SIZE) {
+		} else if (pageoff + chunk == pagesize) {
 			/* next page in same segment */
 			segoff += chunk;
 			page++;
@@ -962,6 +1043,7 @@ omx_user_region_offset_cache_dma_contig_memcpy_from_buf_callback(struct omx_user
 	unsigned long remaining = length;
 	struct page ** page = cache->page;
 	unsigned pageoff = cache->pageoff;
+	unsigned long pagesize = 1UL << omx_user_region_segment_page_shift(cache->seg);
 
 #ifdef OMX_DRIVER_DEBUG
 	BUG_ON(cache->current_offset + length > cache->max_offset);
@@ -973,8 +1055,8 @@ omx_user_region_offset_cache_dma_contig_memcpy_from_buf_callback(struct omx_user
 
 		/* compute the chunk size */
 		chunk = remaining;
-		if (chunk > PAGE_SIZE - pageoff)
-			chunk = PAGE_SIZE - pageoff;
+		if (chunk > pagesize - pageoff)
+			chunk = pagesize - pageoff;
 
 		/* append the page */
 		cookie = dma_async_memcpy_buf_to_pg(chan,
@@ -991,7 +1073,7 @@ omx_user_region_offset_cache_dma_contig_memcpy_from_buf_callback(struct omx_user
 		remaining -= chunk;
 		buffer += chunk;
 
-		if (pageoff + chunk == PAGE_SIZE) {
+		if (pageoff + chunk == pagesize) {
 			/* next page */
 			page++;
 			pageoff = 0;
@@ -1032,6 +1114,7 @@ omx_user_region_offset_cache_dma_vect_memcpy_from_buf_callback(struct omx_user_r
 	unsigned long seglen = seg->length;
 	struct page ** page = cache->page;
 	unsigned pageoff = cache->pageoff;
+	unsigned long pagesize = 1UL << omx_user_region_segment_page_shift(cache->seg);
 
 #ifdef OMX_DRIVER_DEBUG
 	BUG_ON(cache->current_offset + length > cache->max_offset);
@@ -1043,8 +1126,8 @@ omx_user_region_offset_cache_dma_vect_memcpy_from_buf_callback(struct omx_user_r
 
 		/* compute the chunk size */
 		chunk = remaining;
-		if (chunk > PAGE_SIZE - pageoff)
-			chunk = PAGE_SIZE - pageoff;
+		if (chunk > pagesize - pageoff)
+			chunk = pagesize - pageoff;
 		if (chunk > seglen - segoff)
 			chunk = seglen - segoff;
 
@@ -1073,12 +1156,13 @@ omx_user_region_offset_cache_dma_vect_memcpy_from_buf_callback(struct omx_user_r
 				BUG_ON(remaining != 0);
 			} else {
 				seglen = seg->length;
+				pagesize = 1UL << omx_user_region_segment_page_shift(seg);
 				page = &seg->pages[0];
 				pageoff = seg->first_page_offset;
 				dprintk(REG, "switching offset cache to next segment #%ld\n",
 					(unsigned long) (seg - &region->segments[0]));
 			}
-		} else if (pageoff + chunk == PAGE_SIZE) {
+		} else if (pageoff + chunk == pagesize) {
 			/* next page in same segment */
 			segoff += chunk;
 			page++;
@@ -1118,6 +1202,7 @@ omx_user_region_offset_cache_dma_contig_memcpy_from_pg_callback(struct omx_user_
 	unsigned long remaining = length;
 	struct page ** page = cache->page;
 	unsigned pageoff = cache->pageoff;
+	unsigned long pagesize = 1UL << omx_user_region_segment_page_shift(cache->seg);
 
 #ifdef OMX_DRIVER_DEBUG
 	BUG_ON(cache->current_offset + length > cache->max_offset);
@@ -1129,8 +1214,8 @@ omx_user_region_offset_cache_dma_contig_memcpy_from_pg_callback(struct omx_user_
 
 		/* compute the chunk size */
 		chunk = remaining;
-		if (chunk > PAGE_SIZE - pageoff)
-			chunk = PAGE_SIZE - pageoff;
+		if (chunk > pagesize - pageoff)
+			chunk = pagesize - pageoff;
 
 		/* append the page */
 		cookie = dma_async_memcpy_pg_to_pg(chan,
@@ -1147,7 +1232,7 @@ omx_user_region_offset_cache_dma_contig_memcpy_from_pg_callback(struct omx_user_
 		remaining -= chunk;
 		skbpgoff += chunk;
 
-		if (pageoff + chunk == PAGE_SIZE) {
+		if (pageoff + chunk == pagesize) {
 			/* next page */
 			page++;
 			pageoff = 0;
@@ -1188,6 +1273,7 @@ omx_user_region_offset_cache_dma_vect_memcpy_from_pg_callback(struct omx_user_re
 	unsigned long seglen = seg->length;
 	struct page ** page = cache->page;
 	unsigned pageoff = cache->pageoff;
+	unsigned long pagesize = 1UL << omx_user_region_segment_page_shift(cache->seg);
 
 #ifdef OMX_DRIVER_DEBUG
 	BUG_ON(cache->current_offset + length > cache->max_offset);
@@ -1199,8 +1285,8 @@ omx_user_region_offset_cache_dma_vect_memcpy_from_pg_callback(struct omx_user_re
 
 		/* compute the chunk size */
 		chunk = remaining;
-		if (chunk > PAGE_SIZE - pageoff)
-			chunk = PAGE_SIZE - pageoff;
+		if (chunk > pagesize - pageoff)
+			chunk = pagesize - pageoff;
 		if (chunk > seglen - segoff)
 			chunk = seglen - segoff;
 
@@ -1229,12 +1315,13 @@ omx_user_region_offset_cache_dma_vect_memcpy_from_pg_callback(struct omx_user_re
 				BUG_ON(remaining != 0);
 			} else {
 				seglen = seg->length;
+				pagesize = 1UL << omx_user_region_segment_page_shift(seg);
 				page = &seg->pages[0];
 				pageoff = seg->first_page_offset;
 				dprintk(REG, "switching offset cache to next segment #%ld\n",
 					(unsigned long) (seg - &region->segments[0]));
 			}
-		} else if (pageoff + chunk == PAGE_SIZE) {
+		} else if (pageoff + chunk == pagesize) {
 			/* next page in same segment */
 			segoff += chunk;
 			page++;
@@ -1278,6 +1365,7 @@ omx_user_region_offset_cache_init(struct omx_user_region *region,
 {
 	struct omx_user_region_segment *seg;
 	unsigned long segoff;
+	unsigned page_shift;
 
 	if (unlikely(!region->nr_segments || offset + length > region->total_length))
 		return -1;
@@ -1322,8 +1410,9 @@ omx_user_region_offset_cache_init(struct omx_user_region *region,
 	cache->segoff = segoff;
 
 	/* find the page and offset */
-	cache->page = &seg->pages[(segoff + seg->first_page_offset) >> PAGE_SHIFT];
-	cache->pageoff = (segoff + seg->first_page_offset) & (~PAGE_MASK);
+	page_shift = omx_user_region_segment_page_shift(seg);
+	cache->page = &seg->pages[(segoff + seg->first_page_offset) >> page_shift];
+	cache->pageoff = (segoff + seg->first_page_offset) & ((1UL << page_shift) - 1);
 
 	dprintk(REG, "initialized region offset cache to seg #%ld offset %ld page #%ld offset %d\n",
 		(unsigned long) (seg - &region->segments[0]), segoff,
@@ -1350,15 +1439,16 @@ omx__user_region_segment_fill_pages(const struct omx_user_region_segment * segme
 {
 	unsigned long copied = 0;
 	unsigned long remaining = length;
-	unsigned long first_page = (segment_offset+segment->first_page_offset)>>PAGE_SHIFT;
-	unsigned long page_offset = (segment_offset+segment->first_page_offset) & (PAGE_SIZE-1);
+	unsigned page_shift = omx_user_region_segment_page_shift(segment);
+	unsigned long first_page = (segment_offset+segment->first_page_offset)>>page_shift;
+	unsigned long page_offset = (segment_offset+segment->first_page_offset) & ((1UL << page_shift)-1);
 	unsigned long i;
 
 	for(i=first_page; ; i++) {
 		void *kvaddr;
 
 		/* compute chunk to take in this page */
-		unsigned long chunk = PAGE_SIZE-page_offset;
+		unsigned long chunk = (1UL << page_shift)-page_offset;
 		if (unlikely(chunk > remaining))
 			chunk = remaining;
 
@@ -1464,6 +1554,7 @@ omx_memcpy_between_user_regions_to_current(struct omx_user_region * src_region,
 	unsigned long ssegoff, dsegoff; /* current offset in current segment */
 	struct page **spage; /* current page */
 	unsigned int spageoff; /* current offset in current page */
+	unsigned long spagesize; /* size of pages in current segment */
 	void *spageaddr; /* current page mapping */
 	void __user *dvaddr; /* current user-space virtual address */
 	unsigned long spinlen; /* currently pinned length in region */
@@ -1483,8 +1574,9 @@ omx_memcpy_between_user_regions_to_current(struct omx_user_region * src_region,
 	}
 	soff = src_offset;
 	ssegoff = src_offset - tmp;
-	spage = &sseg->pages[(ssegoff + sseg->first_page_offset) >> PAGE_SHIFT];
-	spageoff = (ssegoff + sseg->first_page_offset) & (~PAGE_MASK);
+	spagesize = 1UL << omx_user_region_segment_page_shift(sseg);
+	spage = &sseg->pages[(ssegoff + sseg->first_page_offset) / spagesize];
+	spageoff = (ssegoff + sseg->first_page_offset) & (spagesize - 1);
 	spinlen = 0;
 
 	/* initialize the dst state */
@@ -1500,8 +1592,8 @@ omx_memcpy_between_user_regions_to_current(struct omx_user_region * src_region,
 	while (1) {
 		/* compute the chunk size */
 		unsigned chunk = remaining;
-		if (chunk > PAGE_SIZE - spageoff)
-			chunk = PAGE_SIZE - spageoff;
+		if (chunk > spagesize - spageoff)
+			chunk = spagesize - spageoff;
 		if (chunk > sseglen - ssegoff)
 			chunk = sseglen - ssegoff;
 		if (chunk > dseglen - dsegoff)
@@ -1539,9 +1631,10 @@ omx_memcpy_between_user_regions_to_current(struct omx_user_region * src_region,
 			dprintk(REG, "shared region copy switching to source seg %ld len %ld, %ld remaining\n",
 				(unsigned long) (sseg-&src_region->segments[0]), sseglen, remaining);
 			ssegoff = 0;
+			spagesize = 1UL << omx_user_region_segment_page_shift(sseg);
 			spage = &sseg->pages[0];
 			spageoff = sseg->first_page_offset;
-		} else if (spageoff + chunk == PAGE_SIZE) {
+		} else if (spageoff + chunk == spagesize) {
 			/* next page */
 			ssegoff += chunk;
 			spage++;
@@ -1585,6 +1678,7 @@ omx_dma_copy_between_user_regions(struct omx_user_region * src_region, unsigned
 	unsigned long ssegoff, dsegoff; /* current offset in current segment */
 	struct page **spage, **dpage; /* current page */
 	unsigned int spageoff, dpageoff; /* current offset in current page */
+	unsigned long spagesize, dpagesize; /* size of pages in current segment */
 	unsigned long spinlen, dpinlen; /* currently pinned length in region */
 	struct omx_user_region_pin_state dpinstate;
 	struct dma_chan *dma_chan = NULL;
@@ -1620,8 +1714,9 @@ omx_dma_copy_between_user_regions(struct omx_user_region * src_region, unsigned
 	}
 	soff = src_offset;
 	ssegoff = src_offset - tmp;
-	spage = &sseg->pages[(ssegoff + sseg->first_page_offset) >> PAGE_SHIFT];
-	spageoff = (ssegoff + sseg->first_page_offset) & (~PAGE_MASK);
+	spagesize = 1UL << omx_user_region_segment_page_shift(sseg);
+	spage = &sseg->pages[(ssegoff + sseg->first_page_offset) / spagesize];
+	spageoff = (ssegoff + sseg->first_page_offset) & (spagesize - 1);
 	spinlen = 0;
 
 	/* initialize the dst state */
@@ -1633,20 +1728,21 @@ omx_dma_copy_between_user_regions(struct omx_user_region * src_region, unsigned
 	}
 	doff = dst_offset;
 	dsegoff = dst_offset - tmp;
-	dpage = &dseg->pages[(dsegoff + dseg->first_page_offset) >> PAGE_SHIFT];
-	dpageoff = (dsegoff + dseg->first_page_offset) & (~PAGE_MASK);
+	dpagesize = 1UL << omx_user_region_segment_page_shift(dseg);
+	dpage = &dseg->pages[(dsegoff + dseg->first_page_offset) / dpagesize];
+	dpageoff = (dsegoff + dseg->first_page_offset) & (dpagesize - 1);
 	dpinlen = 0;
 
 	while (1) {
 		dma_cookie_t cookie;
 		/* compute the chunk size */
 		unsigned chunk = remaining;
-		if (chunk > PAGE_SIZE - spageoff)
-			chunk = PAGE_SIZE - spageoff;
+		if (chunk > spagesize - spageoff)
+			chunk = spagesize - spageoff;
 		if (chunk > sseglen - ssegoff)
 			chunk = sseglen - ssegoff;
-		if (chunk > PAGE_SIZE - dpageoff)
-			chunk = PAGE_SIZE - dpageoff;
+		if (chunk > dpagesize - dpageoff)
+			chunk = dpagesize - dpageoff;
 		if (chunk > dseglen - dsegoff)
 			chunk = dseglen - dsegoff;
 
@@ -1698,9 +1794,10 @@ omx_dma_copy_between_user_regions(struct omx_user_region * src_region, unsigned
 			dprintk(REG, "shared region copy switching to source seg %ld len %ld, %ld remaining\n",
 				(unsigned long) (sseg-&src_region->segments[0]), sseglen, remaining);
 			ssegoff = 0;
+			spagesize = 1UL << omx_user_region_segment_page_shift(sseg);
 			spage = &sseg->pages[0];
 			spageoff = sseg->first_page_offset;
-		} else if (spageoff + chunk == PAGE_SIZE) {
+		} else if (spageoff + chunk == spagesize) {
 			/* next page */
 			ssegoff += chunk;
 			spage++;
@@ -1719,9 +1816,10 @@ omx_dma_copy_between_user_regions(struct omx_user_region * src_region, unsigned
 			dprintk(REG, "shared region copy switching to dest seg %ld len %ld, %ld remaining\n",
 				(unsigned long) (dseg-&dst_region->segments[0]), dseglen, remaining);
 			dsegoff = 0;
+			dpagesize = 1UL << omx_user_region_segment_page_shift(dseg);
 			dpage = &dseg->pages[0];
 			dpageoff = dseg->first_page_offset;
-		} else if (dpageoff + chunk == PAGE_SIZE) {
+		} else if (dpageoff + chunk == dpagesize) {
 			/* next page */
 			dsegoff += chunk;
 			dpage++;
@@ -22,13 +22,13 @@
 #include <linux/spinlock.h>
 #include <linux/kref.h>
 #include <linux/rcupdate.h>
+#include <linux/skbuff.h>
 #include <asm/processor.h>
 
 #include "omx_common.h"
 #include "omx_hal.h"
 
 struct omx_endpoint;
-struct sk_buff;
 
 enum omx_user_region_status {
 	OMX_USER_REGION_STATUS_NOT_PINNED,
@@ -53,6 +53,9 @@ struct omx_user_region {
 	enum omx_user_region_status status;
 	unsigned long total_registered_length;
 
+	/* pull requests waiting for demand-pinning to cover their block */
+	struct sk_buff_head deferred_pull_requests;
+
 	struct omx_user_region_segment {
 		unsigned long aligned_vaddr;
 		unsigned first_page_offset;
@@ -60,10 +63,24 @@ struct omx_user_region {
 		unsigned long nr_pages;
 		unsigned long pinned_pages;
 		int vmalloced;
+#ifdef OMX_HAVE_HUGE_PAGE_PINNING
+		unsigned page_shift; /* PAGE_SHIFT, or the huge page shift of hugetlb segments */
+#endif
 		struct page ** pages;
 	} segments[0];
 };
 
+/* pages[] entries are huge pages in hugetlb segments, aligned_vaddr and first_page_offset follow */
+static inline unsigned
+omx_user_region_segment_page_shift(const struct omx_user_region_segment *segment)
+{
+#ifdef OMX_HAVE_HUGE_PAGE_PINNING
+	return segment->page_shift;
+#else
+	return PAGE_SHIFT;
+#endif
+}
+
 struct omx_user_region_offset_cache {
 	/* current segment and its offset */
 	struct omx_user_region_segment *seg;
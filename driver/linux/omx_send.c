@@ -22,6 +22,7 @@
 #include <linux/skbuff.h>
 #include <linux/slab.h>
 #include <linux/mm.h>
+#include <linux/kthread.h>
 
 #include "omx_misc.h"
 #include "omx_hal.h"
@@ -90,29 +91,59 @@ omx_new_skb(unsigned long len)
  *
  * When we need to wait for the skb to be completely sent before releasing
  * the resources, we use a skb destructor callback.
+ * Each skb using the sendq pages holds a reference on the deferred event,
+ * the command holds another one until it is done building its skbs,
+ * the event is reported when the last reference is dropped.
  */
 
 struct omx_deferred_event {
 	struct omx_endpoint *endpoint;
-	struct omx_evt_send_mediumsq_frag_done evt;
+	atomic_t refcount;
+	int cancelled;
+	union omx_evt evt;
 };
 
-/* medium frag skb destructor to release sendq pages */
 static void
-omx_medium_frag_skb_destructor(struct sk_buff *skb)
+omx_deferred_event_put(struct omx_deferred_event *defevent)
 {
-	struct omx_deferred_event * defevent = omx_get_skb_destructor_data(skb);
 	struct omx_endpoint * endpoint = defevent->endpoint;
 
-	/* report the event to user-space */
-	omx_notify_exp_event(endpoint,
-			     &defevent->evt, sizeof(defevent->evt));
+	if (!atomic_dec_and_test(&defevent->refcount))
+		return;
+
+	/* report the event to user-space, unless the command failed */
+	if (likely(!defevent->cancelled))
+		omx_notify_exp_event(endpoint,
+				     &defevent->evt, sizeof(defevent->evt));
 
 	/* release objects now */
 	omx_endpoint_release(endpoint);
 	kfree(defevent);
 }
 
+/* medium frag skb destructor to release sendq pages */
+static void
+omx_medium_frag_skb_destructor(struct sk_buff *skb)
+{
+	omx_deferred_event_put(omx_get_skb_destructor_data(skb));
+}
+
+/* report the send done event once all skbs are done with the sendq pages */
+static void
+omx_deferred_event_commit(struct omx_endpoint *endpoint,
+			  struct omx_deferred_event *defevent,
+			  const union omx_evt *evt)
+{
+	if (defevent) {
+		/* some skbs still use the sendq pages, the last destructor will notify */
+		memcpy(&defevent->evt, evt, sizeof(*evt));
+		omx_deferred_event_put(defevent);
+	} else {
+		/* everything was copied in linear skbs, notify right now */
+		omx_notify_exp_event(endpoint, evt, sizeof(*evt));
+	}
+}
+
 /*********************
  * Main send routines
  */
@@ -194,6 +225,8 @@ omx_ioctl_send_connect_request(struct omx_endpoint * endpoint,
 	OMX_HTON_32(connect_n->request.app_key, cmd.app_key);
 	OMX_HTON_16(connect_n->request.target_recv_seqnum_start, cmd.target_recv_seqnum_start);
 	OMX_HTON_8(connect_n->request.connect_seqnum, cmd.connect_seqnum);
+	OMX_HTON_8(connect_n->request.features, cmd.features);
+	OMX_HTON_16(connect_n->request.features_magic, OMX_PKT_CONNECT_FEATURES_MAGIC);
 
 	omx_queue_xmit(iface, skb, CONNECT_REQUEST);
 
@@ -273,6 +306,8 @@ omx_ioctl_send_connect_reply(struct omx_endpoint * endpoint,
 	OMX_HTON_16(connect_n->reply.target_recv_seqnum_start, cmd.target_recv_seqnum_start);
 	OMX_HTON_8(connect_n->reply.connect_seqnum, cmd.connect_seqnum);
 	OMX_HTON_8(connect_n->reply.connect_status_code, cmd.connect_status_code);
+	OMX_HTON_8(connect_n->reply.features, cmd.features);
+	OMX_HTON_16(connect_n->reply.features_magic, OMX_PKT_CONNECT_FEATURES_MAGIC);
 
 	omx_queue_xmit(iface, skb, CONNECT_REPLY);
 
@@ -284,40 +319,26 @@ omx_ioctl_send_connect_reply(struct omx_endpoint * endpoint,
 	return ret;
 }
 
-int
-omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
-		    void __user * uparam)
+static int omx_aggregate_tiny(struct omx_aggregate * agg, const struct omx_cmd_send_tiny_hdr *cmd, const void *data);
+static int omx_aggregate_small(struct omx_aggregate * agg, const struct omx_cmd_send_small *cmd, const void *data);
+
+/* send a tiny message whose command and data were already read and checked */
+static int
+omx_send_tiny(struct omx_endpoint * endpoint,
+	      const struct omx_cmd_send_tiny_hdr *cmd,
+	      const void *data_src)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
 	struct omx_pkt_head *ph;
 	struct ethhdr *eh;
 	struct omx_pkt_msg *tiny_n;
-	struct omx_cmd_send_tiny_hdr cmd;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
 	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_msg);
 	char * data;
 	int ret;
-	uint8_t length;
-
-	ret = copy_from_user(&cmd, &((struct omx_cmd_send_tiny __user *) uparam)->hdr, sizeof(cmd));
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd hdr\n");
-		ret = -EFAULT;
-		goto out;
-	}
-
-	length = cmd.length;
-	if (unlikely(length > OMX_TINY_MSG_LENGTH_MAX)) {
-		printk(KERN_ERR "Open-MX: Cannot send more than %d as a tiny (tried %d)\n",
-		       OMX_TINY_MSG_LENGTH_MAX, length);
-		ret = -EINVAL;
-		goto out;
-	}
-
-	if (unlikely(cmd.shared))
-		return omx_shared_send_tiny(endpoint, &cmd, &((struct omx_cmd_send_tiny __user *) uparam)->data);
+	uint8_t length = cmd->length;
 
 	skb = omx_new_skb(/* pad to ETH_ZLEN */
 			  max_t(unsigned long, hdr_len + length, ETH_ZLEN));
@@ -340,7 +361,7 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
 
 	/* set destination peer */
-	ret = omx_set_target_peer(ph, iface, cmd.peer_index);
+	ret = omx_set_target_peer(ph, iface, cmd->peer_index);
 	if (ret < 0) {
 		printk(KERN_INFO "Open-MX: Failed to fill target peer in tiny header\n");
 		goto out_with_skb;
@@ -348,24 +369,19 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 
 	/* fill omx header */
 	OMX_HTON_8(tiny_n->src_endpoint, endpoint->endpoint_index);
-	OMX_HTON_8(tiny_n->dst_endpoint, cmd.dest_endpoint);
+	OMX_HTON_8(tiny_n->dst_endpoint, cmd->dest_endpoint);
 	OMX_HTON_8(tiny_n->ptype, OMX_PKT_TYPE_TINY);
 	OMX_HTON_16(tiny_n->length, length);
-	OMX_HTON_16(tiny_n->lib_seqnum, cmd.seqnum);
-	OMX_HTON_16(tiny_n->lib_piggyack, cmd.piggyack);
-	OMX_HTON_32(tiny_n->session, cmd.session_id);
-	OMX_HTON_16(tiny_n->checksum, cmd.checksum);
-	OMX_HTON_MATCH_INFO(tiny_n, cmd.match_info);
+	OMX_HTON_16(tiny_n->lib_seqnum, cmd->seqnum);
+	OMX_HTON_16(tiny_n->lib_piggyack, cmd->piggyack);
+	OMX_HTON_32(tiny_n->session, cmd->session_id);
+	OMX_HTON_16(tiny_n->checksum, cmd->checksum);
+	OMX_HTON_MATCH_INFO(tiny_n, cmd->match_info);
 
 	omx_send_dprintk(eh, "TINY length %ld", (unsigned long) length);
 
 	/* copy the data right after the header */
-	ret = copy_from_user(data, &((struct omx_cmd_send_tiny __user *) uparam)->data, length);
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd data\n");
-		ret = -EFAULT;
-		goto out_with_skb;
-	}
+	memcpy(data, data_src, length);
 
 #ifdef OMX_DRIVER_DEBUG
 	omx_set_skb_destructor(skb, omx_tiny_skb_debug_destructor, (void *) 0x666);
@@ -381,42 +397,69 @@ omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
 	return ret;
 }
 
+/* read a tiny command and send it, or add it to the aggregate if given */
+static int
+__omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
+		      void __user * uparam,
+		      struct omx_aggregate * agg)
+{
+	struct omx_cmd_send_tiny_hdr cmd;
+	char data[OMX_TINY_MSG_LENGTH_MAX];
+	int ret;
+	uint8_t length;
+
+	ret = copy_from_user(&cmd, &((struct omx_cmd_send_tiny __user *) uparam)->hdr, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd hdr\n");
+		return -EFAULT;
+	}
+
+	length = cmd.length;
+	if (unlikely(length > OMX_TINY_MSG_LENGTH_MAX)) {
+		printk(KERN_ERR "Open-MX: Cannot send more than %d as a tiny (tried %d)\n",
+		       OMX_TINY_MSG_LENGTH_MAX, length);
+		return -EINVAL;
+	}
+
+	if (unlikely(cmd.shared))
+		return omx_shared_send_tiny(endpoint, &cmd, &((struct omx_cmd_send_tiny __user *) uparam)->data);
+
+	ret = copy_from_user(data, &((struct omx_cmd_send_tiny __user *) uparam)->data, length);
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send tiny cmd data\n");
+		return -EFAULT;
+	}
+
+	if (agg)
+		return omx_aggregate_tiny(agg, &cmd, data);
+
+	return omx_send_tiny(endpoint, &cmd, data);
+}
+
 int
-omx_ioctl_send_small(struct omx_endpoint * endpoint,
-		     void __user * uparam)
+omx_ioctl_send_tiny(struct omx_endpoint * endpoint,
+		    void __user * uparam)
+{
+	return __omx_ioctl_send_tiny(endpoint, uparam, NULL);
+}
+
+/* send a small message whose command and data were already read and checked */
+static int
+omx_send_small(struct omx_endpoint * endpoint,
+	       const struct omx_cmd_send_small *cmd,
+	       const void *data_src)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
 	struct omx_pkt_head *ph;
 	struct ethhdr *eh;
 	struct omx_pkt_msg *small_n;
-	struct omx_cmd_send_small cmd;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
 	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_msg);
 	char * data;
 	int ret;
-	uint32_t length;
-
-	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send small cmd hdr\n");
-		ret = -EFAULT;
-		goto out;
-	}
-
-	BUILD_BUG_ON(OMX_SMALL_MSG_LENGTH_MAX > OMX_SENDQ_ENTRY_SIZE);
-
-	length = cmd.length;
-	if (unlikely(length > OMX_SMALL_MSG_LENGTH_MAX)) {
-		printk(KERN_ERR "Open-MX: Cannot send more than %d as a small (tried %d)\n",
-		       OMX_SMALL_MSG_LENGTH_MAX, length);
-		ret = -EINVAL;
-		goto out;
-	}
-
-	if (unlikely(cmd.shared))
-		return omx_shared_send_small(endpoint, &cmd);
+	uint32_t length = cmd->length;
 
 	skb = omx_new_skb(/* pad to ETH_ZLEN */
 			  max_t(unsigned long, hdr_len + length, ETH_ZLEN));
@@ -439,7 +482,7 @@ omx_ioctl_send_small(struct omx_endpoint * endpoint,
 	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
 
 	/* set destination peer */
-	ret = omx_set_target_peer(ph, iface, cmd.peer_index);
+	ret = omx_set_target_peer(ph, iface, cmd->peer_index);
 	if (ret < 0) {
 		printk(KERN_INFO "Open-MX: Failed to fill target peer in small header\n");
 		goto out_with_skb;
@@ -447,24 +490,19 @@ omx_ioctl_send_small(struct omx_endpoint * endpoint,
 
 	/* fill omx header */
 	OMX_HTON_8(small_n->src_endpoint, endpoint->endpoint_index);
-	OMX_HTON_8(small_n->dst_endpoint, cmd.dest_endpoint);
+	OMX_HTON_8(small_n->dst_endpoint, cmd->dest_endpoint);
 	OMX_HTON_8(small_n->ptype, OMX_PKT_TYPE_SMALL);
 	OMX_HTON_16(small_n->length, length);
-	OMX_HTON_16(small_n->lib_seqnum, cmd.seqnum);
-	OMX_HTON_16(small_n->lib_piggyack, cmd.piggyack);
-	OMX_HTON_32(small_n->session, cmd.session_id);
-	OMX_HTON_16(small_n->checksum, cmd.checksum);
-	OMX_HTON_MATCH_INFO(small_n, cmd.match_info);
+	OMX_HTON_16(small_n->lib_seqnum, cmd->seqnum);
+	OMX_HTON_16(small_n->lib_piggyack, cmd->piggyack);
+	OMX_HTON_32(small_n->session, cmd->session_id);
+	OMX_HTON_16(small_n->checksum, cmd->checksum);
+	OMX_HTON_MATCH_INFO(small_n, cmd->match_info);
 
 	omx_send_dprintk(eh, "SMALL length %ld", (unsigned long) length);
 
 	/* copy the data right after the header */
-	ret = copy_from_user(data, (__user void *)(unsigned long) cmd.vaddr, length);
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send small cmd data\n");
-		ret = -EFAULT;
-		goto out_with_skb;
-	}
+	memcpy(data, data_src, length);
 
 	omx_queue_xmit(iface, skb, SMALL);
 
@@ -476,59 +514,321 @@ omx_ioctl_send_small(struct omx_endpoint * endpoint,
 	return ret;
 }
 
+/* read a small command and send it, or add it to the aggregate if given */
+static int
+__omx_ioctl_send_small(struct omx_endpoint * endpoint,
+		       void __user * uparam,
+		       struct omx_aggregate * agg)
+{
+	struct omx_cmd_send_small cmd;
+	char data[OMX_SMALL_MSG_LENGTH_MAX];
+	int ret;
+	uint32_t length;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send small cmd hdr\n");
+		return -EFAULT;
+	}
+
+	BUILD_BUG_ON(OMX_SMALL_MSG_LENGTH_MAX > OMX_SENDQ_ENTRY_SIZE);
+
+	length = cmd.length;
+	if (unlikely(length > OMX_SMALL_MSG_LENGTH_MAX)) {
+		printk(KERN_ERR "Open-MX: Cannot send more than %d as a small (tried %d)\n",
+		       OMX_SMALL_MSG_LENGTH_MAX, length);
+		return -EINVAL;
+	}
+
+	if (unlikely(cmd.shared))
+		return omx_shared_send_small(endpoint, &cmd);
+
+	ret = copy_from_user(data, (__user void *)(unsigned long) cmd.vaddr, length);
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send small cmd data\n");
+		return -EFAULT;
+	}
+
+	if (agg)
+		return omx_aggregate_small(agg, &cmd, data);
+
+	return omx_send_small(endpoint, &cmd, data);
+}
+
 int
-omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
-			     void __user * uparam)
+omx_ioctl_send_small(struct omx_endpoint * endpoint,
+		     void __user * uparam)
+{
+	return __omx_ioctl_send_small(endpoint, uparam, NULL);
+}
+
+/******************************
+ * Tiny and small message aggregation
+ *
+ * While draining a batch or the cmdq, consecutive tiny/small commands that
+ * the library flagged for aggregation and that go to the same endpoint are
+ * coalesced into a single aggregate packet. Any other command, or another
+ * destination, flushes the pending messages first so that the submission
+ * order is kept on the wire. The end of the batch or drain is the explicit
+ * flush. A single pending message is sent as a regular tiny/small packet.
+ */
+
+void
+omx_aggregate_init(struct omx_aggregate * agg,
+		   struct omx_endpoint * endpoint)
+{
+	agg->endpoint = endpoint;
+	agg->skb = NULL;
+	agg->nr = 0;
+	agg->length = 0;
+}
+
+/* copy a message (header, data and padding) in the aggregate skb at the given offset */
+static void
+omx_aggregate_copy_msg(struct omx_aggregate * agg, uint32_t offset, uint8_t ptype,
+		       const struct omx_cmd_send_small *cmd, const void *data)
+{
+	struct omx_pkt_aggregate_msg *msg_n;
+	char *buffer;
+	uint16_t length = cmd->length;
+
+	buffer = (char *) omx_skb_mac_header(agg->skb)
+		+ sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_aggregate) + offset;
+	msg_n = (struct omx_pkt_aggregate_msg *) buffer;
+	buffer += sizeof(*msg_n);
+
+	memset(msg_n, 0, sizeof(*msg_n));
+	OMX_HTON_8(msg_n->ptype, ptype);
+	OMX_HTON_16(msg_n->length, length);
+	OMX_HTON_16(msg_n->checksum, cmd->checksum);
+	OMX_HTON_16(msg_n->lib_seqnum, cmd->seqnum);
+	OMX_HTON_16(msg_n->lib_piggyack, cmd->piggyack);
+	OMX_HTON_MATCH_INFO(msg_n, cmd->match_info);
+
+	memcpy(buffer, data, length);
+	/* do not leak kernel memory in the padding */
+	memset(buffer + length, 0, OMX_PKT_AGGREGATE_MSG_ALIGN(length) - length);
+}
+
+/* allocate the aggregate skb and move the first message there */
+static int
+omx_aggregate_start(struct omx_aggregate * agg)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
 	struct omx_pkt_head *ph;
 	struct ethhdr *eh;
-	struct omx_pkt_medium_frag *medium_n;
-	struct omx_cmd_send_mediumsq_frag cmd;
+	struct omx_pkt_aggregate *aggregate_n;
+	struct omx_endpoint * endpoint = agg->endpoint;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
-	uint32_t sendq_offset;
-	struct page * page;
-	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_medium_frag);
+	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_aggregate);
 	int ret;
-	uint32_t frag_length;
 
-	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send mediumsq frag cmd hdr\n");
-		ret = -EFAULT;
-		goto out;
+	BUILD_BUG_ON(sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_aggregate) + OMX_PKT_AGGREGATE_LENGTH_MAX > OMX_MTU);
+
+	/* allocate the max length, the skb is trimmed on flush */
+	skb = omx_new_skb(hdr_len + OMX_PKT_AGGREGATE_LENGTH_MAX);
+	if (unlikely(skb == NULL)) {
+		omx_counter_inc(iface, SEND_NOMEM_SKB);
+		printk(KERN_INFO "Open-MX: Failed to create aggregate skb\n");
+		return -ENOMEM;
 	}
 
-	BUILD_BUG_ON(OMX_MEDIUM_FRAG_LENGTH_MAX > OMX_SENDQ_ENTRY_SIZE);
-	BUILD_BUG_ON(OMX_MEDIUM_FRAG_PACKET_SIZE_OF_PAYLOAD(OMX_MEDIUM_FRAG_LENGTH_MAX) > OMX_MTU);
+	/* locate headers */
+	mh = omx_skb_mac_header(skb);
+	ph = &mh->head;
+	eh = &ph->eth;
+	aggregate_n = (struct omx_pkt_aggregate *) (ph + 1);
 
-	frag_length = cmd.frag_length;
-	if (unlikely(frag_length > OMX_SENDQ_ENTRY_SIZE)) {
-		printk(KERN_ERR "Open-MX: Cannot send more than %ld as a mediumsq frag (tried %ld)\n",
-		       OMX_SENDQ_ENTRY_SIZE, (unsigned long) frag_length);
-		ret = -EINVAL;
-		goto out;
+	/* fill ethernet header */
+	eh->h_proto = __constant_cpu_to_be16(ETH_P_OMX);
+	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
+
+	/* set destination peer */
+	ret = omx_set_target_peer(ph, iface, agg->first_cmd.peer_index);
+	if (ret < 0) {
+		printk(KERN_INFO "Open-MX: Failed to fill target peer in aggregate header\n");
+		kfree_skb(skb);
+		return ret;
 	}
 
-	sendq_offset = cmd.sendq_offset;
-	if (unlikely(sendq_offset >= OMX_SENDQ_SIZE)) {
-		printk(KERN_ERR "Open-MX: Cannot send mediumsq fragment from sendq offset %ld (max %ld)\n",
-		       (unsigned long) sendq_offset, (unsigned long) OMX_SENDQ_SIZE);
-		ret = -EINVAL;
-		goto out;
+	/* fill omx header, length and nr are set on flush */
+	memset(aggregate_n, 0, sizeof(*aggregate_n));
+	OMX_HTON_8(aggregate_n->src_endpoint, endpoint->endpoint_index);
+	OMX_HTON_8(aggregate_n->dst_endpoint, agg->first_cmd.dest_endpoint);
+	OMX_HTON_8(aggregate_n->ptype, OMX_PKT_TYPE_AGGREGATE);
+	OMX_HTON_32(aggregate_n->session, agg->first_cmd.session_id);
+
+	agg->skb = skb;
+	omx_aggregate_copy_msg(agg, 0, agg->first_ptype, &agg->first_cmd, agg->first_data);
+	return 0;
+}
+
+int
+omx_aggregate_flush(struct omx_aggregate * agg)
+{
+	struct omx_iface * iface = agg->endpoint->iface;
+	struct sk_buff *skb = agg->skb;
+	int ret = 0;
+
+	if (!agg->nr)
+		return 0;
+
+	if (!skb) {
+		/* nothing joined the first message, send it as usual */
+		if (agg->first_ptype == OMX_PKT_TYPE_TINY) {
+			struct omx_cmd_send_tiny_hdr tiny;
+
+			tiny.peer_index = agg->first_cmd.peer_index;
+			tiny.dest_endpoint = agg->first_cmd.dest_endpoint;
+			tiny.shared = 0;
+			tiny.session_id = agg->first_cmd.session_id;
+			tiny.seqnum = agg->first_cmd.seqnum;
+			tiny.piggyack = agg->first_cmd.piggyack;
+			tiny.length = agg->first_cmd.length;
+			tiny.checksum = agg->first_cmd.checksum;
+			tiny.match_info = agg->first_cmd.match_info;
+			ret = omx_send_tiny(agg->endpoint, &tiny, agg->first_data);
+		} else {
+			ret = omx_send_small(agg->endpoint, &agg->first_cmd, agg->first_data);
+		}
+
+	} else {
+		struct omx_hdr *mh = omx_skb_mac_header(skb);
+		struct omx_pkt_aggregate *aggregate_n = &mh->body.aggregate;
+		size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_aggregate);
+
+		OMX_HTON_16(aggregate_n->length, agg->length);
+		OMX_HTON_8(aggregate_n->nr, agg->nr);
+		skb_trim(skb, max_t(unsigned long, hdr_len + agg->length, ETH_ZLEN));
+
+		omx_send_dprintk(&mh->head.eth, "AGGREGATE of %d messages length %ld",
+				 agg->nr, (unsigned long) agg->length);
+
+		_omx_queue_xmit(iface, skb, TINY, AGGREGATE);
+		agg->skb = NULL;
 	}
 
-	if (unlikely(cmd.shared))
-		return omx_shared_send_mediumsq_frag(endpoint, &cmd);
+	agg->nr = 0;
+	agg->length = 0;
+	return ret;
+}
+
+static int
+omx_aggregate_msg(struct omx_aggregate * agg, uint8_t ptype,
+		  const struct omx_cmd_send_small *cmd, const void *data)
+{
+	uint32_t msg_length = sizeof(struct omx_pkt_aggregate_msg) + OMX_PKT_AGGREGATE_MSG_ALIGN(cmd->length);
+	int ret;
+
+	if (agg->nr
+	    && (cmd->peer_index != agg->first_cmd.peer_index
+		|| cmd->dest_endpoint != agg->first_cmd.dest_endpoint
+		|| cmd->session_id != agg->first_cmd.session_id
+		|| agg->nr == OMX_PKT_AGGREGATE_NR_MAX
+		|| agg->length + msg_length > OMX_PKT_AGGREGATE_LENGTH_MAX))
+		omx_aggregate_flush(agg);
+
+	if (!agg->nr) {
+		/* keep the first message aside until another one joins it */
+		agg->first_ptype = ptype;
+		agg->first_cmd = *cmd;
+		memcpy(agg->first_data, data, cmd->length);
+		agg->length = msg_length;
+		agg->nr = 1;
+		return 0;
+	}
+
+	if (!agg->skb) {
+		ret = omx_aggregate_start(agg);
+		if (unlikely(ret < 0)) {
+			/* send the first one alone, this one will be resent by the library */
+			omx_aggregate_flush(agg);
+			return ret;
+		}
+	}
+
+	omx_aggregate_copy_msg(agg, agg->length, ptype, cmd, data);
+	agg->length += msg_length;
+	agg->nr++;
+	return 0;
+}
+
+static int
+omx_aggregate_tiny(struct omx_aggregate * agg,
+		   const struct omx_cmd_send_tiny_hdr *cmd,
+		   const void *data)
+{
+	struct omx_cmd_send_small msg;
+
+	msg.peer_index = cmd->peer_index;
+	msg.dest_endpoint = cmd->dest_endpoint;
+	msg.shared = 0;
+	msg.session_id = cmd->session_id;
+	msg.seqnum = cmd->seqnum;
+	msg.piggyack = cmd->piggyack;
+	msg.length = cmd->length;
+	msg.checksum = cmd->checksum;
+	msg.vaddr = 0;
+	msg.match_info = cmd->match_info;
+
+	return omx_aggregate_msg(agg, OMX_PKT_TYPE_TINY, &msg, data);
+}
+
+static int
+omx_aggregate_small(struct omx_aggregate * agg,
+		    const struct omx_cmd_send_small *cmd,
+		    const void *data)
+{
+	return omx_aggregate_msg(agg, OMX_PKT_TYPE_SMALL, cmd, data);
+}
+
+int
+omx_aggregate_ioctl_send_tiny(struct omx_aggregate * agg,
+			      void __user * uparam)
+{
+	return __omx_ioctl_send_tiny(agg->endpoint, uparam, agg);
+}
+
+int
+omx_aggregate_ioctl_send_small(struct omx_aggregate * agg,
+			       void __user * uparam)
+{
+	return __omx_ioctl_send_small(agg->endpoint, uparam, agg);
+}
+
+/*
+ * Build the skb of a mediumsq fragment.
+ * The sendq pages are attached to the skb when possible, the deferred event
+ * is allocated on demand and gets a reference released by the skb destructor.
+ * Otherwise the data is copied into a linear skb right now.
+ */
+static int
+omx_new_mediumsq_frag_skb(struct omx_endpoint * endpoint,
+			  const struct omx_cmd_send_mediumsq_frag *cmd,
+			  struct omx_deferred_event **defeventp,
+			  struct sk_buff **skbp)
+{
+	struct sk_buff *skb;
+	struct omx_hdr *mh;
+	struct omx_pkt_head *ph;
+	struct ethhdr *eh;
+	struct omx_pkt_medium_frag *medium_n;
+	struct omx_iface * iface = endpoint->iface;
+	struct net_device * ifp = iface->eth_ifp;
+	uint32_t sendq_offset = cmd->sendq_offset;
+	uint32_t frag_length = cmd->frag_length;
+	struct page * page;
+	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_medium_frag);
+	int ret;
 
 	if (unlikely(frag_length > omx_skb_copy_max
 		     && hdr_len + frag_length >= ETH_ZLEN
 		     && omx_skb_frags >= (frag_length >> OMX_SENDQ_ENTRY_SHIFT))) {
 		/* use skb with frags */
 
-		struct omx_deferred_event * defevent;
+		struct omx_deferred_event * defevent = *defeventp;
 		unsigned int current_sendq_offset, remaining, desc;
 
 		skb = omx_new_skb(/* only allocate space for the header now, we'll attach pages later */
@@ -540,12 +840,19 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 			goto out;
 		}
 
-		defevent = kmalloc(sizeof(*defevent), GFP_KERNEL);
-		if (unlikely(!defevent)) {
-			omx_counter_inc(iface, SEND_NOMEM_MEDIUM_DEFEVENT);
-			printk(KERN_INFO "Open-MX: Failed to allocate mediumsq frag deferred event\n");
-			ret = -ENOMEM;
-			goto out_with_skb;
+		if (!defevent) {
+			defevent = kmalloc(sizeof(*defevent), GFP_KERNEL);
+			if (unlikely(!defevent)) {
+				omx_counter_inc(iface, SEND_NOMEM_MEDIUM_DEFEVENT);
+				printk(KERN_INFO "Open-MX: Failed to allocate mediumsq frag deferred event\n");
+				ret = -ENOMEM;
+				goto out_with_skb;
+			}
+			omx_endpoint_reacquire(endpoint); /* keep a reference in the defevent */
+			defevent->endpoint = endpoint;
+			atomic_set(&defevent->refcount, 1); /* released by the caller once the event is filled */
+			defevent->cancelled = 0;
+			*defeventp = defevent;
 		}
 
 		/* locate headers */
@@ -555,10 +862,9 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 		medium_n = (struct omx_pkt_medium_frag *) (ph + 1);
 
 		/* set destination peer */
-		ret = omx_set_target_peer(ph, iface, cmd.peer_index);
+		ret = omx_set_target_peer(ph, iface, cmd->peer_index);
 		if (ret < 0) {
 			printk(KERN_INFO "Open-MX: Failed to fill target peer in mediumsq frag header\n");
-			kfree(defevent);
 			goto out_with_skb;
 		}
 
@@ -580,17 +886,12 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 		skb->len += frag_length;
 		skb->data_len = frag_length;
 
-		/* prepare the deferred event now that we cannot fail anymore */
-		omx_endpoint_reacquire(endpoint); /* keep a reference in the defevent */
-		defevent->endpoint = endpoint;
-		defevent->evt.id = 0;
-		defevent->evt.type = OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE;
-		defevent->evt.sendq_offset = cmd.sendq_offset;
+		/* the skb keeps a reference on the deferred event until the pages are released */
+		atomic_inc(&defevent->refcount);
 		omx_set_skb_destructor(skb, omx_medium_frag_skb_destructor, defevent);
 
 	} else {
 		/* use a linear skb */
-		struct omx_evt_send_mediumsq_frag_done evt;
 		void *data;
 
 		omx_counter_inc(iface, MEDIUMSQ_FRAG_SEND_LINEAR);
@@ -612,7 +913,7 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 		data = (char*) (medium_n + 1);
 
 		/* set destination peer */
-		ret = omx_set_target_peer(ph, iface, cmd.peer_index);
+		ret = omx_set_target_peer(ph, iface, cmd->peer_index);
 		if (ret < 0) {
 			printk(KERN_INFO "Open-MX: Failed to fill target peer in mediumsq frag header\n");
 			goto out_with_skb;
@@ -620,13 +921,6 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 
 		/* copy the data in the linear skb */
 		memcpy(data, endpoint->sendq + sendq_offset, frag_length);
-
-		/* notify the event right now */
-		evt.id = 0;
-		evt.type = OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE;
-		evt.sendq_offset = cmd.sendq_offset;
-		omx_notify_exp_event(endpoint,
-				     &evt, sizeof(evt));
 	}
 
 	/* fill ethernet header */
@@ -635,26 +929,25 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 
 	/* fill omx header */
 	OMX_HTON_8(medium_n->src_endpoint, endpoint->endpoint_index);
-	OMX_HTON_8(medium_n->dst_endpoint, cmd.dest_endpoint);
+	OMX_HTON_8(medium_n->dst_endpoint, cmd->dest_endpoint);
 	OMX_HTON_8(medium_n->ptype, OMX_PKT_TYPE_MEDIUM);
 #ifdef OMX_MX_WIRE_COMPAT
-	OMX_HTON_16(medium_n->length, cmd.msg_length);
-	OMX_HTON_8(medium_n->frag_pipeline, cmd.frag_pipeline);
+	OMX_HTON_16(medium_n->length, cmd->msg_length);
+	OMX_HTON_8(medium_n->frag_pipeline, cmd->frag_pipeline);
 #else
-	OMX_HTON_32(medium_n->length, cmd.msg_length);
+	OMX_HTON_32(medium_n->length, cmd->msg_length);
 #endif
-	OMX_HTON_16(medium_n->lib_seqnum, cmd.seqnum);
-	OMX_HTON_16(medium_n->lib_piggyack, cmd.piggyack);
-	OMX_HTON_32(medium_n->session, cmd.session_id);
-	OMX_HTON_MATCH_INFO(medium_n, cmd.match_info);
+	OMX_HTON_16(medium_n->lib_seqnum, cmd->seqnum);
+	OMX_HTON_16(medium_n->lib_piggyack, cmd->piggyack);
+	OMX_HTON_32(medium_n->session, cmd->session_id);
+	OMX_HTON_MATCH_INFO(medium_n, cmd->match_info);
 	OMX_HTON_16(medium_n->frag_length, frag_length);
-	OMX_HTON_8(medium_n->frag_seqnum, cmd.frag_seqnum);
-	OMX_HTON_16(medium_n->checksum, cmd.checksum);
+	OMX_HTON_8(medium_n->frag_seqnum, cmd->frag_seqnum);
+	OMX_HTON_16(medium_n->checksum, cmd->checksum);
 
 	omx_send_dprintk(eh, "MEDIUMSQ FRAG length %ld", (unsigned long) frag_length);
 
-	_omx_queue_xmit(iface, skb, MEDIUM_FRAG, MEDIUMSQ_FRAG);
-
+	*skbp = skb;
 	return 0;
 
  out_with_skb:
@@ -663,6 +956,154 @@ omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
 	return ret;
 }
 
+int
+omx_ioctl_send_mediumsq_frag(struct omx_endpoint * endpoint,
+			     void __user * uparam)
+{
+	struct sk_buff *skb;
+	struct omx_cmd_send_mediumsq_frag cmd;
+	struct omx_deferred_event *defevent = NULL;
+	union omx_evt evt;
+	uint32_t sendq_offset;
+	int ret;
+	uint32_t frag_length;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send mediumsq frag cmd hdr\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	BUILD_BUG_ON(OMX_MEDIUM_FRAG_LENGTH_MAX > OMX_SENDQ_ENTRY_SIZE);
+	BUILD_BUG_ON(OMX_MEDIUM_FRAG_PACKET_SIZE_OF_PAYLOAD(OMX_MEDIUM_FRAG_LENGTH_MAX) > OMX_MTU);
+
+	frag_length = cmd.frag_length;
+	if (unlikely(frag_length > OMX_SENDQ_ENTRY_SIZE)) {
+		printk(KERN_ERR "Open-MX: Cannot send more than %ld as a mediumsq frag (tried %ld)\n",
+		       OMX_SENDQ_ENTRY_SIZE, (unsigned long) frag_length);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	sendq_offset = cmd.sendq_offset;
+	if (unlikely(sendq_offset >= OMX_SENDQ_SIZE)) {
+		printk(KERN_ERR "Open-MX: Cannot send mediumsq fragment from sendq offset %ld (max %ld)\n",
+		       (unsigned long) sendq_offset, (unsigned long) OMX_SENDQ_SIZE);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (unlikely(cmd.shared))
+		return omx_shared_send_mediumsq_frag(endpoint, &cmd);
+
+	ret = omx_new_mediumsq_frag_skb(endpoint, &cmd, &defevent, &skb);
+	if (unlikely(ret < 0))
+		goto out_with_defevent;
+
+	_omx_queue_xmit(endpoint->iface, skb, MEDIUM_FRAG, MEDIUMSQ_FRAG);
+
+	/* notify the event now, or once the skb is released */
+	evt.send_mediumsq_frag_done.id = 0;
+	evt.send_mediumsq_frag_done.type = OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE;
+	evt.send_mediumsq_frag_done.sendq_offset = cmd.sendq_offset;
+	omx_deferred_event_commit(endpoint, defevent, &evt);
+
+	return 0;
+
+ out_with_defevent:
+	if (defevent) {
+		defevent->cancelled = 1;
+		omx_deferred_event_put(defevent);
+	}
+ out:
+	return ret;
+}
+
+/*
+ * Send a whole mediumsq message at once: build all fragment skbs first,
+ * then queue them, and report a single done event once all of them are released.
+ */
+int
+omx_ioctl_send_mediumsq(struct omx_endpoint * endpoint,
+			void __user * uparam)
+{
+	struct sk_buff *skbs[OMX_CMD_SEND_MEDIUMSQ_FRAGS_MAX];
+	struct omx_cmd_send_mediumsq cmd;
+	struct omx_cmd_send_mediumsq_frag frag_cmd;
+	struct omx_deferred_event *defevent = NULL;
+	union omx_evt evt;
+	uint32_t remaining;
+	unsigned frags_nr, i;
+	int ret;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send mediumsq cmd hdr\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	frags_nr = cmd.frags_nr;
+	if (unlikely(!frags_nr || frags_nr > OMX_CMD_SEND_MEDIUMSQ_FRAGS_MAX
+		     || frags_nr != (cmd.msg_length + OMX_MEDIUM_FRAG_LENGTH_MAX - 1) / OMX_MEDIUM_FRAG_LENGTH_MAX)) {
+		printk(KERN_ERR "Open-MX: Cannot send mediumsq of length %ld as %d frags\n",
+		       (unsigned long) cmd.msg_length, frags_nr);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	for(i=0; i<frags_nr; i++)
+		if (unlikely(cmd.sendq_index[i] >= OMX_SENDQ_ENTRY_NR)) {
+			printk(KERN_ERR "Open-MX: Cannot send mediumsq fragment from sendq entry %ld (max %ld)\n",
+			       (unsigned long) cmd.sendq_index[i], (unsigned long) OMX_SENDQ_ENTRY_NR);
+			ret = -EINVAL;
+			goto out;
+		}
+
+	if (unlikely(cmd.shared))
+		return omx_shared_send_mediumsq(endpoint, &cmd);
+
+	omx_mediumsq_frag_cmd_init(&frag_cmd, &cmd);
+
+	remaining = cmd.msg_length;
+	for(i=0; i<frags_nr; i++) {
+		frag_cmd.frag_length = remaining > OMX_MEDIUM_FRAG_LENGTH_MAX ? OMX_MEDIUM_FRAG_LENGTH_MAX : remaining;
+		frag_cmd.frag_seqnum = i;
+		frag_cmd.sendq_offset = cmd.sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT;
+
+		ret = omx_new_mediumsq_frag_skb(endpoint, &frag_cmd, &defevent, &skbs[i]);
+		if (unlikely(ret < 0))
+			goto out_with_skbs;
+
+		remaining -= frag_cmd.frag_length;
+	}
+
+	/* nothing may fail anymore, queue all frags */
+	for(i=0; i<frags_nr; i++)
+		_omx_queue_xmit(endpoint->iface, skbs[i], MEDIUM_FRAG, MEDIUMSQ_FRAG);
+
+	/* notify the event now, or once the last skb is released */
+	evt.send_mediumsq_done.id = 0;
+	evt.send_mediumsq_done.type = OMX_EVT_SEND_MEDIUMSQ_DONE;
+	evt.send_mediumsq_done.sendq_offset = cmd.sendq_index[0] << OMX_SENDQ_ENTRY_SHIFT;
+	evt.send_mediumsq_done.frags_nr = frags_nr;
+	omx_deferred_event_commit(endpoint, defevent, &evt);
+
+	return 0;
+
+ out_with_skbs:
+	/* drop the already built frags without notifying anything */
+	if (defevent)
+		defevent->cancelled = 1;
+	while (i--)
+		kfree_skb(skbs[i]);
+	if (defevent)
+		omx_deferred_event_put(defevent);
+ out:
+	return ret;
+}
+
 int
 omx_ioctl_send_mediumva(struct omx_endpoint * endpoint,
 			void __user * uparam)
@@ -837,7 +1278,10 @@ omx_ioctl_send_rndv(struct omx_endpoint * endpoint,
 	struct omx_cmd_send_rndv cmd;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
+	struct omx_user_region * region = NULL;
+	struct omx_user_region_pin_state pinstate;
 	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_rndv);
+	uint16_t eager_length;
 	int ret;
 
 	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
@@ -850,35 +1294,53 @@ omx_ioctl_send_rndv(struct omx_endpoint * endpoint,
 	if (unlikely(cmd.shared))
 		return omx_shared_send_rndv(endpoint, &cmd);
 
-	if (!omx_pin_synchronous) {
-		/* make sure the region is pinned */
-		struct omx_user_region * region;
-		struct omx_user_region_pin_state pinstate;
+#ifdef OMX_MX_WIRE_COMPAT
+	/* no eager prefix in the MX wire protocol */
+	eager_length = 0;
+#else
+	eager_length = cmd.eager_length;
+	if (unlikely(eager_length > OMX_RNDV_EAGER_LENGTH_MAX || eager_length > cmd.msg_length)) {
+		printk(KERN_ERR "Open-MX: Cannot send rndv eager prefix of %ld bytes (max %ld) for %ld-byte message\n",
+		       (unsigned long) eager_length, (unsigned long) OMX_RNDV_EAGER_LENGTH_MAX,
+		       (unsigned long) cmd.msg_length);
+		ret = -EINVAL;
+		goto out;
+	}
+#endif
 
+	if (!omx_pin_synchronous || eager_length) {
 		region = omx_user_region_acquire(endpoint, cmd.pulled_rdma_id);
 		if (unlikely(!region)) {
 			ret = -EINVAL;
 			goto out;
 		}
+	}
 
+	if (!omx_pin_synchronous) {
 		omx_user_region_demand_pin_init(&pinstate, region);
-		pinstate.next_chunk_pages = omx_pin_chunk_pages_max;
-		ret = omx_user_region_demand_pin_finish(&pinstate);
-		/* no progressive/demand-pinning for native networking */
-		omx_user_region_release(region);
+
+		if (omx_pin_progressive) {
+			/* only pin the eager prefix now, the rest is pinned once the rndv is posted */
+			unsigned long needed = eager_length;
+			ret = omx_user_region_demand_pin_continue(&pinstate, &needed);
+		} else {
+			/* make sure the region is pinned */
+			pinstate.next_chunk_pages = omx_pin_chunk_pages_max;
+			ret = omx_user_region_demand_pin_finish(&pinstate);
+		}
 		if (ret < 0) {
 			dprintk(REG, "failed to pin user region\n");
-			goto out;
+			goto out_with_region;
 		}
 	}
 
 	skb = omx_new_skb(/* pad to ETH_ZLEN */
-			  max_t(unsigned long, hdr_len, ETH_ZLEN));
+			  max_t(unsigned long, hdr_len + eager_length, ETH_ZLEN));
 	if (unlikely(skb == NULL)) {
 		omx_counter_inc(iface, SEND_NOMEM_SKB);
 		printk(KERN_INFO "Open-MX: Failed to create rndv skb\n");
 		ret = -ENOMEM;
-		goto out;
+		goto out_with_region;
 	}
 
 	/* locate headers */
@@ -902,7 +1364,7 @@ omx_ioctl_send_rndv(struct omx_endpoint * endpoint,
 	OMX_HTON_8(rndv_n->msg.src_endpoint, endpoint->endpoint_index);
 	OMX_HTON_8(rndv_n->msg.dst_endpoint, cmd.dest_endpoint);
 	OMX_HTON_8(rndv_n->msg.ptype, OMX_PKT_TYPE_RNDV);
-	OMX_HTON_16(rndv_n->msg.length, OMX_PKT_RNDV_DATA_LENGTH);
+	OMX_HTON_16(rndv_n->msg.length, OMX_PKT_RNDV_DATA_LENGTH + eager_length);
 	OMX_HTON_16(rndv_n->msg.lib_seqnum, cmd.seqnum);
 	OMX_HTON_16(rndv_n->msg.lib_piggyack, cmd.piggyack);
 	OMX_HTON_32(rndv_n->msg.session, cmd.session_id);
@@ -911,43 +1373,70 @@ omx_ioctl_send_rndv(struct omx_endpoint * endpoint,
 	OMX_HTON_8(rndv_n->pulled_rdma_id, cmd.pulled_rdma_id);
 	OMX_HTON_8(rndv_n->pulled_rdma_seqnum, cmd.pulled_rdma_seqnum);
 	OMX_HTON_16(rndv_n->msg.checksum, cmd.checksum);
-	OMX_HTON_16(rndv_n->pulled_rdma_offset, 0); /* not needed for Open-MX */
+	/* the receiver only pulls what follows the eager prefix */
+	OMX_HTON_16(rndv_n->pulled_rdma_offset, eager_length);
+
+	if (eager_length) {
+		/* copy the beginning of the message from the pinned region */
+		struct omx_user_region_offset_cache region_cache;
+
+		ret = omx_user_region_offset_cache_init(region, &region_cache, 0, eager_length);
+		if (unlikely(ret < 0)) {
+			printk(KERN_INFO "Open-MX: Failed to read rndv eager prefix from region\n");
+			goto out_with_skb;
+		}
+		region_cache.copy_pages_to_buf(&region_cache, rndv_n + 1, eager_length);
+		omx_counter_inc(iface, SEND_RNDV_EAGER);
+	}
 
 	omx_queue_xmit(iface, skb, RNDV);
 
+	if (!omx_pin_synchronous && omx_pin_progressive) {
+		/*
+		 * pin the rest of the region while the rndv travels,
+		 * and serve the pull requests that arrived too early
+		 * as soon as each chunk is pinned.
+		 * a pinning failure is reported to the receiver with a nack.
+		 */
+		while (region->status == OMX_USER_REGION_STATUS_PINNED
+		       && region->total_registered_length < region->total_length) {
+			unsigned long needed = pinstate.watching
+				? region->total_length : region->total_registered_length + 1;
+			if (omx_user_region_demand_pin_continue(&pinstate, &needed) < 0)
+				break;
+			omx_pull_serve_deferred_requests(region);
+		}
+		omx_pull_serve_deferred_requests(region);
+	}
+
+	if (region)
+		omx_user_region_release(region);
+
 	return 0;
 
  out_with_skb:
 	kfree_skb(skb);
+ out_with_region:
+	if (region)
+		omx_user_region_release(region);
  out:
 	return ret;
 }
 
-int
-omx_ioctl_send_notify(struct omx_endpoint * endpoint,
-		      void __user * uparam)
+static int
+omx_send_notify(struct omx_endpoint * endpoint,
+		const struct omx_cmd_send_notify *cmd)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
 	struct omx_pkt_head *ph;
 	struct ethhdr *eh;
 	struct omx_pkt_notify *notify_n;
-	struct omx_cmd_send_notify cmd;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
 	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_notify);
 	int ret;
 
-	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send notify cmd hdr\n");
-		ret = -EFAULT;
-		goto out;
-	}
-
-	if (unlikely(cmd.shared))
-		return omx_shared_send_notify(endpoint, &cmd);
-
 	skb = omx_new_skb(/* pad to ETH_ZLEN */
 			  max_t(unsigned long, hdr_len, ETH_ZLEN));
 	if (unlikely(skb == NULL)) {
@@ -967,7 +1456,7 @@ omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
 
 	/* set destination peer */
-	ret = omx_set_target_peer(ph, iface, cmd.peer_index);
+	ret = omx_set_target_peer(ph, iface, cmd->peer_index);
 	if (ret < 0) {
 		printk(KERN_INFO "Open-MX: Failed to fill target peer in notify header\n");
 		goto out_with_skb;
@@ -975,14 +1464,14 @@ omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 
 	/* fill omx header */
 	OMX_HTON_8(notify_n->src_endpoint, endpoint->endpoint_index);
-	OMX_HTON_8(notify_n->dst_endpoint, cmd.dest_endpoint);
+	OMX_HTON_8(notify_n->dst_endpoint, cmd->dest_endpoint);
 	OMX_HTON_8(notify_n->ptype, OMX_PKT_TYPE_NOTIFY);
-	OMX_HTON_32(notify_n->total_length, cmd.total_length);
-	OMX_HTON_16(notify_n->lib_seqnum, cmd.seqnum);
-	OMX_HTON_16(notify_n->lib_piggyack, cmd.piggyack);
-	OMX_HTON_32(notify_n->session, cmd.session_id);
-	OMX_HTON_8(notify_n->pulled_rdma_id, cmd.pulled_rdma_id);
-	OMX_HTON_8(notify_n->pulled_rdma_seqnum, cmd.pulled_rdma_seqnum);
+	OMX_HTON_32(notify_n->total_length, cmd->total_length);
+	OMX_HTON_16(notify_n->lib_seqnum, cmd->seqnum);
+	OMX_HTON_16(notify_n->lib_piggyack, cmd->piggyack);
+	OMX_HTON_32(notify_n->session, cmd->session_id);
+	OMX_HTON_8(notify_n->pulled_rdma_id, cmd->pulled_rdma_id);
+	OMX_HTON_8(notify_n->pulled_rdma_seqnum, cmd->pulled_rdma_seqnum);
 
 	omx_send_dprintk(eh, "NOTIFY");
 
@@ -997,30 +1486,38 @@ omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 }
 
 int
-omx_ioctl_send_liback(struct omx_endpoint * endpoint,
+omx_ioctl_send_notify(struct omx_endpoint * endpoint,
 		      void __user * uparam)
+{
+	struct omx_cmd_send_notify cmd;
+	int ret;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send notify cmd hdr\n");
+		return -EFAULT;
+	}
+
+	if (unlikely(cmd.shared))
+		return omx_shared_send_notify(endpoint, &cmd);
+
+	return omx_send_notify(endpoint, &cmd);
+}
+
+static int
+omx_send_liback(struct omx_endpoint * endpoint,
+		const struct omx_cmd_send_liback *cmd)
 {
 	struct sk_buff *skb;
 	struct omx_hdr *mh;
 	struct omx_pkt_head *ph;
 	struct ethhdr *eh;
 	struct omx_pkt_truc *truc_n;
-	struct omx_cmd_send_liback cmd;
 	struct omx_iface * iface = endpoint->iface;
 	struct net_device * ifp = iface->eth_ifp;
 	size_t hdr_len = sizeof(struct omx_pkt_head) + sizeof(struct omx_pkt_truc);
 	int ret;
 
-	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
-	if (unlikely(ret != 0)) {
-		printk(KERN_ERR "Open-MX: Failed to read send truc cmd hdr\n");
-		ret = -EFAULT;
-		goto out;
-	}
-
-	if (unlikely(cmd.shared))
-		return omx_shared_send_liback(endpoint, &cmd);
-
 	skb = omx_new_skb(/* pad to ETH_ZLEN */
 			  max_t(unsigned long, hdr_len, ETH_ZLEN));
 	if (unlikely(skb == NULL)) {
@@ -1041,7 +1538,7 @@ omx_ioctl_send_liback(struct omx_endpoint * endpoint,
 	memcpy(eh->h_source, ifp->dev_addr, sizeof (eh->h_source));
 
 	/* set destination peer */
-	ret = omx_set_target_peer(ph, iface, cmd.peer_index);
+	ret = omx_set_target_peer(ph, iface, cmd->peer_index);
 	if (ret < 0) {
 		printk(KERN_INFO "Open-MX: Failed to fill target peer in truc header\n");
 		goto out_with_skb;
@@ -1049,16 +1546,16 @@ omx_ioctl_send_liback(struct omx_endpoint * endpoint,
 
 	/* fill omx header */
 	OMX_HTON_8(truc_n->src_endpoint, endpoint->endpoint_index);
-	OMX_HTON_8(truc_n->dst_endpoint, cmd.dest_endpoint);
+	OMX_HTON_8(truc_n->dst_endpoint, cmd->dest_endpoint);
 	OMX_HTON_8(truc_n->ptype, OMX_PKT_TYPE_TRUC);
 	OMX_HTON_8(truc_n->length, OMX_PKT_TRUC_LIBACK_DATA_LENGTH);
-	OMX_HTON_32(truc_n->session, cmd.session_id);
+	OMX_HTON_32(truc_n->session, cmd->session_id);
 	OMX_HTON_8(truc_n->type, OMX_PKT_TRUC_DATA_TYPE_ACK);
-	OMX_HTON_16(truc_n->liback.lib_seqnum, cmd.lib_seqnum);
-	OMX_HTON_32(truc_n->liback.session_id, cmd.session_id);
-	OMX_HTON_32(truc_n->liback.acknum, cmd.acknum);
-	OMX_HTON_16(truc_n->liback.send_seq, cmd.send_seq);
-	OMX_HTON_8(truc_n->liback.resent, cmd.resent);
+	OMX_HTON_16(truc_n->liback.lib_seqnum, cmd->lib_seqnum);
+	OMX_HTON_32(truc_n->liback.session_id, cmd->session_id);
+	OMX_HTON_32(truc_n->liback.acknum, cmd->acknum);
+	OMX_HTON_16(truc_n->liback.send_seq, cmd->send_seq);
+	OMX_HTON_8(truc_n->liback.resent, cmd->resent);
 
 	omx_queue_xmit(iface, skb, LIBACK);
 
@@ -1070,6 +1567,203 @@ omx_ioctl_send_liback(struct omx_endpoint * endpoint,
 	return ret;
 }
 
+int
+omx_ioctl_send_liback(struct omx_endpoint * endpoint,
+		      void __user * uparam)
+{
+	struct omx_cmd_send_liback cmd;
+	int ret;
+
+	ret = copy_from_user(&cmd, uparam, sizeof(cmd));
+	if (unlikely(ret != 0)) {
+		printk(KERN_ERR "Open-MX: Failed to read send truc cmd hdr\n");
+		return -EFAULT;
+	}
+
+	if (unlikely(cmd.shared))
+		return omx_shared_send_liback(endpoint, &cmd);
+
+	return omx_send_liback(endpoint, &cmd);
+}
+
+/******************************
+ * Command queue
+ */
+
+/*
+ * Process the commands that the library queued in the endpoint cmdq.
+ * Called with the endpoint cmdq_lock held.
+ */
+static int
+__omx_endpoint_cmdq_drain(struct omx_endpoint * endpoint)
+{
+	struct omx_endpoint_desc * userdesc = endpoint->userdesc;
+	struct omx_aggregate agg;
+	uint32_t index, submitted;
+	int nr = 0;
+
+	index = endpoint->cmdq_consumed_index;
+	submitted = userdesc->cmdq_submitted_index;
+	/* do not read entries before the index that made them valid */
+	smp_rmb();
+
+	if (unlikely(submitted - index > OMX_CMDQ_ENTRY_NR)) {
+		printk(KERN_ERR "Open-MX: Dropping cmdq entries up to invalid submitted index %ld (consumed %ld)\n",
+		       (unsigned long) submitted, (unsigned long) index);
+		/* resync so that the library does not wait for slots forever, it retransmits on its own */
+		index = submitted;
+		goto out;
+	}
+
+	omx_aggregate_init(&agg, endpoint);
+
+	while (index != submitted) {
+		struct omx_cmdq_entry * slot = endpoint->cmdq + ((index % OMX_CMDQ_ENTRY_NR) << OMX_CMDQ_ENTRY_SHIFT);
+		struct omx_cmd_submit_batch_entry hdr;
+		int err = -EINVAL;
+
+		/* copy what we check, user-space may modify the slot behind our back */
+		hdr = slot->hdr;
+		if (!(hdr.flags & OMX_CMD_SUBMIT_BATCH_ENTRY_FLAG_AGGREGATE))
+			/* keep the submission order */
+			omx_aggregate_flush(&agg);
+
+		switch (hdr.epcmd) {
+		case OMX_EPCMD_SEND_TINY: {
+			struct omx_cmd_send_tiny tiny = slot->cmd.tiny;
+			if (likely(tiny.hdr.length <= OMX_TINY_MSG_LENGTH_MAX && !tiny.hdr.shared)) {
+				if (hdr.flags & OMX_CMD_SUBMIT_BATCH_ENTRY_FLAG_AGGREGATE)
+					err = omx_aggregate_tiny(&agg, &tiny.hdr, tiny.data);
+				else
+					err = omx_send_tiny(endpoint, &tiny.hdr, tiny.data);
+			}
+			break;
+		}
+		case OMX_EPCMD_SEND_SMALL: {
+			struct omx_cmd_send_small small = slot->cmd.small;
+			if (likely(small.length <= OMX_SMALL_MSG_LENGTH_MAX && !small.shared)) {
+				if (hdr.flags & OMX_CMD_SUBMIT_BATCH_ENTRY_FLAG_AGGREGATE)
+					err = omx_aggregate_small(&agg, &small, slot->small_data);
+				else
+					err = omx_send_small(endpoint, &small, slot->small_data);
+			}
+			break;
+		}
+		case OMX_EPCMD_SEND_NOTIFY: {
+			struct omx_cmd_send_notify notify = slot->cmd.notify;
+			if (likely(!notify.shared))
+				err = omx_send_notify(endpoint, &notify);
+			break;
+		}
+		case OMX_EPCMD_SEND_LIBACK: {
+			struct omx_cmd_send_liback liback = slot->cmd.liback;
+			if (likely(!liback.shared))
+				err = omx_send_liback(endpoint, &liback);
+			break;
+		}
+		}
+
+		/* the library retransmits on its own, just report invalid commands */
+		if (unlikely(err == -EINVAL))
+			printk(KERN_ERR "Open-MX: Ignoring invalid cmdq entry #%ld with command %d\n",
+			       (unsigned long) index, hdr.epcmd);
+
+		index++;
+		nr++;
+	}
+
+	omx_aggregate_flush(&agg);
+
+ out:
+	endpoint->cmdq_consumed_index = index;
+	/* make sure we are done with the slots before the library reuses them */
+	smp_mb();
+	userdesc->cmdq_consumed_index = index;
+	return nr;
+}
+
+/*
+ * Called before each endpoint ioctl.
+ * Wait for a concurrent drainer so that the queued commands
+ * are always submitted before the ioctl one.
+ */
+int
+omx_endpoint_cmdq_drain(struct omx_endpoint * endpoint)
+{
+	int nr;
+
+	if (!(endpoint->userdesc->user_features & OMX_ENDPOINT_DESC_USER_FEATURE_CMDQ))
+		return 0;
+
+	spin_lock(&endpoint->cmdq_lock);
+	nr = __omx_endpoint_cmdq_drain(endpoint);
+	spin_unlock(&endpoint->cmdq_lock);
+	return nr;
+}
+
+/*
+ * Called by the cmdq poll thread under rcu_read_lock.
+ * Leave the work to the ioctl that is already draining, if any.
+ */
+static int
+omx_cmdq_poll_endpoint(struct omx_endpoint * endpoint, void * data)
+{
+	if (!(endpoint->userdesc->user_features & OMX_ENDPOINT_DESC_USER_FEATURE_CMDQ))
+		return 0;
+
+	if (spin_trylock(&endpoint->cmdq_lock)) {
+		__omx_endpoint_cmdq_drain(endpoint);
+		spin_unlock(&endpoint->cmdq_lock);
+	}
+	return 0;
+}
+
+/*
+ * The poll thread busy-polls the command queues of all open endpoints
+ * so that the library never has to ring the doorbell.
+ * Only started when the cmdqpoll module parameter is set since it burns a core.
+ */
+static struct task_struct * omx_cmdq_poll_task = NULL;
+
+static int
+omx_cmdq_poll_thread(void * data)
+{
+	while (!kthread_should_stop()) {
+		omx_for_each_endpoint(omx_cmdq_poll_endpoint, NULL);
+		cond_resched();
+	}
+
+	return 0;
+}
+
+int
+omx_cmdq_poll_init(void)
+{
+	struct task_struct * task;
+
+	if (!omx_cmdq_poll)
+		return 0;
+
+	task = kthread_run(omx_cmdq_poll_thread, NULL, "omx_cmdq");
+	if (IS_ERR(task)) {
+		printk(KERN_ERR "Open-MX: Failed to start the cmdq poll thread, error %ld\n", PTR_ERR(task));
+		return PTR_ERR(task);
+	}
+
+	omx_cmdq_poll_task = task;
+	omx_driver_userdesc->features |= OMX_DRIVER_FEATURE_CMDQ_POLL;
+	return 0;
+}
+
+void
+omx_cmdq_poll_exit(void)
+{
+	if (omx_cmdq_poll_task) {
+		kthread_stop(omx_cmdq_poll_task);
+		omx_cmdq_poll_task = NULL;
+	}
+}
+
 void
 omx_send_nack_lib(struct omx_iface * iface, uint32_t peer_index, enum omx_nack_type nack_type,
 		  uint8_t src_endpoint, uint8_t dst_endpoint, uint16_t lib_seqnum)
@@ -161,6 +161,7 @@ omx_shared_try_send_connect_request(struct omx_endpoint *src_endpoint,
 	event.app_key = hdr->app_key;
 	event.target_recv_seqnum_start = hdr->target_recv_seqnum_start;
 	event.connect_seqnum = hdr->connect_seqnum;
+	event.features = hdr->features;
 
 	/* notify the event */
 	err = omx_notify_unexp_event(dst_endpoint, &event, sizeof(event));
@@ -214,6 +215,7 @@ omx_shared_try_send_connect_reply(struct omx_endpoint *src_endpoint,
 	event.target_recv_seqnum_start = hdr->target_recv_seqnum_start;
 	event.connect_seqnum = hdr->connect_seqnum;
 	event.connect_status_code = hdr->connect_status_code;
+	event.features = hdr->features;
 
 	/* notify the event */
 	err = omx_notify_unexp_event(dst_endpoint, &event, sizeof(event));
@@ -349,13 +351,16 @@ omx_shared_send_small(struct omx_endpoint *src_endpoint,
 	return err;
 }
 
-int
-omx_shared_send_mediumsq_frag(struct omx_endpoint *src_endpoint,
+/*
+ * Copy one mediumsq fragment into the destination recvq and notify it there.
+ * Returns a negative error if there is no unexpected event slot available.
+ */
+static int
+omx_shared_post_mediumsq_frag(struct omx_endpoint *src_endpoint,
+			      struct omx_endpoint *dst_endpoint,
 			      const struct omx_cmd_send_mediumsq_frag *hdr)
 {
-	struct omx_endpoint * dst_endpoint;
 	struct omx_evt_recv_msg dst_event;
-	struct omx_evt_send_mediumsq_frag_done src_event;
 	unsigned long recvq_offset;
 #ifdef OMX_HAVE_DMA_ENGINE
 	dma_cookie_t dma_cookie = -1;
@@ -368,19 +373,10 @@ omx_shared_send_mediumsq_frag(struct omx_endpoint *src_endpoint,
 	int current_sendq_offset;
 	int err;
 
-	dst_endpoint = omx_shared_get_endpoint_or_notify_nack(src_endpoint, hdr->peer_index,
-							      hdr->dest_endpoint, hdr->session_id,
-							      hdr->seqnum);
-	if (unlikely(!dst_endpoint))
-		return 0;
-
 	/* get the dst eventq slot */
 	err = omx_prepare_notify_unexp_event_with_recvq(dst_endpoint, &recvq_offset);
-	if (unlikely(err < 0)) {
-		/* no more unexpected eventq slot? just drop the packet, it will be resent anyway */
-		err = 0;
-		goto out_with_endpoint;
-	}
+	if (unlikely(err < 0))
+		return err;
 
 #ifndef OMX_NORECVCOPY
 	/* copy the data */
@@ -452,26 +448,76 @@ omx_shared_send_mediumsq_frag(struct omx_endpoint *src_endpoint,
 	/* notify the dst event */
 	omx_commit_notify_unexp_event_with_recvq(dst_endpoint, &dst_event, sizeof(dst_event));
 
-	/* fill and notify the src event */
+	omx_counter_inc(omx_shared_fake_iface, SHARED_MEDIUMSQ_FRAG);
+
+	return 0;
+}
+
+int
+omx_shared_send_mediumsq_frag(struct omx_endpoint *src_endpoint,
+			      const struct omx_cmd_send_mediumsq_frag *hdr)
+{
+	struct omx_endpoint * dst_endpoint;
+	struct omx_evt_send_mediumsq_frag_done src_event;
+
+	dst_endpoint = omx_shared_get_endpoint_or_notify_nack(src_endpoint, hdr->peer_index,
+							      hdr->dest_endpoint, hdr->session_id,
+							      hdr->seqnum);
+	if (unlikely(!dst_endpoint))
+		return 0;
+
+	/* if no more unexpected eventq slot, just drop the packet, it will be resent anyway */
+	omx_shared_post_mediumsq_frag(src_endpoint, dst_endpoint, hdr);
+
+	/* fill and notify the src event anyway, so that the sender doesn't leak eventq slots */
 	src_event.id = 0;
 	src_event.type = OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE;
 	src_event.sendq_offset = hdr->sendq_offset;
 	omx_notify_exp_event(src_endpoint, &src_event, sizeof(src_event));
+
 	omx_endpoint_release(dst_endpoint);
+	return 0;
+}
 
-	omx_counter_inc(omx_shared_fake_iface, SHARED_MEDIUMSQ_FRAG);
+int
+omx_shared_send_mediumsq(struct omx_endpoint *src_endpoint,
+			 const struct omx_cmd_send_mediumsq *hdr)
+{
+	struct omx_endpoint * dst_endpoint;
+	struct omx_cmd_send_mediumsq_frag frag_hdr;
+	struct omx_evt_send_mediumsq_done src_event;
+	uint32_t remaining = hdr->msg_length;
+	unsigned i;
 
-	return 0;
+	dst_endpoint = omx_shared_get_endpoint_or_notify_nack(src_endpoint, hdr->peer_index,
+							      hdr->dest_endpoint, hdr->session_id,
+							      hdr->seqnum);
+	if (unlikely(!dst_endpoint))
+		return 0;
 
- out_with_endpoint:
-	/* fill and notify the src event anyway, so that the sender doesn't leak eventq slots */
+	omx_mediumsq_frag_cmd_init(&frag_hdr, hdr);
+
+	for(i=0; i<hdr->frags_nr; i++) {
+		frag_hdr.frag_length = remaining > OMX_MEDIUM_FRAG_LENGTH_MAX ? OMX_MEDIUM_FRAG_LENGTH_MAX : remaining;
+		frag_hdr.frag_seqnum = i;
+		frag_hdr.sendq_offset = hdr->sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT;
+
+		/* if no more unexpected eventq slot, just drop the remaining frags, they will be resent anyway */
+		if (unlikely(omx_shared_post_mediumsq_frag(src_endpoint, dst_endpoint, &frag_hdr) < 0))
+			break;
+
+		remaining -= frag_hdr.frag_length;
+	}
+
+	/* notify a single src event for the whole message */
 	src_event.id = 0;
-	src_event.type = OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE;
-	src_event.sendq_offset = hdr->sendq_offset;
+	src_event.type = OMX_EVT_SEND_MEDIUMSQ_DONE;
+	src_event.sendq_offset = hdr->sendq_index[0] << OMX_SENDQ_ENTRY_SHIFT;
+	src_event.frags_nr = hdr->frags_nr;
 	omx_notify_exp_event(src_endpoint, &src_event, sizeof(src_event));
 
 	omx_endpoint_release(dst_endpoint);
-	return err;
+	return 0;
 }
 
 int
@@ -655,6 +701,8 @@ omx_shared_send_rndv(struct omx_endpoint *src_endpoint,
 	event.specific.rndv.pulled_rdma_seqnum = hdr->pulled_rdma_seqnum;
 	event.specific.rndv.pulled_rdma_offset = 0; /* not needed in Open-MX */
 	event.specific.rndv.checksum = hdr->checksum;
+	event.specific.rndv.eager_length = 0; /* never over shared communication */
+	event.specific.rndv.recvq_offset = 0;
 
 	/* make sure the region is marked as pinning before reporting the event */
 	if (!omx_pin_synchronous) {
@@ -754,7 +802,7 @@ omx_shared_pull(struct omx_endpoint *src_endpoint,
 #ifndef OMX_NORECVCOPY
 	/* pull from the dst region into the src region */
 	err = omx_copy_between_user_regions(dst_region, hdr->pulled_rdma_offset,
-					    src_region, 0,
+					    src_region, hdr->puller_rdma_offset,
 					    hdr->length);
 	event.status = err < 0 ? OMX_EVT_PULL_DONE_ABORTED : OMX_EVT_PULL_DONE_SUCCESS;
 #else
@@ -39,6 +39,10 @@ extern int
 omx_shared_send_mediumsq_frag(struct omx_endpoint *src_endpoint,
 			      const struct omx_cmd_send_mediumsq_frag *hdr);
 
+extern int
+omx_shared_send_mediumsq(struct omx_endpoint *src_endpoint,
+			 const struct omx_cmd_send_mediumsq *hdr);
+
 extern int
 omx_shared_send_mediumva(struct omx_endpoint *src_endpoint,
 			 const struct omx_cmd_send_mediumva *hdr);
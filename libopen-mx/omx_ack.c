@@ -106,7 +106,7 @@ omx__handle_ack(struct omx_endpoint *ep,
     omx__debug_printf(ACK, ep, "marking seqnums up to %d (#%d) as acked (jiffies %lld)\n",
 		      (unsigned) OMX__SEQNUM(ack_before - 1),
 		      (unsigned) OMX__SESNUM_SHIFTED(ack_before - 1),
-		      (unsigned long long) omx__driver_desc->jiffies);
+		      (unsigned long long) omx__now());
 
     omx__foreach_partner_request_safe(&partner->non_acked_req_q, req, next) {
       /* take care of the seqnum wrap around here too */
@@ -220,7 +220,7 @@ omx__handle_nack(struct omx_endpoint *ep,
  */
 
 static omx_return_t
-omx__submit_send_liback(const struct omx_endpoint *ep,
+omx__submit_send_liback(struct omx_endpoint *ep,
 			struct omx__partner * partner)
 {
   struct omx_cmd_send_liback liback_param;
@@ -239,7 +239,8 @@ omx__submit_send_liback(const struct omx_endpoint *ep,
   liback_param.send_seq = ack_upto; /* FIXME? partner->send_seq */
   liback_param.resent = 0; /* FIXME? partner->requeued */
 
-  err = ioctl(ep->fd, OMX_CMD_SEND_LIBACK, &liback_param);
+  err = omx__submit_cmd(ep, OMX_CMD_SEND_LIBACK, OMX_EPCMD_SEND_LIBACK, 0,
+			&liback_param, sizeof(liback_param), liback_param.shared);
   if (unlikely(err < 0)) {
     omx_return_t ret = omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
 							  OMX_SUCCESS,
@@ -258,7 +259,7 @@ void
 omx__process_partners_to_ack(struct omx_endpoint *ep)
 {
   struct omx__partner *partner, *next;
-  uint64_t now = omx__driver_desc->jiffies;
+  uint64_t now = omx__now();
 
   /* look at the immediate list */
   list_for_each_entry_safe(partner, next,
@@ -327,7 +328,7 @@ omx__flush_partners_to_ack(struct omx_endpoint *ep)
 		      (unsigned long long) partner->board_addr, (unsigned) partner->endpoint_index,
 		      (unsigned) OMX__SEQNUM(partner->next_frag_recv_seq - 1),
 		      (unsigned) OMX__SESNUM_SHIFTED(partner->next_frag_recv_seq - 1),
-		      (unsigned long long) omx__driver_desc->jiffies,
+		      (unsigned long long) omx__now(),
 		      (unsigned long long) partner->oldest_recv_time_not_acked);
 
     ret = omx__submit_send_liback(ep, partner);
@@ -356,7 +357,7 @@ omx__prepare_progress_wakeup(struct omx_endpoint *ep)
     tmp = partner->oldest_recv_time_not_acked + omx__globals.ack_delay_jiffies;
 
     omx__debug_printf(WAIT, ep, "need to wakeup at %lld jiffies (in %ld) for delayed acks\n",
-		      (unsigned long long) tmp, (unsigned long) (tmp - omx__driver_desc->jiffies));
+		      (unsigned long long) tmp, (unsigned long) (tmp - omx__now()));
 
     if (tmp < wakeup_jiffies || wakeup_jiffies == OMX_NO_WAKEUP_JIFFIES)
       wakeup_jiffies = tmp;
@@ -370,7 +371,7 @@ omx__prepare_progress_wakeup(struct omx_endpoint *ep)
     tmp = req->generic.last_send_jiffies + omx__globals.resend_delay_jiffies;
 
     omx__debug_printf(WAIT, ep, "need to wakeup at %lld jiffies (in %ld) for resend\n",
-		      (unsigned long long) tmp, (unsigned long) (tmp - omx__driver_desc->jiffies));
+		      (unsigned long long) tmp, (unsigned long) (tmp - omx__now()));
 
     if (tmp < wakeup_jiffies || wakeup_jiffies == OMX_NO_WAKEUP_JIFFIES)
       wakeup_jiffies = tmp;
@@ -384,13 +385,14 @@ omx__prepare_progress_wakeup(struct omx_endpoint *ep)
     tmp = req->generic.last_send_jiffies + omx__globals.resend_delay_jiffies;
 
     omx__debug_printf(WAIT, ep, "need to wakeup at %lld jiffies (in %ld) for resend\n",
-		      (unsigned long long) tmp, (unsigned long) (tmp - omx__driver_desc->jiffies));
+		      (unsigned long long) tmp, (unsigned long) (tmp - omx__now()));
 
     if (tmp < wakeup_jiffies || wakeup_jiffies == OMX_NO_WAKEUP_JIFFIES)
       wakeup_jiffies = tmp;
   }
 
-  ep->desc->wakeup_jiffies = wakeup_jiffies;
+  ep->desc->wakeup_jiffies = wakeup_jiffies == OMX_NO_WAKEUP_JIFFIES
+    ? OMX_NO_WAKEUP_JIFFIES : omx__absolute_kernel_jiffies(wakeup_jiffies);
 }
 
 /**********************************
@@ -402,7 +404,7 @@ omx_return_t
 omx_set_request_timeout(struct omx_endpoint *ep,
 			union omx_request *request, uint32_t ms)
 {
-  uint32_t jiffies = omx__timeout_ms_to_relative_jiffies(ms);
+  uint32_t jiffies = omx__relative_kernel_jiffies(omx__timeout_ms_to_relative_jiffies(ms));
   uint32_t resends = omx__timeout_ms_to_resends(ms);
 
   /* no need to lock here, there's no possible race condition or so */
@@ -111,6 +111,36 @@ omx__dump_req_ctxidq(const char * name, const struct list_head *head, int max, i
   printf("%d requests\n", count);
 }
 
+static void
+omx__dump_posted_recv_q(const char * name, const struct omx_endpoint *ep)
+{
+  union omx_request *req;
+  unsigned exact = 0, wildcard = 0;
+  int i, count;
+
+  printf("  %s: ", name);
+  if (omx__globals.debug_signal_level > 1) printf("\n");
+
+  count = 0;
+  for(i=0; i<ep->ctxid_max; i++) {
+    const struct omx__recv_match_queue *queue = &ep->ctxid[i].recv_match;
+    const struct list_head *bucket;
+    unsigned j;
+
+    omx__foreach_posted_recv_bucket(queue, j, bucket) {
+      omx__foreach_request(bucket, req) {
+	omx__dump_request("    ", req);
+	count++;
+      }
+    }
+    exact += queue->exact_nr;
+    wildcard += queue->wildcard_nr;
+  }
+
+  if (omx__globals.debug_signal_level > 1) printf("   Total: ");
+  printf("%d requests (%d exact, %d wildcard)\n", count, exact, wildcard);
+}
+
 static void
 omx__dump_partner_req_q(const char * name, const struct list_head *head)
 {
@@ -150,7 +180,8 @@ omx__dump_partner_early_q(const struct omx__partner *partner)
 static void
 omx__dump_endpoint(struct omx_endpoint *ep, void *data)
 {
-  unsigned i, count;
+  struct omx__partner *partner;
+  unsigned count;
 
   OMX__ENDPOINT_LOCK(ep);
 
@@ -158,9 +189,8 @@ omx__dump_endpoint(struct omx_endpoint *ep, void *data)
 	 ep->endpoint_index, ep->board_index);
 
   count = 0;
-  for(i=0; i<omx__driver_desc->peer_max * omx__driver_desc->endpoint_max; i++) {
-    struct omx__partner *partner = ep->partners[i];
-    if (partner && partner != ep->myself) {
+  omx__foreach_partner(ep, partner) {
+    if (partner != ep->myself) {
       printf("  Partner addr %016llx endpoint %d index %d:\n",
 	     (unsigned long long) partner->board_addr,
 	     (unsigned) partner->endpoint_index,
@@ -185,16 +215,23 @@ omx__dump_endpoint(struct omx_endpoint *ep, void *data)
    }
   }
   printf("   Total %d partners excluding myself\n", count);
+  printf("   Partner table uses %ld bytes (%ld/%ld leaves allocated)\n",
+	 (unsigned long) ep->desc->partners_memory,
+	 (unsigned long) ep->partner_leaves_allocated,
+	 (unsigned long) ep->partner_leaves_nr);
 
+  omx__dump_posted_recv_q("Recv                  ", ep);
   if (unlikely(HAS_CTXIDS(ep))) {
-    omx__dump_req_ctxidq("Recv                  ", &ep->ctxid[0].recv_req_q, ep->ctxid_max, sizeof(ep->ctxid[0]));
     omx__dump_req_ctxidq("Unexpected            ", &ep->ctxid[0].unexp_req_q, ep->ctxid_max, sizeof(ep->ctxid[0]));
     omx__dump_req_ctxidq("Done                  ", &ep->ctxid[0].done_req_q, ep->ctxid_max, sizeof(ep->ctxid[0]));
   } else {
-    omx__dump_req_q("Recv                  ", &ep->ctxid[0].recv_req_q);
     omx__dump_req_q("Unexpected            ", &ep->anyctxid.unexp_req_q); /* ctxid[0].unexp_req_q unused if no ctxids */
     omx__dump_req_q("Done                  ", &ep->anyctxid.done_req_q); /* ctxid[0].done_req_q unused if no ctxids */
   }
+  printf("  Unexpected depth      : %ld (max %ld, %ld index buckets)\n",
+	 (unsigned long) ep->anyctxid.unexp_index.depth,
+	 (unsigned long) ep->anyctxid.unexp_index.depth_max,
+	 (unsigned long) ep->anyctxid.unexp_index.buckets_nr);
   omx__dump_req_q("Missing resources     ", &ep->need_resources_send_req_q);
   omx__dump_req_q("Driver mediumsq sending ", &ep->driver_mediumsq_sending_req_q);
 #ifdef OMX_LIB_DEBUG
@@ -120,7 +120,8 @@ omx__endpoint_sendq_map_exit(struct omx_endpoint * ep)
  * Binding
  */
 
-static void
+/* bind the calling thread, either the whole process or the progress thread */
+void
 omx__endpoint_bind_process(const struct omx_endpoint *ep, const char *bindstring)
 {
   cpu_set_t cs;
@@ -332,6 +333,8 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   uint8_t ctxid_bits;
   uint8_t ctxid_shift;
   omx_error_handler_t error_handler;
+  int progress_thread;
+  int cmdq;
   omx_return_t ret = OMX_SUCCESS;
   int err, fd;
   unsigned i;
@@ -357,6 +360,8 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   error_handler = NULL;
   ctxid_bits = omx__globals.ctxid_bits;
   ctxid_shift = omx__globals.ctxid_shift;
+  progress_thread = omx__globals.progress_thread;
+  cmdq = omx__globals.cmdq;
 
   for(i=0; i<param_count; i++) {
     switch (param_array[i].key) {
@@ -375,6 +380,22 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
 			  ctxid_bits, ctxid_shift);
       break;
     }
+    case OMX_ENDPOINT_PARAM_PROGRESS_THREAD: {
+      progress_thread = param_array[i].val.progress_thread;
+      omx__verbose_printf(NULL, "%s progress thread\n",
+			  progress_thread ? "Enabling" : "Disabling");
+      break;
+    }
+    case OMX_ENDPOINT_PARAM_CMDQ: {
+      cmdq = param_array[i].val.cmdq;
+      if (cmdq && !(omx__driver_desc->features & OMX_DRIVER_FEATURE_CMDQ)) {
+	omx__verbose_printf(NULL, "Driver does not support the command queue, ignoring endpoint parameter\n");
+	cmdq = 0;
+      }
+      omx__verbose_printf(NULL, "%s command queue\n",
+			  cmdq ? "Enabling" : "Disabling");
+      break;
+    }
     default: {
       ret = omx__error(OMX_ENDPOINT_PARAM_BAD_KEY,
 		       "Reading endpoint parameter key %d", (unsigned) key);
@@ -495,6 +516,17 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   ep->unexp_eventq = unexp_eventq;
   ep->next_unexp_event_index = 0;
 
+  /* mmap cmdq if enabled */
+  ep->cmdq = NULL;
+  if (cmdq) {
+    void * cmdq_map = mmap(0, OMX_CMDQ_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, OMX_CMDQ_FILE_OFFSET);
+    if (cmdq_map == MAP_FAILED) {
+      ret = omx__check_mmap("endpoint command queue");
+      goto out_with_unexp_eventq;
+    }
+    ep->cmdq = cmdq_map;
+  }
+
   BUILD_BUG_ON(sizeof(struct omx_evt_recv_msg) != OMX_EVENTQ_ENTRY_SIZE);
   BUILD_BUG_ON(sizeof(union omx_evt) != OMX_EVENTQ_ENTRY_SIZE);
 
@@ -505,19 +537,36 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
 		    ep->board_info.hostname, ep->board_info.ifacename, ep->board_addr_str);
 
   /* init most of the endpoint state */
-  ep->avail_exp_events = OMX_EXP_EVENTQ_ENTRY_NR - (OMX_EXP_RELEASE_SLOTS_BATCH_NR - 1); /* up to BATCH_NR-1 event slots may have been
-											  * processed but not released to the kernel yet */
+  if (omx__globals.release_index) {
+    /* processed event slots are released to the kernel through the endpoint desc */
+    desc->released_exp_eventq_index = 0;
+    desc->released_unexp_eventq_index = 0;
+    desc->user_features |= OMX_ENDPOINT_DESC_USER_FEATURE_RELEASE_INDEX;
+    ep->avail_exp_events = OMX_EXP_EVENTQ_ENTRY_NR - 1; /* the slot being processed is released right after */
+  } else {
+    ep->avail_exp_events = OMX_EXP_EVENTQ_ENTRY_NR - (OMX_EXP_RELEASE_SLOTS_BATCH_NR - 1); /* up to BATCH_NR-1 event slots may have been
+											    * processed but not released to the kernel yet */
+  }
   BUILD_BUG_ON(OMX_EXP_EVENTQ_ENTRY_NR - (OMX_EXP_RELEASE_SLOTS_BATCH_NR - 1)
 	       < OMX_MEDIUM_FRAGS_MAX); /* make sure a single request has enough expected event slots in the ring */
   ep->req_resends_max = omx__globals.req_resends_max;
-  ep->pull_resend_timeout_jiffies = omx__globals.resend_delay_jiffies * omx__globals.req_resends_max;
-  ep->check_status_delay_jiffies = omx__driver_desc->hz; /* once per second */
+  ep->pull_resend_timeout_jiffies = omx__relative_kernel_jiffies(omx__globals.resend_delay_jiffies
+								 * (uint64_t) omx__globals.req_resends_max);
+  ep->check_status_delay_jiffies = omx__globals.hz; /* once per second */
   ep->last_check_jiffies = 0;
 #ifdef OMX_LIB_DEBUG
   ep->last_progress_jiffies = 0;
 #endif
   ep->zombie_max = omx__globals.zombie_max;
   ep->zombies = 0;
+  ep->batch_nr = 0;
+  ep->batch_length = 0;
+  if (ep->cmdq) {
+    /* queued commands are processed by the driver through the endpoint desc */
+    ep->cmdq_index = 0;
+    desc->cmdq_submitted_index = 0;
+    desc->user_features |= OMX_ENDPOINT_DESC_USER_FEATURE_CMDQ;
+  }
   ep->error_handler = error_handler;
   omx__lock(&omx__global_lock);
   ep->message_prefix = omx__create_message_prefix(ep); /* needs endpoint_index to be set */
@@ -527,6 +576,7 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   omx__request_alloc_init(ep);
   omx__lock_init(&ep->lock);
   omx__cond_init(&ep->in_handler_cond);
+  omx__cond_init(&ep->progression_enabled_cond);
 
   /* prepare the large regions */
   ret = omx__endpoint_large_region_map_init(ep);
@@ -536,9 +586,8 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   }
 
   /* allocate partners */
-  ep->partners = omx_calloc_ep(ep, omx__driver_desc->peer_max * omx__driver_desc->endpoint_max,
-			       sizeof(*ep->partners));
-  if (!ep->partners) {
+  ret = omx__partners_init(ep);
+  if (ret != OMX_SUCCESS) {
     ret = omx__error(OMX_NO_RESOURCES, "Allocating new endpoint partners array");
     goto out_with_large_regions;
   }
@@ -559,21 +608,24 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
   ep->ctxid = omx_malloc_ep(ep, ep->ctxid_max * sizeof(*ep->ctxid));
   if (!ep->ctxid) {
     ret = omx__error(OMX_NO_RESOURCES, "Allocating new endpoint ctxids array");
-    goto out_with_myself;
+    goto out_with_partners;
   }
 
   /* init lib specific fieds */
   ep->unexp_handler = NULL;
+  ep->completion_handler = NULL;
   ep->progression_disabled = 0;
 
   list_head_init(&ep->anyctxid.done_req_q);
   list_head_init(&ep->anyctxid.unexp_req_q);
+  omx__unexp_index_init(&ep->anyctxid.unexp_index);
 
   for(i=0; i<ep->ctxid_max; i++) {
     list_head_init(&ep->ctxid[i].unexp_req_q);
-    list_head_init(&ep->ctxid[i].recv_req_q);
+    omx__recv_match_queue_init(&ep->ctxid[i].recv_match);
     list_head_init(&ep->ctxid[i].done_req_q);
   }
+  ep->next_recv_post_stamp = 0;
 
   list_head_init(&ep->need_resources_send_req_q);
   list_head_init(&ep->driver_mediumsq_sending_req_q);
@@ -591,32 +643,60 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
 #endif
 
   list_head_init(&ep->partners_to_ack_immediate_list);
+  ep->next_resend_jiffies = 0;
   ep->last_partners_acking_jiffies = 0;
   list_head_init(&ep->partners_to_ack_delayed_list);
   list_head_init(&ep->throttling_partners_list);
 
   list_head_init(&ep->sleepers);
+  ep->driver_sleeper = NULL;
+  ep->sleepers_signaled = 0;
+  ep->sleepers_driver_wakeups = 0;
 
   ep->desc->user_event_index = 0;
+  ep->fd_armed = 0;
 
   omx__add_endpoint_to_list(ep);
 
   omx__progress(ep);
 
+  /* start the thread last, nothing else touches the endpoint without its lock from now on */
+  ep->progress_thread_running = 0;
+  ep->progress_thread_stopping = 0;
+  if (progress_thread) {
+    ret = omx__progress_thread_start(ep);
+    if (ret != OMX_SUCCESS) {
+      ret = omx__error(ret, "Starting endpoint progress thread");
+      goto out_with_endpoint_in_list;
+    }
+  }
+
   *epp = ep;
 
   return OMX_SUCCESS;
 
- out_with_myself:
-  omx_free_ep(ep, ep->myself);
+ out_with_endpoint_in_list:
+  omx__remove_endpoint_from_list(ep);
+  omx__flush_partners_to_ack(ep);
+  omx__flush_batch(ep);
+  omx__flush_cmdq(ep);
+  omx__destroy_requests_on_close(ep);
+  omx__unexp_index_exit(ep, &ep->anyctxid.unexp_index);
+  for(i=0; i<ep->ctxid_max; i++)
+    omx__recv_match_queue_exit(ep, &ep->ctxid[i].recv_match);
+  omx_free_ep(ep, ep->ctxid);
  out_with_partners:
-  omx_free_ep(ep, ep->partners);
+  omx__partners_exit(ep);
  out_with_large_regions:
   omx__endpoint_large_region_map_exit(ep);
  out_with_message_prefix:
+  omx__request_alloc_exit(ep);
   omx__lock(&omx__global_lock);
   omx_free(ep->message_prefix);
   omx__unlock(&omx__global_lock);
+  if (ep->cmdq)
+    munmap(ep->cmdq, OMX_CMDQ_SIZE);
+ out_with_unexp_eventq:
   munmap((void *) ep->exp_eventq, OMX_EXP_EVENTQ_SIZE);
  out_with_exp_eventq:
   munmap((void *) ep->unexp_eventq, OMX_UNEXP_EVENTQ_SIZE);
@@ -638,6 +718,7 @@ omx_open_endpoint(uint32_t board_index, uint32_t endpoint_index, uint32_t key,
  out_with_ep:
   omx__lock_destroy(&ep->lock);
   omx__cond_destroy(&ep->in_handler_cond);
+  omx__cond_destroy(&ep->progression_enabled_cond);
   omx__lock(&omx__global_lock);
   omx_free(ep);
   omx__unlock(&omx__global_lock);
@@ -659,6 +740,9 @@ omx_close_endpoint(struct omx_endpoint *ep)
     goto out_with_lock;
   }
 
+  if (ep->progress_thread_running)
+    omx__progress_thread_stop(ep);
+
   ret = omx__remove_endpoint_from_list(ep);
   if (ret != OMX_SUCCESS) {
     ret = omx__error(ret, "Closing endpoint");
@@ -666,20 +750,30 @@ omx_close_endpoint(struct omx_endpoint *ep)
   }
 
   omx__flush_partners_to_ack(ep);
+  omx__flush_batch(ep);
+  omx__flush_cmdq(ep);
 
   omx__destroy_requests_on_close(ep);
   omx__request_alloc_check(ep);
   omx__request_alloc_exit(ep);
 
+  if (ep->anyctxid.unexp_index.depth_max)
+    omx__verbose_printf(ep, "Unexpected queue depth reached %ld\n",
+			(unsigned long) ep->anyctxid.unexp_index.depth_max);
+  if (ep->sleepers_signaled || ep->sleepers_driver_wakeups)
+    omx__verbose_printf(ep, "Woke up %ld parked sleepers and %ld times sleepers in the driver\n",
+			ep->sleepers_signaled, ep->sleepers_driver_wakeups);
+  omx__unexp_index_exit(ep, &ep->anyctxid.unexp_index);
+  for(i=0; i<ep->ctxid_max; i++)
+    omx__recv_match_queue_exit(ep, &ep->ctxid[i].recv_match);
   omx_free_ep(ep, ep->ctxid);
-  for(i=0; i<omx__driver_desc->peer_max * omx__driver_desc->endpoint_max; i++)
-    if (ep->partners[i])
-      omx_free_ep(ep, ep->partners[i]);
-  omx_free_ep(ep, ep->partners);
+  omx__partners_exit(ep);
   omx__endpoint_large_region_map_exit(ep);
   omx__lock(&omx__global_lock);
   omx_free(ep->message_prefix);
   omx__unlock(&omx__global_lock);
+  if (ep->cmdq)
+    munmap(ep->cmdq, OMX_CMDQ_SIZE);
   munmap((void *) ep->unexp_eventq, OMX_UNEXP_EVENTQ_SIZE);
   munmap((void *) ep->exp_eventq, OMX_EXP_EVENTQ_SIZE);
   munmap((void *) ep->recvq, OMX_RECVQ_SIZE);
@@ -692,6 +786,7 @@ omx_close_endpoint(struct omx_endpoint *ep)
   ep->fd = -1;
   omx__lock_destroy(&ep->lock);
   omx__cond_destroy(&ep->in_handler_cond);
+  omx__cond_destroy(&ep->progression_enabled_cond);
   omx__lock(&omx__global_lock);
   omx_free(ep);
   omx__unlock(&omx__global_lock);
@@ -760,7 +855,9 @@ omx__destroy_unlinked_request_on_close(struct omx_endpoint *ep, union omx_reques
 
   case OMX_REQUEST_TYPE_RECV_LARGE:
     if (state & OMX_REQUEST_STATE_UNEXPECTED_RECV) {
-      /* nothing to do */
+      /* only the eager prefix may have been buffered */
+      if (req->recv.specific.large.eager_length)
+	omx_free_ep(ep, OMX_SEG_PTR(&req->recv.segs.single));
     } else {
       if (!(resources & OMX_REQUEST_RESOURCE_LARGE_REGION)
 	  && (state & OMX_REQUEST_STATE_RECV_PARTIAL))
@@ -800,15 +897,12 @@ omx__destroy_unlinked_request_on_close(struct omx_endpoint *ep, union omx_reques
 static void
 omx__destroy_requests_on_close(struct omx_endpoint *ep)
 {
+  struct omx__partner *partner;
   union omx_request *req, *next;
   struct omx__early_packet *early, *next_early;
   unsigned i;
 
-  for(i=0; i<omx__driver_desc->peer_max * omx__driver_desc->endpoint_max; i++) {
-    struct omx__partner *partner =  ep->partners[i];
-    if (!partner)
-      continue;
-
+  omx__foreach_partner(ep, partner) {
     /* free early packets */
     omx__foreach_partner_early_packet_safe(partner, early, next_early) {
       omx___dequeue_partner_early_packet(early);
@@ -859,20 +953,25 @@ omx__destroy_requests_on_close(struct omx_endpoint *ep)
   omx__debug_assert(omx__empty_queue(&ep->partial_medium_recv_req_q));
 #endif
 
-  /* free ctxid.recv and ctxid.unexp requests */
+  /* free ctxid.recv requests, hashed and wildcard */
   for(i=0; i<ep->ctxid_max; i++) {
-    omx__foreach_request_safe(&ep->ctxid[i].recv_req_q, req, next) {
-      omx___dequeue_request(req);
-      /* cannot be done */
-      omx__destroy_unlinked_request_on_close(ep, req);
+    struct omx__recv_match_queue *queue = &ep->ctxid[i].recv_match;
+    struct list_head *bucket;
+    unsigned j;
+
+    omx__foreach_posted_recv_bucket(queue, j, bucket) {
+      omx__foreach_request_safe(bucket, req, next) {
+	omx___dequeue_request(req);
+	/* cannot be done */
+	omx__destroy_unlinked_request_on_close(ep, req);
+      }
     }
+    queue->exact_nr = queue->wildcard_nr = 0;
   }
 
   /* free unexp reqs */
   omx__foreach_request_safe(&ep->anyctxid.unexp_req_q, req, next) {
-    omx___dequeue_request(req);
-    if (unlikely(HAS_CTXIDS(ep)))
-      omx___dequeue_ctxid_request(req);
+    omx___dequeue_unexp_request(ep, req);
     /* cannot be done */
     omx__destroy_unlinked_request_on_close(ep, req);
   }
@@ -941,6 +1040,70 @@ omx__destroy_requests_on_close(struct omx_endpoint *ep)
 #endif
 }
 
+/*********************
+ * Request allocation
+ */
+
+int
+omx__request_alloc_grow(struct omx_endpoint *ep)
+{
+  struct omx__request_chunk *chunk;
+  unsigned i;
+
+  chunk = omx_malloc_ep(ep, OMX__REQUEST_CHUNK_SIZE);
+  if (unlikely(!chunk))
+    return -1;
+
+  chunk->next = ep->req_chunks;
+  ep->req_chunks = chunk;
+  ep->req_chunks_nr++;
+
+  for(i=0; i<OMX__REQUEST_CHUNK_NR; i++)
+    list_add_tail(&chunk->reqs[i].generic.queue_elt, &ep->req_free_list);
+
+  return 0;
+}
+
+void
+omx__request_alloc_init(struct omx_endpoint *ep)
+{
+  unsigned nr;
+
+  list_head_init(&ep->req_free_list);
+  ep->req_chunks = NULL;
+  ep->req_chunks_nr = 0;
+#ifdef OMX_LIB_DEBUG
+  ep->req_alloc_nr = 0;
+#endif
+
+  /* warm the free list, requests will be allocated on demand if it fails */
+  for(nr=0; nr<omx__globals.req_prealloc; nr+=OMX__REQUEST_CHUNK_NR)
+    if (omx__request_alloc_grow(ep) < 0)
+      break;
+}
+
+void
+omx__request_alloc_exit(struct omx_endpoint *ep)
+{
+  struct omx__request_chunk *chunk, *next;
+
+#ifdef OMX_LIB_DEBUG
+  if (ep->req_alloc_nr)
+    omx__verbose_printf(ep, "%d requests were not freed on endpoint close\n", ep->req_alloc_nr);
+#endif
+
+  omx__debug_printf(ENDPOINT, ep, "releasing %d request chunks of %ld requests\n",
+		    ep->req_chunks_nr, (unsigned long) OMX__REQUEST_CHUNK_NR);
+
+  for(chunk = ep->req_chunks; chunk; chunk = next) {
+    next = chunk->next;
+    omx_free_ep(ep, chunk);
+  }
+  ep->req_chunks = NULL;
+  ep->req_chunks_nr = 0;
+  list_head_init(&ep->req_free_list);
+}
+
 /***************************
  * Request Allocation Debug
  */
@@ -951,7 +1114,7 @@ omx__request_alloc_check(const struct omx_endpoint *ep)
   unsigned i, j, nr = 0;
 
   for(i=0; i<ep->ctxid_max; i++) {
-    j = omx__queue_count(&ep->ctxid[i].recv_req_q);
+    j = omx__posted_recv_queue_count(&ep->ctxid[i].recv_match);
     if (j > 0) {
       nr += j;
       if (omx__globals.check_request_alloc > 2)
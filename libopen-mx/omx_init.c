@@ -28,6 +28,8 @@
 #include "omx_wire.h"
 
 #define OMX_ZOMBIE_MAX_DEFAULT 512
+/* larger messages need more than one push request, they are pulled anyway */
+#define OMX_PUSH_MAX_DEFAULT (OMX_PULL_PUSH_REPLIES_MAX*OMX_PULL_REPLY_LENGTH_MAX)
 
 #ifdef OMX_LIB_THREAD_SAFETY
 struct omx__lock omx__global_lock = OMX__LOCK_INITIALIZER;
@@ -253,12 +255,67 @@ omx__init_comms(void)
   int debug_signum = SIGUSR1;
   char *env;
 
-  /***************
-   * Misc globals
+  /**************
+   * Time source
    */
 
+  omx__globals.clock_source = OMX__CLOCK_JIFFIES;
+  omx__globals.hz = omx__driver_desc->hz;
+#ifdef OMX_HAVE_CLOCK_GETTIME
+  {
+    enum omx__clock_source source = OMX__CLOCK_MONOTONIC_COARSE;
+    struct timespec ts;
+
+    env = getenv("OMX_CLOCK");
+    if (env) {
+      if (!strcmp(env, "jiffies"))
+	source = OMX__CLOCK_JIFFIES;
+      else if (!strcmp(env, "coarse"))
+	source = OMX__CLOCK_MONOTONIC_COARSE;
+      else if (!strcmp(env, "monotonic"))
+	source = OMX__CLOCK_MONOTONIC;
+      else
+	omx__abort(NULL, "Unknown clock source '%s'\n", env);
+      omx__verbose_printf(NULL, "Forcing clock source to %s\n", env);
+    }
+
+#ifdef CLOCK_MONOTONIC_COARSE
+    if (source == OMX__CLOCK_MONOTONIC_COARSE && !clock_gettime(CLOCK_MONOTONIC_COARSE, &ts)) {
+      omx__globals.clock_source = OMX__CLOCK_MONOTONIC_COARSE;
+      omx__globals.clock_id = CLOCK_MONOTONIC_COARSE;
+    } else
+#endif
+    if (source != OMX__CLOCK_JIFFIES && !clock_gettime(CLOCK_MONOTONIC, &ts)) {
+      /* also used when the coarse clock is not supported */
+      omx__globals.clock_source = OMX__CLOCK_MONOTONIC;
+      omx__globals.clock_id = CLOCK_MONOTONIC;
+    }
+
+    if (omx__globals.clock_source != OMX__CLOCK_JIFFIES)
+      omx__globals.hz = 1000000;
+  }
+#endif
+  omx__debug_printf(WAIT, NULL, "Using %s clock source with %ld jiffies per second\n",
+		    omx__globals.clock_source == OMX__CLOCK_JIFFIES ? "driver jiffies"
+		    : omx__globals.clock_source == OMX__CLOCK_MONOTONIC_COARSE ? "coarse monotonic"
+		    : "monotonic",
+		    (unsigned long) omx__globals.hz);
+
   omx__globals.ack_delay_jiffies = omx__ack_delay_jiffies();
+  env = getenv("OMX_ACK_DELAY");
+  if (env) {
+    omx__globals.ack_delay_jiffies = omx__us_to_relative_jiffies(atoi(env));
+    omx__verbose_printf(NULL, "Forcing ack delay to %s us (%ld jiffies)\n",
+			env, (unsigned long) omx__globals.ack_delay_jiffies);
+  }
+
   omx__globals.resend_delay_jiffies = omx__resend_delay_jiffies();
+  env = getenv("OMX_RESEND_DELAY");
+  if (env) {
+    omx__globals.resend_delay_jiffies = omx__us_to_relative_jiffies(atoi(env));
+    omx__verbose_printf(NULL, "Forcing resend delay to %s us (%ld jiffies)\n",
+			env, (unsigned long) omx__globals.resend_delay_jiffies);
+  }
 
   /********************************
    * Endpoint debug initialization
@@ -339,6 +396,104 @@ omx__init_comms(void)
     }
   }
 
+  /* event slot release configuration */
+  omx__globals.release_index = (omx__driver_desc->features & OMX_DRIVER_FEATURE_RELEASE_INDEX);
+  env = getenv("OMX_RELEASE_IOCTL");
+  if (env) {
+    omx__globals.release_index = !atoi(env) && omx__globals.release_index;
+    omx__verbose_printf(NULL, "Forcing event slot release through %s\n",
+			omx__globals.release_index ? "the endpoint descriptor" : "ioctls");
+  }
+
+  /* mediumsq submission configuration */
+  omx__globals.mediumsq_whole = (omx__driver_desc->features & OMX_DRIVER_FEATURE_SEND_MEDIUMSQ);
+  env = getenv("OMX_MEDIUMSQ_FRAG_IOCTL");
+  if (env) {
+    omx__globals.mediumsq_whole = !atoi(env) && omx__globals.mediumsq_whole;
+    omx__verbose_printf(NULL, "Forcing mediumsq submission with %s\n",
+			omx__globals.mediumsq_whole ? "a single ioctl per message" : "one ioctl per fragment");
+  }
+
+  /* batched submission configuration */
+  omx__globals.submit_batch = 0;
+  env = getenv("OMX_SUBMIT_BATCH");
+  if (env) {
+    omx__globals.submit_batch = atoi(env);
+    if (omx__globals.submit_batch && !(omx__driver_desc->features & OMX_DRIVER_FEATURE_SUBMIT_BATCH)) {
+      omx__verbose_printf(NULL, "Driver does not support batched submission, ignoring OMX_SUBMIT_BATCH\n");
+      omx__globals.submit_batch = 0;
+    }
+    omx__verbose_printf(NULL, "Submitting small commands %s\n",
+			omx__globals.submit_batch ? "in batches" : "one ioctl at a time");
+  }
+
+  /* command queue configuration */
+  omx__globals.cmdq = 0;
+  env = getenv("OMX_CMDQ");
+  if (env) {
+    omx__globals.cmdq = atoi(env);
+    if (omx__globals.cmdq && !(omx__driver_desc->features & OMX_DRIVER_FEATURE_CMDQ)) {
+      omx__verbose_printf(NULL, "Driver does not support the command queue, ignoring OMX_CMDQ\n");
+      omx__globals.cmdq = 0;
+    }
+    omx__verbose_printf(NULL, "%s the command queue by default\n",
+			omx__globals.cmdq ? "Enabling" : "Disabling");
+  }
+
+  /* tiny/small message aggregation configuration */
+  omx__globals.aggregate = 0;
+  env = getenv("OMX_AGGREGATE");
+  if (env) {
+    omx__globals.aggregate = atoi(env);
+    if (omx__globals.aggregate && !(omx__driver_desc->features & OMX_DRIVER_FEATURE_AGGREGATE)) {
+      omx__verbose_printf(NULL, "Driver does not support message aggregation, ignoring OMX_AGGREGATE\n");
+      omx__globals.aggregate = 0;
+    }
+    omx__verbose_printf(NULL, "%s tiny/small message aggregation\n",
+			omx__globals.aggregate ? "Enabling" : "Disabling");
+  }
+
+  /* large message sender-push configuration */
+  omx__globals.push = 0;
+  env = getenv("OMX_PUSH");
+  if (env) {
+    omx__globals.push = atoi(env);
+    if (omx__globals.push && !(omx__driver_desc->features & OMX_DRIVER_FEATURE_PUSH)) {
+      omx__verbose_printf(NULL, "Driver does not support large message push, ignoring OMX_PUSH\n");
+      omx__globals.push = 0;
+    }
+    omx__verbose_printf(NULL, "%s large message push\n",
+			omx__globals.push ? "Enabling" : "Disabling");
+  }
+  omx__globals.push_max = OMX_PUSH_MAX_DEFAULT;
+  env = getenv("OMX_PUSH_MAX");
+  if (env) {
+    omx__globals.push_max = atoi(env);
+    omx__verbose_printf(NULL, "Forcing large message push up to %d bytes\n",
+			omx__globals.push_max);
+  }
+
+  /* rndv eager prefix configuration */
+  omx__globals.rndv_eager = 0;
+#ifndef OMX_MX_WIRE_COMPAT
+  env = getenv("OMX_RNDV_EAGER");
+  if (env) {
+    unsigned val = atoi(env);
+    if (val && !(omx__driver_desc->features & OMX_DRIVER_FEATURE_RNDV_EAGER)) {
+      omx__verbose_printf(NULL, "Driver does not support rndv eager prefixes, ignoring OMX_RNDV_EAGER\n");
+      val = 0;
+    }
+    if (val > OMX_RNDV_EAGER_LENGTH_MAX) {
+      omx__verbose_printf(NULL, "Cannot send more than %ld bytes within rndv\n",
+			  (unsigned long) OMX_RNDV_EAGER_LENGTH_MAX);
+      val = OMX_RNDV_EAGER_LENGTH_MAX;
+    }
+    omx__globals.rndv_eager = val;
+    omx__verbose_printf(NULL, "Forcing rndv eager prefix to %d bytes\n",
+			omx__globals.rndv_eager);
+  }
+#endif
+
   /******************
    * Rndv thresholds
    */
@@ -441,6 +596,15 @@ omx__init_comms(void)
 			omx__globals.not_acked_max);
   }
 
+  /* request preallocation */
+  omx__globals.req_prealloc = 128;
+  env = getenv("OMX_REQ_PREALLOC");
+  if (env) {
+    omx__globals.req_prealloc = atoi(env);
+    omx__verbose_printf(NULL, "Forcing request preallocation to %ld per endpoint\n",
+			(unsigned long) omx__globals.req_prealloc);
+  }
+
   /*************************
    * Sleeping configuration
    */
@@ -503,11 +667,31 @@ omx__init_comms(void)
 			omx__globals.regcache ? "enabled" : "disabled");
   }
 
+  omx__globals.regcache_unused_max = OMX_USER_REGION_MAX;
+  env = getenv("OMX_RCACHE_UNUSED_MAX");
+  if (env) {
+    omx__globals.regcache_unused_max = atoi(env);
+    omx__verbose_printf(NULL, "Forcing regcache to keep at most %ld unused regions\n",
+			(unsigned long) omx__globals.regcache_unused_max);
+  }
+
   /******************
    * Process binding
    */
   omx__globals.process_binding = getenv("OMX_PROCESS_BINDING");
 
+  /******************
+   * Progress thread
+   */
+  omx__globals.progress_thread = 0;
+  env = getenv("OMX_PROGRESS_THREAD");
+  if (env) {
+    omx__globals.progress_thread = atoi(env);
+    omx__verbose_printf(NULL, "Forcing progress thread to %s\n",
+			omx__globals.progress_thread ? "enabled" : "disabled");
+  }
+  omx__globals.progress_thread_binding = getenv("OMX_PROGRESS_THREAD_BINDING");
+
   /********************
    * Tune medium frags
    */
@@ -27,6 +27,214 @@
 #include "omx_request.h"
 #include "omx_segments.h"
 
+/*******************************
+ * Registration cache interval tree
+ */
+
+/*
+ * Contigous regions are kept in an AVL tree ordered by their start address
+ * (and by their address in memory to break ties). Each node also stores the
+ * highest end address of its subtree so that regions overlapping a segment
+ * may be found without scanning the whole tree.
+ */
+
+#define omx__regcache_node_region(node) containerof(node, struct omx__large_region, reg_node)
+
+static INLINE int
+omx__regcache_node_height(const struct omx__regcache_node *node)
+{
+  return node ? node->height : 0;
+}
+
+static INLINE void
+omx__regcache_node_update(struct omx__regcache_node *node)
+{
+  int lheight = omx__regcache_node_height(node->left);
+  int rheight = omx__regcache_node_height(node->right);
+
+  node->height = 1 + (lheight > rheight ? lheight : rheight);
+  node->max_end = node->end;
+  if (node->left && node->left->max_end > node->max_end)
+    node->max_end = node->left->max_end;
+  if (node->right && node->right->max_end > node->max_end)
+    node->max_end = node->right->max_end;
+}
+
+static INLINE int
+omx__regcache_node_before(const struct omx__regcache_node *node1,
+			  const struct omx__regcache_node *node2)
+{
+  return node1->begin < node2->begin
+    || (node1->begin == node2->begin && (uintptr_t) node1 < (uintptr_t) node2);
+}
+
+static struct omx__regcache_node *
+omx__regcache_rotate_right(struct omx__regcache_node *node)
+{
+  struct omx__regcache_node *left = node->left;
+
+  node->left = left->right;
+  left->right = node;
+  omx__regcache_node_update(node);
+  omx__regcache_node_update(left);
+  return left;
+}
+
+static struct omx__regcache_node *
+omx__regcache_rotate_left(struct omx__regcache_node *node)
+{
+  struct omx__regcache_node *right = node->right;
+
+  node->right = right->left;
+  right->left = node;
+  omx__regcache_node_update(node);
+  omx__regcache_node_update(right);
+  return right;
+}
+
+static struct omx__regcache_node *
+omx__regcache_balance(struct omx__regcache_node *node)
+{
+  int balance;
+
+  omx__regcache_node_update(node);
+  balance = omx__regcache_node_height(node->left) - omx__regcache_node_height(node->right);
+
+  if (balance > 1) {
+    if (omx__regcache_node_height(node->left->left) < omx__regcache_node_height(node->left->right))
+      node->left = omx__regcache_rotate_left(node->left);
+    return omx__regcache_rotate_right(node);
+  }
+
+  if (balance < -1) {
+    if (omx__regcache_node_height(node->right->right) < omx__regcache_node_height(node->right->left))
+      node->right = omx__regcache_rotate_right(node->right);
+    return omx__regcache_rotate_left(node);
+  }
+
+  return node;
+}
+
+static struct omx__regcache_node *
+omx__regcache_insert(struct omx__regcache_node *root, struct omx__regcache_node *node)
+{
+  if (!root) {
+    node->left = node->right = NULL;
+    omx__regcache_node_update(node);
+    return node;
+  }
+
+  if (omx__regcache_node_before(node, root))
+    root->left = omx__regcache_insert(root->left, node);
+  else
+    root->right = omx__regcache_insert(root->right, node);
+
+  return omx__regcache_balance(root);
+}
+
+static struct omx__regcache_node *
+omx__regcache_remove_first(struct omx__regcache_node *root, struct omx__regcache_node **firstp)
+{
+  if (!root->left) {
+    *firstp = root;
+    return root->right;
+  }
+
+  root->left = omx__regcache_remove_first(root->left, firstp);
+  return omx__regcache_balance(root);
+}
+
+static struct omx__regcache_node *
+omx__regcache_remove(struct omx__regcache_node *root, struct omx__regcache_node *node)
+{
+  omx__debug_assert(root);
+
+  if (root == node) {
+    struct omx__regcache_node *left = node->left, *right = node->right, *first;
+
+    if (!right)
+      return left;
+
+    /* replace the removed node with the first one of its right subtree */
+    right = omx__regcache_remove_first(right, &first);
+    first->left = left;
+    first->right = right;
+    return omx__regcache_balance(first);
+  }
+
+  if (omx__regcache_node_before(node, root))
+    root->left = omx__regcache_remove(root->left, node);
+  else
+    root->right = omx__regcache_remove(root->right, node);
+
+  return omx__regcache_balance(root);
+}
+
+/* find the first region starting at vaddr that may be reused for length bytes */
+static struct omx__large_region *
+omx__regcache_find_reusable(struct omx__regcache_node *node,
+			    unsigned long vaddr, unsigned long length,
+			    const void *reserver)
+{
+  struct omx__large_region *region;
+
+  while (node && node->begin != vaddr)
+    node = vaddr < node->begin ? node->left : node->right;
+  if (!node)
+    return NULL;
+
+  /* regions with the same start address may be on both sides */
+  region = omx__regcache_find_reusable(node->left, vaddr, length, reserver);
+  if (region)
+    return region;
+
+  region = omx__regcache_node_region(node);
+  if ((!reserver || !region->reserver)
+      && (omx__globals.parallel_regcache || !region->use_count)
+      && node->end - node->begin >= length)
+    return region;
+
+  return omx__regcache_find_reusable(node->right, vaddr, length, reserver);
+}
+
+/* find the first region intersecting [begin:end[ */
+static struct omx__large_region *
+omx__regcache_find_overlap(struct omx__regcache_node *node,
+			   unsigned long begin, unsigned long end)
+{
+  struct omx__large_region *region;
+
+  if (!node || node->max_end <= begin)
+    return NULL;
+
+  region = omx__regcache_find_overlap(node->left, begin, end);
+  if (region)
+    return region;
+
+  if (node->begin >= end)
+    /* this node and its right subtree start after the segment */
+    return NULL;
+
+  if (node->end > begin)
+    return omx__regcache_node_region(node);
+
+  return omx__regcache_find_overlap(node->right, begin, end);
+}
+
+static INLINE void
+omx__regcache_unused_add(struct omx_endpoint *ep, struct omx__large_region *region)
+{
+  list_add_tail(&region->reg_unused_elt, &ep->reg_unused_list);
+  ep->reg_unused_nr++;
+}
+
+static INLINE void
+omx__regcache_unused_del(struct omx_endpoint *ep, struct omx__large_region *region)
+{
+  list_del(&region->reg_unused_elt);
+  ep->reg_unused_nr--;
+}
+
 /***********************
  * Region Map managment
  */
@@ -56,8 +264,9 @@ omx__endpoint_large_region_map_init(struct omx_endpoint * ep)
   ep->large_region_map.first_free = 0;
   ep->large_region_map.nr_free = OMX_USER_REGION_MAX;
 
-  list_head_init(&ep->reg_list);
+  ep->reg_tree = NULL;
   list_head_init(&ep->reg_unused_list);
+  ep->reg_unused_nr = 0;
   list_head_init(&ep->reg_vect_list);
   ep->large_sends_avail_nr = OMX_USER_REGION_MAX/2;
 
@@ -117,9 +326,10 @@ omx__endpoint_large_region_map_exit(struct omx_endpoint * ep)
 {
   struct omx__large_region *region, *next;
 
-  list_for_each_entry_safe(region, next, &ep->reg_list, reg_elt) {
+  while (ep->reg_tree) {
+    region = omx__regcache_node_region(ep->reg_tree);
     if (!region->use_count)
-      list_del(&region->reg_unused_elt);
+      omx__regcache_unused_del(ep, region);
     omx__destroy_region(ep, region);
   }
 
@@ -199,13 +409,29 @@ omx__destroy_region(struct omx_endpoint *ep,
 		    struct omx__large_region *region)
 {
   omx__deregister_region(ep, region);
-  list_del(&region->reg_elt);
+  if (region->segs.nseg > 1)
+    list_del(&region->reg_elt);
+  else
+    ep->reg_tree = omx__regcache_remove(ep->reg_tree, &region->reg_node);
   /* no need to free the reqseqs segment array since the request owns it
    * (see omx__create_region())
    */
   omx__endpoint_large_region_free(ep, region);
 }
 
+/* destroy the least recently used unused region */
+static INLINE void
+omx__regcache_release_lru(struct omx_endpoint *ep)
+{
+  struct omx__large_region *region;
+
+  region = list_first_entry(&ep->reg_unused_list, struct omx__large_region, reg_unused_elt);
+  omx__debug_printf(LARGE, ep, "regcache releasing unused region %d\n", region->id);
+  omx__regcache_unused_del(ep, region);
+  omx__debug_printf(LARGE, ep, "destroying region %d\n", region->id);
+  omx__destroy_region(ep, region);
+}
+
 static INLINE omx_return_t
 omx__endpoint_large_region_alloc(struct omx_endpoint *ep, struct omx__large_region **regionp)
 {
@@ -217,12 +443,7 @@ omx__endpoint_large_region_alloc(struct omx_endpoint *ep, struct omx__large_regi
   if (unlikely(ret == OMX_INTERNAL_MISSING_RESOURCES && omx__globals.regcache)) {
     /* try to free some unused region in the cache */
     if (!list_empty(&ep->reg_unused_list)) {
-      struct omx__large_region *region;
-      region = list_first_entry(&ep->reg_unused_list, struct omx__large_region, reg_unused_elt);
-      omx__debug_printf(LARGE, ep, "regcache releasing unused region %d\n", region->id);
-      list_del(&region->reg_unused_elt);
-      omx__debug_printf(LARGE, ep, "destroying region %d\n", region->id);
-      omx__destroy_region(ep, region);
+      omx__regcache_release_lru(ep);
 
       /* try again now, it should work */
       ret = omx__endpoint_large_region_try_alloc(ep, regionp);
@@ -287,17 +508,12 @@ omx__get_contigous_region(struct omx_endpoint *ep,
 
   if (omx__globals.regcache) {
     const struct omx_cmd_user_segment *seg = &reqsegs->single;
-    list_for_each_entry(region, &ep->reg_list, reg_elt) {
-      if ((!reserver || !region->reserver)
-	  && (omx__globals.parallel_regcache || !region->use_count)
-	  && region->segs.single.vaddr == seg->vaddr
-	  && region->segs.single.len >= seg->len) {
-
-	if (!(region->use_count++))
-	  list_del(&region->reg_unused_elt);
-	omx__debug_printf(LARGE, ep, "regcache reusing region %d (usecount %d)\n", region->id, region->use_count);
-	goto found;
-      }
+    region = omx__regcache_find_reusable(ep->reg_tree, seg->vaddr, seg->len, reserver);
+    if (region) {
+      if (!(region->use_count++))
+	omx__regcache_unused_del(ep, region);
+      omx__debug_printf(LARGE, ep, "regcache reusing region %d (usecount %d)\n", region->id, region->use_count);
+      goto found;
     }
   }
 
@@ -306,7 +522,9 @@ omx__get_contigous_region(struct omx_endpoint *ep,
     /* let the caller handle the error */
     goto out;
 
-  list_add_tail(&region->reg_elt, &ep->reg_list);
+  region->reg_node.begin = region->segs.single.vaddr;
+  region->reg_node.end = region->segs.single.vaddr + region->segs.single.len;
+  ep->reg_tree = omx__regcache_insert(ep->reg_tree, &region->reg_node);
   region->use_count++;
   omx__debug_printf(LARGE, ep, "created contigous region %d (usecount %d)\n", region->id, region->use_count);
 
@@ -390,9 +608,16 @@ omx__put_region(struct omx_endpoint *ep,
   }
 
   if (omx__globals.regcache && region->segs.nseg == 1) {
-    if (!region->use_count)
-      list_add_tail(&region->reg_unused_elt, &ep->reg_unused_list);
+    if (!region->use_count) {
+      omx__regcache_unused_add(ep, region);
+      /* bound the number of cached unused regions by evicting the least recently used */
+      if (ep->reg_unused_nr > omx__globals.regcache_unused_max)
+	omx__regcache_release_lru(ep);
+    }
     omx__debug_printf(LARGE, ep, "regcache keeping region %d (usecount %d)\n", region->id, region->use_count);
+  } else if (region->use_count) {
+    /* still pinned by a persistent request */
+    omx__debug_printf(LARGE, ep, "keeping region %d (usecount %d)\n", region->id, region->use_count);
   } else {
     omx__debug_printf(LARGE, ep, "destroying region %d\n", region->id);
     omx__destroy_region(ep, region);
@@ -405,16 +630,6 @@ omx__put_region(struct omx_endpoint *ep,
  * Invalid Regcache Entries
  */
 
-static INLINE int
-omx__segments_intersect(unsigned long begin1, unsigned long end1,
-			unsigned long begin2, unsigned long end2)
-{
-  /* [a:b] intersecs [c:d] if min(b,d) > max(a,c) */
-  unsigned long min_end = end1 > end2 ? end2 : end1;
-  unsigned long max_begin = begin1 > begin2 ? begin1 : begin2;
-  return min_end > max_begin;
-}
-
 struct omx_regcache_clean_segment {
   unsigned long begin, end;
 };
@@ -422,31 +637,28 @@ struct omx_regcache_clean_segment {
 static void
 omx__endpoint_regcache_clean(struct omx_endpoint *ep, void *data)
 {
-  struct omx__large_region *region, *next;
+  struct omx__large_region *region;
   struct omx_regcache_clean_segment *inval_seg = (void *)data;
 
   OMX__ENDPOINT_LOCK(ep);
-  list_for_each_entry_safe(region, next, &ep->reg_list, reg_elt) {
+  /* destroy all regions whose segment intersects the invalidated segment */
+  while ((region = omx__regcache_find_overlap(ep->reg_tree, inval_seg->begin, inval_seg->end)) != NULL) {
     unsigned long reg_begin = region->segs.single.vaddr;
     unsigned long reg_end = reg_begin + region->segs.single.len;
 
-    /* If the invalidated segment intersects the region segment */
-    if (omx__segments_intersect(inval_seg->begin, inval_seg->end, reg_begin, reg_end)) {
-
-      if (region->use_count)
-	/* Invalidating a region that's being used is an application bug */
-	omx__abort(ep, "Application is freeing segment [%lx:%lx] under use by region %d segment [%lx:%lx]\n",
-		   inval_seg->begin, inval_seg->end,
-		   (unsigned) region->id,
-		   reg_begin, reg_end);
-
-      omx__verbose_printf(ep, "cleaning regcache [0x%lx:0x%lx] for region #%d segment [0x%lx:0x%lx]\n",
-			  inval_seg->begin, inval_seg->end,
-			  (unsigned) region->id,
-			  reg_begin, reg_end);
-      list_del(&region->reg_unused_elt);
-      omx__destroy_region(ep, region);
-    }
+    if (region->use_count)
+      /* Invalidating a region that's being used is an application bug */
+      omx__abort(ep, "Application is freeing segment [%lx:%lx] under use by region %d segment [%lx:%lx]\n",
+		 inval_seg->begin, inval_seg->end,
+		 (unsigned) region->id,
+		 reg_begin, reg_end);
+
+    omx__verbose_printf(ep, "cleaning regcache [0x%lx:0x%lx] for region #%d segment [0x%lx:0x%lx]\n",
+			inval_seg->begin, inval_seg->end,
+			(unsigned) region->id,
+			reg_begin, reg_end);
+    omx__regcache_unused_del(ep, region);
+    omx__destroy_region(ep, region);
   }
   OMX__ENDPOINT_UNLOCK(ep);
 }
@@ -511,15 +723,20 @@ omx__alloc_setup_pull(struct omx_endpoint * ep,
   pull_param.peer_index = partner->peer_index;
   pull_param.dest_endpoint = partner->endpoint_index;
   pull_param.shared = omx__partner_localization_shared(partner);
-  pull_param.length = xfer_length;
+  /* the eager prefix was received within the rndv */
+  pull_param.length = xfer_length - req->recv.specific.large.eager_length;
   pull_param.session_id = partner->back_session_id;
   pull_param.lib_cookie = (uintptr_t) req;
   pull_param.puller_rdma_id = region->id;
   pull_param.pulled_rdma_id = req->recv.specific.large.pulled_rdma_id;
   pull_param.pulled_rdma_seqnum = req->recv.specific.large.pulled_rdma_seqnum;
   pull_param.pulled_rdma_offset = req->recv.specific.large.pulled_rdma_offset;
+  pull_param.puller_rdma_offset = req->recv.specific.large.eager_length;
   pull_param.resend_timeout_jiffies = ep->pull_resend_timeout_jiffies;
+  pull_param.flags = partner->push && !pull_param.shared && xfer_length <= omx__globals.push_max
+    ? OMX_CMD_PULL_FLAG_PUSH : 0;
 
+  omx__flush_batch(ep); /* keep submission ordered */
   err = ioctl(ep->fd, OMX_CMD_PULL, &pull_param);
   if (unlikely(err < 0)) {
     ret = omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
@@ -547,7 +764,7 @@ omx__submit_pull(struct omx_endpoint * ep,
 {
   omx_return_t ret;
 
-  if (req->generic.status.xfer_length) {
+  if (req->generic.status.xfer_length > req->recv.specific.large.eager_length) {
     /* we need to pull some data */
     req->generic.missing_resources = OMX_REQUEST_PULL_RESOURCES;
     ret = omx__alloc_setup_pull(ep, req);
@@ -559,7 +776,7 @@ omx__submit_pull(struct omx_endpoint * ep,
     }
 
   } else {
-    /* nothing to transfer, just send the notify.
+    /* nothing to transfer, or everything came within the rndv, just send the notify.
      * but we want to piggyack the rndv here too,
      * so we queue, let progression finish processing events,
      * and then send the notify as a queued request with correct piggyack
@@ -670,6 +887,7 @@ omx__submit_discarded_notify(struct omx_endpoint *ep, const struct omx__partner
   fakereq->recv.specific.large.pulled_rdma_id = rdma_id;
   fakereq->recv.specific.large.pulled_rdma_seqnum = rdma_seqnum;
   fakereq->recv.specific.large.pulled_rdma_offset = rdma_offset;
+  fakereq->recv.specific.large.eager_length = 0;
   ep->zombies++;
 
   omx__submit_notify(ep, fakereq, 1 /* always delayed */);
@@ -21,6 +21,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <errno.h>
 
 #include "omx_io.h"
 #include "omx_lib.h"
@@ -75,8 +76,14 @@ omx__process_event(struct omx_endpoint * ep, const union omx_evt * evt)
   case OMX_EVT_RECV_RNDV: {
     const struct omx_evt_recv_msg * msg = &evt->recv_msg;
     uint32_t msg_length = msg->specific.rndv.msg_length;
+    const char * recvq_buffer = NULL;
+#ifndef OMX_MX_WIRE_COMPAT
+    /* the eager prefix, if any, is in the recvq */
+    if (msg->specific.rndv.eager_length)
+      recvq_buffer = ep->recvq + msg->specific.rndv.recvq_offset;
+#endif
     omx__process_recv(ep,
-		      msg, NULL, msg_length,
+		      msg, recvq_buffer, msg_length,
 		      omx__process_recv_rndv);
     break;
   }
@@ -89,9 +96,13 @@ omx__process_event(struct omx_endpoint * ep, const union omx_evt * evt)
     break;
   }
 
-  case OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE: {
+  case OMX_EVT_SEND_MEDIUMSQ_FRAG_DONE:
+  case OMX_EVT_SEND_MEDIUMSQ_DONE: {
+    /* the whole-message event reports the offset of the first frag at the same place */
     omx_sendq_map_index_t sendq_index = evt->send_mediumsq_frag_done.sendq_offset >> OMX_SENDQ_ENTRY_SHIFT;
     union omx_request * req = omx__endpoint_sendq_map_user(ep, sendq_index);
+    uint32_t frags_done = evt->generic.type == OMX_EVT_SEND_MEDIUMSQ_DONE
+      ? evt->send_mediumsq_done.frags_nr : 1;
 
     omx__debug_assert(req);
     omx__debug_assert(req->generic.type == OMX_REQUEST_TYPE_SEND_MEDIUMSQ);
@@ -99,7 +110,8 @@ omx__process_event(struct omx_endpoint * ep, const union omx_evt * evt)
     ep->avail_exp_events++;
 
     /* message is not done */
-    if (unlikely(--req->send.specific.mediumsq.frags_pending_nr))
+    req->send.specific.mediumsq.frags_pending_nr -= frags_done;
+    if (unlikely(req->send.specific.mediumsq.frags_pending_nr))
       break;
 
     req->generic.state &= ~OMX_REQUEST_STATE_DRIVER_MEDIUMSQ_SENDING;
@@ -146,7 +158,7 @@ omx__process_event(struct omx_endpoint * ep, const union omx_evt * evt)
 static INLINE void
 omx__check_endpoint_desc(struct omx_endpoint * ep)
 {
-  uint64_t now = omx__driver_desc->jiffies;
+  uint64_t now = omx__now();
   uint64_t last = ep->last_check_jiffies;
   uint64_t driver_status;
   struct omx__partner *partner;
@@ -196,26 +208,113 @@ static INLINE void
 omx__check_enough_progression(struct omx_endpoint * ep)
 {
 #ifdef OMX_LIB_DEBUG
-  unsigned long long now = omx__driver_desc->jiffies;
+  unsigned long long now = omx__now();
   unsigned long long last = ep->last_progress_jiffies;
   unsigned long long delay = now - last;
 
-  if (last && delay > omx__driver_desc->hz)
+  if (last && delay > omx__globals.hz)
     omx__verbose_printf(ep, "No progression occured in the last %lld seconds (%lld jiffies)\n",
-			delay/omx__driver_desc->hz, delay);
+			delay/omx__globals.hz, delay);
 
   ep->last_progress_jiffies = now;
 #endif
 }
 
+/* submit all batched commands at once */
+void
+omx__flush_batch(struct omx_endpoint *ep)
+{
+  struct omx_cmd_submit_batch batch_param;
+  int err;
+
+  if (likely(!ep->batch_nr))
+    return;
+
+  batch_param.nr = ep->batch_nr;
+  batch_param.length = ep->batch_length;
+  batch_param.buffer = (uintptr_t) ep->batch_buffer;
+
+  omx__debug_printf(SEND, ep, "submitting a batch of %ld commands (%ld bytes)\n",
+		    (unsigned long) ep->batch_nr, (unsigned long) ep->batch_length);
+
+  err = ioctl(ep->fd, OMX_CMD_SUBMIT_BATCH, &batch_param);
+  if (unlikely(err < 0))
+    omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
+				       OMX_SUCCESS,
+				       "submit batch of commands");
+    /* if OMX_NO_SYSTEM_RESOURCES, let the retransmission try again later */
+
+  ep->batch_nr = 0;
+  ep->batch_length = 0;
+}
+
+/* let the driver drain the cmdq with an empty batch */
+static int
+omx__ring_cmdq_doorbell(struct omx_endpoint *ep)
+{
+  struct omx_cmd_submit_batch batch_param;
+  int err;
+
+  batch_param.nr = 0;
+  batch_param.length = 0;
+  batch_param.buffer = 0;
+
+  err = ioctl(ep->fd, OMX_CMD_SUBMIT_BATCH, &batch_param);
+  if (unlikely(err < 0))
+    omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
+				       OMX_SUCCESS,
+				       "ring command queue doorbell");
+  return err;
+}
+
+/* make sure the driver processes the commands queued in the cmdq */
+void
+omx__flush_cmdq(struct omx_endpoint *ep)
+{
+  if (likely(!ep->cmdq || !omx__cmdq_pending(ep)))
+    return;
+
+  /* the driver polls the cmdq on its own */
+  if (omx__driver_desc->features & OMX_DRIVER_FEATURE_CMDQ_POLL)
+    return;
+
+  omx__debug_printf(SEND, ep, "ringing the doorbell for %ld queued commands\n",
+		    (unsigned long) omx__cmdq_pending(ep));
+  omx__ring_cmdq_doorbell(ep);
+}
+
+/*
+ * Get a cmdq slot back when the cmdq is full.
+ * Ring the doorbell even if the driver polls the cmdq, the ioctl drains
+ * the cmdq in order before returning, so we do not depend on the poll thread.
+ * Returns -1 if the cmdq is still full.
+ */
+int
+omx__cmdq_wait_slot(struct omx_endpoint *ep)
+{
+  omx__debug_printf(SEND, ep, "command queue full, draining it\n");
+
+  if (omx__ring_cmdq_doorbell(ep) < 0)
+    return -1;
+  if (unlikely(omx__cmdq_pending(ep) >= OMX_CMDQ_ENTRY_NR)) {
+    errno = EBUSY;
+    return -1;
+  }
+  return 0;
+}
+
 omx_return_t
 omx__progress(struct omx_endpoint * ep)
 {
   omx_eventq_index_t index;
   int err;
 
-  if (unlikely(ep->progression_disabled))
+  if (unlikely(ep->progression_disabled)) {
+    /* still submit what the application posted */
+    omx__flush_batch(ep);
+    omx__flush_cmdq(ep);
     return OMX_SUCCESS;
+  }
 
   omx__check_enough_progression(ep);
 
@@ -237,12 +336,18 @@ omx__progress(struct omx_endpoint * ep)
 
     /* Acknowledgement per batch of event slots */
     BUILD_BUG_ON(OMX_UNEXP_RELEASE_SLOTS_BATCH_NR < 1); /* make sure we release something */
-    if (unlikely(index % OMX_UNEXP_RELEASE_SLOTS_BATCH_NR == 0)) {
+    if (unlikely(!omx__globals.release_index && index % OMX_UNEXP_RELEASE_SLOTS_BATCH_NR == 0)) {
       err = ioctl(ep->fd, OMX_CMD_RELEASE_UNEXP_SLOTS);
       if (err < 0)
 	omx__abort(ep, "Failed to release a batch of unexpected slots\n");
     }
   }
+  if (omx__globals.release_index && index != ep->next_unexp_event_index) {
+    /* the driver reads this index when the queue looks full,
+     * make sure we are done reading the slots before releasing them */
+    __sync_synchronize();
+    ep->desc->released_unexp_eventq_index = index;
+  }
   ep->next_unexp_event_index = index;
 
   /* process expected events then */
@@ -259,6 +364,13 @@ omx__progress(struct omx_endpoint * ep)
     /* next event */
     index++;
 
+    if (omx__globals.release_index) {
+      /* release each slot immediately since avail_exp_events already accounts for it */
+      __sync_synchronize();
+      ep->desc->released_exp_eventq_index = index;
+      continue;
+    }
+
     /* Acknowledgement per batch of event slots */
     BUILD_BUG_ON(OMX_EXP_RELEASE_SLOTS_BATCH_NR < 1); /* make sure we release something */
     if (unlikely(index % OMX_EXP_RELEASE_SLOTS_BATCH_NR == 0)) {
@@ -281,6 +393,10 @@ omx__progress(struct omx_endpoint * ep)
   /* check the endpoint descriptor */
   omx__check_endpoint_desc(ep);
 
+  /* submit the commands posted by the application or by the above progression */
+  omx__flush_batch(ep);
+  omx__flush_cmdq(ep);
+
 #ifdef OMX_LIB_DEBUG
   /* check if we leaked some requests */
   if (omx__globals.check_request_alloc)
@@ -305,6 +421,21 @@ omx_register_unexp_handler(omx_endpoint_t ep,
   return OMX_SUCCESS;
 }
 
+/* API omx_register_completion_handler */
+omx_return_t
+omx_register_completion_handler(omx_endpoint_t ep,
+				omx_completion_handler_t handler,
+				void *context)
+{
+  OMX__ENDPOINT_LOCK(ep);
+
+  ep->completion_handler = handler;
+  ep->completion_handler_context = context;
+
+  OMX__ENDPOINT_UNLOCK(ep);
+  return OMX_SUCCESS;
+}
+
 /* API omx_progress */
 omx_return_t
 omx_progress(omx_endpoint_t ep)
@@ -319,6 +450,19 @@ omx_progress(omx_endpoint_t ep)
   return ret;
 }
 
+/* API omx_flush */
+omx_return_t
+omx_flush(omx_endpoint_t ep)
+{
+  OMX__ENDPOINT_LOCK(ep);
+
+  omx__flush_batch(ep);
+  omx__flush_cmdq(ep);
+
+  OMX__ENDPOINT_UNLOCK(ep);
+  return OMX_SUCCESS;
+}
+
 #ifdef OMX_LIB_DEBUG
 static uint64_t omx_disable_progression_jiffies_start = 0;
 #endif
@@ -341,7 +485,7 @@ omx_disable_progression(struct omx_endpoint *ep)
   ep->progression_disabled = OMX_PROGRESSION_DISABLED_BY_API;
 
 #ifdef OMX_LIB_DEBUG
-  omx_disable_progression_jiffies_start = omx__driver_desc->jiffies;
+  omx_disable_progression_jiffies_start = omx__now();
 #endif
 
  out_with_lock:
@@ -361,14 +505,15 @@ omx_reenable_progression(struct omx_endpoint *ep)
   }
 
   ep->progression_disabled &= ~OMX_PROGRESSION_DISABLED_BY_API;
+  OMX__ENDPOINT_PROGRESSION_ENABLED_SIGNAL(ep);
 
 #ifdef OMX_LIB_DEBUG
   {
-    uint64_t now = omx__driver_desc->jiffies;
+    uint64_t now = omx__now();
     uint64_t delay = now - omx_disable_progression_jiffies_start;
-    if (delay > omx__driver_desc->hz)
+    if (delay > omx__globals.hz)
       omx__verbose_printf(ep, "Application disabled progression during %lld seconds (%lld jiffies)\n",
-			  (unsigned long long) delay/omx__driver_desc->hz, (unsigned long long) delay);
+			  (unsigned long long) delay/omx__globals.hz, (unsigned long long) delay);
   }
 #endif
 
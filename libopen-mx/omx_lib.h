@@ -24,6 +24,7 @@
 #include <stdint.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/ioctl.h>
 
 #include "open-mx.h"
 #include "omx_types.h"
@@ -89,33 +90,91 @@ extern volatile struct omx_driver_desc * omx__driver_desc;
  * Timing routines
  */
 
+/*
+ * All library *_jiffies are counted in omx__globals.hz units of the
+ * library time source, either the driver jiffies, or microseconds from
+ * clock_gettime(). Only what is passed to the driver uses kernel jiffies.
+ */
+static inline uint64_t
+omx__now(void)
+{
+#ifdef OMX_HAVE_CLOCK_GETTIME
+	if (likely(omx__globals.clock_source != OMX__CLOCK_JIFFIES)) {
+		struct timespec ts;
+		clock_gettime(omx__globals.clock_id, &ts);
+		return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+	}
+#endif
+	return omx__driver_desc->jiffies;
+}
+
+/* convert a library delay into kernel jiffies for the driver */
+static inline uint64_t
+omx__relative_kernel_jiffies(uint64_t delay)
+{
+	if (omx__globals.clock_source == OMX__CLOCK_JIFFIES
+	    || delay == OMX_CMD_WAIT_EVENT_TIMEOUT_INFINITE)
+		return delay;
+
+	return (delay * omx__driver_desc->hz + omx__globals.hz - 1) / omx__globals.hz;
+}
+
+/* convert an absolute library time into kernel jiffies for the driver */
+static inline uint64_t
+omx__absolute_kernel_jiffies(uint64_t jiffies)
+{
+	uint64_t now;
+
+	if (omx__globals.clock_source == OMX__CLOCK_JIFFIES
+	    || jiffies == OMX_CMD_WAIT_EVENT_TIMEOUT_INFINITE)
+		return jiffies;
+
+	now = omx__now();
+	if (jiffies <= now)
+		return omx__driver_desc->jiffies;
+	return omx__driver_desc->jiffies + omx__relative_kernel_jiffies(jiffies - now);
+}
+
 #define ACK_PER_SECOND 64 /* simplifies divisions too */
-#define omx__ack_delay_jiffies() ((omx__driver_desc->hz + ACK_PER_SECOND) / ACK_PER_SECOND)
+#define omx__ack_delay_jiffies() ((omx__globals.hz + ACK_PER_SECOND) / ACK_PER_SECOND)
 
 #define RESEND_PER_SECOND 2
-#define omx__resend_delay_jiffies() ((omx__driver_desc->hz + RESEND_PER_SECOND) / RESEND_PER_SECOND)
+#define omx__resend_delay_jiffies() ((omx__globals.hz + RESEND_PER_SECOND) / RESEND_PER_SECOND)
 
-/* assume 1s = 1024ms, to simplify divisions */
+/* convert a delay in microseconds, never less than one jiffy */
+static inline __pure uint64_t
+omx__us_to_relative_jiffies(uint64_t us)
+{
+	uint64_t jiffies = (us * omx__globals.hz + 999999) / 1000000;
+	return jiffies ? jiffies : 1;
+}
 
-#define omx__timeout_ms_to_resends(ms) ((ms * RESEND_PER_SECOND + 1023) / 1024)
+/* assume 1s = 1024ms, to simplify divisions */
 
 static inline __pure uint64_t
 omx__timeout_ms_to_relative_jiffies(uint32_t ms)
 {
-	uint32_t hz = omx__driver_desc->hz;
+	uint64_t hz = omx__globals.hz;
 	return (ms == OMX_TIMEOUT_INFINITE)
 		? OMX_CMD_WAIT_EVENT_TIMEOUT_INFINITE
 		: (ms * hz + 1023)/1024;
 }
 
-static inline __pure uint64_t
+static inline __pure uint32_t
+omx__timeout_ms_to_resends(uint32_t ms)
+{
+	uint64_t delay = omx__globals.resend_delay_jiffies;
+	uint64_t resends = ((uint64_t) ms * omx__globals.hz / 1024 + delay - 1) / delay;
+	return resends > UINT32_MAX ? UINT32_MAX : resends;
+}
+
+static inline uint64_t
 omx__timeout_ms_to_absolute_jiffies(uint32_t ms)
 {
-	uint32_t hz = omx__driver_desc->hz;
-	uint64_t now = omx__driver_desc->jiffies;
+	uint64_t hz = omx__globals.hz;
 	return (ms == OMX_TIMEOUT_INFINITE)
 		? OMX_CMD_WAIT_EVENT_TIMEOUT_INFINITE
-		: now + (ms * hz + 1023)/1024;
+		: omx__now() + (ms * hz + 1023)/1024;
 }
 
 /**************************
@@ -151,16 +210,37 @@ omx__partner_localization_shared(const struct omx__partner *partner)
   return (partner->localization == OMX__PARTNER_LOCALIZATION_LOCAL);
 }
 
+#define OMX__PARTNER_LEAF_SHIFT 8
+#define OMX__PARTNER_LEAF_SIZE (1U << OMX__PARTNER_LEAF_SHIFT)
+
+static inline uint32_t
+omx__partner_index(uint16_t peer_index, uint8_t endpoint_index)
+{
+  return ((uint32_t) endpoint_index)
+    + ((uint32_t) peer_index) * omx__driver_desc->endpoint_max;
+}
+
+static inline struct omx__partner *
+omx__partner_table_get(const struct omx_endpoint *ep, uint32_t partner_index)
+{
+  struct omx__partner ** leaf = ep->partners[partner_index >> OMX__PARTNER_LEAF_SHIFT];
+  return likely(leaf) ? leaf[partner_index & (OMX__PARTNER_LEAF_SIZE-1)] : NULL;
+}
+
 static inline void
 omx__partner_recv_lookup(const struct omx_endpoint *ep,
 			 uint16_t peer_index, uint8_t endpoint_index,
 			 struct omx__partner ** partnerp)
 {
-  uint32_t partner_index = ((uint32_t) endpoint_index)
-    + ((uint32_t) peer_index) * omx__driver_desc->endpoint_max;
-  *partnerp = ep->partners[partner_index];
+  *partnerp = omx__partner_table_get(ep, omx__partner_index(peer_index, endpoint_index));
 }
 
+#define omx__foreach_partner(ep, partner) \
+list_for_each_entry(partner, &(ep)->partners_list, endpoint_partners_elt)
+
+#define omx__foreach_partner_safe(ep, partner, next) \
+list_for_each_entry_safe(partner, next, &(ep)->partners_list, endpoint_partners_elt)
+
 static inline void
 omx__mark_partner_need_ack_delayed(struct omx_endpoint *ep,
 				   struct omx__partner *partner)
@@ -169,7 +249,7 @@ omx__mark_partner_need_ack_delayed(struct omx_endpoint *ep,
 
   if (partner->need_ack == OMX__PARTNER_NEED_NO_ACK) {
     partner->need_ack = OMX__PARTNER_NEED_ACK_DELAYED;
-    partner->oldest_recv_time_not_acked = omx__driver_desc->jiffies;
+    partner->oldest_recv_time_not_acked = omx__now();
     list_add_tail(&partner->endpoint_partners_to_ack_elt, &ep->partners_to_ack_delayed_list);
   }
 }
@@ -334,6 +414,21 @@ omx__endpoint_sendq_map_put(struct omx_endpoint * ep,
   ep->sendq_map.nr_free += nr;
 }
 
+/* change the user of some allocated sendq map entries, when a persistent request lends them */
+static inline void
+omx__endpoint_sendq_map_set_user(struct omx_endpoint * ep,
+				 int nr, const omx_sendq_map_index_t * indexes, const void * user)
+{
+  struct omx__sendq_entry * array = ep->sendq_map.array;
+  int i;
+
+  for(i=0; i<nr; i++) {
+    omx__debug_assert(array[indexes[i]].user != NULL);
+    omx__debug_assert(array[indexes[i]].next_free == -1);
+    array[indexes[i]].user = (void *) user;
+  }
+}
+
 static inline void *
 omx__endpoint_sendq_map_user(const struct omx_endpoint * ep,
 			     omx_sendq_map_index_t index)
@@ -384,6 +479,11 @@ extern void
 omx__recv_complete(struct omx_endpoint *ep, union omx_request *req,
 		   omx_return_t status);
 
+extern omx_return_t
+omx__start_irecv(struct omx_endpoint *ep,
+		 const struct omx_persistent_request *persistent,
+		 union omx_request **requestp);
+
 extern void
 omx__process_recv(struct omx_endpoint *ep,
 		  const struct omx_evt_recv_msg *msg, const void *data, uint32_t msg_length,
@@ -411,7 +511,7 @@ extern void
 omx__process_recv_rndv(struct omx_endpoint *ep, struct omx__partner *partner,
 		       union omx_request *req,
 		       const struct omx_evt_recv_msg *msg,
-		       const void *data /* unused */, uint32_t xfer_length);
+		       const void *data /* eager prefix, if any */, uint32_t xfer_length);
 
 extern void
 omx__process_recv_notify(struct omx_endpoint *ep, struct omx__partner *partner,
@@ -436,19 +536,138 @@ omx__process_recv_nack_lib(struct omx_endpoint *ep,
 extern omx_return_t
 omx__progress(struct omx_endpoint * ep);
 
+extern void
+omx__flush_batch(struct omx_endpoint *ep);
+
+extern void
+omx__flush_cmdq(struct omx_endpoint *ep);
+
+extern int
+omx__cmdq_wait_slot(struct omx_endpoint *ep);
+
+static inline uint32_t
+omx__cmdq_pending(const struct omx_endpoint *ep)
+{
+  return ep->cmdq_index - *(volatile const uint32_t *) &ep->desc->cmdq_consumed_index;
+}
+
+/*
+ * Queue a command in the endpoint cmdq.
+ * The driver reads it on the next endpoint ioctl, on the next doorbell
+ * at the end of the progression, or right now if it polls the cmdq.
+ * Returns -1 if no slot could be released.
+ */
+static inline int
+omx__cmdq_submit(struct omx_endpoint *ep, uint8_t epcmd, uint8_t flags,
+		 const void *param, uint16_t length)
+{
+  struct omx_cmdq_entry *entry;
+
+  if (unlikely(omx__cmdq_pending(ep) >= OMX_CMDQ_ENTRY_NR)
+      && omx__cmdq_wait_slot(ep) < 0)
+    return -1;
+
+  entry = ep->cmdq + ((ep->cmdq_index % OMX_CMDQ_ENTRY_NR) << OMX_CMDQ_ENTRY_SHIFT);
+  entry->hdr.epcmd = epcmd;
+  entry->hdr.flags = flags;
+  entry->hdr.length = length;
+  memcpy(&entry->cmd, param, length);
+  if (epcmd == OMX_EPCMD_SEND_SMALL) {
+    /* the driver cannot read the application buffer, copy the data in the entry */
+    const struct omx_cmd_send_small *small_param = param;
+    memcpy(entry->small_data, (const void *)(uintptr_t) small_param->vaddr, small_param->length);
+  }
+
+  /* make the entry visible before the index */
+  __sync_synchronize();
+  ep->desc->cmdq_submitted_index = ++ep->cmdq_index;
+  return 0;
+}
+
+/*
+ * Let the driver aggregate tiny/small messages to this partner
+ * if it advertised support for it at connect time.
+ */
+static inline uint8_t
+omx__partner_aggregate_flags(const struct omx__partner *partner, int shared)
+{
+  return partner->aggregate && !shared ? OMX_CMD_SUBMIT_BATCH_ENTRY_FLAG_AGGREGATE : 0;
+}
+
+/*
+ * Submit a tiny, small, notify or liback command,
+ * either through the cmdq if enabled, right now, or in the next batch if enabled.
+ * Shared communication commands never go through the cmdq since the
+ * driver would have to access the application memory.
+ * Batched commands are flushed at the end of the progression,
+ * or before any other send command is submitted.
+ * Flags are only meaningful to the driver when batched or queued in the cmdq,
+ * for instance to aggregate consecutive tiny/small messages.
+ */
+static inline int
+omx__submit_cmd(struct omx_endpoint *ep, unsigned long cmd, uint8_t epcmd, uint8_t flags,
+		const void *param, uint16_t length, int shared)
+{
+  struct omx_cmd_submit_batch_entry *entry;
+  uint32_t entry_length = sizeof(*entry) + OMX_CMD_SUBMIT_BATCH_ENTRY_ALIGN(length);
+
+  if (ep->cmdq && !shared
+      && likely(omx__cmdq_submit(ep, epcmd, flags, param, length) == 0))
+    /* failures will be handled as lost packets */
+    return 0;
+  /* if the cmdq is still full, submit directly, the driver drains the cmdq first */
+
+  if (likely(!omx__globals.submit_batch))
+    return ioctl(ep->fd, cmd, param);
+
+  if (unlikely(ep->batch_length + entry_length > OMX_CMD_SUBMIT_BATCH_LENGTH_MAX))
+    omx__flush_batch(ep);
+
+  entry = (void *) ((char *) ep->batch_buffer + ep->batch_length);
+  entry->epcmd = epcmd;
+  entry->flags = flags;
+  entry->length = length;
+  memcpy(entry + 1, param, length);
+  ep->batch_length += entry_length;
+  ep->batch_nr++;
+
+  /* failures will be handled as lost packets */
+  return 0;
+}
+
 extern void
 omx__notify_user_event(struct omx_endpoint *ep);
 
+extern void
+omx__notify_sleepers(struct omx_endpoint *ep, union omx_request *req);
+
+extern omx_return_t
+omx__progress_thread_start(struct omx_endpoint *ep);
+
+extern void
+omx__progress_thread_stop(struct omx_endpoint *ep);
+
+extern void
+omx__endpoint_bind_process(const struct omx_endpoint *ep, const char *bindstring);
+
 extern void
 omx__forget(struct omx_endpoint *ep, union omx_request *req);
 
+/* partner table management */
+
+extern omx_return_t
+omx__partners_init(struct omx_endpoint *ep);
+
+extern void
+omx__partners_exit(struct omx_endpoint *ep);
+
 /* connect management */
 
 extern omx_return_t
 omx__connect_myself(struct omx_endpoint *ep);
 
 extern void
-omx__post_connect_request(const struct omx_endpoint *ep,
+omx__post_connect_request(struct omx_endpoint *ep,
 			  const struct omx__partner *partner,
 			  union omx_request * req);
 
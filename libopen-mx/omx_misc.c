@@ -276,8 +276,7 @@ omx__cancel_common(omx_endpoint_t ep,
   case OMX_REQUEST_TYPE_RECV: {
     if (req->generic.state & OMX_REQUEST_STATE_RECV_NEED_MATCHING) {
       /* not matched, still in the recv queue */
-      uint32_t ctxid = CTXID_FROM_MATCHING(ep, req->recv.match_info);
-      omx__dequeue_request(&ep->ctxid[ctxid].recv_req_q, req);
+      omx__dequeue_posted_recv_request(ep, req);
       omx_free_segments(ep, &req->send.segs);
       req->generic.state &= ~OMX_REQUEST_STATE_RECV_NEED_MATCHING;
       *result = 1;
@@ -103,6 +103,91 @@ omx_decompose_endpoint_addr_with_session(omx_endpoint_addr_t endpoint_addr,
   return OMX_SUCCESS;
 }
 
+/*******************
+ * Partner table
+ */
+
+/*
+ * Partners are stored in a two-level table indexed by
+ * endpoint_index + peer_index * endpoint_max.
+ * The first level is allocated on endpoint open, leaves of
+ * OMX__PARTNER_LEAF_SIZE pointers are allocated when a partner
+ * first goes there. Leaves are kept until the endpoint is closed.
+ */
+
+/* make the partner table footprint visible to omx_endpoint_info */
+static void
+omx__partners_update_footprint(struct omx_endpoint *ep)
+{
+  ep->desc->partners_nr = ep->partners_nr;
+  ep->desc->partners_memory = ep->partner_leaves_nr * sizeof(*ep->partners)
+    + ep->partner_leaves_allocated * OMX__PARTNER_LEAF_SIZE * sizeof(**ep->partners)
+    + ep->partners_nr * sizeof(struct omx__partner);
+}
+
+omx_return_t
+omx__partners_init(struct omx_endpoint *ep)
+{
+  uint32_t nr = omx__driver_desc->peer_max * omx__driver_desc->endpoint_max;
+
+  ep->partner_leaves_nr = (nr + OMX__PARTNER_LEAF_SIZE - 1) >> OMX__PARTNER_LEAF_SHIFT;
+  ep->partners = omx_calloc_ep(ep, ep->partner_leaves_nr, sizeof(*ep->partners));
+  if (!ep->partners)
+    return OMX_NO_RESOURCES;
+
+  ep->partner_leaves_allocated = 0;
+  list_head_init(&ep->partners_list);
+  ep->partners_nr = 0;
+  omx__partners_update_footprint(ep);
+  return OMX_SUCCESS;
+}
+
+void
+omx__partners_exit(struct omx_endpoint *ep)
+{
+  struct omx__partner *partner, *next;
+  uint32_t i;
+
+  omx__foreach_partner_safe(ep, partner, next)
+    omx_free_ep(ep, partner);
+
+  for(i=0; i<ep->partner_leaves_nr; i++)
+    if (ep->partners[i])
+      omx_free_ep(ep, ep->partners[i]);
+  omx_free_ep(ep, ep->partners);
+}
+
+static omx_return_t
+omx__partner_table_insert(struct omx_endpoint *ep, struct omx__partner *partner)
+{
+  uint32_t partner_index = omx__partner_index(partner->peer_index, partner->endpoint_index);
+  struct omx__partner *** leafp = &ep->partners[partner_index >> OMX__PARTNER_LEAF_SHIFT];
+
+  if (unlikely(!*leafp)) {
+    *leafp = omx_calloc_ep(ep, OMX__PARTNER_LEAF_SIZE, sizeof(**leafp));
+    if (unlikely(!*leafp))
+      return OMX_NO_RESOURCES;
+    ep->partner_leaves_allocated++;
+  }
+
+  (*leafp)[partner_index & (OMX__PARTNER_LEAF_SIZE-1)] = partner;
+  list_add_tail(&partner->endpoint_partners_elt, &ep->partners_list);
+  ep->partners_nr++;
+  omx__partners_update_footprint(ep);
+  return OMX_SUCCESS;
+}
+
+static void
+omx__partner_table_remove(struct omx_endpoint *ep, struct omx__partner *partner)
+{
+  uint32_t partner_index = omx__partner_index(partner->peer_index, partner->endpoint_index);
+
+  ep->partners[partner_index >> OMX__PARTNER_LEAF_SHIFT][partner_index & (OMX__PARTNER_LEAF_SIZE-1)] = NULL;
+  list_del(&partner->endpoint_partners_elt);
+  ep->partners_nr--;
+  omx__partners_update_footprint(ep);
+}
+
 /*********************
  * Partner management
  */
@@ -127,6 +212,9 @@ omx__partner_reset(struct omx__partner *partner)
   partner->next_frag_recv_seq = partner->next_match_recv_seq; /* will force the sender's send seq through the connect */
   partner->last_acked_recv_seq = partner->next_frag_recv_seq; /* nothing to ack yet */
   partner->connect_seqnum = 0;
+  partner->aggregate = 0;
+  partner->push = 0;
+  partner->rndv_eager = 0;
   partner->last_send_acknum = 0;
   partner->last_recv_acknum = 0;
   partner->throttling_sends_nr = 0;
@@ -143,7 +231,6 @@ omx__partner_create(struct omx_endpoint *ep, uint16_t peer_index,
 		    struct omx__partner ** partnerp)
 {
   struct omx__partner * partner;
-  uint32_t partner_index;
 
   partner = omx_malloc_ep(ep, sizeof(*partner));
   if (unlikely(!partner))
@@ -160,9 +247,10 @@ omx__partner_create(struct omx_endpoint *ep, uint16_t peer_index,
 
   omx__partner_reset(partner);
 
-  partner_index = ((uint32_t) endpoint_index)
-    + ((uint32_t) peer_index) * omx__driver_desc->endpoint_max;
-  ep->partners[partner_index] = partner;
+  if (unlikely(omx__partner_table_insert(ep, partner) != OMX_SUCCESS)) {
+    omx_free_ep(ep, partner);
+    return OMX_NO_RESOURCES;
+  }
 
   *partnerp = partner;
   omx__debug_printf(CONNECT, ep, "created partner %016llx ep %d peer index %d\n",
@@ -194,12 +282,10 @@ omx__partner_lookup(struct omx_endpoint *ep,
 		    uint16_t peer_index, uint8_t endpoint_index,
 		    struct omx__partner ** partnerp)
 {
-  uint32_t partner_index;
-
-  partner_index = ((uint32_t) endpoint_index)
-    + ((uint32_t) peer_index) * omx__driver_desc->endpoint_max;
+  struct omx__partner * partner;
 
-  if (unlikely(!ep->partners[partner_index])) {
+  partner = omx__partner_table_get(ep, omx__partner_index(peer_index, endpoint_index));
+  if (unlikely(!partner)) {
     uint64_t board_addr;
     omx_return_t ret;
 
@@ -214,7 +300,7 @@ omx__partner_lookup(struct omx_endpoint *ep,
     return omx__partner_create(ep, peer_index, board_addr, endpoint_index, partnerp);
   }
 
-  *partnerp = ep->partners[partner_index];
+  *partnerp = partner;
   return OMX_SUCCESS;
 }
 
@@ -223,7 +309,7 @@ omx__partner_lookup_by_addr(struct omx_endpoint *ep,
 			    uint64_t board_addr, uint8_t endpoint_index,
 			    struct omx__partner ** partnerp)
 {
-  uint32_t partner_index;
+  struct omx__partner * partner;
   uint16_t peer_index;
   omx_return_t ret;
 
@@ -237,13 +323,11 @@ omx__partner_lookup_by_addr(struct omx_endpoint *ep,
     return ret;
   }
 
-  partner_index = ((uint32_t) endpoint_index)
-    + ((uint32_t) peer_index) * omx__driver_desc->endpoint_max;
-
-  if (unlikely(!ep->partners[partner_index]))
+  partner = omx__partner_table_get(ep, omx__partner_index(peer_index, endpoint_index));
+  if (unlikely(!partner))
     return omx__partner_create(ep, peer_index, board_addr, endpoint_index, partnerp);
 
-  *partnerp = ep->partners[partner_index];
+  *partnerp = partner;
   return OMX_SUCCESS;
 }
 
@@ -294,7 +378,7 @@ omx__connect_myself(struct omx_endpoint *ep)
  */
 
 void
-omx__post_connect_request(const struct omx_endpoint *ep,
+omx__post_connect_request(struct omx_endpoint *ep,
 			  const struct omx__partner *partner,
 			  union omx_request * req)
 {
@@ -303,6 +387,7 @@ omx__post_connect_request(const struct omx_endpoint *ep,
 
   connect_param->target_recv_seqnum_start = partner->next_match_recv_seq;
 
+  omx__flush_batch(ep); /* keep submission ordered */
   err = ioctl(ep->fd, OMX_CMD_SEND_CONNECT_REQUEST, connect_param);
   if (err < 0) {
     omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
@@ -312,7 +397,25 @@ omx__post_connect_request(const struct omx_endpoint *ep,
   }
 
   req->generic.resends++;
-  req->generic.last_send_jiffies = omx__driver_desc->jiffies;
+  req->generic.last_send_jiffies = omx__now();
+}
+
+/*
+ * Wire features that we advertise in our connect requests and replies.
+ * Receiving aggregates and rndv eager prefixes, and pushing large messages
+ * only requires driver support.
+ */
+static INLINE uint8_t
+omx__connect_features(void)
+{
+  uint8_t features = 0;
+  if (omx__driver_desc->features & OMX_DRIVER_FEATURE_AGGREGATE)
+    features |= OMX_PKT_CONNECT_FEATURE_AGGREGATE;
+  if (omx__driver_desc->features & OMX_DRIVER_FEATURE_PUSH)
+    features |= OMX_PKT_CONNECT_FEATURE_PUSH;
+  if (omx__driver_desc->features & OMX_DRIVER_FEATURE_RNDV_EAGER)
+    features |= OMX_PKT_CONNECT_FEATURE_RNDV_EAGER;
+  return features;
 }
 
 /*
@@ -374,6 +477,7 @@ omx__connect_common(omx_endpoint_t ep,
   connect_param->src_session_id = ep->desc->session_id;
   connect_param->app_key = key;
   connect_param->connect_seqnum = connect_seqnum;
+  connect_param->features = omx__connect_features();
 
   omx__post_connect_request(ep, partner, req);
 
@@ -596,6 +700,9 @@ omx__handle_connect_reply(struct omx_endpoint *ep,
     }
 
     partner->true_session_id = target_session_id;
+    partner->aggregate = omx__globals.aggregate && (event->features & OMX_PKT_CONNECT_FEATURE_AGGREGATE);
+    partner->push = omx__globals.push && (event->features & OMX_PKT_CONNECT_FEATURE_PUSH);
+    partner->rndv_eager = omx__globals.rndv_eager && (event->features & OMX_PKT_CONNECT_FEATURE_RNDV_EAGER);
   }
 }
 
@@ -695,6 +802,9 @@ omx__process_recv_connect_request(struct omx_endpoint *ep,
 
   partner->true_session_id  = src_session_id;
   partner->back_session_id  = src_session_id;
+  partner->aggregate = omx__globals.aggregate && (event->features & OMX_PKT_CONNECT_FEATURE_AGGREGATE);
+  partner->push = omx__globals.push && (event->features & OMX_PKT_CONNECT_FEATURE_PUSH);
+  partner->rndv_eager = omx__globals.rndv_eager && (event->features & OMX_PKT_CONNECT_FEATURE_RNDV_EAGER);
 
   reply_param.peer_index = partner->peer_index;
   reply_param.dest_endpoint = partner->endpoint_index;
@@ -705,7 +815,9 @@ omx__process_recv_connect_request(struct omx_endpoint *ep,
   reply_param.target_recv_seqnum_start = partner->next_match_recv_seq;
   reply_param.connect_seqnum = event->connect_seqnum;
   reply_param.connect_status_code = connect_status_code;
+  reply_param.features = omx__connect_features();
 
+  omx__flush_batch(ep); /* keep submission ordered */
   err = ioctl(ep->fd, OMX_CMD_SEND_CONNECT_REPLY, &reply_param);
   if (err < 0) {
     omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
@@ -859,16 +971,12 @@ omx__partner_cleanup(struct omx_endpoint *ep, struct omx__partner *partner, int
    */
   count = 0;
   omx__foreach_partner_request_safe(&partner->partial_medium_recv_req_q, req, next) {
-    uint32_t ctxid = CTXID_FROM_MATCHING(ep, req->generic.status.match_info);
-
     omx__debug_printf(CONNECT, ep, "Dropping partial medium recv %p\n", req);
 
     /* dequeue and complete with status error */
     omx___dequeue_partner_request(req);
     if(unlikely(req->generic.state & OMX_REQUEST_STATE_UNEXPECTED_RECV)) {
-      omx__dequeue_request(&ep->anyctxid.unexp_req_q, req);
-      if (unlikely(HAS_CTXIDS(ep)))
-	omx__dequeue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+      omx__dequeue_unexp_request(ep, req);
 #ifdef OMX_LIB_DEBUG
     } else {
       omx__dequeue_request(&ep->partial_medium_recv_req_q, req);
@@ -909,9 +1017,10 @@ omx__partner_cleanup(struct omx_endpoint *ep, struct omx__partner *partner, int
     omx__debug_printf(CONNECT, ep, "Dropping unexpected recv %p\n", req);
 
     /* drop it and that's it */
-    omx___dequeue_request(req);
+    omx___dequeue_unexp_request(ep, req);
     if (req->generic.type != OMX_REQUEST_TYPE_RECV_LARGE
-	&& req->generic.status.msg_length > 0)
+	? req->generic.status.msg_length > 0
+	: req->recv.specific.large.eager_length > 0)
       /* release the single segment used for unexp buffer */
       omx_free_ep(ep, OMX_SEG_PTR(&req->recv.segs.single));
     omx__request_free(ep, req);
@@ -943,9 +1052,7 @@ omx__partner_cleanup(struct omx_endpoint *ep, struct omx__partner *partner, int
        * is now invalid. Just drop the partner entirely, it will prevent messages
        * about future reconnections
        */
-      uint32_t partner_index = ((uint32_t) partner->endpoint_index)
-				+ ((uint32_t) partner->peer_index) * omx__driver_desc->endpoint_max;
-      ep->partners[partner_index] = NULL;
+      omx__partner_table_remove(ep, partner);
       omx_free_ep(ep, partner);
     }
   }
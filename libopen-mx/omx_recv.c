@@ -201,6 +201,18 @@ omx__postpone_early_packet(struct omx_endpoint *ep, struct omx__partner * partne
   }
 
   case OMX_EVT_RECV_RNDV: {
+    if (data) {
+      /* keep the eager prefix */
+      uint16_t eager_length = msg->specific.rndv.eager_length;
+      char * early_data = omx_malloc_ep(ep, eager_length);
+      if (unlikely(!early_data)) {
+	omx_free_ep(ep, early);
+	/* cannot store early? just drop, it will be resent */
+	return;
+      }
+      memcpy(early_data, data, eager_length);
+      early->data = early_data;
+    }
     early->msg_length = msg->specific.rndv.msg_length;
     break;
   }
@@ -257,9 +269,7 @@ omx__process_recv_tiny(struct omx_endpoint *ep, struct omx__partner *partner,
 #endif
 
   if (unlikely(req->generic.state & OMX_REQUEST_STATE_UNEXPECTED_RECV)) {
-    omx__enqueue_request(&ep->anyctxid.unexp_req_q, req);
-    if (unlikely(HAS_CTXIDS(ep)))
-      omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+    omx__enqueue_unexp_request(ep, ctxid, req);
   } else {
     omx__recv_complete(ep, req, OMX_SUCCESS);
   }
@@ -288,9 +298,7 @@ omx__process_recv_small(struct omx_endpoint *ep, struct omx__partner *partner,
 #endif
 
   if (unlikely(req->generic.state & OMX_REQUEST_STATE_UNEXPECTED_RECV)) {
-    omx__enqueue_request(&ep->anyctxid.unexp_req_q, req);
-    if (unlikely(HAS_CTXIDS(ep)))
-      omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+    omx__enqueue_unexp_request(ep, ctxid, req);
   } else {
     omx__recv_complete(ep, req, OMX_SUCCESS);
   }
@@ -385,9 +393,7 @@ omx__process_recv_medium_frag(struct omx_endpoint *ep, struct omx__partner *part
      * ordered to ensure in-order matching.
      */
     if (unlikely(req->generic.state & OMX_REQUEST_STATE_UNEXPECTED_RECV)) {
-      omx__enqueue_request(&ep->anyctxid.unexp_req_q, req);
-      if (unlikely(HAS_CTXIDS(ep)))
-	omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+      omx__enqueue_unexp_request(ep, ctxid, req);
 #ifdef OMX_LIB_DEBUG
     } else {
       omx__enqueue_request(&ep->partial_medium_recv_req_q, req);
@@ -438,33 +444,159 @@ void
 omx__process_recv_rndv(struct omx_endpoint *ep, struct omx__partner *partner,
 		       union omx_request *req,
 		       const struct omx_evt_recv_msg *msg,
-		       const void *data /* unused */, uint32_t xfer_length)
+		       const void *data /* eager prefix, if any */, uint32_t xfer_length)
 {
   uint32_t ctxid = CTXID_FROM_MATCHING(ep, msg->match_info);
   uint8_t rdma_id = msg->specific.rndv.pulled_rdma_id;
   uint8_t rdma_seqnum = msg->specific.rndv.pulled_rdma_seqnum;
   uint16_t rdma_offset = msg->specific.rndv.pulled_rdma_offset;
   uint16_t checksum = msg->specific.rndv.checksum;
+  /* the driver made sure that the eager prefix ends at the pulled offset */
+  uint16_t eager_length = data ? msg->specific.rndv.eager_length : 0;
 
-  omx__debug_printf(LARGE, ep, "got a rndv req for rdma id %d seqnum %d offset %d length %d\n",
+  omx__debug_printf(LARGE, ep, "got a rndv req for rdma id %d seqnum %d offset %d length %d eager %d\n",
 		    (unsigned) rdma_id, (unsigned) rdma_seqnum, (unsigned) rdma_offset,
-		    (unsigned) xfer_length);
+		    (unsigned) xfer_length, (unsigned) eager_length);
 
   req->recv.checksum = checksum;
   req->recv.specific.large.pulled_rdma_id = rdma_id;
   req->recv.specific.large.pulled_rdma_seqnum = rdma_seqnum;
   req->recv.specific.large.pulled_rdma_offset = rdma_offset;
+  req->recv.specific.large.eager_length = eager_length;
 
   req->generic.type = OMX_REQUEST_TYPE_RECV_LARGE;
   req->generic.state |= OMX_REQUEST_STATE_RECV_PARTIAL;
 
   if (unlikely(req->generic.state & OMX_REQUEST_STATE_UNEXPECTED_RECV)) {
-    omx__enqueue_request(&ep->anyctxid.unexp_req_q, req);
-    if (unlikely(HAS_CTXIDS(ep)))
-      omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+    /* keep the eager prefix in the unexpected buffer */
+    if (eager_length)
+      omx_copy_to_segments(&req->recv.segs, data, eager_length);
+    omx__enqueue_unexp_request(ep, ctxid, req);
   } else {
     omx__submit_pull(ep, req);
+    /* copy the eager prefix while the pull of the rest starts */
+    if (eager_length)
+      omx_copy_to_segments(&req->recv.segs, data,
+			   eager_length < xfer_length ? eager_length : xfer_length);
+  }
+}
+
+/****************************************
+ * Posted receive matching queue resizing
+ */
+
+void
+omx__recv_match_queue_init(struct omx__recv_match_queue *queue)
+{
+  list_head_init(&queue->exact_single_bucket);
+  queue->exact_buckets = &queue->exact_single_bucket;
+  queue->exact_buckets_nr = 1;
+  queue->exact_nr = 0;
+  list_head_init(&queue->wildcard_q);
+  queue->wildcard_nr = 0;
+}
+
+void
+omx__recv_match_queue_exit(struct omx_endpoint *ep, struct omx__recv_match_queue *queue)
+{
+  if (queue->exact_buckets != &queue->exact_single_bucket)
+    omx_free_ep(ep, queue->exact_buckets);
+  queue->exact_buckets = &queue->exact_single_bucket;
+  queue->exact_buckets_nr = 1;
+}
+
+void
+omx__recv_match_queue_grow(struct omx_endpoint *ep, struct omx__recv_match_queue *queue)
+{
+  struct list_head *old_buckets = queue->exact_buckets;
+  uint32_t old_nr = queue->exact_buckets_nr;
+  uint32_t new_nr = old_nr < OMX__RECV_MATCH_BUCKETS_MIN ? OMX__RECV_MATCH_BUCKETS_MIN : old_nr * 2;
+  struct list_head *new_buckets;
+  uint32_t i;
+
+  new_buckets = omx_malloc_ep(ep, new_nr * sizeof(*new_buckets));
+  if (unlikely(!new_buckets))
+    /* keep the current table, chains will just be longer */
+    return;
+
+  for(i=0; i<new_nr; i++)
+    list_head_init(&new_buckets[i]);
+
+  /* move requests in their bucket order so that identical match_info remain in posting order */
+  for(i=0; i<old_nr; i++) {
+    union omx_request *req, *next;
+    omx__foreach_request_safe(&old_buckets[i], req, next) {
+      omx___dequeue_request(req);
+      omx__enqueue_request(&new_buckets[omx__recv_match_hash(req->recv.match_info, new_nr)], req);
+    }
+  }
+
+  if (old_buckets != &queue->exact_single_bucket)
+    omx_free_ep(ep, old_buckets);
+  queue->exact_buckets = new_buckets;
+  queue->exact_buckets_nr = new_nr;
+
+  omx__debug_printf(RECV, ep, "resized posted recv hash table to %ld buckets for %ld exact receives\n",
+		    (unsigned long) new_nr, (unsigned long) queue->exact_nr);
+}
+
+/*************************************
+ * Unexpected receive index resizing
+ */
+
+void
+omx__unexp_index_init(struct omx__unexp_match_index *index)
+{
+  list_head_init(&index->single_bucket);
+  index->buckets = &index->single_bucket;
+  index->buckets_nr = 1;
+  index->depth = 0;
+  index->depth_max = 0;
+}
+
+void
+omx__unexp_index_exit(struct omx_endpoint *ep, struct omx__unexp_match_index *index)
+{
+  if (index->buckets != &index->single_bucket)
+    omx_free_ep(ep, index->buckets);
+  index->buckets = &index->single_bucket;
+  index->buckets_nr = 1;
+}
+
+void
+omx__unexp_index_grow(struct omx_endpoint *ep, struct omx__unexp_match_index *index)
+{
+  struct list_head *old_buckets = index->buckets;
+  uint32_t old_nr = index->buckets_nr;
+  uint32_t new_nr = old_nr < OMX__UNEXP_INDEX_BUCKETS_MIN ? OMX__UNEXP_INDEX_BUCKETS_MIN : old_nr * 2;
+  struct list_head *new_buckets;
+  uint32_t i;
+
+  new_buckets = omx_malloc_ep(ep, new_nr * sizeof(*new_buckets));
+  if (unlikely(!new_buckets))
+    /* keep the current table, chains will just be longer */
+    return;
+
+  for(i=0; i<new_nr; i++)
+    list_head_init(&new_buckets[i]);
+
+  /* move requests in their bucket order so that identical match_info remain in arrival order */
+  for(i=0; i<old_nr; i++) {
+    union omx_request *req, *next;
+    list_for_each_entry_safe(req, next, &old_buckets[i], generic.done_elt) {
+      list_del(&req->generic.done_elt);
+      list_add_tail(&req->generic.done_elt,
+		    &new_buckets[omx__recv_match_hash(req->generic.status.match_info, new_nr)]);
+    }
   }
+
+  if (old_buckets != &index->single_bucket)
+    omx_free_ep(ep, old_buckets);
+  index->buckets = new_buckets;
+  index->buckets_nr = new_nr;
+
+  omx__debug_printf(RECV, ep, "resized unexpected index to %ld buckets for %ld unexpected receives\n",
+		    (unsigned long) new_nr, (unsigned long) index->depth);
 }
 
 /*********************************
@@ -479,13 +611,10 @@ omx__match_recv(struct omx_endpoint *ep,
   uint32_t ctxid = CTXID_FROM_MATCHING(ep, match_info);
   union omx_request * req;
 
-  omx__foreach_request(&ep->ctxid[ctxid].recv_req_q, req)
-    if (likely(req->recv.match_info == (req->recv.match_mask & match_info))) {
-      /* matched a posted recv */
-      omx___dequeue_request(req);
-      *reqp = req;
-      break;
-    }
+  req = omx__match_posted_recv_request(ep, ctxid, match_info);
+  if (likely(req))
+    /* matched a posted recv */
+    *reqp = req;
 }
 
 static INLINE omx_return_t
@@ -524,7 +653,7 @@ omx__try_match_next_recv(struct omx_endpoint *ep,
     omx__debug_assert(!(ep->progression_disabled & OMX_PROGRESSION_DISABLED_IN_HANDLER));
     ep->progression_disabled = OMX_PROGRESSION_DISABLED_IN_HANDLER;
 #ifdef OMX_LIB_DEBUG
-    omx_handler_jiffies_start = omx__driver_desc->jiffies;
+    omx_handler_jiffies_start = omx__now();
 #endif
     OMX__ENDPOINT_UNLOCK(ep);
 
@@ -534,13 +663,14 @@ omx__try_match_next_recv(struct omx_endpoint *ep,
     OMX__ENDPOINT_LOCK(ep);
     ep->progression_disabled = 0;
     OMX__ENDPOINT_HANDLER_DONE_SIGNAL(ep);
+    OMX__ENDPOINT_PROGRESSION_ENABLED_SIGNAL(ep);
 #ifdef OMX_LIB_DEBUG
   {
-    uint64_t now = omx__driver_desc->jiffies;
+    uint64_t now = omx__now();
     uint64_t delay = now - omx_handler_jiffies_start;
-    if (delay > omx__driver_desc->hz)
+    if (delay > omx__globals.hz)
       omx__verbose_printf(ep, "Unexpected handler disabled progression during %lld seconds (%lld jiffies)\n",
-			  (unsigned long long) delay/omx__driver_desc->hz, (unsigned long long) delay);
+			  (unsigned long long) delay/omx__globals.hz, (unsigned long long) delay);
   }
 #endif
 
@@ -610,6 +740,19 @@ omx__try_match_next_recv(struct omx_endpoint *ep,
       }
 
       omx_cache_single_segment(&req->recv.segs, unexp_buffer, msg_length);
+
+    } else if (data) {
+      /* rndv only need an unexpected buffer for their eager prefix */
+      uint16_t eager_length = msg->specific.rndv.eager_length;
+      void *unexp_buffer = omx_malloc_ep(ep, eager_length);
+      if (unlikely(!unexp_buffer)) {
+	omx__verbose_printf(ep, "Failed to allocate buffer for unexpected messages, dropping\n");
+	omx__request_free(ep, req);
+	/* let the caller handle the error */
+	return OMX_NO_RESOURCES;
+      }
+
+      omx_cache_single_segment(&req->recv.segs, unexp_buffer, eager_length);
     }
 
     req->generic.partner = partner;
@@ -878,7 +1021,7 @@ omx__process_self_send(struct omx_endpoint *ep,
     omx__debug_assert(!(ep->progression_disabled & OMX_PROGRESSION_DISABLED_IN_HANDLER));
     ep->progression_disabled = OMX_PROGRESSION_DISABLED_IN_HANDLER;
 #ifdef OMX_LIB_DEBUG
-    omx_handler_jiffies_start = omx__driver_desc->jiffies;
+    omx_handler_jiffies_start = omx__now();
 #endif
     OMX__ENDPOINT_UNLOCK(ep);
 
@@ -888,13 +1031,14 @@ omx__process_self_send(struct omx_endpoint *ep,
     OMX__ENDPOINT_LOCK(ep);
     ep->progression_disabled = 0;
     OMX__ENDPOINT_HANDLER_DONE_SIGNAL(ep);
+    OMX__ENDPOINT_PROGRESSION_ENABLED_SIGNAL(ep);
 #ifdef OMX_LIB_DEBUG
   {
-    uint64_t now = omx__driver_desc->jiffies;
+    uint64_t now = omx__now();
     uint64_t delay = now - omx_handler_jiffies_start;
-    if (delay > omx__driver_desc->hz)
+    if (delay > omx__globals.hz)
       omx__verbose_printf(ep, "Unexpected handler disabled progression during %lld seconds (%lld jiffies)\n",
-			  (unsigned long long) delay/omx__driver_desc->hz, (unsigned long long) delay);
+			  (unsigned long long) delay/omx__globals.hz, (unsigned long long) delay);
   }
 #endif
 
@@ -992,9 +1136,7 @@ omx__process_self_send(struct omx_endpoint *ep,
     omx_copy_from_segments(unexp_buffer, &sreq->send.segs, msg_length);
     rreq->recv.checksum = omx_checksum_segments(&rreq->recv.segs, msg_length);
 
-    omx__enqueue_request(&ep->anyctxid.unexp_req_q, rreq);
-    if (unlikely(HAS_CTXIDS(ep)))
-      omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, rreq);
+    omx__enqueue_unexp_request(ep, ctxid, rreq);
 
     /* self communication are always synchronous,
      * the send will be completed on matching
@@ -1101,9 +1243,7 @@ omx__complete_unexp_req_as_irecv(struct omx_endpoint *ep,
   uint32_t msg_length;
   uint32_t xfer_length;
 
-  omx___dequeue_request(req);
-  if (unlikely(HAS_CTXIDS(ep)))
-    omx___dequeue_ctxid_request(req);
+  omx___dequeue_unexp_request(ep, req);
 
   /* get the unexp buffer and store the new segments */
   unexp_buffer = OMX_SEG_PTR(&req->recv.segs.single);
@@ -1120,9 +1260,18 @@ omx__complete_unexp_req_as_irecv(struct omx_endpoint *ep,
   req->generic.status.context = context;
 
   if (unlikely(req->generic.type == OMX_REQUEST_TYPE_RECV_LARGE)) {
+    uint16_t eager_length = req->recv.specific.large.eager_length;
+
     /* it's a large message, queue the recv large */
     omx__submit_pull(ep, req);
 
+    if (eager_length) {
+      /* copy the eager prefix while the pull of the rest starts */
+      omx_copy_to_segments(reqsegs, unexp_buffer,
+			   eager_length < xfer_length ? eager_length : xfer_length);
+      omx_free_ep(ep, unexp_buffer);
+    }
+
   } else if (unlikely(req->generic.type == OMX_REQUEST_TYPE_RECV_SELF_UNEXPECTED)) {
     /* it's a unexpected from self, we need to complete the corresponding send */
     union omx_request *sreq = req->recv.specific.self_unexp.sreq;
@@ -1195,13 +1344,21 @@ omx__complete_unexp_req_as_irecv(struct omx_endpoint *ep,
 static INLINE omx_return_t
 omx__irecv_segs(struct omx_endpoint *ep, const struct omx__req_segs * reqsegs,
 		uint64_t match_info, uint64_t match_mask,
-		void *context, union omx_request **requestp)
+		void *context, union omx_request **requestp,
+		int progress)
 {
   uint32_t ctxid = CTXID_FROM_MATCHING(ep, match_info);
   union omx_request * req;
   omx_return_t ret;
 
-  if (unlikely(HAS_CTXIDS(ep))) {
+  if (likely(match_mask == OMX__RECV_MATCH_MASK_EXACT)) {
+    req = omx__find_exact_unexp_request(ep, match_info);
+    if (req) {
+      /* matched an unexpected through the index */
+      omx__complete_unexp_req_as_irecv(ep, req, reqsegs, context);
+      goto ok;
+    }
+  } else if (unlikely(HAS_CTXIDS(ep))) {
     omx__foreach_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req) {
       if (likely((req->generic.status.match_info & match_mask) == match_info)) {
 	/* matched an unexpected in the ctxid queue */
@@ -1234,8 +1391,9 @@ omx__irecv_segs(struct omx_endpoint *ep, const struct omx__req_segs * reqsegs,
   req->recv.match_info = match_info;
   req->recv.match_mask = match_mask;
 
-  omx__enqueue_request(&ep->ctxid[ctxid].recv_req_q, req);
-  omx__progress(ep);
+  omx__enqueue_posted_recv_request(ep, ctxid, req);
+  if (progress)
+    omx__progress(ep);
 
  ok:
   if (requestp) {
@@ -1279,7 +1437,7 @@ omx_irecv(struct omx_endpoint *ep,
 
   OMX__ENDPOINT_LOCK(ep);
 
-  ret = omx__irecv_segs(ep, &reqsegs, match_info, match_mask, context, requestp);
+  ret = omx__irecv_segs(ep, &reqsegs, match_info, match_mask, context, requestp, 1);
   if (unlikely(ret != OMX_SUCCESS))
     goto out_with_lock;
 
@@ -1293,6 +1451,120 @@ omx_irecv(struct omx_endpoint *ep,
   return ret;
 }
 
+/* API omx_recv_init */
+omx_return_t
+omx_recv_init(struct omx_endpoint *ep,
+	      void *buffer, size_t length,
+	      uint64_t match_info, uint64_t match_mask,
+	      void *context, struct omx_persistent_request **persistentp)
+{
+  struct omx_persistent_request *persistent;
+  omx_return_t ret = OMX_SUCCESS;
+
+  /* check the matching once for all starts */
+  if (unlikely(match_info & ~match_mask)) {
+    ret = omx__error_with_ep(ep, OMX_BAD_MATCH_MASK,
+			     "recv_init with match info %llx mask %llx",
+			     (unsigned long long) match_info, (unsigned long long) match_mask);
+    goto out;
+  }
+
+  /* check that there's no wildcard in the context id range */
+  if (unlikely(ep->ctxid_mask & ~match_mask)) {
+    ret = omx__error_with_ep(ep, OMX_BAD_MATCHING_FOR_CONTEXT_ID_MASK,
+			     "recv_init with match mask %llx and ctxid mask %llx",
+			     (unsigned long long) match_mask, ep->ctxid_mask);
+    goto out;
+  }
+
+  OMX__ENDPOINT_LOCK(ep);
+
+  persistent = omx_malloc_ep(ep, sizeof(*persistent));
+  if (unlikely(!persistent)) {
+    ret = omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating persistent recv request");
+    goto out_with_lock;
+  }
+
+  omx_cache_single_segment(&persistent->segs, buffer, length);
+
+  persistent->type = OMX_REQUEST_TYPE_RECV;
+  persistent->partner = NULL;
+  persistent->match_info = match_info;
+  persistent->match_mask = match_mask;
+  persistent->context = context;
+
+  *persistentp = persistent;
+
+ out_with_lock:
+  OMX__ENDPOINT_UNLOCK(ep);
+ out:
+  return ret;
+}
+
+/* called by omx_start with the endpoint lock held */
+omx_return_t
+omx__start_irecv(struct omx_endpoint *ep,
+		 const struct omx_persistent_request *persistent,
+		 union omx_request **requestp)
+{
+  return omx__irecv_segs(ep, &persistent->segs,
+			 persistent->match_info, persistent->match_mask,
+			 persistent->context, requestp, 1);
+}
+
+/* API omx_irecv_many */
+omx_return_t
+omx_irecv_many(struct omx_endpoint *ep,
+	       struct omx_recv_desc *descs, uint32_t count,
+	       union omx_request **requests)
+{
+  struct omx__req_segs reqsegs;
+  omx_return_t ret = OMX_SUCCESS;
+  uint32_t i;
+
+  OMX__ENDPOINT_LOCK(ep);
+
+  for(i=0; i<count; i++) {
+    uint64_t match_info = descs[i].match_info;
+    uint64_t match_mask = descs[i].match_mask;
+
+    if (unlikely(match_info & ~match_mask)) {
+      ret = omx__error_with_ep(ep, OMX_BAD_MATCH_MASK,
+			       "irecv_many with match info %llx mask %llx",
+			       (unsigned long long) match_info, (unsigned long long) match_mask);
+      break;
+    }
+
+    /* check that there's no wildcard in the context id range */
+    if (unlikely(ep->ctxid_mask & ~match_mask)) {
+      ret = omx__error_with_ep(ep, OMX_BAD_MATCHING_FOR_CONTEXT_ID_MASK,
+			       "irecv_many with match mask %llx and ctxid mask %llx",
+			       (unsigned long long) match_mask, ep->ctxid_mask);
+      break;
+    }
+
+    omx_cache_single_segment(&reqsegs, descs[i].buffer, descs[i].length);
+
+    ret = omx__irecv_segs(ep, &reqsegs, match_info, match_mask, descs[i].context,
+			  requests ? &requests[i] : NULL, 0);
+    if (unlikely(ret != OMX_SUCCESS)) {
+      omx_free_segments(ep, &reqsegs);
+      break;
+    }
+  }
+
+  /* the following requests were not posted */
+  if (requests)
+    for( ; i<count; i++)
+      requests[i] = NULL;
+
+  /* progress once for all of them */
+  omx__progress(ep);
+
+  OMX__ENDPOINT_UNLOCK(ep);
+  return ret;
+}
+
 /* API omx_irecvv */
 omx_return_t
 omx_irecvv(omx_endpoint_t ep,
@@ -1329,7 +1601,7 @@ omx_irecvv(omx_endpoint_t ep,
 
   OMX__ENDPOINT_LOCK(ep);
 
-  ret = omx__irecv_segs(ep, &reqsegs, match_info, match_mask, context, requestp);
+  ret = omx__irecv_segs(ep, &reqsegs, match_info, match_mask, context, requestp, 1);
   if (unlikely(ret != OMX_SUCCESS))
     goto out_with_lock;
 
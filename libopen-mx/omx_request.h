@@ -20,6 +20,7 @@
 #define __omx_request_h__
 
 #include <stdlib.h>
+#include <string.h>
 
 #include "omx_lib.h"
 #include "omx_list.h"
@@ -28,36 +29,39 @@
  * Request allocation
  */
 
-static inline void
-omx__request_alloc_init(struct omx_endpoint *ep)
-{
-#ifdef OMX_LIB_DEBUG
-  ep->req_alloc_nr = 0;
-#endif
-}
+/*
+ * Requests are allocated from page-sized chunks and recycled through a per-endpoint
+ * free list (queued by their queue_elt) so that the critical path does not call the allocator.
+ * Chunks are only released when closing the endpoint.
+ */
 
-static inline void
-omx__request_alloc_exit(struct omx_endpoint *ep)
-{
-#ifdef OMX_LIB_DEBUG
-  if (ep->req_alloc_nr)
-    omx__verbose_printf(ep, "%d requests were not freed on endpoint close\n", ep->req_alloc_nr);
-#endif
-}
+#define OMX__REQUEST_CHUNK_SIZE 4096
+#define OMX__REQUEST_CHUNK_NR ((OMX__REQUEST_CHUNK_SIZE - sizeof(struct omx__request_chunk)) / sizeof(union omx_request))
+
+extern int
+omx__request_alloc_grow(struct omx_endpoint *ep);
+
+extern void
+omx__request_alloc_init(struct omx_endpoint *ep);
+
+extern void
+omx__request_alloc_exit(struct omx_endpoint *ep);
 
 static inline __malloc union omx_request *
 omx__request_alloc(struct omx_endpoint *ep)
 {
   union omx_request * req;
 
-#ifdef OMX_LIB_DEBUG
-  req = omx_calloc_ep(ep, 1, sizeof(*req));
-#else
-  req = omx_malloc_ep(ep, sizeof(*req));
-#endif
-  if (unlikely(!req))
+  if (unlikely(list_empty(&ep->req_free_list))
+      && unlikely(omx__request_alloc_grow(ep) < 0))
     return NULL;
 
+  req = list_first_entry(&ep->req_free_list, union omx_request, generic.queue_elt);
+  list_del(&req->generic.queue_elt);
+
+#ifdef OMX_LIB_DEBUG
+  memset(req, 0, sizeof(*req));
+#endif
   req->generic.state = 0;
   req->generic.status.code = OMX_SUCCESS;
 
@@ -70,7 +74,8 @@ omx__request_alloc(struct omx_endpoint *ep)
 static inline void
 omx__request_free(struct omx_endpoint *ep, union omx_request * req)
 {
-  omx_free_ep(ep, req);
+  /* reuse the most recently freed requests first, they are likely still in cache */
+  list_add_after(&req->generic.queue_elt, &ep->req_free_list);
 #ifdef OMX_LIB_DEBUG
   ep->req_alloc_nr--;
 #endif
@@ -167,6 +172,227 @@ omx__dequeue_ctxid_request(struct list_head *head,
 #define omx__foreach_ctxid_request(head, req)	\
 list_for_each_entry(req, head, generic.ctxid_elt)
 
+/*****************************************
+ * Posted receive matching queue management
+ */
+
+/*
+ * Fully-specified receives are hashed on their match_info so that the common
+ * exact matching does not depend on the number of posted receives.
+ * Wildcard receives remain in a posting-ordered list. Each receive gets
+ * a stamp when posted so that the oldest of the exact and wildcard candidates
+ * is matched first, as required by the MX semantics.
+ */
+
+#define OMX__RECV_MATCH_MASK_EXACT ((uint64_t) -1)
+#define OMX__RECV_MATCH_BUCKETS_MIN 64
+#define OMX__RECV_MATCH_LOAD_MAX 2 /* average exact receives per bucket before growing */
+
+extern void
+omx__recv_match_queue_init(struct omx__recv_match_queue *queue);
+
+extern void
+omx__recv_match_queue_exit(struct omx_endpoint *ep, struct omx__recv_match_queue *queue);
+
+extern void
+omx__recv_match_queue_grow(struct omx_endpoint *ep, struct omx__recv_match_queue *queue);
+
+static inline uint32_t
+omx__recv_match_hash(uint64_t match_info, uint32_t buckets_nr)
+{
+  /* multiplicative hashing, the number of buckets is a power of 2 */
+  return ((uint32_t) ((match_info * 0x9e3779b97f4a7c15ULL) >> 32)) & (buckets_nr - 1);
+}
+
+static inline struct list_head *
+omx__recv_match_bucket(const struct omx__recv_match_queue *queue, uint64_t match_info)
+{
+  return &queue->exact_buckets[omx__recv_match_hash(match_info, queue->exact_buckets_nr)];
+}
+
+static inline void
+omx__enqueue_posted_recv_request(struct omx_endpoint *ep, uint32_t ctxid,
+				 union omx_request *req)
+{
+  struct omx__recv_match_queue *queue = &ep->ctxid[ctxid].recv_match;
+
+  req->recv.post_stamp = ep->next_recv_post_stamp++;
+
+  if (likely(req->recv.match_mask == OMX__RECV_MATCH_MASK_EXACT)) {
+    if (unlikely(queue->exact_nr >= queue->exact_buckets_nr * OMX__RECV_MATCH_LOAD_MAX))
+      omx__recv_match_queue_grow(ep, queue);
+    omx__enqueue_request(omx__recv_match_bucket(queue, req->recv.match_info), req);
+    queue->exact_nr++;
+  } else {
+    omx__enqueue_request(&queue->wildcard_q, req);
+    queue->wildcard_nr++;
+  }
+}
+
+static inline void
+omx__dequeue_posted_recv_request(struct omx_endpoint *ep,
+				 union omx_request *req)
+{
+  uint32_t ctxid = CTXID_FROM_MATCHING(ep, req->recv.match_info);
+  struct omx__recv_match_queue *queue = &ep->ctxid[ctxid].recv_match;
+
+  if (likely(req->recv.match_mask == OMX__RECV_MATCH_MASK_EXACT)) {
+    omx__dequeue_request(omx__recv_match_bucket(queue, req->recv.match_info), req);
+    queue->exact_nr--;
+  } else {
+    omx__dequeue_request(&queue->wildcard_q, req);
+    queue->wildcard_nr--;
+  }
+}
+
+/* find the first posted receive matching an incoming match_info and dequeue it */
+static inline union omx_request *
+omx__match_posted_recv_request(struct omx_endpoint *ep, uint32_t ctxid,
+			       uint64_t match_info)
+{
+  struct omx__recv_match_queue *queue = &ep->ctxid[ctxid].recv_match;
+  union omx_request *req, *found = NULL;
+
+  if (likely(queue->exact_nr)) {
+    omx__foreach_request(omx__recv_match_bucket(queue, match_info), req)
+      if (likely(req->recv.match_info == match_info)) {
+	found = req;
+	break;
+      }
+  }
+
+  if (unlikely(queue->wildcard_nr)) {
+    omx__foreach_request(&queue->wildcard_q, req) {
+      if (found && req->recv.post_stamp > found->recv.post_stamp)
+	/* posted after the exact candidate, which thus matches first */
+	break;
+      if (req->recv.match_info == (req->recv.match_mask & match_info)) {
+	found = req;
+	break;
+      }
+    }
+  }
+
+  if (likely(found)) {
+    omx___dequeue_request(found);
+    if (likely(found->recv.match_mask == OMX__RECV_MATCH_MASK_EXACT))
+      queue->exact_nr--;
+    else
+      queue->wildcard_nr--;
+  }
+
+  return found;
+}
+
+/* iterate over all exact buckets, and then the wildcard queue */
+#define omx__foreach_posted_recv_bucket(queue, i, bucket)		\
+for(i = 0, bucket = (queue)->exact_buckets;				\
+    i <= (queue)->exact_buckets_nr;					\
+    i++, bucket = (i < (queue)->exact_buckets_nr) ? &(queue)->exact_buckets[i] : &(queue)->wildcard_q)
+
+static inline unsigned
+omx__posted_recv_queue_count(const struct omx__recv_match_queue *queue)
+{
+  const struct list_head *bucket;
+  unsigned i, count = 0;
+
+  omx__foreach_posted_recv_bucket(queue, i, bucket)
+    count += omx__queue_count(bucket);
+
+  return count;
+}
+
+/************************************
+ * Unexpected receive queue management
+ */
+
+/*
+ * Unexpected receives are queued in arrival order in the anyctxid queue
+ * (and in their ctxid queue if there are multiple ctxids) for wildcard
+ * matching, and hashed on their match_info for exact matching.
+ * Since arrival order is preserved within each bucket, the first entry with
+ * the same match_info in the bucket is also the first one in the queues.
+ */
+
+#define OMX__UNEXP_INDEX_BUCKETS_MIN 64
+#define OMX__UNEXP_INDEX_LOAD_MAX 2 /* average unexpected receives per bucket before growing */
+
+extern void
+omx__unexp_index_init(struct omx__unexp_match_index *index);
+
+extern void
+omx__unexp_index_exit(struct omx_endpoint *ep, struct omx__unexp_match_index *index);
+
+extern void
+omx__unexp_index_grow(struct omx_endpoint *ep, struct omx__unexp_match_index *index);
+
+static inline struct list_head *
+omx__unexp_index_bucket(const struct omx__unexp_match_index *index, uint64_t match_info)
+{
+  return &index->buckets[omx__recv_match_hash(match_info, index->buckets_nr)];
+}
+
+static inline void
+omx__enqueue_unexp_request(struct omx_endpoint *ep, uint32_t ctxid,
+			   union omx_request *req)
+{
+  struct omx__unexp_match_index *index = &ep->anyctxid.unexp_index;
+
+  omx__enqueue_request(&ep->anyctxid.unexp_req_q, req);
+  if (unlikely(HAS_CTXIDS(ep)))
+    omx__enqueue_ctxid_request(&ep->ctxid[ctxid].unexp_req_q, req);
+
+  if (unlikely(index->depth >= index->buckets_nr * OMX__UNEXP_INDEX_LOAD_MAX))
+    omx__unexp_index_grow(ep, index);
+  list_add_tail(&req->generic.done_elt,
+		omx__unexp_index_bucket(index, req->generic.status.match_info));
+  if (unlikely(++index->depth > index->depth_max))
+    index->depth_max = index->depth;
+}
+
+/* remove an unexpected receive from the queues and from the index */
+static inline void
+omx___dequeue_unexp_request(struct omx_endpoint *ep,
+			    union omx_request *req)
+{
+  omx___dequeue_request(req);
+  if (unlikely(HAS_CTXIDS(ep)))
+    omx___dequeue_ctxid_request(req);
+  list_del(&req->generic.done_elt);
+  ep->anyctxid.unexp_index.depth--;
+}
+
+static inline void
+omx__dequeue_unexp_request(struct omx_endpoint *ep,
+			   union omx_request *req)
+{
+  list_check_elt(&ep->anyctxid.unexp_req_q, &req->generic.queue_elt,
+		 NULL, "Failed to find request in unexpected queue for dequeueing\n");
+  if (unlikely(HAS_CTXIDS(ep)))
+    list_check_elt(&ep->ctxid[CTXID_FROM_MATCHING(ep, req->generic.status.match_info)].unexp_req_q,
+		   &req->generic.ctxid_elt,
+		   NULL, "Failed to find request in unexpected ctxid queue for dequeueing\n");
+  list_check_elt(omx__unexp_index_bucket(&ep->anyctxid.unexp_index, req->generic.status.match_info),
+		 &req->generic.done_elt,
+		 NULL, "Failed to find request in unexpected index for dequeueing\n");
+
+  omx___dequeue_unexp_request(ep, req);
+}
+
+/* find the first unexpected receive whose match_info is exactly the given one, without dequeueing it */
+static inline union omx_request *
+omx__find_exact_unexp_request(const struct omx_endpoint *ep, uint64_t match_info)
+{
+  const struct omx__unexp_match_index *index = &ep->anyctxid.unexp_index;
+  union omx_request *req;
+
+  list_for_each_entry(req, omx__unexp_index_bucket(index, match_info), generic.done_elt)
+    if (likely(req->generic.status.match_info == match_info))
+      return req;
+
+  return NULL;
+}
+
 /********************************
  * Done request queue management
  */
@@ -185,10 +411,21 @@ omx__notify_request_done_early(struct omx_endpoint *ep, uint32_t ctxid,
 
   req->generic.state |= OMX_REQUEST_STATE_DONE;
 
-  if (likely(!(req->generic.state & OMX_REQUEST_STATE_ZOMBIE))) {
+  if (ep->completion_handler && !(req->generic.state & OMX_REQUEST_STATE_ZOMBIE)) {
+    /* deliver to the application now and zombify, the real completion will free it */
+    ep->completion_handler(ep->completion_handler_context, &req->generic.status);
+    req->generic.state &= ~OMX_REQUEST_STATE_DONE;
+    req->generic.state |= OMX_REQUEST_STATE_ZOMBIE;
+    ep->zombies++;
+
+  } else if (likely(!(req->generic.state & OMX_REQUEST_STATE_ZOMBIE))) {
+    /* not really done yet, the application will have to zombify it */
     list_add_tail(&req->generic.done_elt, &ep->anyctxid.done_req_q);
     if (unlikely(HAS_CTXIDS(ep)))
       list_add_tail(&req->generic.ctxid_elt, &ep->ctxid[ctxid].done_req_q);
+
+    if (unlikely(!list_empty(&ep->sleepers)))
+      omx__notify_sleepers(ep, req);
   }
 
   /*
@@ -210,12 +447,21 @@ omx__notify_request_done(struct omx_endpoint *ep, uint32_t ctxid,
 #ifdef OMX_LIB_DEBUG
     omx__enqueue_request(&ep->internal_done_req_q, req);
 #endif
+    if (unlikely(!list_empty(&ep->sleepers)))
+      omx__notify_sleepers(ep, req);
 
   } else if (likely(req->generic.state & OMX_REQUEST_STATE_ZOMBIE)) {
     /* request already completed by the application, just free it */
     omx__request_free(ep, req);
     ep->zombies--;
 
+  } else if (ep->completion_handler && !(req->generic.state & OMX_REQUEST_STATE_DONE)) {
+    /* deliver to the application instead of queueing */
+    omx__debug_assert(!req->generic.state);
+    req->generic.state |= OMX_REQUEST_STATE_DONE;
+    ep->completion_handler(ep->completion_handler_context, &req->generic.status);
+    omx__request_free(ep, req);
+
   } else if (unlikely(!(req->generic.state & OMX_REQUEST_STATE_DONE))) {
     /* queue the request to the done queue */
     omx__debug_assert(!req->generic.state);
@@ -226,6 +472,9 @@ omx__notify_request_done(struct omx_endpoint *ep, uint32_t ctxid,
 #ifdef OMX_LIB_DEBUG
     omx__enqueue_request(&ep->really_done_req_q, req);
 #endif
+
+    if (unlikely(!list_empty(&ep->sleepers)))
+      omx__notify_sleepers(ep, req);
   } else {
     /* request was marked as done early, its done_*_elt are already queued */
     omx__debug_assert(req->generic.state == OMX_REQUEST_STATE_DONE);
@@ -266,6 +515,9 @@ list_for_each_entry(req, &ep->anyctxid.done_req_q, generic.done_elt)
 #define omx__foreach_done_anyctxid_request_safe(ep, req, next)		\
 list_for_each_entry_safe(req, next, &ep->anyctxid.done_req_q, generic.done_elt)
 
+#define omx__foreach_done_ctxid_request_safe(ep, _ctxid, req, next)		\
+list_for_each_entry_safe(req, next, &ep->ctxid[_ctxid].done_req_q, generic.ctxid_elt)
+
 static inline union omx_request *
 omx__first_done_anyctxid_request(const struct omx_endpoint *ep)
 {
@@ -29,6 +29,20 @@
  * Send Request Completion
  */
 
+/* give the sendq slots back to their persistent request, or release them if it was freed meanwhile */
+static INLINE void
+omx__persistent_release_sendq(struct omx_endpoint *ep, struct omx_persistent_request *persistent)
+{
+  persistent->specific.mediumsq.sendq_busy = 0;
+  omx__endpoint_sendq_map_set_user(ep, persistent->specific.mediumsq.frags_nr,
+				   persistent->specific.mediumsq.sendq_map_index, persistent);
+
+  if (unlikely(persistent->specific.mediumsq.released)) {
+    omx__endpoint_sendq_map_put(ep, persistent->specific.mediumsq.frags_nr, persistent->specific.mediumsq.sendq_map_index);
+    omx_free_ep(ep, persistent);
+  }
+}
+
 void
 omx__send_complete(struct omx_endpoint *ep, union omx_request *req,
 		   omx_return_t status)
@@ -56,7 +70,10 @@ omx__send_complete(struct omx_endpoint *ep, union omx_request *req,
     omx_free_ep(ep, req->send.specific.small.copy);
     break;
   case OMX_REQUEST_TYPE_SEND_MEDIUMSQ:
-    omx__endpoint_sendq_map_put(ep, req->send.specific.mediumsq.frags_nr, req->send.specific.mediumsq.sendq_map_index);
+    if (req->send.specific.mediumsq.persistent)
+      omx__persistent_release_sendq(ep, req->send.specific.mediumsq.persistent);
+    else
+      omx__endpoint_sendq_map_put(ep, req->send.specific.mediumsq.frags_nr, req->send.specific.mediumsq.sendq_map_index);
     break;
   default:
     break;
@@ -86,10 +103,13 @@ omx__post_isend_tiny(struct omx_endpoint *ep,
   omx__debug_printf(ACK, ep, "piggy acking back to partner up to %d (#%d) at jiffies %lld\n",
 		    (unsigned int) OMX__SEQNUM(ack_upto - 1),
 		    (unsigned int) OMX__SESNUM_SHIFTED(ack_upto - 1),
-		    (unsigned long long) omx__driver_desc->jiffies);
+		    (unsigned long long) omx__now());
   tiny_param->hdr.piggyack = ack_upto;
 
-  err = ioctl(ep->fd, OMX_CMD_SEND_TINY, tiny_param);
+  err = omx__submit_cmd(ep, OMX_CMD_SEND_TINY, OMX_EPCMD_SEND_TINY,
+			omx__partner_aggregate_flags(partner, tiny_param->hdr.shared),
+			tiny_param, sizeof(tiny_param->hdr) + tiny_param->hdr.length,
+			tiny_param->hdr.shared);
   if (unlikely(err < 0)) {
     omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
 				       OMX_SUCCESS,
@@ -98,7 +118,7 @@ omx__post_isend_tiny(struct omx_endpoint *ep,
   }
 
   req->generic.resends++;
-  req->generic.last_send_jiffies = omx__driver_desc->jiffies;
+  req->generic.last_send_jiffies = omx__now();
 
   if (!err)
     omx__mark_partner_ack_sent(ep, partner);
@@ -207,10 +227,12 @@ omx__post_isend_small(struct omx_endpoint *ep,
   omx__debug_printf(ACK, ep, "piggy acking back to partner up to %d (#%d) at jiffies %lld\n",
 		    (unsigned int) OMX__SEQNUM(ack_upto - 1),
 		    (unsigned int) OMX__SESNUM_SHIFTED(ack_upto - 1),
-		    (unsigned long long) omx__driver_desc->jiffies);
+		    (unsigned long long) omx__now());
   small_param->piggyack = ack_upto;
 
-  err = ioctl(ep->fd, OMX_CMD_SEND_SMALL, small_param);
+  err = omx__submit_cmd(ep, OMX_CMD_SEND_SMALL, OMX_EPCMD_SEND_SMALL,
+			omx__partner_aggregate_flags(partner, small_param->shared),
+			small_param, sizeof(*small_param), small_param->shared);
   if (unlikely(err < 0)) {
     omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
 				       OMX_SUCCESS,
@@ -219,7 +241,7 @@ omx__post_isend_small(struct omx_endpoint *ep,
   }
 
   req->generic.resends++;
-  req->generic.last_send_jiffies = omx__driver_desc->jiffies;
+  req->generic.last_send_jiffies = omx__now();
 
   if (!err)
     omx__mark_partner_ack_sent(ep, partner);
@@ -278,9 +300,10 @@ omx__alloc_setup_isend_small(struct omx_endpoint *ep,
    * if single segment, use it for the first pio,
    * else copy it in the contigous copy buffer first
    */
-  if (likely(req->send.segs.nseg == 1)) {
+  if (likely(req->send.segs.nseg == 1 && !omx__globals.submit_batch)) {
     small_param->vaddr = (uintptr_t) OMX_SEG_PTR(&req->send.segs.single);
   } else {
+    /* batched commands are submitted after the application may reuse its buffer */
     omx_copy_from_segments(copy, &req->send.segs, length);
     small_param->vaddr = (uintptr_t) copy;
   }
@@ -298,7 +321,7 @@ omx__alloc_setup_isend_small(struct omx_endpoint *ep,
   }
 
   /* bufferize data for retransmission (if not done already) */
-  if (likely(req->send.segs.nseg == 1)) {
+  if (likely(small_param->vaddr != (uintptr_t) copy)) {
     omx_copy_from_segments(copy, &req->send.segs, length);
     small_param->vaddr = (uintptr_t) copy;
   }
@@ -350,9 +373,10 @@ omx__post_isend_mediumva(struct omx_endpoint *ep,
   omx__debug_printf(ACK, ep, "piggy acking back to partner up to %d (#%d) at jiffies %lld\n",
 		    (unsigned int) OMX__SEQNUM(ack_upto - 1),
 		    (unsigned int) OMX__SESNUM_SHIFTED(ack_upto - 1),
-		    (unsigned long long) omx__driver_desc->jiffies);
+		    (unsigned long long) omx__now());
   medium_param->piggyack = ack_upto;
 
+  omx__flush_batch(ep); /* keep submission ordered */
   err = ioctl(ep->fd, OMX_CMD_SEND_MEDIUMVA, medium_param);
   if (unlikely(err < 0)) {
     omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
@@ -362,7 +386,7 @@ omx__post_isend_mediumva(struct omx_endpoint *ep,
   }
 
   req->generic.resends++;
-  req->generic.last_send_jiffies = omx__driver_desc->jiffies;
+  req->generic.last_send_jiffies = omx__now();
 
   if (!err)
     omx__mark_partner_ack_sent(ep, partner);
@@ -435,6 +459,82 @@ omx__alloc_setup_isend_mediumva(struct omx_endpoint *ep,
  * Send Medium through the Send Queue
  */
 
+/* number of expected events needed each time a mediumsq request is posted */
+static INLINE uint32_t
+omx__mediumsq_exp_events_nr(const union omx_request *req)
+{
+  /* the whole-message command reports a single event */
+  return omx__globals.mediumsq_whole ? 1 : req->send.specific.mediumsq.frags_nr;
+}
+
+/* copy all fragments into their sendq slots */
+static INLINE void
+omx__copy_isend_mediumsq(struct omx_endpoint *ep, union omx_request *req)
+{
+  uint32_t remaining = req->generic.status.msg_length;
+  omx_sendq_map_index_t * sendq_index = req->send.specific.mediumsq.sendq_map_index;
+  uint32_t frags_nr = req->send.specific.mediumsq.frags_nr;
+  uint32_t frag_max = OMX_MEDIUM_FRAG_LENGTH_MAX;
+  unsigned i;
+
+  if (likely(req->send.segs.nseg == 1)) {
+    /* optimize the contigous send medium */
+    char * data = OMX_SEG_PTR(&req->send.segs.single);
+
+    for(i=0; i<frags_nr; i++) {
+      unsigned chunk = remaining > frag_max ? frag_max : remaining;
+      memcpy(ep->sendq + (sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT), data, chunk);
+      remaining -= chunk;
+      data += chunk;
+    }
+
+  } else {
+    /* initialize the state to the beginning */
+    struct omx_segscan_state state = { .seg = &req->send.segs.segs[0], .offset = 0 };
+
+    for(i=0; i<frags_nr; i++) {
+      unsigned chunk = remaining > frag_max ? frag_max : remaining;
+      omx_continue_partial_copy_from_segments(ep, ep->sendq + (sendq_index[i] << OMX_SENDQ_ENTRY_SHIFT),
+					      &req->send.segs, chunk,
+					      &state);
+      remaining -= chunk;
+    }
+  }
+}
+
+/* submit all fragments to the driver at once, it will report a single done event */
+static INLINE int
+omx__post_isend_mediumsq_whole(struct omx_endpoint *ep,
+			       union omx_request *req)
+{
+  const struct omx_cmd_send_mediumsq_frag * medium_param = &req->send.specific.mediumsq.send_mediumsq_frag_ioctl_param;
+  omx_sendq_map_index_t * sendq_index = req->send.specific.mediumsq.sendq_map_index;
+  uint32_t frags_nr = req->send.specific.mediumsq.frags_nr;
+  struct omx_cmd_send_mediumsq whole_param;
+  unsigned i;
+
+  BUILD_BUG_ON(OMX_MEDIUM_FRAGS_MAX > OMX_CMD_SEND_MEDIUMSQ_FRAGS_MAX);
+
+  whole_param.peer_index = medium_param->peer_index;
+  whole_param.dest_endpoint = medium_param->dest_endpoint;
+  whole_param.shared = medium_param->shared;
+  whole_param.session_id = medium_param->session_id;
+  whole_param.seqnum = medium_param->seqnum;
+  whole_param.piggyack = medium_param->piggyack;
+  whole_param.msg_length = medium_param->msg_length;
+  whole_param.checksum = medium_param->checksum;
+  whole_param.frag_pipeline = medium_param->frag_pipeline;
+  whole_param.match_info = medium_param->match_info;
+  whole_param.frags_nr = frags_nr;
+  for(i=0; i<frags_nr; i++)
+    whole_param.sendq_index[i] = sendq_index[i];
+
+  omx__debug_printf(MEDIUM, ep, "sending mediumsq length %ld as %ld frags at once\n",
+		    (unsigned long) medium_param->msg_length, (unsigned long) frags_nr);
+
+  return ioctl(ep->fd, OMX_CMD_SEND_MEDIUMSQ, &whole_param);
+}
+
 static void
 omx__post_isend_mediumsq(struct omx_endpoint *ep,
 			 struct omx__partner *partner,
@@ -453,10 +553,24 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
   omx__debug_printf(ACK, ep, "piggy acking back to partner up to %d (#%d) at jiffies %lld\n",
 		    (unsigned int) OMX__SEQNUM(ack_upto - 1),
 		    (unsigned int) OMX__SESNUM_SHIFTED(ack_upto - 1),
-		    (unsigned long long) omx__driver_desc->jiffies);
+		    (unsigned long long) omx__now());
   medium_param->piggyack = ack_upto;
 
-  if (likely(req->send.segs.nseg == 1)) {
+  omx__flush_batch(ep); /* keep submission ordered */
+
+  if (likely(omx__globals.mediumsq_whole)) {
+    /* copy the data in the sendq only once */
+    if (likely(!req->generic.resends))
+      omx__copy_isend_mediumsq(ep, req);
+
+    err = omx__post_isend_mediumsq_whole(ep, req);
+    if (unlikely(err < 0)) {
+      /* nothing was posted */
+      i = 0;
+      goto err;
+    }
+
+  } else if (likely(req->send.segs.nseg == 1)) {
     /* optimize the contigous send medium */
     char * data = OMX_SEG_PTR(&req->send.segs.single);
     uint32_t offset = 0;
@@ -534,7 +648,7 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
 
  ok:
   req->generic.resends++;
-  req->generic.last_send_jiffies = omx__driver_desc->jiffies;
+  req->generic.last_send_jiffies = omx__now();
   req->generic.state |= OMX_REQUEST_STATE_DRIVER_MEDIUMSQ_SENDING;
 
   /* at least one frag was posted, the ack has been sent for sure */
@@ -550,7 +664,7 @@ omx__post_isend_mediumsq(struct omx_endpoint *ep,
 
   /* update the number of fragment that we actually submitted */
   req->send.specific.mediumsq.frags_pending_nr = i;
-  ep->avail_exp_events += frags_nr - i;
+  ep->avail_exp_events += omx__mediumsq_exp_events_nr(req) - i;
   if (i)
     /*
      * some frags were posted, mark the request as DRIVER_MEDIUM_SENDING
@@ -604,7 +718,6 @@ omx__alloc_setup_isend_mediumsq(struct omx_endpoint *ep,
   uint32_t length = req->generic.status.msg_length;
   omx_sendq_map_index_t * sendq_index = req->send.specific.mediumsq.sendq_map_index;
   int res = req->generic.missing_resources;
-  uint32_t frags_nr = req->send.specific.mediumsq.frags_nr;
 
   if (likely(res & OMX_REQUEST_RESOURCE_EXP_EVENT))
     goto need_exp_events;
@@ -613,9 +726,9 @@ omx__alloc_setup_isend_mediumsq(struct omx_endpoint *ep,
   omx__abort(ep, "Unexpected missing resources %x for mediumsq send request\n", res);
 
  need_exp_events:
-  if (unlikely(ep->avail_exp_events < frags_nr))
+  if (unlikely(ep->avail_exp_events < omx__mediumsq_exp_events_nr(req)))
     return OMX_INTERNAL_MISSING_RESOURCES;
-  ep->avail_exp_events -= frags_nr;
+  ep->avail_exp_events -= omx__mediumsq_exp_events_nr(req);
   req->generic.missing_resources &= ~OMX_REQUEST_RESOURCE_EXP_EVENT;
 
  need_sendq_map_slot:
@@ -682,6 +795,7 @@ omx__submit_isend_medium(struct omx_endpoint *ep,
 #ifdef OMX_MX_WIRE_COMPAT
     req->send.specific.mediumsq.frag_pipeline = OMX_MEDIUM_FRAG_LENGTH_SHIFT;
 #endif
+    req->send.specific.mediumsq.persistent = NULL;
   } else {
     req->generic.type = OMX_REQUEST_TYPE_SEND_MEDIUMVA;
     /* no resources needed */
@@ -724,9 +838,10 @@ omx__post_isend_rndv(struct omx_endpoint *ep,
   omx__debug_printf(ACK, ep, "piggy acking back to partner up to %d (#%d) at jiffies %lld\n",
 		    (unsigned int) OMX__SEQNUM(ack_upto - 1),
 		    (unsigned int) OMX__SESNUM_SHIFTED(ack_upto - 1),
-		    (unsigned long long) omx__driver_desc->jiffies);
+		    (unsigned long long) omx__now());
   rndv_param->piggyack = ack_upto;
 
+  omx__flush_batch(ep); /* keep submission ordered */
   err = ioctl(ep->fd, OMX_CMD_SEND_RNDV, rndv_param);
   if (unlikely(err < 0)) {
     omx_return_t ret;
@@ -740,7 +855,7 @@ omx__post_isend_rndv(struct omx_endpoint *ep,
   }
 
   req->generic.resends++;
-  req->generic.last_send_jiffies = omx__driver_desc->jiffies;
+  req->generic.last_send_jiffies = omx__now();
 
   if (!err)
     omx__mark_partner_ack_sent(ep, partner);
@@ -814,6 +929,10 @@ omx__alloc_setup_isend_large(struct omx_endpoint *ep,
   rndv_param->msg_length = length;
   rndv_param->pulled_rdma_id = region->id;
   rndv_param->pulled_rdma_seqnum = req->send.specific.large.region_seqnum;
+  /* let the receiver copy the beginning while it prepares the pull of the rest */
+  rndv_param->eager_length = partner->rndv_eager && !rndv_param->shared
+    ? (length < omx__globals.rndv_eager ? length : omx__globals.rndv_eager) : 0;
+  rndv_param->pad1 = 0;
 
 #ifdef OMX_LIB_DEBUG
   if (omx__globals.debug_checksum)
@@ -879,10 +998,11 @@ omx__post_notify(struct omx_endpoint *ep,
   omx__debug_printf(ACK, ep, "piggy acking back to partner up to %d (#%d) at jiffies %lld\n",
 		    (unsigned int) OMX__SEQNUM(ack_upto - 1),
 		    (unsigned int) OMX__SESNUM_SHIFTED(ack_upto - 1),
-		    (unsigned long long) omx__driver_desc->jiffies);
+		    (unsigned long long) omx__now());
   notify_param->piggyack = ack_upto;
 
-  err = ioctl(ep->fd, OMX_CMD_SEND_NOTIFY, notify_param);
+  err = omx__submit_cmd(ep, OMX_CMD_SEND_NOTIFY, OMX_EPCMD_SEND_NOTIFY, 0,
+			notify_param, sizeof(*notify_param), notify_param->shared);
   if (unlikely(err < 0)) {
     omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
 				       OMX_SUCCESS,
@@ -891,7 +1011,7 @@ omx__post_notify(struct omx_endpoint *ep,
   }
 
   req->generic.resends++;
-  req->generic.last_send_jiffies = omx__driver_desc->jiffies;
+  req->generic.last_send_jiffies = omx__now();
 
   if (!err)
     omx__mark_partner_ack_sent(ep, partner);
@@ -975,7 +1095,8 @@ omx__submit_notify(struct omx_endpoint *ep,
 
 static INLINE omx_return_t
 omx__isend_req(struct omx_endpoint *ep, struct omx__partner *partner,
-	       union omx_request *req, union omx_request **requestp)
+	       union omx_request *req, union omx_request **requestp,
+	       int progress)
 {
   uint32_t length = req->send.segs.total_length;
 
@@ -1009,8 +1130,9 @@ omx__isend_req(struct omx_endpoint *ep, struct omx__partner *partner,
     omx__forget(ep, req);
   }
 
-  /* progress a little bit */
-  omx__progress(ep);
+  /* progress a little bit, unless the caller posts more requests first */
+  if (progress)
+    omx__progress(ep);
 
  return OMX_SUCCESS;
 }
@@ -1042,7 +1164,7 @@ omx_isend(struct omx_endpoint *ep,
   req->generic.status.match_info = match_info;
   req->generic.status.context = context;
 
-  ret = omx__isend_req(ep, partner, req, requestp);
+  ret = omx__isend_req(ep, partner, req, requestp, 1);
   if (likely(ret != OMX_SUCCESS)) {
     omx_free_segments(ep, &req->send.segs);
     omx__request_free(ep, req);
@@ -1088,7 +1210,7 @@ omx_isendv(omx_endpoint_t ep,
   req->generic.status.match_info = match_info;
   req->generic.status.context = context;
 
-  ret = omx__isend_req(ep, partner, req, requestp);
+  ret = omx__isend_req(ep, partner, req, requestp, 1);
   if (likely(ret != OMX_SUCCESS)) {
     omx_free_segments(ep, &req->send.segs);
     omx__request_free(ep, req);
@@ -1099,6 +1221,483 @@ omx_isendv(omx_endpoint_t ep,
   return ret;
 }
 
+/* API omx_isend_many */
+omx_return_t
+omx_isend_many(struct omx_endpoint *ep,
+	       struct omx_send_desc *descs, uint32_t count,
+	       union omx_request **requests)
+{
+  struct omx__partner *partner;
+  union omx_request *req;
+  omx_return_t ret = OMX_SUCCESS;
+  uint32_t i;
+
+  OMX__ENDPOINT_LOCK(ep);
+
+  for(i=0; i<count; i++) {
+    req = omx__request_alloc(ep);
+    if (unlikely(!req)) {
+      ret = omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating isend_many request");
+      break;
+    }
+
+    omx_cache_single_segment(&req->send.segs, descs[i].buffer, descs[i].length);
+
+    req->generic.partner = partner = omx__partner_from_addr(&descs[i].dest_endpoint);
+    req->generic.status.addr = descs[i].dest_endpoint;
+    req->generic.status.match_info = descs[i].match_info;
+    req->generic.status.context = descs[i].context;
+
+    ret = omx__isend_req(ep, partner, req, requests ? &requests[i] : NULL, 0);
+    if (unlikely(ret != OMX_SUCCESS)) {
+      omx_free_segments(ep, &req->send.segs);
+      omx__request_free(ep, req);
+      break;
+    }
+  }
+
+  /* the following requests were not posted */
+  if (requests)
+    for( ; i<count; i++)
+      requests[i] = NULL;
+
+  /* progress once for all of them */
+  omx__progress(ep);
+
+  OMX__ENDPOINT_UNLOCK(ep);
+  return ret;
+}
+
+/********************************
+ * Persistent Send Requests
+ */
+
+/* prebuild the send command once, only the seqnum and piggyack will change at each start */
+static INLINE void
+omx__init_persistent_send(struct omx_endpoint *ep,
+			  struct omx__partner *partner,
+			  struct omx_persistent_request *persistent)
+{
+  uint32_t length = persistent->segs.total_length;
+
+  if (unlikely(omx__globals.selfcomms && partner == ep->myself)) {
+    /* nothing to prebuild, self sends are started as usual isends */
+    persistent->type = OMX_REQUEST_TYPE_SEND_SELF;
+
+  } else if (likely(length <= OMX_TINY_MSG_LENGTH_MAX)) {
+    struct omx_cmd_send_tiny_hdr * tiny_hdr = &persistent->specific.tiny.send_tiny_hdr;
+
+    persistent->type = OMX_REQUEST_TYPE_SEND_TINY;
+    tiny_hdr->peer_index = partner->peer_index;
+    tiny_hdr->dest_endpoint = partner->endpoint_index;
+    tiny_hdr->shared = omx__partner_localization_shared(partner);
+    tiny_hdr->match_info = persistent->match_info;
+    tiny_hdr->length = length;
+    tiny_hdr->checksum = 0;
+
+  } else if (length <= OMX_SMALL_MSG_LENGTH_MAX) {
+    struct omx_cmd_send_small * small_param = &persistent->specific.small.send_small_ioctl_param;
+
+    persistent->type = OMX_REQUEST_TYPE_SEND_SMALL;
+    small_param->peer_index = partner->peer_index;
+    small_param->dest_endpoint = partner->endpoint_index;
+    small_param->shared = omx__partner_localization_shared(partner);
+    small_param->match_info = persistent->match_info;
+    small_param->length = length;
+    small_param->checksum = 0;
+
+  } else if (length <= partner->rndv_threshold && omx__globals.medium_sendq) {
+    struct omx_cmd_send_mediumsq_frag * medium_param = &persistent->specific.mediumsq.send_mediumsq_frag_ioctl_param;
+    int frag_max = OMX_MEDIUM_FRAG_LENGTH_MAX;
+    uint32_t frags_nr = (length+frag_max-1) / frag_max;
+
+    persistent->type = OMX_REQUEST_TYPE_SEND_MEDIUMSQ;
+    medium_param->peer_index = partner->peer_index;
+    medium_param->dest_endpoint = partner->endpoint_index;
+    medium_param->shared = omx__partner_localization_shared(partner);
+    medium_param->match_info = persistent->match_info;
+#ifdef OMX_MX_WIRE_COMPAT
+    medium_param->frag_pipeline = OMX_MEDIUM_FRAG_LENGTH_SHIFT;
+#endif
+    medium_param->msg_length = length;
+    medium_param->checksum = 0;
+
+    /* keep the sendq slots for all starts, if there are enough of them */
+    persistent->specific.mediumsq.frags_nr = frags_nr;
+    persistent->specific.mediumsq.sendq_busy = 0;
+    persistent->specific.mediumsq.released = 0;
+    persistent->specific.mediumsq.sendq_slots =
+      omx__endpoint_sendq_map_get(ep, frags_nr, persistent, persistent->specific.mediumsq.sendq_map_index) == 0;
+
+  } else if (length <= partner->rndv_threshold) {
+    struct omx_cmd_send_mediumva * medium_param = &persistent->specific.mediumva.send_mediumva_ioctl_param;
+
+    persistent->type = OMX_REQUEST_TYPE_SEND_MEDIUMVA;
+    medium_param->peer_index = partner->peer_index;
+    medium_param->dest_endpoint = partner->endpoint_index;
+    medium_param->shared = omx__partner_localization_shared(partner);
+    medium_param->match_info = persistent->match_info;
+    medium_param->length = length;
+    medium_param->nr_segments = 1;
+    medium_param->checksum = 0;
+
+  } else {
+    struct omx_cmd_send_rndv * rndv_param = &persistent->specific.large.send_rndv_ioctl_param;
+    struct omx__large_region *region;
+
+    persistent->type = OMX_REQUEST_TYPE_SEND_LARGE;
+    rndv_param->peer_index = partner->peer_index;
+    rndv_param->dest_endpoint = partner->endpoint_index;
+    rndv_param->shared = omx__partner_localization_shared(partner);
+    rndv_param->match_info = persistent->match_info;
+    rndv_param->msg_length = length;
+    rndv_param->checksum = 0;
+
+    /* keep the region pinned for all starts, if one is available */
+    if (omx__get_region(ep, &persistent->segs, &region, NULL) != OMX_SUCCESS)
+      region = NULL;
+    persistent->specific.large.region = region;
+    if (region)
+      rndv_param->pulled_rdma_id = region->id;
+  }
+}
+
+/* a prebuilt command may only be posted immediately, otherwise go through the usual submission */
+static INLINE int
+omx__persistent_may_start(struct omx_endpoint *ep, struct omx__partner *partner)
+{
+  return likely(omx__empty_queue(&ep->need_resources_send_req_q))
+    && likely(OMX__SEQNUM(partner->next_send_seq - partner->next_acked_send_seq) < OMX__THROTTLING_OFFSET_MAX);
+}
+
+static INLINE int
+omx__start_isend_tiny(struct omx_endpoint *ep,
+		      struct omx__partner *partner,
+		      union omx_request *req,
+		      const struct omx_persistent_request *persistent)
+{
+  struct omx_cmd_send_tiny * tiny_param = &req->send.specific.tiny.send_tiny_ioctl_param;
+  uint32_t length = req->send.segs.total_length;
+
+  req->generic.type = OMX_REQUEST_TYPE_SEND_TINY;
+  req->generic.status.msg_length = length;
+  req->generic.status.xfer_length = length; /* truncation not notified to the sender */
+
+  tiny_param->hdr = persistent->specific.tiny.send_tiny_hdr;
+  /* the partner session may change if it got disconnected */
+  tiny_param->hdr.session_id = partner->true_session_id;
+#ifdef OMX_LIB_DEBUG
+  if (omx__globals.debug_checksum)
+    tiny_param->hdr.checksum = omx_checksum_segments(&req->send.segs, length);
+#endif
+  memcpy(tiny_param->data, OMX_SEG_PTR(&req->send.segs.single), length);
+
+  omx__setup_isend_tiny(ep, partner, req);
+  return 1;
+}
+
+static INLINE int
+omx__start_isend_small(struct omx_endpoint *ep,
+		       struct omx__partner *partner,
+		       union omx_request *req,
+		       const struct omx_persistent_request *persistent)
+{
+  struct omx_cmd_send_small * small_param = &req->send.specific.small.send_small_ioctl_param;
+  uint32_t length = req->send.segs.total_length;
+  void *copy = req->send.specific.small.copy;
+
+  req->generic.type = OMX_REQUEST_TYPE_SEND_SMALL;
+  req->generic.status.msg_length = length;
+  req->generic.status.xfer_length = length; /* truncation not notified to the sender */
+
+  *small_param = persistent->specific.small.send_small_ioctl_param;
+  small_param->session_id = partner->true_session_id;
+#ifdef OMX_LIB_DEBUG
+  if (omx__globals.debug_checksum)
+    small_param->checksum = omx_checksum_segments(&req->send.segs, length);
+#endif
+
+  if (likely(!omx__globals.submit_batch)) {
+    /* use the application buffer for the first pio */
+    small_param->vaddr = (uintptr_t) OMX_SEG_PTR(&req->send.segs.single);
+  } else {
+    /* batched commands are submitted after the application may reuse its buffer */
+    memcpy(copy, OMX_SEG_PTR(&req->send.segs.single), length);
+    small_param->vaddr = (uintptr_t) copy;
+  }
+
+  omx__setup_isend_small(ep, partner, req);
+
+  /* bufferize data for retransmission (if not done already) */
+  if (likely(small_param->vaddr != (uintptr_t) copy)) {
+    memcpy(copy, OMX_SEG_PTR(&req->send.segs.single), length);
+    small_param->vaddr = (uintptr_t) copy;
+  }
+  return 1;
+}
+
+static INLINE int
+omx__start_isend_mediumsq(struct omx_endpoint *ep,
+			  struct omx__partner *partner,
+			  union omx_request *req,
+			  struct omx_persistent_request *persistent)
+{
+  struct omx_cmd_send_mediumsq_frag * medium_param = &req->send.specific.mediumsq.send_mediumsq_frag_ioctl_param;
+  uint32_t frags_nr = persistent->specific.mediumsq.frags_nr;
+
+  /* the slots are still used by the previous start, or were never allocated */
+  if (unlikely(!persistent->specific.mediumsq.sendq_slots || persistent->specific.mediumsq.sendq_busy))
+    return 0;
+
+  req->send.specific.mediumsq.frags_nr = frags_nr;
+  if (unlikely(ep->avail_exp_events < omx__mediumsq_exp_events_nr(req)))
+    return 0;
+  ep->avail_exp_events -= omx__mediumsq_exp_events_nr(req);
+
+  req->generic.type = OMX_REQUEST_TYPE_SEND_MEDIUMSQ;
+  req->generic.missing_resources = 0;
+  req->generic.status.msg_length = req->send.segs.total_length;
+  req->generic.status.xfer_length = req->send.segs.total_length; /* truncation not notified to the sender */
+
+#ifdef OMX_MX_WIRE_COMPAT
+  req->send.specific.mediumsq.frag_pipeline = OMX_MEDIUM_FRAG_LENGTH_SHIFT;
+#endif
+  memcpy(req->send.specific.mediumsq.sendq_map_index, persistent->specific.mediumsq.sendq_map_index,
+	 frags_nr * sizeof(omx_sendq_map_index_t));
+  req->send.specific.mediumsq.persistent = persistent;
+  persistent->specific.mediumsq.sendq_busy = 1;
+  /* the completion events look the request up through the slots */
+  omx__endpoint_sendq_map_set_user(ep, frags_nr, req->send.specific.mediumsq.sendq_map_index, req);
+
+  *medium_param = persistent->specific.mediumsq.send_mediumsq_frag_ioctl_param;
+  medium_param->session_id = partner->true_session_id;
+#ifdef OMX_LIB_DEBUG
+  if (omx__globals.debug_checksum)
+    medium_param->checksum = omx_checksum_segments(&req->send.segs, req->generic.status.msg_length);
+#endif
+
+  omx__setup_isend_mediumsq(ep, partner, req);
+  return 1;
+}
+
+static INLINE int
+omx__start_isend_mediumva(struct omx_endpoint *ep,
+			  struct omx__partner *partner,
+			  union omx_request *req,
+			  const struct omx_persistent_request *persistent)
+{
+  struct omx_cmd_send_mediumva * medium_param = &req->send.specific.mediumva.send_mediumva_ioctl_param;
+
+  req->generic.type = OMX_REQUEST_TYPE_SEND_MEDIUMVA;
+  req->generic.status.msg_length = req->send.segs.total_length;
+  req->generic.status.xfer_length = req->send.segs.total_length; /* truncation not notified to the sender */
+
+  *medium_param = persistent->specific.mediumva.send_mediumva_ioctl_param;
+  medium_param->session_id = partner->true_session_id;
+  medium_param->segments = (uintptr_t) req->send.segs.segs;
+#ifdef OMX_LIB_DEBUG
+  if (omx__globals.debug_checksum)
+    medium_param->checksum = omx_checksum_segments(&req->send.segs, req->generic.status.msg_length);
+#endif
+
+  omx__setup_isend_mediumva(ep, partner, req);
+  return 1;
+}
+
+static INLINE int
+omx__start_isend_large(struct omx_endpoint *ep,
+		       struct omx__partner *partner,
+		       union omx_request *req,
+		       const struct omx_persistent_request *persistent)
+{
+  struct omx_cmd_send_rndv * rndv_param = &req->send.specific.large.send_rndv_ioctl_param;
+  struct omx__large_region *region = persistent->specific.large.region;
+
+  /* the region is still used by the previous start, or was never allocated */
+  if (unlikely(!region || region->reserver || !ep->large_sends_avail_nr))
+    return 0;
+
+  ep->large_sends_avail_nr--;
+  region->use_count++;
+  region->reserver = req;
+  omx__debug_printf(LARGE, ep, "persistent send reusing region %d (usecount %d)\n", region->id, region->use_count);
+
+  req->generic.type = OMX_REQUEST_TYPE_SEND_LARGE;
+  req->generic.missing_resources = 0;
+  req->generic.status.msg_length = req->send.segs.total_length;
+  /* will set xfer_length when receiving the notify */
+
+  req->send.specific.large.region = region;
+  req->send.specific.large.region_seqnum = region->last_seqnum++;
+
+  *rndv_param = persistent->specific.large.send_rndv_ioctl_param;
+  rndv_param->session_id = partner->true_session_id;
+  rndv_param->pulled_rdma_seqnum = req->send.specific.large.region_seqnum;
+#ifdef OMX_LIB_DEBUG
+  if (omx__globals.debug_checksum)
+    rndv_param->checksum = omx_checksum_segments(&req->send.segs, req->generic.status.msg_length);
+#endif
+
+  omx__setup_isend_rndv(ep, partner, req);
+  return 1;
+}
+
+static INLINE omx_return_t
+omx__start_isend_req(struct omx_endpoint *ep, struct omx__partner *partner,
+		     union omx_request *req, union omx_request **requestp,
+		     struct omx_persistent_request *persistent)
+{
+  int started = 0;
+
+  if (likely(omx__persistent_may_start(ep, partner))) {
+    switch (persistent->type) {
+    case OMX_REQUEST_TYPE_SEND_TINY:
+      started = omx__start_isend_tiny(ep, partner, req, persistent);
+      break;
+    case OMX_REQUEST_TYPE_SEND_SMALL: {
+      void *copy = omx_malloc_ep(ep, req->send.segs.total_length);
+      if (unlikely(!copy))
+	return omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating persistent send small copy buffer");
+      req->send.specific.small.copy = copy;
+      started = omx__start_isend_small(ep, partner, req, persistent);
+      break;
+    }
+    case OMX_REQUEST_TYPE_SEND_MEDIUMSQ:
+      started = omx__start_isend_mediumsq(ep, partner, req, persistent);
+      break;
+    case OMX_REQUEST_TYPE_SEND_MEDIUMVA:
+      started = omx__start_isend_mediumva(ep, partner, req, persistent);
+      break;
+    case OMX_REQUEST_TYPE_SEND_LARGE:
+      started = omx__start_isend_large(ep, partner, req, persistent);
+      break;
+    default:
+      break;
+    }
+  }
+
+  if (unlikely(!started))
+    /* missing resources, throttling or self send, submit as usual */
+    return omx__isend_req(ep, partner, req, requestp, 1);
+
+  if (requestp) {
+    *requestp = req;
+  } else {
+    omx__forget(ep, req);
+  }
+
+  omx__progress(ep);
+
+  return OMX_SUCCESS;
+}
+
+/* API omx_send_init */
+omx_return_t
+omx_send_init(struct omx_endpoint *ep,
+	      void *buffer, size_t length,
+	      omx_endpoint_addr_t dest_endpoint,
+	      uint64_t match_info,
+	      void *context, struct omx_persistent_request **persistentp)
+{
+  struct omx_persistent_request *persistent;
+  struct omx__partner *partner;
+  omx_return_t ret = OMX_SUCCESS;
+
+  OMX__ENDPOINT_LOCK(ep);
+
+  persistent = omx_malloc_ep(ep, sizeof(*persistent));
+  if (unlikely(!persistent)) {
+    ret = omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating persistent send request");
+    goto out_with_lock;
+  }
+
+  omx_cache_single_segment(&persistent->segs, buffer, length);
+
+  persistent->partner = partner = omx__partner_from_addr(&dest_endpoint);
+  persistent->addr = dest_endpoint;
+  persistent->match_info = match_info;
+  persistent->context = context;
+
+  omx__init_persistent_send(ep, partner, persistent);
+
+  *persistentp = persistent;
+
+ out_with_lock:
+  OMX__ENDPOINT_UNLOCK(ep);
+  return ret;
+}
+
+/* API omx_start */
+omx_return_t
+omx_start(struct omx_endpoint *ep, struct omx_persistent_request *persistent,
+	  union omx_request **requestp)
+{
+  struct omx__partner *partner = persistent->partner;
+  union omx_request *req;
+  omx_return_t ret;
+
+  OMX__ENDPOINT_LOCK(ep);
+
+  if (persistent->type == OMX_REQUEST_TYPE_RECV) {
+    ret = omx__start_irecv(ep, persistent, requestp);
+    goto out_with_lock;
+  }
+
+  req = omx__request_alloc(ep);
+  if (unlikely(!req)) {
+    ret = omx__error_with_ep(ep, OMX_NO_RESOURCES, "Allocating persistent isend request");
+    goto out_with_lock;
+  }
+
+  omx_clone_segments(&req->send.segs, &persistent->segs);
+
+  req->generic.partner = partner;
+  req->generic.status.addr = persistent->addr;
+  req->generic.status.match_info = persistent->match_info;
+  req->generic.status.context = persistent->context;
+
+  ret = omx__start_isend_req(ep, partner, req, requestp, persistent);
+  if (unlikely(ret != OMX_SUCCESS))
+    omx__request_free(ep, req);
+
+ out_with_lock:
+  OMX__ENDPOINT_UNLOCK(ep);
+  return ret;
+}
+
+/* API omx_persistent_free */
+omx_return_t
+omx_persistent_free(struct omx_endpoint *ep, struct omx_persistent_request *persistent)
+{
+  OMX__ENDPOINT_LOCK(ep);
+
+  switch (persistent->type) {
+  case OMX_REQUEST_TYPE_SEND_MEDIUMSQ:
+    if (!persistent->specific.mediumsq.sendq_slots)
+      break;
+    if (persistent->specific.mediumsq.sendq_busy) {
+      /* the started request will release the slots and the persistent request when acked */
+      persistent->specific.mediumsq.released = 1;
+      goto out_with_lock;
+    }
+    omx__endpoint_sendq_map_put(ep, persistent->specific.mediumsq.frags_nr, persistent->specific.mediumsq.sendq_map_index);
+    break;
+  case OMX_REQUEST_TYPE_SEND_LARGE:
+    /* a started request may still use the region, it will be released with it */
+    if (persistent->specific.large.region)
+      omx__put_region(ep, persistent->specific.large.region, NULL);
+    break;
+  default:
+    break;
+  }
+
+  omx_free_ep(ep, persistent);
+
+ out_with_lock:
+  OMX__ENDPOINT_UNLOCK(ep);
+  return OMX_SUCCESS;
+}
+
 /*****************************
  * ISSEND Submission Routines
  */
@@ -1336,7 +1935,7 @@ omx__release_unsent_send_resources(struct omx_endpoint *ep, union omx_request *r
 
   case OMX_REQUEST_TYPE_SEND_MEDIUMSQ:
     if (!(res & OMX_REQUEST_RESOURCE_EXP_EVENT))
-      ep->avail_exp_events += req->send.specific.mediumsq.frags_nr;
+      ep->avail_exp_events += omx__mediumsq_exp_events_nr(req);
 
     /* make sure we don't release garbage sendq map slots */
     if (res & OMX_REQUEST_RESOURCE_SENDQ_SLOT)
@@ -1417,17 +2016,27 @@ void
 omx__process_resend_requests(struct omx_endpoint *ep)
 {
   union omx_request *req, *next;
-  uint64_t now = omx__driver_desc->jiffies;
+  uint64_t now = omx__now();
   struct list_head tmp_req_q;
 
   list_head_init(&tmp_req_q);
 
+  /*
+   * Requests are queued in last_send_jiffies order, so nothing may become due
+   * before the deadline of the request that was first in the queue last time.
+   */
+  if (now < ep->next_resend_jiffies)
+    goto done_resending;
+  ep->next_resend_jiffies = 0;
+
   /* resend the first requests from the non_acked queue */
  start_resending:
   omx__foreach_request_safe(&ep->non_acked_req_q, req, next) {
-    if (now - req->generic.last_send_jiffies < omx__globals.resend_delay_jiffies)
+    if (now - req->generic.last_send_jiffies < omx__globals.resend_delay_jiffies) {
       /* the remaining ones are more recent, no need to resend them yet */
+      ep->next_resend_jiffies = req->generic.last_send_jiffies + omx__globals.resend_delay_jiffies;
       goto done_resending;
+    }
 
     /* check before dequeueing so that omx__partner_cleanup() is called with queues in a coherent state */
     if (req->generic.resends > req->generic.resends_max) {
@@ -1462,14 +2071,15 @@ omx__process_resend_requests(struct omx_endpoint *ep)
       omx__debug_printf(SEND, ep, "reposting resend mediumsq request %p seqnum %d (#%d)\n", req,
 			(unsigned) OMX__SEQNUM(req->generic.send_seqnum),
 			(unsigned) OMX__SESNUM_SHIFTED(req->generic.send_seqnum));
-      if (ep->avail_exp_events < req->send.specific.mediumsq.frags_nr) {
+      if (ep->avail_exp_events < omx__mediumsq_exp_events_nr(req)) {
 	/* not enough expected events available, stop resending for now, and try again later */
 	omx__debug_printf(SEND, ep, "stopping resending for now, only %d exp events available to resend %d mediumsq frags\n",
 			  ep->avail_exp_events, req->send.specific.mediumsq.frags_nr);
 	omx__requeue_request(&ep->non_acked_req_q, req);
+	/* next_resend_jiffies is still 0, we look at the queue again during the next progression */
 	goto done_resending;
       }
-      ep->avail_exp_events -= req->send.specific.mediumsq.frags_nr;
+      ep->avail_exp_events -= omx__mediumsq_exp_events_nr(req);
       omx__post_isend_mediumsq(ep, req->generic.partner, req);
       break;
     case OMX_REQUEST_TYPE_SEND_MEDIUMVA:
@@ -22,39 +22,124 @@
 #include "omx_lib.h"
 #include "omx_request.h"
 
+/*
+ * What a sleeper waits for. Only one sleeper waits in the driver at a time,
+ * the ones that wait for a completion are parked in the library and woken up
+ * only when their completion is notified.
+ */
+enum omx__sleeper_interest {
+  OMX__SLEEPER_INTEREST_EVENT, /* any event, cannot be parked */
+  OMX__SLEEPER_INTEREST_REQUEST, /* completion of a single request */
+  OMX__SLEEPER_INTEREST_MATCH, /* completion of any request matching */
+};
+
 /* per endpoint queue of sleepers */
 struct omx__sleeper {
   struct list_head list_elt;
   int need_wakeup;
+  enum omx__sleeper_interest interest;
+  union omx_request *req;
+  uint64_t match_info;
+  uint64_t match_mask;
+  int in_driver;
+  int parked;
+  struct omx__cond cond;
 };
 
+/* called with the endpoint lock held */
+static INLINE void
+omx__add_sleeper(struct omx_endpoint *ep, struct omx__sleeper *sleeper,
+		 enum omx__sleeper_interest interest)
+{
+  sleeper->need_wakeup = 0;
+  sleeper->interest = interest;
+  sleeper->in_driver = 0;
+  sleeper->parked = 0;
+  omx__cond_init(&sleeper->cond);
+  list_add_tail(&sleeper->list_elt, &ep->sleepers);
+}
+
+/* called with the endpoint lock held */
+static INLINE void
+omx__del_sleeper(struct omx_endpoint *ep, struct omx__sleeper *sleeper)
+{
+  list_del(&sleeper->list_elt);
+  omx__cond_destroy(&sleeper->cond);
+
+  if (ep->driver_sleeper == sleeper) {
+    struct omx__sleeper *next;
+
+    /* let one parked sleeper take over waiting in the driver */
+    ep->driver_sleeper = NULL;
+    list_for_each_entry(next, &ep->sleepers, list_elt)
+      if (next->parked) {
+	next->parked = 0;
+	omx__cond_signal(&next->cond);
+	break;
+      }
+  }
+}
+
 /**************************
  * Common sleeping routine
  */
 
+/*
+ * Sleep until something happens. The sleeper may be NULL for the progress thread
+ * which is never parked and always goes to sleep in the driver.
+ */
 static omx_return_t
 omx__wait(struct omx_endpoint *ep,
+	  struct omx__sleeper *sleeper,
 	  struct omx_cmd_wait_event *wait_param,
 	  uint32_t ms_timeout,
 	  const char *caller)
 {
+  uint64_t jiffies_expire = wait_param->jiffies_expire;
   int err;
 
-  if (omx__driver_desc->jiffies >= wait_param->jiffies_expire
+  if (omx__now() >= jiffies_expire
       || wait_param->status == OMX_CMD_WAIT_EVENT_STATUS_TIMEOUT
       || wait_param->status == OMX_CMD_WAIT_EVENT_STATUS_WAKEUP
+      || (sleeper && sleeper->need_wakeup)
       || (omx__globals.waitintr && wait_param->status == OMX_CMD_WAIT_EVENT_STATUS_INTR))
     /* this is not an error in most cases, let the caller handle it if needed */
     return OMX_TIMEOUT;
 
+#ifdef OMX_LIB_THREAD_SAFETY
+  if (sleeper
+      && sleeper->interest != OMX__SLEEPER_INTEREST_EVENT
+      && ms_timeout == OMX_TIMEOUT_INFINITE
+      && ep->driver_sleeper && ep->driver_sleeper != sleeper) {
+    /*
+     * another thread is already waiting for events in the driver,
+     * park until our completion is notified or the driver sleeper leaves
+     */
+    omx__debug_printf(WAIT, ep, "%s parking at %lld\n",
+		      caller, (unsigned long long) omx__now());
+
+    sleeper->parked = 1;
+    do
+      omx__cond_wait(&sleeper->cond, &ep->lock);
+    while (sleeper->parked);
+
+    omx__debug_printf(WAIT, ep, "%s unparked at %lld\n",
+		      caller, (unsigned long long) omx__now());
+    return OMX_SUCCESS;
+  }
+#endif
+
+  if (sleeper && !ep->driver_sleeper)
+    ep->driver_sleeper = sleeper;
+
   if (ms_timeout == OMX_TIMEOUT_INFINITE)
     omx__debug_printf(WAIT, ep, "%s going to sleep at %lld for ever\n",
-		      caller, (unsigned long long) omx__driver_desc->jiffies);
+		      caller, (unsigned long long) omx__now());
   else
     omx__debug_printf(WAIT, ep, "%s going to sleep at %lld until %lld\n",
 		      caller,
-		      (unsigned long long) omx__driver_desc->jiffies,
-		      (unsigned long long) wait_param->jiffies_expire);
+		      (unsigned long long) omx__now(),
+		      (unsigned long long) jiffies_expire);
 
   BUILD_BUG_ON(sizeof(wait_param->next_exp_event_index) != sizeof(ep->next_exp_event_index));
   BUILD_BUG_ON(sizeof(wait_param->next_unexp_event_index) != sizeof(ep->next_unexp_event_index));
@@ -64,29 +149,40 @@ omx__wait(struct omx_endpoint *ep,
   wait_param->user_event_index = ep->desc->user_event_index;
   omx__prepare_progress_wakeup(ep);
 
+  /* the driver wants kernel jiffies */
+  wait_param->jiffies_expire = omx__absolute_kernel_jiffies(jiffies_expire);
+
+  /* do not sleep before everything is submitted */
+  omx__flush_batch(ep);
+
   /* release the lock while sleeping */
+  if (sleeper)
+    sleeper->in_driver = 1;
   OMX__ENDPOINT_UNLOCK(ep);
   err = ioctl(ep->fd, OMX_CMD_WAIT_EVENT, wait_param);
   OMX__ENDPOINT_LOCK(ep);
+  if (sleeper)
+    sleeper->in_driver = 0;
 
   OMX_VALGRIND_MEMORY_MAKE_READABLE(wait_param, sizeof(*wait_param));
+  wait_param->jiffies_expire = jiffies_expire;
 
 #ifdef OMX_LIB_DEBUG
   {
-    uint64_t now = omx__driver_desc->jiffies;
-    if (ms_timeout != OMX_TIMEOUT_INFINITE && now > wait_param->jiffies_expire + 2) {
-      /* tolerate 2 jiffies of timeshift */
+    uint64_t now = omx__now();
+    if (ms_timeout != OMX_TIMEOUT_INFINITE && now > jiffies_expire + 2 * omx__globals.hz / omx__driver_desc->hz) {
+      /* tolerate 2 kernel jiffies of timeshift */
       omx__verbose_printf(ep, "Sleep for %ld ms actually slept until jiffies %lld instead of %lld\n",
 			  (unsigned long) ms_timeout,
 			  (unsigned long long) now,
-			  (unsigned long long) wait_param->jiffies_expire);
+			  (unsigned long long) jiffies_expire);
     }
   }
 #endif
 
   omx__debug_printf(WAIT, ep, "%s woken up at %lld\n",
 		    caller,
-		    (unsigned long long) omx__driver_desc->jiffies);
+		    (unsigned long long) omx__now());
 
   if (unlikely(err < 0))
       omx__ioctl_errno_to_return_checked(OMX_NO_SYSTEM_RESOURCES,
@@ -172,8 +268,8 @@ omx_wait(struct omx_endpoint *ep, union omx_request **requestp,
   uint32_t result = 0;
 
   OMX__ENDPOINT_LOCK(ep);
-  sleeper.need_wakeup = 0;
-  list_add_tail(&sleeper.list_elt, &ep->sleepers);
+  sleeper.req = *requestp;
+  omx__add_sleeper(ep, &sleeper, OMX__SLEEPER_INTEREST_REQUEST);
 
   if (omx__globals.waitspin) {
     /* busy spin instead of sleeping */
@@ -185,7 +281,7 @@ omx_wait(struct omx_endpoint *ep, union omx_request **requestp,
       if ((result = omx__test_common(ep, requestp, status)) != 0)
 	goto out_with_lock;
 
-      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__driver_desc->jiffies >= jiffies_expire)
+      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__now() >= jiffies_expire)
 	goto out_with_lock;
 
       /* release the lock a bit */
@@ -207,7 +303,7 @@ omx_wait(struct omx_endpoint *ep, union omx_request **requestp,
     if ((result = omx__test_common(ep, requestp, status)) != 0)
       goto out_with_lock;
 
-    ret = omx__wait(ep, &wait_param, ms_timeout, "wait");
+    ret = omx__wait(ep, &sleeper, &wait_param, ms_timeout, "wait");
     if (ret != OMX_SUCCESS) {
       if (ret == OMX_TIMEOUT)
 	ret = OMX_SUCCESS;
@@ -216,7 +312,7 @@ omx_wait(struct omx_endpoint *ep, union omx_request **requestp,
   }
 
  out_with_lock:
-  list_del(&sleeper.list_elt);
+  omx__del_sleeper(ep, &sleeper);
   OMX__ENDPOINT_UNLOCK(ep);
   *resultp = result;
   return ret;
@@ -346,8 +442,9 @@ omx_wait_any(struct omx_endpoint *ep,
   }
 
   OMX__ENDPOINT_LOCK(ep);
-  sleeper.need_wakeup = 0;
-  list_add_tail(&sleeper.list_elt, &ep->sleepers);
+  sleeper.match_info = match_info;
+  sleeper.match_mask = match_mask;
+  omx__add_sleeper(ep, &sleeper, OMX__SLEEPER_INTEREST_MATCH);
 
   if (omx__globals.waitspin) {
     /* busy spin instead of sleeping */
@@ -359,7 +456,7 @@ omx_wait_any(struct omx_endpoint *ep,
       if ((result = omx__test_any_common(ep, match_info, match_mask, status)) != 0)
 	goto out_with_lock;
 
-      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__driver_desc->jiffies >= jiffies_expire)
+      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__now() >= jiffies_expire)
 	goto out_with_lock;
 
       /* release the lock a bit */
@@ -381,7 +478,7 @@ omx_wait_any(struct omx_endpoint *ep,
     if ((result = omx__test_any_common(ep, match_info, match_mask, status)) != 0)
       goto out_with_lock;
 
-    ret = omx__wait(ep, &wait_param, ms_timeout, "wait_any");
+    ret = omx__wait(ep, &sleeper, &wait_param, ms_timeout, "wait_any");
     if (ret != OMX_SUCCESS) {
       if (ret == OMX_TIMEOUT)
 	ret = OMX_SUCCESS;
@@ -390,13 +487,154 @@ omx_wait_any(struct omx_endpoint *ep,
   }
 
  out_with_lock:
-  list_del(&sleeper.list_elt);
+  omx__del_sleeper(ep, &sleeper);
   OMX__ENDPOINT_UNLOCK(ep);
  out:
   *resultp = result;
   return ret;
 }
 
+/******************************************
+ * Test/Wait many requests and complete them
+ */
+
+/* complete up to max matching requests, called with the endpoint lock held */
+static INLINE uint32_t
+omx__test_many_common(struct omx_endpoint *ep,
+		      uint64_t match_info, uint64_t match_mask,
+		      omx_status_t *statuses, uint32_t max)
+{
+  union omx_request *req, *next;
+  uint32_t count = 0;
+
+#define OMX__TEST_MANY_ONE(req)						\
+  if ((req->generic.status.match_info & match_mask) == match_info) {	\
+    if (count == max)							\
+      break;								\
+    omx__test_success(ep, req, &statuses[count++]);			\
+  }
+
+  if (likely(!HAS_CTXIDS(ep) || MATCHING_CROSS_CTXIDS(ep, match_mask))) {
+    /* no ctxids, or matching across multiple ctxids, so use the anyctxid queue */
+    omx__foreach_done_anyctxid_request_safe(ep, req, next)
+      OMX__TEST_MANY_ONE(req)
+
+  } else {
+    /* use one of the ctxid queues */
+    uint32_t ctxid = CTXID_FROM_MATCHING(ep, match_info);
+    omx__foreach_done_ctxid_request_safe(ep, ctxid, req, next)
+      OMX__TEST_MANY_ONE(req)
+  }
+
+#undef OMX__TEST_MANY_ONE
+
+  return count;
+}
+
+/* API omx_test_many */
+omx_return_t
+omx_test_many(struct omx_endpoint *ep,
+	      uint64_t match_info, uint64_t match_mask,
+	      omx_status_t *statuses, uint32_t max, uint32_t *countp)
+{
+  omx_return_t ret = OMX_SUCCESS;
+  uint32_t count = 0;
+
+  if (unlikely(match_info & ~match_mask)) {
+    ret = omx__error_with_ep(ep, OMX_BAD_MATCH_MASK,
+			     "test_many with match info %llx mask %llx",
+			     (unsigned long long) match_info, (unsigned long long) match_mask);
+    goto out;
+  }
+
+  OMX__ENDPOINT_LOCK(ep);
+
+  ret = omx__progress(ep);
+  if (unlikely(ret != OMX_SUCCESS))
+    goto out_with_lock;
+
+  count = omx__test_many_common(ep, match_info, match_mask, statuses, max);
+
+ out_with_lock:
+  OMX__ENDPOINT_UNLOCK(ep);
+ out:
+  *countp = count;
+  return ret;
+}
+
+/* API omx_wait_many */
+omx_return_t
+omx_wait_many(struct omx_endpoint *ep,
+	      uint64_t match_info, uint64_t match_mask,
+	      omx_status_t *statuses, uint32_t max, uint32_t *countp,
+	      uint32_t ms_timeout)
+{
+  struct omx_cmd_wait_event wait_param;
+  struct omx__sleeper sleeper;
+  uint64_t jiffies_expire = omx__timeout_ms_to_absolute_jiffies(ms_timeout);
+  omx_return_t ret = OMX_SUCCESS;
+  uint32_t count = 0;
+
+  if (unlikely(match_info & ~match_mask)) {
+    ret = omx__error_with_ep(ep, OMX_BAD_MATCH_MASK,
+			     "wait_many with match info %llx mask %llx",
+			     (unsigned long long) match_info, (unsigned long long) match_mask);
+    goto out;
+  }
+
+  OMX__ENDPOINT_LOCK(ep);
+  sleeper.match_info = match_info;
+  sleeper.match_mask = match_mask;
+  omx__add_sleeper(ep, &sleeper, OMX__SLEEPER_INTEREST_MATCH);
+
+  if (omx__globals.waitspin) {
+    /* busy spin instead of sleeping */
+    while (!sleeper.need_wakeup) {
+      ret = omx__progress(ep);
+      if (unlikely(ret != OMX_SUCCESS))
+	goto out_with_lock;
+
+      if ((count = omx__test_many_common(ep, match_info, match_mask, statuses, max)) != 0)
+	goto out_with_lock;
+
+      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__now() >= jiffies_expire)
+	goto out_with_lock;
+
+      /* release the lock a bit */
+      OMX__ENDPOINT_UNLOCK(ep);
+      OMX__ENDPOINT_LOCK(ep);
+    }
+
+    goto out_with_lock;
+  }
+
+  wait_param.jiffies_expire = jiffies_expire;
+  wait_param.status = OMX_CMD_WAIT_EVENT_STATUS_EVENT;
+
+  while (1) {
+    ret = omx__progress(ep);
+    if (unlikely(ret != OMX_SUCCESS))
+      goto out_with_lock;
+
+    if ((count = omx__test_many_common(ep, match_info, match_mask, statuses, max)) != 0)
+      goto out_with_lock;
+
+    ret = omx__wait(ep, &sleeper, &wait_param, ms_timeout, "wait_many");
+    if (ret != OMX_SUCCESS) {
+      if (ret == OMX_TIMEOUT)
+	ret = OMX_SUCCESS;
+      goto out_with_lock;
+    }
+  }
+
+ out_with_lock:
+  omx__del_sleeper(ep, &sleeper);
+  OMX__ENDPOINT_UNLOCK(ep);
+ out:
+  *countp = count;
+  return ret;
+}
+
 /*****************************************************
  * Test/Wait any single request without completing it
  */
@@ -446,8 +684,10 @@ omx_peek(struct omx_endpoint *ep, union omx_request **requestp,
   uint32_t result = 0;
 
   OMX__ENDPOINT_LOCK(ep);
-  sleeper.need_wakeup = 0;
-  list_add_tail(&sleeper.list_elt, &ep->sleepers);
+  /* any completion will do */
+  sleeper.match_info = 0;
+  sleeper.match_mask = 0;
+  omx__add_sleeper(ep, &sleeper, OMX__SLEEPER_INTEREST_MATCH);
 
   if (omx__globals.waitspin) {
     /* busy spin instead of sleeping */
@@ -459,7 +699,7 @@ omx_peek(struct omx_endpoint *ep, union omx_request **requestp,
       if ((result = omx__ipeek_common(ep, requestp)) != 0)
 	goto out_with_lock;
 
-      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__driver_desc->jiffies >= jiffies_expire)
+      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__now() >= jiffies_expire)
 	goto out_with_lock;
 
       /* release the lock a bit */
@@ -481,7 +721,7 @@ omx_peek(struct omx_endpoint *ep, union omx_request **requestp,
     if ((result = omx__ipeek_common(ep, requestp)) != 0)
       goto out_with_lock;
 
-    ret = omx__wait(ep, &wait_param, ms_timeout, "peek");
+    ret = omx__wait(ep, &sleeper, &wait_param, ms_timeout, "peek");
     if (ret != OMX_SUCCESS) {
       if (ret == OMX_TIMEOUT)
 	ret = OMX_SUCCESS;
@@ -490,7 +730,7 @@ omx_peek(struct omx_endpoint *ep, union omx_request **requestp,
   }
 
  out_with_lock:
-  list_del(&sleeper.list_elt);
+  omx__del_sleeper(ep, &sleeper);
   OMX__ENDPOINT_UNLOCK(ep);
   *resultp = result;
   return ret;
@@ -568,7 +808,15 @@ omx__iprobe_common(const struct omx_endpoint *ep,
 {
   union omx_request * req;
 
-  if (likely(!HAS_CTXIDS(ep) || MATCHING_CROSS_CTXIDS(ep, match_mask))) {
+  if (likely(match_mask == OMX__RECV_MATCH_MASK_EXACT)) {
+    /* fully-specified, use the index */
+    req = omx__find_exact_unexp_request(ep, match_info);
+    if (req) {
+      memcpy(status, &req->generic.status, sizeof(*status));
+      return 1;
+    }
+
+  } else if (likely(!HAS_CTXIDS(ep) || MATCHING_CROSS_CTXIDS(ep, match_mask))) {
     /* no ctxids, or matching across multiple ctxids, so use the anyctxid queue */
     omx__foreach_request(&ep->anyctxid.unexp_req_q, req) {
       if (likely((req->generic.status.match_info & match_mask) == match_info)) {
@@ -642,8 +890,8 @@ omx_probe(struct omx_endpoint *ep,
   }
 
   OMX__ENDPOINT_LOCK(ep);
-  sleeper.need_wakeup = 0;
-  list_add_tail(&sleeper.list_elt, &ep->sleepers);
+  /* unexpected messages are not completions, wait for any event */
+  omx__add_sleeper(ep, &sleeper, OMX__SLEEPER_INTEREST_EVENT);
 
   if (omx__globals.waitspin) {
     /* busy spin instead of sleeping */
@@ -655,7 +903,7 @@ omx_probe(struct omx_endpoint *ep,
       if ((result = omx__iprobe_common(ep, match_info, match_mask, status)) != 0)
 	goto out_with_lock;
 
-      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__driver_desc->jiffies >= jiffies_expire)
+      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__now() >= jiffies_expire)
 	goto out_with_lock;
 
       /* release the lock a bit */
@@ -677,7 +925,7 @@ omx_probe(struct omx_endpoint *ep,
     if ((result = omx__iprobe_common(ep, match_info, match_mask, status)) != 0)
       goto out_with_lock;
 
-    ret = omx__wait(ep, &wait_param, ms_timeout, "probe");
+    ret = omx__wait(ep, &sleeper, &wait_param, ms_timeout, "probe");
     if (ret != OMX_SUCCESS) {
       if (ret == OMX_TIMEOUT)
 	ret = OMX_SUCCESS;
@@ -686,7 +934,7 @@ omx_probe(struct omx_endpoint *ep,
   }
 
  out_with_lock:
-  list_del(&sleeper.list_elt);
+  omx__del_sleeper(ep, &sleeper);
   OMX__ENDPOINT_UNLOCK(ep);
  out:
   *resultp = result;
@@ -706,8 +954,8 @@ omx__connect_wait(omx_endpoint_t ep, union omx_request * req, uint32_t ms_timeou
   uint64_t jiffies_expire = omx__timeout_ms_to_absolute_jiffies(ms_timeout);
   omx_return_t ret = OMX_SUCCESS;
 
-  sleeper.need_wakeup = 0;
-  list_add_tail(&sleeper.list_elt, &ep->sleepers);
+  sleeper.req = req;
+  omx__add_sleeper(ep, &sleeper, OMX__SLEEPER_INTEREST_REQUEST);
 
   if (omx__globals.connect_pollall) {
     /* busy spin and poll other endpoints instead of sleeping */
@@ -719,7 +967,7 @@ omx__connect_wait(omx_endpoint_t ep, union omx_request * req, uint32_t ms_timeou
       if (req->generic.state == (OMX_REQUEST_STATE_DONE|OMX_REQUEST_STATE_INTERNAL))
 	goto out;
 
-      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__driver_desc->jiffies >= jiffies_expire) {
+      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__now() >= jiffies_expire) {
 	/* let the caller handle errors */
 	ret = OMX_TIMEOUT;
 	goto out;
@@ -741,7 +989,7 @@ omx__connect_wait(omx_endpoint_t ep, union omx_request * req, uint32_t ms_timeou
       if (req->generic.state == (OMX_REQUEST_STATE_DONE|OMX_REQUEST_STATE_INTERNAL))
 	goto out;
 
-      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__driver_desc->jiffies >= jiffies_expire) {
+      if (ms_timeout != OMX_TIMEOUT_INFINITE && omx__now() >= jiffies_expire) {
 	/* let the caller handle errors */
 	ret = OMX_TIMEOUT;
 	goto out;
@@ -768,7 +1016,7 @@ omx__connect_wait(omx_endpoint_t ep, union omx_request * req, uint32_t ms_timeou
     if (req->generic.state == (OMX_REQUEST_STATE_DONE|OMX_REQUEST_STATE_INTERNAL))
       goto out;
 
-    ret = omx__wait(ep, &wait_param, ms_timeout, "connect");
+    ret = omx__wait(ep, &sleeper, &wait_param, ms_timeout, "connect");
     if (ret != OMX_SUCCESS) {
       /* keep OMX_TIMEOUT as is and let the caller handle errors */
       goto out;
@@ -776,7 +1024,7 @@ omx__connect_wait(omx_endpoint_t ep, union omx_request * req, uint32_t ms_timeou
   }
 
  out:
-  list_del(&sleeper.list_elt);
+  omx__del_sleeper(ep, &sleeper);
   return ret;
 }
 
@@ -784,28 +1032,48 @@ omx__connect_wait(omx_endpoint_t ep, union omx_request * req, uint32_t ms_timeou
  * Wakeup waiters
  */
 
+static INLINE void
+omx__wakeup_driver(struct omx_endpoint *ep, uint32_t status)
+{
+  struct omx_cmd_wakeup wakeup;
+  int err;
+
+  wakeup.status = status;
+  ep->sleepers_driver_wakeups++;
+
+  err = ioctl(ep->fd, OMX_CMD_WAKEUP, &wakeup);
+  if (unlikely(err < 0))
+    omx__ioctl_errno_to_return_checked(OMX_SUCCESS,
+				       "wakeup sleepers in the driver");
+}
+
 static INLINE omx_return_t
 omx__wakeup(struct omx_endpoint *ep, uint32_t status)
 {
-  if (omx__globals.waitspin) {
-    /* change waitspiner's wakeup status */
-    struct omx__sleeper *sleeper;
-    list_for_each_entry(sleeper, &ep->sleepers, list_elt)
-      sleeper->need_wakeup = 1;
-
-  } else if (!list_empty(&ep->sleepers)) {
-    /* enter the driver to wakeup sleeper if any */
-    struct omx_cmd_wakeup wakeup;
-    int err;
+  struct omx__sleeper *sleeper;
+  int driver_wakeup = ep->fd_armed;
 
-    wakeup.status = status;
+  list_for_each_entry(sleeper, &ep->sleepers, list_elt) {
+    if (status == OMX_CMD_WAIT_EVENT_STATUS_WAKEUP) {
+      /* everybody has to return, including waitspiners */
+      sleeper->need_wakeup = 1;
+      if (sleeper->parked) {
+	sleeper->parked = 0;
+	omx__cond_signal(&sleeper->cond);
+      }
+    } else if (sleeper->interest != OMX__SLEEPER_INTEREST_EVENT) {
+      /* completions are notified to the interested sleepers only */
+      continue;
+    }
 
-    err = ioctl(ep->fd, OMX_CMD_WAKEUP, &wakeup);
-    if (unlikely(err < 0))
-      omx__ioctl_errno_to_return_checked(OMX_SUCCESS,
-					 "wakeup sleepers in the driver");
+    if (sleeper->in_driver)
+      driver_wakeup = 1;
   }
 
+  /* enter the driver to wakeup sleeper or poll() if any */
+  if (driver_wakeup)
+    omx__wakeup_driver(ep, status);
+
   return OMX_SUCCESS;
 }
 
@@ -818,13 +1086,214 @@ omx__notify_user_event(struct omx_endpoint *ep)
   omx__wakeup(ep, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
 }
 
+/*
+ * wakeup the sleepers waiting for this completion only,
+ * called with the endpoint lock held when the request becomes done
+ */
+void
+omx__notify_sleepers(struct omx_endpoint *ep, union omx_request *req)
+{
+  struct omx__sleeper *sleeper;
+  int driver_wakeup = 0;
+
+  list_for_each_entry(sleeper, &ep->sleepers, list_elt) {
+    switch (sleeper->interest) {
+    case OMX__SLEEPER_INTEREST_REQUEST:
+      if (sleeper->req != req)
+	continue;
+      break;
+    case OMX__SLEEPER_INTEREST_MATCH:
+      if ((req->generic.status.match_info & sleeper->match_mask) != sleeper->match_info)
+	continue;
+      break;
+    default:
+      /* woken up by user events instead */
+      continue;
+    }
+
+    if (sleeper->parked) {
+      sleeper->parked = 0;
+      omx__cond_signal(&sleeper->cond);
+      ep->sleepers_signaled++;
+    } else if (sleeper->in_driver) {
+      /* only wakeup once */
+      sleeper->in_driver = 0;
+      driver_wakeup = 1;
+    }
+  }
+
+  if (driver_wakeup) {
+    /* make sure the sleeper does not go to sleep if it did not enter the driver yet */
+    ep->desc->user_event_index++;
+    omx__wakeup_driver(ep, OMX_CMD_WAIT_EVENT_STATUS_EVENT);
+  }
+}
+
 /* API omx_wakeup */
 omx_return_t
 omx_wakeup(struct omx_endpoint *ep)
 {
   omx_return_t ret  = OMX_SUCCESS;
   OMX__ENDPOINT_LOCK(ep);
+  if (ep->fd_armed)
+    /* make the endpoint file readable */
+    ep->desc->user_event_index++;
   ret = omx__wakeup(ep, OMX_CMD_WAIT_EVENT_STATUS_WAKEUP);
   OMX__ENDPOINT_UNLOCK(ep);
   return ret;
 }
+
+/********************************
+ * Polling endpoint file descriptors
+ */
+
+/* API omx_get_endpoint_fd */
+omx_return_t
+omx_get_endpoint_fd(struct omx_endpoint *ep, int *fd)
+{
+  /* no need to lock here, there's no possible race condition or so */
+
+  if (!(omx__driver_desc->features & OMX_DRIVER_FEATURE_POLL))
+    return omx__error_with_ep(ep, OMX_NOT_IMPLEMENTED, "Getting endpoint file descriptor for polling");
+
+  *fd = ep->fd;
+  return OMX_SUCCESS;
+}
+
+/*
+ * API omx_arm_endpoint_fd
+ *
+ * Progress the endpoint and tell the driver which events were processed,
+ * so that the endpoint file becomes readable once something new happens.
+ * Must be called again before each poll() once the file became readable.
+ * result is set if some requests are already done, the caller should
+ * complete them instead of polling.
+ */
+omx_return_t
+omx_arm_endpoint_fd(struct omx_endpoint *ep, uint32_t *result)
+{
+  omx_return_t ret = OMX_SUCCESS;
+
+  OMX__ENDPOINT_LOCK(ep);
+
+  if (!(omx__driver_desc->features & OMX_DRIVER_FEATURE_POLL)) {
+    ret = omx__error_with_ep(ep, OMX_NOT_IMPLEMENTED, "Arming endpoint file descriptor for polling");
+    goto out_with_lock;
+  }
+
+  ret = omx__progress(ep);
+  if (ret != OMX_SUCCESS) {
+    ret = omx__error_with_ep(ep, ret, "Progressing endpoint before arming its file descriptor");
+    goto out_with_lock;
+  }
+
+  BUILD_BUG_ON(sizeof(ep->desc->poll_exp_event_index) != sizeof(ep->next_exp_event_index));
+  BUILD_BUG_ON(sizeof(ep->desc->poll_unexp_event_index) != sizeof(ep->next_unexp_event_index));
+  BUILD_BUG_ON(sizeof(ep->desc->poll_user_event_index) != sizeof(ep->desc->user_event_index));
+  ep->desc->poll_exp_event_index = ep->next_exp_event_index;
+  ep->desc->poll_unexp_event_index = ep->next_unexp_event_index;
+  ep->desc->poll_user_event_index = ep->desc->user_event_index;
+  omx__prepare_progress_wakeup(ep);
+  ep->fd_armed = 1;
+
+  *result = !list_empty(&ep->anyctxid.done_req_q);
+
+ out_with_lock:
+  OMX__ENDPOINT_UNLOCK(ep);
+  return ret;
+}
+
+/******************
+ * Progress thread
+ */
+
+#ifdef OMX_LIB_THREAD_SAFETY
+
+static void *
+omx__progress_thread(void *data)
+{
+  struct omx_endpoint *ep = data;
+  struct omx_cmd_wait_event wait_param;
+
+  if (omx__globals.progress_thread_binding)
+    omx__endpoint_bind_process(ep, omx__globals.progress_thread_binding);
+
+  OMX__ENDPOINT_LOCK(ep);
+  while (!ep->progress_thread_stopping) {
+    if (unlikely(ep->progression_disabled)) {
+      /* pending events would wake us up immediately, sleep until the application re-enables progression */
+      OMX__ENDPOINT_PROGRESSION_ENABLED_WAIT(ep);
+      continue;
+    }
+
+    omx__progress(ep);
+
+    /*
+     * the endpoint lock is released while sleeping in the driver,
+     * until new events arrive or a resend/ack is due
+     */
+    wait_param.jiffies_expire = OMX_CMD_WAIT_EVENT_TIMEOUT_INFINITE;
+    wait_param.status = OMX_CMD_WAIT_EVENT_STATUS_EVENT;
+    omx__wait(ep, NULL, &wait_param, OMX_TIMEOUT_INFINITE, "progress thread");
+  }
+  OMX__ENDPOINT_UNLOCK(ep);
+
+  return NULL;
+}
+
+omx_return_t
+omx__progress_thread_start(struct omx_endpoint *ep)
+{
+  int err;
+
+  if (!omx__thread_available())
+    return omx__error(OMX_NOT_IMPLEMENTED, "Starting progress thread without pthread support in the application");
+
+  err = omx__thread_create(&ep->progress_thread, omx__progress_thread, ep);
+  if (err)
+    return omx__error(OMX_NO_SYSTEM_RESOURCES, "Creating progress thread (%s)", strerror(err));
+
+  ep->progress_thread_running = 1;
+  return OMX_SUCCESS;
+}
+
+/* called with the endpoint lock held */
+void
+omx__progress_thread_stop(struct omx_endpoint *ep)
+{
+  struct omx_cmd_wakeup wakeup;
+  int err;
+
+  ep->progress_thread_stopping = 1;
+  OMX__ENDPOINT_PROGRESSION_ENABLED_SIGNAL(ep);
+
+  /* prevent the thread from going back to sleep, and wake it up if already sleeping */
+  ep->desc->user_event_index++;
+  wakeup.status = OMX_CMD_WAIT_EVENT_STATUS_WAKEUP;
+  err = ioctl(ep->fd, OMX_CMD_WAKEUP, &wakeup);
+  if (unlikely(err < 0))
+    omx__ioctl_errno_to_return_checked(OMX_SUCCESS,
+				       "wakeup progress thread in the driver");
+
+  OMX__ENDPOINT_UNLOCK(ep);
+  omx__thread_join(&ep->progress_thread);
+  OMX__ENDPOINT_LOCK(ep);
+
+  ep->progress_thread_running = 0;
+}
+
+#else /* !OMX_LIB_THREAD_SAFETY */
+
+omx_return_t
+omx__progress_thread_start(struct omx_endpoint *ep)
+{
+  return omx__error(OMX_NOT_IMPLEMENTED, "Starting progress thread without thread safety support in the library");
+}
+
+void
+omx__progress_thread_stop(struct omx_endpoint *ep)
+{
+  /* nothing to do */
+}
+
+#endif /* !OMX_LIB_THREAD_SAFETY */
@@ -42,6 +42,15 @@ struct omx__cond {
 #define omx__cond_signal(cond) pthread_cond_signal(&(cond)->_cond)
 #define omx__cond_wait(cond, lock) pthread_cond_wait(&(cond)->_cond, &(lock)->_mutex)
 
+struct omx__thread {
+  pthread_t _thread;
+};
+
+/* pthread_create is not available if the application is not linked with pthreads */
+#define omx__thread_available() (pthread_create != NULL)
+#define omx__thread_create(thread, func, arg) pthread_create(&(thread)->_thread, NULL, func, arg)
+#define omx__thread_join(thread) pthread_join((thread)->_thread, NULL)
+
 #pragma weak pthread_mutex_init
 #pragma weak pthread_mutex_destroy
 #pragma weak pthread_mutex_lock
@@ -52,6 +61,9 @@ struct omx__cond {
 #pragma weak pthread_cond_signal
 #pragma weak pthread_cond_wait
 
+#pragma weak pthread_create
+#pragma weak pthread_join
+
 #else /* !OMX_LIB_THREAD_SAFETY */
 
 struct omx__lock { /* nothing */ };
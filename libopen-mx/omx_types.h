@@ -22,6 +22,9 @@
 #define __omx_types_h__
 
 #include <stdint.h>
+#ifdef OMX_HAVE_CLOCK_GETTIME
+#include <time.h>
+#endif
 
 #include "omx_io.h"
 #include "omx_threads.h"
@@ -59,13 +62,48 @@ struct omx__sendq_map {
   } * array;
 };
 
+/* posted receives of a single ctxid, indexed for matching */
+struct omx__recv_match_queue {
+  /* fully-specified receives (mask == ~0) hashed on their match_info (queued by their queue_elt) */
+  struct list_head * exact_buckets;
+  uint32_t exact_buckets_nr; /* always a power of 2 */
+  uint32_t exact_nr;
+  /* single bucket used until enough exact receives are posted */
+  struct list_head exact_single_bucket;
+  /* receives with a wildcard mask, in posting order (queued by their queue_elt) */
+  struct list_head wildcard_q;
+  uint32_t wildcard_nr;
+};
+
+/* unexpected receives hashed on their match_info, in arrival order within each bucket */
+struct omx__unexp_match_index {
+  /* queued by their done_elt, which is unused until the request gets matched */
+  struct list_head * buckets;
+  uint32_t buckets_nr; /* always a power of 2 */
+  /* single bucket used until enough unexpected receives are queued */
+  struct list_head single_bucket;
+  /* current and highest number of unexpected receives */
+  uint32_t depth;
+  uint32_t depth_max;
+};
+
+/* node of the registration cache interval tree, ordered by address */
+struct omx__regcache_node {
+  struct omx__regcache_node * left;
+  struct omx__regcache_node * right;
+  unsigned long begin, end; /* [begin:end[ segment of the region */
+  unsigned long max_end; /* highest end in this subtree */
+  int height;
+};
+
 struct omx__large_region_map {
   int first_free;
   int nr_free;
   struct omx__large_region_slot {
     int next_free;
     struct omx__large_region {
-      struct list_head reg_elt; /* linked into the endpoint reg_list or reg_vect_list */
+      struct list_head reg_elt; /* linked into the endpoint reg_vect_list if vectorial */
+      struct omx__regcache_node reg_node; /* inserted in the endpoint reg_tree if contigous */
       struct list_head reg_unused_elt; /* linked into the endpoint reg_unused_list if contigous, unused and cached */
       int use_count;
       uint8_t id;
@@ -140,6 +178,13 @@ struct omx__partner {
   /* seq num of the last connect request to this partner */
   uint8_t connect_seqnum;
 
+  /* tiny/small messages to this partner may be aggregated by the driver */
+  uint8_t aggregate;
+  /* large messages from this partner may be pushed by its driver at once */
+  uint8_t push;
+  /* rndv to this partner may carry an eager prefix */
+  uint8_t rndv_eager;
+
   /* ack seqnums of last sent and recv explicit ack */
   uint32_t last_send_acknum;
   uint32_t last_recv_acknum;
@@ -202,6 +247,9 @@ struct omx__partner {
 
   /* user private data for get/set_endpoint_addr_context */
   void * user_context;
+
+  /* list of existing partners of the endpoint */
+  struct list_head endpoint_partners_elt;
 };
 
 /* the internal structure hidden behind an API omx_endpoint_addr */
@@ -249,8 +297,17 @@ struct omx_endpoint {
 #endif
   int progression_disabled;
   struct omx__cond in_handler_cond;
+  struct omx__cond progression_enabled_cond; /* the progress thread sleeps on it while progression is disabled */
+#ifdef OMX_LIB_THREAD_SAFETY
+  struct omx__thread progress_thread;
+#endif
+  int progress_thread_running;
+  int progress_thread_stopping;
+  int fd_armed;
   omx_unexp_handler_t unexp_handler;
   void * unexp_handler_context;
+  omx_completion_handler_t completion_handler;
+  void * completion_handler_context;
   struct omx_endpoint_desc * desc;
   uint32_t check_status_delay_jiffies;
   uint64_t last_check_jiffies;
@@ -266,6 +323,14 @@ struct omx_endpoint {
   uint32_t pull_resend_timeout_jiffies;
   uint32_t zombies, zombie_max;
 
+  /* small commands waiting to be submitted to the driver at once */
+  uint32_t batch_nr, batch_length;
+  uint64_t batch_buffer[OMX_CMD_SUBMIT_BATCH_LENGTH_MAX / sizeof(uint64_t)];
+
+  /* commands queued for the driver without any ioctl, NULL if disabled */
+  void * cmdq;
+  uint32_t cmdq_index;
+
   /* context ids */
   uint8_t ctxid_bits;
   uint32_t ctxid_max;
@@ -278,6 +343,8 @@ struct omx_endpoint {
     struct list_head done_req_q;
     /* unexpected receive, may be partial (queued by their queue_elt) */
     struct list_head unexp_req_q;
+    /* same unexpected receives indexed for exact matching (queued by their done_elt) */
+    struct omx__unexp_match_index unexp_index;
   } anyctxid;
 
   /* context id array for multiplexed queues */
@@ -285,13 +352,16 @@ struct omx_endpoint {
     /* unexpected receive, may be partial (queued by their ctxid_elt, only if there are multiple ctxids) */
     struct list_head unexp_req_q;
     /* posted non-matched receive (queued by their queue_elt) */
-    /* (we could queue by the ctxid_elt but we would need another recv_req_q to ensure conservation of matter) */
-    struct list_head recv_req_q;
+    /* (we could queue by the ctxid_elt but we would need another queue to ensure conservation of matter) */
+    struct omx__recv_match_queue recv_match;
 
     /* done requests (queued by their ctxid_elt, only if there are multiple ctxids) */
     struct list_head done_req_q;
   } * ctxid;
 
+  /* stamp of the next posted receive, used to preserve posting order across recv_match queues */
+  uint64_t next_recv_post_stamp;
+
   /* non multiplexed queues */
   /* SEND req with state = NEED_RESOURCES (queued by their queue_elt) */
   struct list_head need_resources_send_req_q;
@@ -322,18 +392,31 @@ struct omx_endpoint {
 
   struct omx__sendq_map sendq_map;
   struct omx__large_region_map large_region_map;
-  struct omx__partner ** partners;
+  /*
+   * partners indexed by endpoint_index + peer_index * endpoint_max
+   * in a two-level table whose leaves are only allocated when used
+   */
+  struct omx__partner *** partners;
+  uint32_t partner_leaves_nr;
+  uint32_t partner_leaves_allocated;
+  struct list_head partners_list; /* existing partners (queued by their endpoint_partners_elt) */
+  uint32_t partners_nr;
   struct omx__partner * myself;
 
+  uint64_t next_resend_jiffies; /* no non-acked request is due before */
   uint64_t last_partners_acking_jiffies;
   struct list_head partners_to_ack_immediate_list;
   struct list_head partners_to_ack_delayed_list;
   struct list_head throttling_partners_list;
 
   struct list_head sleepers;
+  struct omx__sleeper * driver_sleeper; /* the sleeper waiting in the driver while the others are parked */
+  unsigned long sleepers_signaled; /* parked sleepers woken up because their completion arrived */
+  unsigned long sleepers_driver_wakeups; /* sleepers woken up in the driver */
 
-  struct list_head reg_list; /* registered single-segment windows */
+  struct omx__regcache_node * reg_tree; /* registered single-segment windows, balanced by address */
   struct list_head reg_unused_list; /* unused registered single-segment windows, LRU in front */
+  unsigned reg_unused_nr;
   struct list_head reg_vect_list; /* registered vectorial windows (uncached) */
   int large_sends_avail_nr; /* number of simultaneous large send that may be posted,
 			     * limited to prevent deadlocks */
@@ -342,6 +425,11 @@ struct omx_endpoint {
 
   struct list_head omx_endpoints_list_elt;
 
+  /* free requests (queued by their queue_elt) and the chunks they come from */
+  struct list_head req_free_list;
+  struct omx__request_chunk * req_chunks;
+  unsigned int req_chunks_nr;
+
 #ifdef OMX_LIB_DEBUG
   unsigned int req_alloc_nr;
 #endif
@@ -352,6 +440,8 @@ struct omx_endpoint {
 #define OMX__ENDPOINT_UNLOCK(ep) omx__unlock(&(ep)->lock)
 #define OMX__ENDPOINT_HANDLER_DONE_WAIT(ep) omx__cond_wait(&(ep)->in_handler_cond, &(ep)->lock)
 #define OMX__ENDPOINT_HANDLER_DONE_SIGNAL(ep) omx__cond_signal(&(ep)->in_handler_cond)
+#define OMX__ENDPOINT_PROGRESSION_ENABLED_WAIT(ep) omx__cond_wait(&(ep)->progression_enabled_cond, &(ep)->lock)
+#define OMX__ENDPOINT_PROGRESSION_ENABLED_SIGNAL(ep) omx__cond_signal(&(ep)->progression_enabled_cond)
 
 enum omx__request_type {
   OMX_REQUEST_TYPE_NONE=0,
@@ -494,6 +584,7 @@ union omx_request {
 	unsigned frag_pipeline;
 #endif
 	omx_sendq_map_index_t sendq_map_index[OMX_MEDIUM_FRAGS_MAX];
+	struct omx_persistent_request *persistent; /* owner of the sendq slots if started from a persistent request */
       } mediumsq;
       struct {
 	struct omx_cmd_send_mediumva send_mediumva_ioctl_param;
@@ -511,6 +602,7 @@ union omx_request {
     struct omx__req_segs segs;
     uint64_t match_info;
     uint64_t match_mask;
+    uint64_t post_stamp; /* posting order, only valid while RECV_NEED_MATCHING */
     uint16_t checksum; /* checksum given by sender in incoming send */
     omx__seqnum_t seqnum; /* seqnum of the incoming matched send */
     union {
@@ -526,6 +618,7 @@ union omx_request {
 	uint8_t pulled_rdma_id;
 	uint8_t pulled_rdma_seqnum;
 	uint16_t pulled_rdma_offset;
+	uint16_t eager_length; /* beginning of the message received within the rndv */
       } large;
       struct {
 	union omx_request *sreq;
@@ -541,6 +634,51 @@ union omx_request {
   } connect;
 };
 
+/*
+ * Send or receive prepared once by omx_send_init/omx_recv_init and started many times by omx_start.
+ * Send commands are prebuilt, only their seqnum and piggyack change when starting.
+ * Mediumsq keep their sendq slots and large keep their region pinned until omx_persistent_free.
+ */
+struct omx_persistent_request {
+  enum omx__request_type type;
+  struct omx__partner * partner;
+  struct omx__req_segs segs;
+  omx_endpoint_addr_t addr;
+  uint64_t match_info;
+  uint64_t match_mask;
+  void * context;
+
+  union {
+    struct {
+      struct omx_cmd_send_tiny_hdr send_tiny_hdr;
+    } tiny;
+    struct {
+      struct omx_cmd_send_small send_small_ioctl_param;
+    } small;
+    struct {
+      struct omx_cmd_send_mediumsq_frag send_mediumsq_frag_ioctl_param;
+      uint32_t frags_nr;
+      uint8_t sendq_slots; /* set if the slots below were allocated */
+      uint8_t sendq_busy; /* set while a started request uses the slots */
+      uint8_t released; /* set if freed while the slots were busy */
+      omx_sendq_map_index_t sendq_map_index[OMX_MEDIUM_FRAGS_MAX];
+    } mediumsq;
+    struct {
+      struct omx_cmd_send_mediumva send_mediumva_ioctl_param;
+    } mediumva;
+    struct {
+      struct omx_cmd_send_rndv send_rndv_ioctl_param;
+      struct omx__large_region * region; /* NULL if it could not be allocated at init */
+    } large;
+  } specific;
+};
+
+/* chunk of requests allocated at once by the endpoint request allocator */
+struct omx__request_chunk {
+  struct omx__request_chunk * next;
+  union omx_request reqs[];
+};
+
 typedef void (*omx__process_recv_func_t) (struct omx_endpoint *ep,
 					  struct omx__partner *partner,
 					  union omx_request *req,
@@ -555,6 +693,12 @@ struct omx__early_packet {
   uint32_t msg_length;
 };
 
+enum omx__clock_source {
+  OMX__CLOCK_JIFFIES, /* jiffies mapped from the driver desc */
+  OMX__CLOCK_MONOTONIC_COARSE, /* clock_gettime(CLOCK_MONOTONIC_COARSE) in microseconds */
+  OMX__CLOCK_MONOTONIC, /* clock_gettime(CLOCK_MONOTONIC) in microseconds */
+};
+
 struct omx__globals {
   int initialized;
   int control_fd;
@@ -563,6 +707,7 @@ struct omx__globals {
   int verbdebug;
   int regcache;
   int parallel_regcache;
+  unsigned regcache_unused_max;
   int waitspin;
   int connect_pollall;
   int zombie_max;
@@ -575,15 +720,31 @@ struct omx__globals {
   uint32_t any_endpoint_id;
   int selfcomms;
   int sharedcomms;
+  int release_index;
+  int mediumsq_whole;
+  int submit_batch;
+  int cmdq;
+  int aggregate;
+  int push;
+  unsigned push_max;
+  unsigned rndv_eager;
+  int progress_thread;
   unsigned rndv_threshold;
   unsigned shared_rndv_threshold;
+  enum omx__clock_source clock_source;
+#ifdef OMX_HAVE_CLOCK_GETTIME
+  clockid_t clock_id;
+#endif
+  unsigned hz; /* library jiffies per second */
   unsigned ack_delay_jiffies;
   unsigned resend_delay_jiffies;
   unsigned req_resends_max;
   unsigned not_acked_max;
   unsigned ctxid_bits;
   unsigned ctxid_shift;
+  unsigned req_prealloc;
   char *process_binding;
+  char *progress_thread_binding;
   char *message_prefix;
   char *message_prefix_format;
   unsigned abort_sleeps;
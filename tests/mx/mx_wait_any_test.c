@@ -48,6 +48,10 @@
 #define MATCH_RECEIVER_VAL 0ULL
 #define MATCH_SIDE_MASK (1ULL << 41)
 
+/* throughput mode */
+#define BENCH_WINDOW 64
+#define BENCH_MAX 16
+
 void
 usage()
 {
@@ -55,6 +59,8 @@ usage()
   fprintf(stderr, "-n nic_id - local NIC ID [MX_ANY_NIC]\n");
   fprintf(stderr, "-b board_id - local Board ID [MX_ANY_NIC]\n");
   fprintf(stderr, "-e local_eid - local endpoint ID [%d]\n", DFLT_EID);
+  fprintf(stderr, "-N iter - measure the throughput of iter messages instead\n");
+  fprintf(stderr, "-M max - complete up to max requests per call in throughput mode, 1 uses mx_wait_any [%d]\n", BENCH_MAX);
   fprintf(stderr, "---- the following options are only used on the sender side -------\n");
   fprintf(stderr, "-d hostname - destination hostname, required for sender\n");
   fprintf(stderr, "-r remote_eid - remote endpoint ID [%d]\n", DFLT_EID);
@@ -259,6 +265,104 @@ wait_any_receiver(mx_endpoint_t ep, uint32_t filter)
   return 0;
 }
 
+/* complete count requests on one side, up to max at once */
+static inline
+mx_return_t
+wait_many(mx_endpoint_t ep, uint64_t side, int count, uint32_t max)
+{
+  omx_status_t statuses[max];
+  mx_status_t status;
+  uint32_t result, i;
+  mx_return_t ret;
+
+  while (count) {
+    if (max == 1) {
+      ret = mx_wait_any(ep, MX_INFINITE, side, MATCH_SIDE_MASK, &status, &result);
+      assert(ret == MX_SUCCESS);
+      assert(status.code == MX_STATUS_SUCCESS);
+    } else {
+      ret = omx_wait_many(ep, side, MATCH_SIDE_MASK, statuses, max < count ? max : count, &result, OMX_TIMEOUT_INFINITE);
+      assert(ret == MX_SUCCESS);
+      for(i=0; i<result; i++)
+	assert(statuses[i].code == OMX_SUCCESS);
+    }
+    count -= result;
+  }
+
+  return MX_SUCCESS;
+}
+
+static inline
+mx_return_t
+bench_sender(mx_endpoint_t ep, mx_endpoint_addr_t dest, int iter, uint32_t max)
+{
+  omx_send_desc_t descs[BENCH_WINDOW];
+  mx_request_t reqs[BENCH_WINDOW];
+  int i, j, nr;
+  mx_return_t ret;
+
+  for(j=0; j<BENCH_WINDOW; j++) {
+    descs[j].buffer = NULL;
+    descs[j].length = 0;
+    descs[j].dest_endpoint = dest;
+    descs[j].match_info = MATCH_VAL1 | MATCH_SENDER_VAL;
+    descs[j].context = NULL;
+  }
+
+  for(i=0; i<iter; i+=nr) {
+    nr = iter-i < BENCH_WINDOW ? iter-i : BENCH_WINDOW;
+    ret = omx_isend_many(ep, descs, nr, reqs);
+    assert(ret == MX_SUCCESS);
+    ret = wait_many(ep, MATCH_SENDER_VAL, nr, max);
+    assert(ret == MX_SUCCESS);
+  }
+  printf("Sent %d messages\n", iter);
+
+  return MX_SUCCESS;
+}
+
+static inline
+mx_return_t
+bench_receiver(mx_endpoint_t ep, int iter, uint32_t max)
+{
+  omx_recv_desc_t descs[BENCH_WINDOW];
+  mx_request_t reqs[BENCH_WINDOW];
+  struct timeval tv1, tv2;
+  unsigned long long us;
+  int i, j, nr;
+  mx_return_t ret;
+
+  for(j=0; j<BENCH_WINDOW; j++) {
+    descs[j].buffer = NULL;
+    descs[j].length = 0;
+    descs[j].match_info = MATCH_VAL1 | MATCH_SENDER_VAL;
+    descs[j].match_mask = MX_MATCH_MASK_NONE;
+    descs[j].context = NULL;
+  }
+
+  /* get the first message before starting the timer */
+  ret = omx_irecv_many(ep, descs, 1, reqs);
+  assert(ret == MX_SUCCESS);
+  ret = wait_many(ep, MATCH_SENDER_VAL, 1, max);
+  assert(ret == MX_SUCCESS);
+
+  gettimeofday(&tv1, NULL);
+  for(i=1; i<iter; i+=nr) {
+    nr = iter-i < BENCH_WINDOW ? iter-i : BENCH_WINDOW;
+    ret = omx_irecv_many(ep, descs, nr, reqs);
+    assert(ret == MX_SUCCESS);
+    ret = wait_many(ep, MATCH_SENDER_VAL, nr, max);
+    assert(ret == MX_SUCCESS);
+  }
+  gettimeofday(&tv2, NULL);
+
+  us = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
+  printf("Received %d messages in %lld us (%lld msg/s) completing up to %d at once\n",
+	 iter, us, us ? (unsigned long long) iter*1000000ULL/us : 0ULL, (int) max);
+
+  return MX_SUCCESS;
+}
+
 #if MX_OS_FREEBSD
 /* hack around bug in pthreads that gets us into an unkillable state */
 #include <signal.h>
@@ -284,6 +388,8 @@ int main(int argc, char **argv)
   uint16_t his_eid;
   mx_endpoint_addr_t his_addr;
   char *rem_host;
+  int iter = 0;
+  uint32_t max = BENCH_MAX;
   int c;
   extern char *optarg;
 
@@ -307,7 +413,7 @@ int main(int argc, char **argv)
 
   mx_init();
   mx_set_error_handler(MX_ERRORS_RETURN);
-  while ((c = getopt(argc, argv, "hd:e:f:n:b:r:")) != EOF) switch(c) {
+  while ((c = getopt(argc, argv, "hd:e:f:n:b:r:N:M:")) != EOF) switch(c) {
   case 'd':
     rem_host = optarg;
     break;
@@ -331,6 +437,12 @@ int main(int argc, char **argv)
   case 'r':
     his_eid = atoi(optarg);
     break;
+  case 'N':
+    iter = atoi(optarg);
+    break;
+  case 'M':
+    max = atoi(optarg);
+    break;
   case 'h':
   default:
     usage();
@@ -356,7 +468,10 @@ int main(int argc, char **argv)
     mx_nic_id_to_hostname(nic_id, hostname);
     printf("Starting wait_any receiver on %s, endpoint=%d\n", hostname, my_eid);
 
-    rc = wait_any_receiver(ep, filter);
+    if (iter)
+      rc = bench_receiver(ep, iter, max);
+    else
+      rc = wait_any_receiver(ep, filter);
 
   /* remote hostname implies we are sender */
   } else {
@@ -375,7 +490,10 @@ int main(int argc, char **argv)
 
     printf("Starting wait_any sender to host %s\n", rem_host);
 
-    rc = wait_any_sender(ep, his_addr);
+    if (iter)
+      rc = bench_sender(ep, his_addr, iter, max);
+    else
+      rc = wait_any_sender(ep, his_addr);
   }
 
  abort_with_endpoint:
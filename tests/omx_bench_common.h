@@ -0,0 +1,275 @@
+/*
+ * Open-MX
+ * Copyright © inria 2007-2011 (see AUTHORS file)
+ *
+ * The development of this software has been funded by Myricom, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Option parsing and endpoint setup shared by the omx_*_bench programs.
+ * Benchmarks either run between two local endpoints, or between a sender
+ * and a range of endpoints opened by a receiver on another host.
+ */
+
+#ifndef __omx_bench_common_h__
+#define __omx_bench_common_h__
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "open-mx.h"
+
+#define OMX_BENCH_BID 0
+#define OMX_BENCH_RID 0
+#define OMX_BENCH_KEY 0x12345678
+#define OMX_BENCH_READY_MATCH_INFO 0x1ULL
+
+/* common getopt options, to be prepended to the benchmark specific ones */
+#define OMX_BENCH_LOCAL_OPTIONS "b:h"
+#define OMX_BENCH_REMOTE_OPTIONS "b:e:d:r:h"
+
+struct omx_bench_options {
+  int board_index;
+  int endpoint_index;
+  int remote_endpoint_index;
+  const char *dest_hostname; /* sender mode if set */
+};
+
+static inline void
+omx_bench_options_init(struct omx_bench_options *opts, int endpoint_index)
+{
+  opts->board_index = OMX_BENCH_BID;
+  opts->endpoint_index = endpoint_index;
+  opts->remote_endpoint_index = OMX_BENCH_RID;
+  opts->dest_hostname = NULL;
+}
+
+/* describe the common options that appear in optstring */
+static inline void
+omx_bench_usage(const char *optstring, int endpoint_index)
+{
+  fprintf(stderr, " -b <n>\tchange local board id [%d]\n", OMX_BENCH_BID);
+  if (strchr(optstring, 'e'))
+    fprintf(stderr, " -e <n>\tchange local endpoint id [%d]\n", endpoint_index);
+  if (strchr(optstring, 'd'))
+    fprintf(stderr, " -d <hostname>\tset remote peer name and switch to sender mode\n");
+  if (strchr(optstring, 'r'))
+    fprintf(stderr, " -r <n>\tchange first remote endpoint id [%d]\n", OMX_BENCH_RID);
+}
+
+/* parse a common option, return -1 if the usage should be displayed */
+static inline int
+omx_bench_parse_option(struct omx_bench_options *opts, int c, const char *arg)
+{
+  switch (c) {
+  case 'b':
+    opts->board_index = atoi(arg);
+    return 0;
+  case 'e':
+    opts->endpoint_index = atoi(arg);
+    return 0;
+  case 'd':
+    opts->dest_hostname = arg;
+    return 0;
+  case 'r':
+    opts->remote_endpoint_index = atoi(arg);
+    return 0;
+  default:
+    fprintf(stderr, "Unknown option -%c\n", c);
+  case 'h':
+    return -1;
+  }
+}
+
+static inline unsigned long long
+omx_bench_elapsed_us(const struct timeval *tv1, const struct timeval *tv2)
+{
+  return (tv2->tv_sec-tv1->tv_sec)*1000000ULL+(tv2->tv_usec-tv1->tv_usec);
+}
+
+/* open two local endpoints and connect the send one to the receive one */
+static inline int
+omx_bench_open_local_pair(const struct omx_bench_options *opts,
+			  omx_endpoint_t *send_ep, omx_endpoint_t *recv_ep,
+			  omx_endpoint_addr_t *addr)
+{
+  omx_request_t req;
+  omx_status_t status;
+  uint64_t nic_id;
+  uint32_t eid, result;
+  omx_return_t ret;
+
+  ret = omx_open_endpoint(opts->board_index, OMX_ANY_ENDPOINT, OMX_BENCH_KEY, NULL, 0, recv_ep);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to open receive endpoint (%s)\n",
+	    omx_strerror(ret));
+    goto out;
+  }
+
+  ret = omx_open_endpoint(opts->board_index, OMX_ANY_ENDPOINT, OMX_BENCH_KEY, NULL, 0, send_ep);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to open send endpoint (%s)\n",
+	    omx_strerror(ret));
+    goto out_with_recv_ep;
+  }
+
+  ret = omx_get_endpoint_addr(*recv_ep, addr);
+  if (ret == OMX_SUCCESS)
+    ret = omx_decompose_endpoint_addr(*addr, &nic_id, &eid);
+  if (ret == OMX_SUCCESS)
+    ret = omx_iconnect(*send_ep, nic_id, eid, OMX_BENCH_KEY, 0, NULL, &req);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to connect (%s)\n", omx_strerror(ret));
+    goto out_with_send_ep;
+  }
+  /* let the receive endpoint reply to the connect request */
+  do {
+    omx_progress(*recv_ep);
+    ret = omx_test(*send_ep, &req, &status, &result);
+  } while (ret == OMX_SUCCESS && !result);
+  if (ret != OMX_SUCCESS || status.code != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to connect (%s)\n",
+	    omx_strerror(ret != OMX_SUCCESS ? ret : status.code));
+    goto out_with_send_ep;
+  }
+  *addr = status.addr;
+  return 0;
+
+ out_with_send_ep:
+  omx_close_endpoint(*send_ep);
+ out_with_recv_ep:
+  omx_close_endpoint(*recv_ep);
+ out:
+  return -1;
+}
+
+static inline void
+omx_bench_close_local_pair(omx_endpoint_t send_ep, omx_endpoint_t recv_ep)
+{
+  omx_close_endpoint(send_ep);
+  omx_close_endpoint(recv_ep);
+}
+
+/*
+ * Sender side: open the local endpoint and connect it to the range of
+ * remote endpoints. Each remote endpoint gets a ready message once connected
+ * so that the receiver moves to the next one.
+ */
+static inline int
+omx_bench_connect_peers(const struct omx_bench_options *opts, int peers,
+			omx_endpoint_t *ep, omx_endpoint_addr_t *addrs)
+{
+  omx_request_t req;
+  uint64_t dest_addr;
+  omx_return_t ret;
+  int i;
+
+  ret = omx_hostname_to_nic_id((char *) opts->dest_hostname, &dest_addr);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Cannot find peer name %s\n", opts->dest_hostname);
+    goto out;
+  }
+
+  ret = omx_open_endpoint(opts->board_index, opts->endpoint_index, OMX_BENCH_KEY, NULL, 0, ep);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to open endpoint (%s)\n",
+	    omx_strerror(ret));
+    goto out;
+  }
+
+  for(i=0; i<peers; i++) {
+    int rid = opts->remote_endpoint_index + i;
+
+    ret = omx_connect(*ep, dest_addr, rid, OMX_BENCH_KEY, OMX_TIMEOUT_INFINITE, &addrs[i]);
+    if (ret != OMX_SUCCESS) {
+      fprintf(stderr, "Failed to connect to endpoint %d (%s)\n",
+	      rid, omx_strerror(ret));
+      goto out_with_ep;
+    }
+    ret = omx_isend(*ep, NULL, 0, addrs[i], OMX_BENCH_READY_MATCH_INFO, NULL, &req);
+    if (ret == OMX_SUCCESS)
+      ret = omx_forget(*ep, &req);
+    if (ret != OMX_SUCCESS) {
+      fprintf(stderr, "Failed to post ready isend (%s)\n", omx_strerror(ret));
+      goto out_with_ep;
+    }
+  }
+  return 0;
+
+ out_with_ep:
+  omx_close_endpoint(*ep);
+ out:
+  return -1;
+}
+
+/* receiver side: open the range of endpoints that the sender connects to */
+static inline int
+omx_bench_open_peer_endpoints(const struct omx_bench_options *opts, int peers,
+			      omx_endpoint_t *eps)
+{
+  omx_return_t ret;
+  int i;
+
+  for(i=0; i<peers; i++) {
+    ret = omx_open_endpoint(opts->board_index, opts->endpoint_index+i, OMX_BENCH_KEY, NULL, 0, &eps[i]);
+    if (ret != OMX_SUCCESS) {
+      fprintf(stderr, "Failed to open endpoint %d (%s)\n",
+	      opts->endpoint_index+i, omx_strerror(ret));
+      goto out_with_eps;
+    }
+  }
+  return 0;
+
+ out_with_eps:
+  while (i--)
+    omx_close_endpoint(eps[i]);
+  return -1;
+}
+
+/* receiver side: reply to the connect request of each endpoint, in order */
+static inline int
+omx_bench_wait_peers_ready(const struct omx_bench_options *opts, int peers,
+			   omx_endpoint_t *eps)
+{
+  omx_request_t req;
+  omx_status_t status;
+  uint32_t result;
+  omx_return_t ret;
+  int i;
+
+  for(i=0; i<peers; i++) {
+    ret = omx_irecv(eps[i], NULL, 0, OMX_BENCH_READY_MATCH_INFO, ~0ULL, NULL, &req);
+    if (ret == OMX_SUCCESS)
+      ret = omx_wait(eps[i], &req, &status, &result, OMX_TIMEOUT_INFINITE);
+    if (ret != OMX_SUCCESS) {
+      fprintf(stderr, "Failed to receive ready message on endpoint %d (%s)\n",
+	      opts->endpoint_index+i, omx_strerror(ret));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static inline void
+omx_bench_close_endpoints(omx_endpoint_t *eps, int nr)
+{
+  int i;
+
+  for(i=0; i<nr; i++)
+    omx_close_endpoint(eps[i]);
+}
+
+#endif /* __omx_bench_common_h__ */
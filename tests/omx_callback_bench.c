@@ -0,0 +1,229 @@
+/*
+ * Open-MX
+ * Copyright © inria 2007-2011 (see AUTHORS file)
+ *
+ * The development of this software has been funded by Myricom, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Compare the rate of receive completions delivered to several threads
+ * through omx_test_any polling, and through a completion handler that
+ * forwards them to an application queue while the threads only progress.
+ * The messages are sent by the main thread from another local endpoint.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/time.h>
+
+#include "open-mx.h"
+#include "omx_bench_common.h"
+
+#define THREADS 4
+#define WINDOW 64
+#define ITER 100000
+#define DATA_MATCH_INFO 0x2ULL
+#define OPTIONS OMX_BENCH_LOCAL_OPTIONS
+
+static omx_endpoint_t recv_ep;
+static int iter = ITER;
+static int use_handler = 0;
+
+/* the application queue where the completion handler forwards completions */
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static int queued = 0;
+static int received = 0;
+
+static void
+usage(int argc, char *argv[])
+{
+  fprintf(stderr, "%s [options]\n", argv[0]);
+  omx_bench_usage(OPTIONS, OMX_ANY_ENDPOINT);
+  fprintf(stderr, " -T <n>\tchange number of receiving threads [%d]\n", THREADS);
+  fprintf(stderr, " -W <n>\tchange number of messages in flight [%d]\n", WINDOW);
+  fprintf(stderr, " -N <n>\tchange number of messages [%d]\n", ITER);
+  fprintf(stderr, " -c\tuse a completion handler instead of omx_test_any\n");
+}
+
+static void
+completion_handler(void *context, omx_status_t *status)
+{
+  /* only queue, no Open-MX call is allowed on this endpoint here */
+  pthread_mutex_lock(&queue_lock);
+  queued++;
+  pthread_mutex_unlock(&queue_lock);
+}
+
+/* take one completion from the application queue, return 1 if any */
+static int
+dequeue_completion(void)
+{
+  int ret = 0;
+
+  pthread_mutex_lock(&queue_lock);
+  if (queued) {
+    queued--;
+    received++;
+    ret = 1;
+  }
+  pthread_mutex_unlock(&queue_lock);
+  return ret;
+}
+
+static void *
+receiver(void *data)
+{
+  omx_status_t status;
+  omx_return_t ret;
+  uint32_t result;
+  int done = 0;
+
+  while (!done) {
+    if (use_handler) {
+      ret = omx_progress(recv_ep);
+      if (ret != OMX_SUCCESS)
+	break;
+      while (dequeue_completion())
+	;
+
+    } else {
+      ret = omx_test_any(recv_ep, 0, 0, &status, &result);
+      if (ret != OMX_SUCCESS)
+	break;
+      if (result) {
+	pthread_mutex_lock(&queue_lock);
+	received++;
+	pthread_mutex_unlock(&queue_lock);
+      }
+    }
+
+    pthread_mutex_lock(&queue_lock);
+    done = (received == iter);
+    pthread_mutex_unlock(&queue_lock);
+  }
+
+  if (!done)
+    fprintf(stderr, "Failed to complete receives (%s)\n", omx_strerror(ret));
+  return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+  struct omx_bench_options opts;
+  omx_endpoint_t send_ep;
+  omx_endpoint_addr_t addr;
+  omx_request_t *sreqs;
+  omx_status_t status;
+  pthread_t *threads;
+  struct timeval tv1, tv2;
+  unsigned long long us;
+  uint32_t result;
+  omx_return_t ret;
+  int nthreads = THREADS;
+  int window = WINDOW;
+  int c, i, j;
+
+  omx_bench_options_init(&opts, OMX_ANY_ENDPOINT);
+  while ((c = getopt(argc, argv, OPTIONS "T:W:N:c")) != -1)
+    switch (c) {
+    case 'T':
+      nthreads = atoi(optarg);
+      break;
+    case 'W':
+      window = atoi(optarg);
+      break;
+    case 'N':
+      iter = atoi(optarg);
+      break;
+    case 'c':
+      use_handler = 1;
+      break;
+    default:
+      if (omx_bench_parse_option(&opts, c, optarg) < 0) {
+	usage(argc, argv);
+	exit(-1);
+      }
+      break;
+    }
+
+  ret = omx_init();
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to initialize (%s)\n",
+	    omx_strerror(ret));
+    goto out;
+  }
+
+  threads = malloc(nthreads * sizeof(*threads));
+  sreqs = malloc(window * sizeof(*sreqs));
+  if (!threads || !sreqs) {
+    fprintf(stderr, "Failed to allocate arrays for %d threads\n", nthreads);
+    goto out;
+  }
+
+  if (omx_bench_open_local_pair(&opts, &send_ep, &recv_ep, &addr) < 0)
+    goto out;
+
+  for(i=0; i<iter; i++) {
+    omx_request_t rreq;
+    ret = omx_irecv(recv_ep, NULL, 0, DATA_MATCH_INFO, ~0ULL, NULL, &rreq);
+    if (ret != OMX_SUCCESS) {
+      fprintf(stderr, "Failed to post irecv (%s)\n", omx_strerror(ret));
+      goto out_with_eps;
+    }
+  }
+
+  if (use_handler)
+    omx_register_completion_handler(recv_ep, completion_handler, NULL);
+
+  gettimeofday(&tv1, NULL);
+  for(i=0; i<nthreads; i++)
+    pthread_create(&threads[i], NULL, receiver, NULL);
+
+  for(i=0; i<iter; i+=window) {
+    int nr = iter-i < window ? iter-i : window;
+    for(j=0; j<nr; j++) {
+      ret = omx_isend(send_ep, NULL, 0, addr, DATA_MATCH_INFO, NULL, &sreqs[j]);
+      if (ret != OMX_SUCCESS) {
+	fprintf(stderr, "Failed to post isend (%s)\n", omx_strerror(ret));
+	goto out_with_eps;
+      }
+    }
+    for(j=0; j<nr; j++) {
+      ret = omx_wait(send_ep, &sreqs[j], &status, &result, OMX_TIMEOUT_INFINITE);
+      if (ret != OMX_SUCCESS || !result) {
+	fprintf(stderr, "Failed to wait for isend completion (%s)\n", omx_strerror(ret));
+	goto out_with_eps;
+      }
+    }
+  }
+
+  for(i=0; i<nthreads; i++)
+    pthread_join(threads[i], NULL);
+  gettimeofday(&tv2, NULL);
+
+  us = omx_bench_elapsed_us(&tv1, &tv2);
+  printf("%d threads with %s: %lld completions/s (%lld us for %d messages)\n",
+	 nthreads, use_handler ? "completion handler" : "omx_test_any",
+	 (unsigned long long) iter*1000000ULL/us, us, iter);
+
+  omx_bench_close_local_pair(send_ep, recv_ep);
+  return 0;
+
+ out_with_eps:
+  omx_bench_close_local_pair(send_ep, recv_ep);
+ out:
+  return -1;
+}
@@ -23,6 +23,8 @@
 #include "omx_lib.h"
 
 #define ITER 1000000
+#define SEND_ITER 100000
+#define CMDQ_BATCH 16
 
 static void
 usage(int argc, char *argv[])
@@ -33,10 +35,13 @@ usage(int argc, char *argv[])
 int
 main(int argc, char *argv[])
 {
-  omx_endpoint_t ep;
+  omx_endpoint_t ep, cmdq_ep;
+  omx_endpoint_param_t cmdq_param;
   omx_return_t ret;
   struct timeval tv1,tv2;
   struct omx_cmd_bench cmd;
+  struct omx_cmd_send_liback liback;
+  struct omx_cmd_submit_batch doorbell;
   unsigned long long total, delay, olddelay;
   int i, err;
   int c;
@@ -164,5 +169,85 @@ main(int argc, char *argv[])
   printf("+ recv done:      +%lld ns =>\t%lld ns (%lld us for %d iter)\n", delay-olddelay, delay, total, ITER);
   olddelay = delay;
 
+  if (!(omx__driver_desc->features & OMX_DRIVER_FEATURE_CMDQ)) {
+    printf("driver does not support the command queue\n");
+    return 0;
+  }
+
+  cmdq_param.key = OMX_ENDPOINT_PARAM_CMDQ;
+  cmdq_param.val.cmdq = 1;
+  ret = omx_open_endpoint(0, OMX_ANY_ENDPOINT, 0, &cmdq_param, 1, &cmdq_ep);
+  assert(ret == OMX_SUCCESS);
+
+  /* send libacks to ourself with an invalid session so that they get dropped on receive */
+  memset(&liback, 0, sizeof(liback));
+  liback.peer_index = ep->myself->peer_index;
+  liback.dest_endpoint = ep->endpoint_index;
+  liback.session_id = ~ep->desc->session_id;
+
+  doorbell.nr = 0;
+  doorbell.length = 0;
+  doorbell.buffer = 0;
+
+  gettimeofday(&tv1, NULL);
+  for(i=0; i<SEND_ITER; i++) {
+    err = ioctl(ep->fd, OMX_CMD_SEND_LIBACK, &liback);
+    assert(!err);
+  }
+  gettimeofday(&tv2, NULL);
+  total = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
+  delay = total*1000ULL/SEND_ITER;
+  printf("liback IOCTL:           %lld ns => %lld msg/s (%lld us for %d iter)\n", delay, 1000000000ULL/delay, total, SEND_ITER);
+
+  gettimeofday(&tv1, NULL);
+  for(i=0; i<SEND_ITER; i++) {
+    omx__cmdq_submit(cmdq_ep, OMX_EPCMD_SEND_LIBACK, 0, &liback, sizeof(liback));
+    err = ioctl(cmdq_ep->fd, OMX_CMD_SUBMIT_BATCH, &doorbell);
+    assert(!err);
+  }
+  gettimeofday(&tv2, NULL);
+  total = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
+  delay = total*1000ULL/SEND_ITER;
+  printf("liback cmdq + doorbell: %lld ns => %lld msg/s (%lld us for %d iter)\n", delay, 1000000000ULL/delay, total, SEND_ITER);
+
+  gettimeofday(&tv1, NULL);
+  for(i=0; i<SEND_ITER; i++) {
+    omx__cmdq_submit(cmdq_ep, OMX_EPCMD_SEND_LIBACK, 0, &liback, sizeof(liback));
+    if (i % CMDQ_BATCH == CMDQ_BATCH-1) {
+      err = ioctl(cmdq_ep->fd, OMX_CMD_SUBMIT_BATCH, &doorbell);
+      assert(!err);
+    }
+  }
+  while (omx__cmdq_pending(cmdq_ep))
+    ioctl(cmdq_ep->fd, OMX_CMD_SUBMIT_BATCH, &doorbell);
+  gettimeofday(&tv2, NULL);
+  total = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
+  delay = total*1000ULL/SEND_ITER;
+  printf("liback cmdq x%d:        %lld ns => %lld msg/s (%lld us for %d iter)\n", CMDQ_BATCH, delay, 1000000000ULL/delay, total, SEND_ITER);
+
+  if (omx__driver_desc->features & OMX_DRIVER_FEATURE_CMDQ_POLL) {
+    /* latency until the poll thread consumes the command */
+    gettimeofday(&tv1, NULL);
+    for(i=0; i<SEND_ITER; i++) {
+      omx__cmdq_submit(cmdq_ep, OMX_EPCMD_SEND_LIBACK, 0, &liback, sizeof(liback));
+      while (omx__cmdq_pending(cmdq_ep));
+    }
+    gettimeofday(&tv2, NULL);
+    total = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
+    delay = total*1000ULL/SEND_ITER;
+    printf("liback cmdq polled:     %lld ns => %lld msg/s (%lld us for %d iter)\n", delay, 1000000000ULL/delay, total, SEND_ITER);
+
+    /* rate of the poll thread when the ring never gets empty */
+    gettimeofday(&tv1, NULL);
+    for(i=0; i<SEND_ITER; i++)
+      omx__cmdq_submit(cmdq_ep, OMX_EPCMD_SEND_LIBACK, 0, &liback, sizeof(liback));
+    while (omx__cmdq_pending(cmdq_ep));
+    gettimeofday(&tv2, NULL);
+    total = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
+    delay = total*1000ULL/SEND_ITER;
+    printf("liback cmdq streamed:   %lld ns => %lld msg/s (%lld us for %d iter)\n", delay, 1000000000ULL/delay, total, SEND_ITER);
+  }
+
+  omx_close_endpoint(cmdq_ep);
   return 0;
 }
@@ -0,0 +1,220 @@
+/*
+ * Open-MX
+ * Copyright © inria 2007-2011 (see AUTHORS file)
+ *
+ * The development of this software has been funded by Myricom, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Compare pinning and pulling a large buffer allocated with regular pages
+ * and with hugetlb pages. The first transfer of each buffer includes the
+ * pinning of both regions, the next ones reuse them from the registration
+ * cache and only measure the pull.
+ * The messages are sent between two local endpoints through native networking.
+ */
+
+#define _SVID_SOURCE 1 /* for putenv */
+#define _DEFAULT_SOURCE 1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+#include "open-mx.h"
+#include "omx_bench_common.h"
+
+#define ITER 10
+#define LENGTH (1024*1024*1024)
+#define DATA_MATCH_INFO 0x2ULL
+#define OPTIONS OMX_BENCH_LOCAL_OPTIONS
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+static omx_endpoint_t send_ep, recv_ep;
+static omx_endpoint_addr_t addr;
+
+static void
+usage(int argc, char *argv[])
+{
+  fprintf(stderr, "%s [options]\n", argv[0]);
+  omx_bench_usage(OPTIONS, OMX_ANY_ENDPOINT);
+  fprintf(stderr, " -l <n>\tchange buffer length [%d]\n", LENGTH);
+  fprintf(stderr, " -N <n>\tchange number of transfers after the first one [%d]\n", ITER);
+  fprintf(stderr, " -G\tuse 1GB huge pages instead of the default huge page size\n");
+}
+
+static char *
+alloc_buffer(size_t length, int mmap_flags)
+{
+  void *buffer = mmap(NULL, length, PROT_READ|PROT_WRITE,
+		      MAP_PRIVATE|MAP_ANONYMOUS|mmap_flags, -1, 0);
+  if (buffer == MAP_FAILED)
+    return NULL;
+  /* fault the pages in so that only pinning is measured */
+  memset(buffer, 'a', length);
+  return buffer;
+}
+
+static omx_return_t
+transfer(char *sbuf, char *rbuf, size_t length)
+{
+  omx_request_t sreq, rreq;
+  omx_status_t status;
+  omx_return_t ret;
+  uint32_t result;
+
+  ret = omx_irecv(recv_ep, rbuf, length, DATA_MATCH_INFO, ~0ULL, NULL, &rreq);
+  if (ret != OMX_SUCCESS)
+    return ret;
+  ret = omx_isend(send_ep, sbuf, length, addr, DATA_MATCH_INFO, NULL, &sreq);
+  if (ret != OMX_SUCCESS)
+    return ret;
+
+  do {
+    omx_progress(send_ep);
+    ret = omx_test(recv_ep, &rreq, &status, &result);
+  } while (ret == OMX_SUCCESS && !result);
+  if (ret != OMX_SUCCESS)
+    return ret;
+  if (status.code != OMX_SUCCESS)
+    return status.code;
+
+  do {
+    omx_progress(recv_ep);
+    ret = omx_test(send_ep, &sreq, &status, &result);
+  } while (ret == OMX_SUCCESS && !result);
+  if (ret != OMX_SUCCESS)
+    return ret;
+  return status.code;
+}
+
+static int
+run(const char *name, size_t length, int iter, int mmap_flags)
+{
+  struct timeval tv1, tv2, tv3;
+  char *sbuf, *rbuf;
+  omx_return_t ret;
+  int i;
+
+  sbuf = alloc_buffer(length, mmap_flags);
+  rbuf = alloc_buffer(length, mmap_flags);
+  if (!sbuf || !rbuf) {
+    fprintf(stderr, "Failed to allocate %s buffers of %ld bytes (%m)\n",
+	    name, (unsigned long) length);
+    goto out;
+  }
+
+  gettimeofday(&tv1, NULL);
+  ret = transfer(sbuf, rbuf, length);
+  if (ret != OMX_SUCCESS)
+    goto out_with_error;
+  gettimeofday(&tv2, NULL);
+  for(i=0; i<iter; i++) {
+    ret = transfer(sbuf, rbuf, length);
+    if (ret != OMX_SUCCESS)
+      goto out_with_error;
+  }
+  gettimeofday(&tv3, NULL);
+
+  printf("%-8s %ld bytes: pin+pull %lld us, pull %lld us (%.1f MB/s)\n",
+	 name, (unsigned long) length,
+	 omx_bench_elapsed_us(&tv1, &tv2),
+	 iter ? omx_bench_elapsed_us(&tv2, &tv3) / iter : 0ULL,
+	 iter ? (double) length * iter / omx_bench_elapsed_us(&tv2, &tv3) : 0.);
+
+  munmap(sbuf, length);
+  munmap(rbuf, length);
+  return 0;
+
+ out_with_error:
+  fprintf(stderr, "Failed to transfer %s buffer (%s)\n", name, omx_strerror(ret));
+ out:
+  if (sbuf)
+    munmap(sbuf, length);
+  if (rbuf)
+    munmap(rbuf, length);
+  return -1;
+}
+
+int main(int argc, char *argv[])
+{
+  struct omx_bench_options opts;
+  omx_return_t ret;
+  size_t length = LENGTH;
+  int iter = ITER;
+  int huge_flags = 0;
+  int c;
+
+  omx_bench_options_init(&opts, OMX_ANY_ENDPOINT);
+  while ((c = getopt(argc, argv, OPTIONS "l:N:G")) != -1)
+    switch (c) {
+    case 'l':
+      length = atol(optarg);
+      break;
+    case 'N':
+      iter = atoi(optarg);
+      break;
+    case 'G':
+      huge_flags = 30 << MAP_HUGE_SHIFT;
+      break;
+    default:
+      if (omx_bench_parse_option(&opts, c, optarg) < 0) {
+	usage(argc, argv);
+	exit(-1);
+      }
+      break;
+    }
+
+#ifdef MAP_HUGETLB
+  huge_flags |= MAP_HUGETLB;
+#else
+  fprintf(stderr, "MAP_HUGETLB is not supported\n");
+  goto out;
+#endif
+
+  /* go through the driver pull path, and keep regions pinned after the first transfer */
+  if (!getenv("OMX_DISABLE_SELF"))
+    putenv("OMX_DISABLE_SELF=1");
+  if (!getenv("OMX_DISABLE_SHARED"))
+    putenv("OMX_DISABLE_SHARED=1");
+  if (!getenv("OMX_RCACHE"))
+    putenv("OMX_RCACHE=1");
+
+  ret = omx_init();
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to initialize (%s)\n",
+	    omx_strerror(ret));
+    goto out;
+  }
+
+  if (omx_bench_open_local_pair(&opts, &send_ep, &recv_ep, &addr) < 0)
+    goto out;
+
+  if (run("regular", length, iter, 0) < 0)
+    goto out_with_eps;
+  if (run("hugetlb", length, iter, huge_flags) < 0)
+    goto out_with_eps;
+
+  omx_bench_close_local_pair(send_ep, recv_ep);
+  return 0;
+
+ out_with_eps:
+  omx_bench_close_local_pair(send_ep, recv_ep);
+ out:
+  return -1;
+}
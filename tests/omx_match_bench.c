@@ -0,0 +1,186 @@
+/*
+ * Open-MX
+ * Copyright © inria 2007-2011 (see AUTHORS file)
+ *
+ * The development of this software has been funded by Myricom, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Measure the cost of matching an incoming message against a growing
+ * number of pre-posted receives, using self communications so that
+ * only the library matching is involved.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <assert.h>
+#include <sys/time.h>
+
+#include "open-mx.h"
+#include "omx_bench_common.h"
+
+#define EID OMX_ANY_ENDPOINT
+#define ITER 100000
+#define DEPTH_MAX 100000
+#define TARGET_MATCH_INFO 0x1ULL
+#define OPTIONS OMX_BENCH_LOCAL_OPTIONS "e:"
+
+static void
+usage(int argc, char *argv[])
+{
+  fprintf(stderr, "%s [options]\n", argv[0]);
+  omx_bench_usage(OPTIONS, EID);
+  fprintf(stderr, " -N <n>\tchange number of iterations per depth [%d]\n", ITER);
+  fprintf(stderr, " -D <n>\tchange maximal posted receive depth [%d]\n", DEPTH_MAX);
+  fprintf(stderr, " -w\tpost the non-matching receives with a wildcard mask\n");
+}
+
+static omx_request_t *fillers;
+
+static void
+post_fillers(omx_endpoint_t ep, int from, int to, int wildcard)
+{
+  omx_return_t ret;
+  int i;
+
+  for(i=from; i<to; i++) {
+    if (wildcard)
+      /* upper 32 bits never match the target, lower bits are wildcard */
+      ret = omx_irecv(ep, NULL, 0, ((uint64_t) i+1) << 32, ~0xffffffffULL, NULL, &fillers[i]);
+    else
+      ret = omx_irecv(ep, NULL, 0, ((uint64_t) i+1) << 32, ~0ULL, NULL, &fillers[i]);
+    assert(ret == OMX_SUCCESS);
+  }
+}
+
+static void
+cancel_fillers(omx_endpoint_t ep, int nr)
+{
+  omx_return_t ret;
+  uint32_t result;
+  int i;
+
+  for(i=0; i<nr; i++) {
+    ret = omx_cancel(ep, &fillers[i], &result);
+    assert(ret == OMX_SUCCESS);
+    assert(result);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct omx_bench_options opts;
+  omx_endpoint_t ep;
+  omx_endpoint_addr_t addr;
+  int iter = ITER;
+  int depth_max = DEPTH_MAX;
+  int wildcard = 0;
+  int depth, posted;
+  struct timeval tv1, tv2;
+  omx_return_t ret;
+  int c, i;
+
+  omx_bench_options_init(&opts, EID);
+  while ((c = getopt(argc, argv, OPTIONS "N:D:w")) != -1)
+    switch (c) {
+    case 'N':
+      iter = atoi(optarg);
+      break;
+    case 'D':
+      depth_max = atoi(optarg);
+      break;
+    case 'w':
+      wildcard = 1;
+      break;
+    default:
+      if (omx_bench_parse_option(&opts, c, optarg) < 0) {
+	usage(argc, argv);
+	exit(-1);
+      }
+      break;
+    }
+
+  fillers = malloc(depth_max * sizeof(*fillers));
+  if (!fillers) {
+    fprintf(stderr, "Failed to allocate the array of %d receive requests\n", depth_max);
+    goto out;
+  }
+
+  ret = omx_init();
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to initialize (%s)\n",
+	    omx_strerror(ret));
+    goto out_with_fillers;
+  }
+
+  ret = omx_open_endpoint(opts.board_index, opts.endpoint_index, OMX_BENCH_KEY, NULL, 0, &ep);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to open endpoint (%s)\n",
+	    omx_strerror(ret));
+    goto out_with_fillers;
+  }
+
+  ret = omx_get_endpoint_addr(ep, &addr);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to get local endpoint address (%s)\n",
+	    omx_strerror(ret));
+    goto out_with_ep;
+  }
+
+  printf("Matching %d self messages against %s posted receives\n",
+	 iter, wildcard ? "wildcard" : "exact");
+
+  posted = 0;
+  for(depth=1; depth<=depth_max; depth*=10) {
+    unsigned long long us;
+    omx_request_t sreq, rreq;
+    omx_status_t status;
+    uint32_t result;
+
+    /* keep the target receive behind depth-1 non-matching receives */
+    post_fillers(ep, posted, depth-1, wildcard);
+    posted = depth-1;
+
+    gettimeofday(&tv1, NULL);
+    for(i=0; i<iter; i++) {
+      ret = omx_irecv(ep, NULL, 0, TARGET_MATCH_INFO, ~0ULL, NULL, &rreq);
+      assert(ret == OMX_SUCCESS);
+      ret = omx_isend(ep, NULL, 0, addr, TARGET_MATCH_INFO, NULL, &sreq);
+      assert(ret == OMX_SUCCESS);
+      ret = omx_wait(ep, &sreq, &status, &result, OMX_TIMEOUT_INFINITE);
+      assert(ret == OMX_SUCCESS && result);
+      ret = omx_wait(ep, &rreq, &status, &result, OMX_TIMEOUT_INFINITE);
+      assert(ret == OMX_SUCCESS && result);
+    }
+    gettimeofday(&tv2, NULL);
+
+    us = omx_bench_elapsed_us(&tv1, &tv2);
+    printf("depth %7d: %7lld ns per message (%lld us for %d iter)\n",
+	   depth, us*1000ULL/iter, us, iter);
+  }
+
+  cancel_fillers(ep, posted);
+  omx_close_endpoint(ep);
+  free(fillers);
+  return 0;
+
+ out_with_ep:
+  omx_close_endpoint(ep);
+ out_with_fillers:
+  free(fillers);
+ out:
+  return -1;
+}
@@ -0,0 +1,194 @@
+/*
+ * Open-MX
+ * Copyright © inria 2007-2011 (see AUTHORS file)
+ *
+ * The development of this software has been funded by Myricom, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Measure the rate of small messages sent from a single endpoint to
+ * a range of remote endpoints, as in a halo exchange. The sender posts
+ * a window of messages to each peer before completing all of them.
+ * Run with OMX_SUBMIT_BATCH=1 to compare with batched submission.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "open-mx.h"
+#include "omx_bench_common.h"
+
+#define EID 0
+#define PEERS 4
+#define WINDOW 16
+#define LEN 8
+#define ITER 10000
+#define DATA_MATCH_INFO 0x2ULL
+#define OPTIONS OMX_BENCH_REMOTE_OPTIONS
+
+static void
+usage(int argc, char *argv[])
+{
+  fprintf(stderr, "%s [options]\n", argv[0]);
+  omx_bench_usage(OPTIONS, EID);
+  fprintf(stderr, " -P <n>\tchange number of peer endpoints [%d]\n", PEERS);
+  fprintf(stderr, " -W <n>\tchange number of messages per peer and iteration [%d]\n", WINDOW);
+  fprintf(stderr, " -L <n>\tchange message length [%d]\n", LEN);
+  fprintf(stderr, " -N <n>\tchange number of iterations [%d]\n", ITER);
+}
+
+int main(int argc, char *argv[])
+{
+  struct omx_bench_options opts;
+  omx_endpoint_t *eps;
+  omx_endpoint_addr_t *addrs;
+  omx_request_t *reqs;
+  omx_status_t status;
+  uint32_t result;
+  omx_return_t ret;
+  char *buffer;
+  int c, i, j, k;
+
+  int peers = PEERS;
+  int window = WINDOW;
+  int len = LEN;
+  int iter = ITER;
+
+  omx_bench_options_init(&opts, EID);
+  while ((c = getopt(argc, argv, OPTIONS "P:W:L:N:")) != -1)
+    switch (c) {
+    case 'P':
+      peers = atoi(optarg);
+      break;
+    case 'W':
+      window = atoi(optarg);
+      break;
+    case 'L':
+      len = atoi(optarg);
+      break;
+    case 'N':
+      iter = atoi(optarg);
+      break;
+    default:
+      if (omx_bench_parse_option(&opts, c, optarg) < 0) {
+	usage(argc, argv);
+	exit(-1);
+      }
+      break;
+    }
+
+  ret = omx_init();
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to initialize (%s)\n",
+	    omx_strerror(ret));
+    goto out;
+  }
+
+  eps = malloc(peers * sizeof(*eps));
+  addrs = malloc(peers * sizeof(*addrs));
+  reqs = malloc(peers * window * sizeof(*reqs));
+  buffer = malloc(len ? len : 1);
+  if (!eps || !addrs || !reqs || !buffer) {
+    fprintf(stderr, "Failed to allocate arrays for %d peers\n", peers);
+    goto out;
+  }
+  memset(buffer, 'a', len);
+
+  if (opts.dest_hostname) {
+    /* sender */
+    struct timeval tv1, tv2;
+    unsigned long long us;
+
+    if (omx_bench_connect_peers(&opts, peers, &eps[0], addrs) < 0)
+      goto out;
+
+    gettimeofday(&tv1, NULL);
+    for(k=0; k<iter; k++) {
+      /* interleave destinations like a halo exchange does */
+      for(j=0; j<window; j++)
+	for(i=0; i<peers; i++) {
+	  ret = omx_isend(eps[0], buffer, len, addrs[i], DATA_MATCH_INFO, NULL, &reqs[j*peers+i]);
+	  if (ret != OMX_SUCCESS) {
+	    fprintf(stderr, "Failed to post isend (%s)\n", omx_strerror(ret));
+	    goto out_with_eps;
+	  }
+	}
+      for(j=0; j<window*peers; j++) {
+	ret = omx_wait(eps[0], &reqs[j], &status, &result, OMX_TIMEOUT_INFINITE);
+	if (ret != OMX_SUCCESS || !result || status.code != OMX_SUCCESS) {
+	  fprintf(stderr, "Failed to wait for isend completion (%s)\n", omx_strerror(ret));
+	  goto out_with_eps;
+	}
+      }
+    }
+    gettimeofday(&tv2, NULL);
+
+    us = omx_bench_elapsed_us(&tv1, &tv2);
+    printf("%d peers, %d bytes: %lld msg/s (%lld us for %lld messages)\n",
+	   peers, len, (unsigned long long) iter*window*peers*1000000ULL/us,
+	   us, (unsigned long long) iter*window*peers);
+
+    omx_close_endpoint(eps[0]);
+
+  } else {
+    /* receiver */
+
+    if (omx_bench_open_peer_endpoints(&opts, peers, eps) < 0)
+      goto out;
+    printf("Opened %d endpoints, waiting for the sender\n", peers);
+
+    /* prepost the first window on each endpoint */
+    for(i=0; i<peers; i++)
+      for(j=0; j<window; j++) {
+	ret = omx_irecv(eps[i], buffer, len, DATA_MATCH_INFO, ~0ULL, NULL, &reqs[i*window+j]);
+	if (ret != OMX_SUCCESS) {
+	  fprintf(stderr, "Failed to post irecv (%s)\n", omx_strerror(ret));
+	  goto out_with_eps;
+	}
+      }
+
+    if (omx_bench_wait_peers_ready(&opts, peers, eps) < 0)
+      goto out_with_eps;
+
+    for(k=0; k<iter; k++)
+      for(i=0; i<peers; i++)
+	for(j=0; j<window; j++) {
+	  ret = omx_wait(eps[i], &reqs[i*window+j], &status, &result, OMX_TIMEOUT_INFINITE);
+	  if (ret != OMX_SUCCESS || !result) {
+	    fprintf(stderr, "Failed to wait for irecv completion (%s)\n", omx_strerror(ret));
+	    goto out_with_eps;
+	  }
+	  if (k+1 < iter) {
+	    ret = omx_irecv(eps[i], buffer, len, DATA_MATCH_INFO, ~0ULL, NULL, &reqs[i*window+j]);
+	    if (ret != OMX_SUCCESS) {
+	      fprintf(stderr, "Failed to post irecv (%s)\n", omx_strerror(ret));
+	      goto out_with_eps;
+	    }
+	  }
+	}
+
+    printf("Received %lld messages\n", (unsigned long long) iter*window*peers);
+    omx_bench_close_endpoints(eps, peers);
+  }
+
+  return 0;
+
+ out_with_eps:
+  omx_bench_close_endpoints(eps, opts.dest_hostname ? 1 : peers);
+ out:
+  return -1;
+}
@@ -17,9 +17,16 @@
  * See the GNU General Public License in COPYING.GPL for more details.
  */
 
+/*
+ * Receive null messages from several sender processes with many threads
+ * sleeping in omx_wait_any (or in omx_wait on their own requests with -R)
+ * and report how long each thread slept per message. Run the receiver with
+ * OMX_VERBOSE=1 to see how many sleepers had to be woken up.
+ */
 
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/time.h>
 
 #include <stdio.h>
 #include <errno.h>
@@ -53,6 +60,7 @@ typedef struct cl_req
     struct {
 	struct {
 	    unsigned nb_threads;
+	    int own_requests;
 	} recv;
 
 	struct {
@@ -84,6 +92,8 @@ typedef struct thread_param {
     cl_req_t *cl_req;
     omx_endpoint_t ep;
     int nb_thread_iter;
+    unsigned long long total_us;
+    unsigned long long max_us;
 } thread_param_t;
 
 
@@ -146,6 +156,7 @@ usage(int argc, char *argv[])
 
     fprintf(stderr, "Receiver options:\n");
     fprintf(stderr, " -t <n>\tchange the number of receiver threads [2*nbprocs]\n");
+    fprintf(stderr, " -R\twait for per-thread receives with omx_wait instead of omx_wait_any\n");
 }
 
 
@@ -153,7 +164,7 @@ int parse_cl (int argc, char *argv[], cl_req_t *cl_req)
 {
     int c;
 
-    while ((c = getopt (argc, argv, "b:d:D:r:t:p:N:hv")) != -1)
+    while ((c = getopt (argc, argv, "b:d:D:r:t:p:N:Rhv")) != -1)
 	switch (c) {
 	case 'b':
 	    cl_req->bid = atoi(optarg);
@@ -176,6 +187,9 @@ int parse_cl (int argc, char *argv[], cl_req_t *cl_req)
 	case 't':
 	    cl_req->side.recv.nb_threads = atoi(optarg);
 	    break;
+	case 'R':
+	    cl_req->side.recv.own_requests = 1;
+	    break;
 	case 'p':
 	    cl_req->side.send.nb_processes = atoi(optarg);
 	    break;
@@ -363,18 +377,40 @@ out:
 
 void * thread_receive (void *uncasted_thread_param)
 {
-    omx_endpoint_t ep  = ((thread_param_t *)uncasted_thread_param)->ep;
-    int nb_thread_iter = ((thread_param_t *)uncasted_thread_param)->nb_thread_iter;
+    thread_param_t *thread_param = uncasted_thread_param;
+    omx_endpoint_t ep  = thread_param->ep;
+    int nb_thread_iter = thread_param->nb_thread_iter;
 
+    struct timeval tv1, tv2;
+    unsigned long long us;
+    omx_request_t req;
     omx_status_t status;
     uint32_t result;
     omx_return_t ret;
     int i;
 
     for (i = 0; i < nb_thread_iter; i++) {
-	try_omx (ret = omx_wait_any (ep, 0, 0, &status, &result, OMX_TIMEOUT_INFINITE),
-		 fprintf (stderr, "Failed to wait null message %d (%s)\n", i, omx_strerror(ret)),
-		 out);
+	if (thread_param->cl_req->side.recv.own_requests) {
+	    try_omx (ret = omx_irecv (ep, NULL, 0, 0, 0, NULL, &req),
+		     fprintf (stderr, "Failed to irecv null message %d (%s)\n", i, omx_strerror(ret)),
+		     out);
+
+	    gettimeofday (&tv1, NULL);
+	    try_omx (ret = omx_wait (ep, &req, &status, &result, OMX_TIMEOUT_INFINITE),
+		     fprintf (stderr, "Failed to wait null message %d (%s)\n", i, omx_strerror(ret)),
+		     out);
+	} else {
+	    gettimeofday (&tv1, NULL);
+	    try_omx (ret = omx_wait_any (ep, 0, 0, &status, &result, OMX_TIMEOUT_INFINITE),
+		     fprintf (stderr, "Failed to wait null message %d (%s)\n", i, omx_strerror(ret)),
+		     out);
+	}
+	gettimeofday (&tv2, NULL);
+
+	us = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
+	thread_param->total_us += us;
+	if (us > thread_param->max_us)
+	    thread_param->max_us = us;
 
 	try_omx (status.code,
 		 fprintf(stderr, "irecv null message %d failed with status (%s)\n",
@@ -441,7 +477,8 @@ int main (int argc, char *argv[])
 			.side.send	= { .delay	    = DELAY,
 					    .constant_delay = 0,
 					    .nb_processes   = nbcores },
-			.side.recv	= { .nb_threads = 2*nbthreads } };
+			.side.recv	= { .nb_threads = 2*nbthreads,
+					    .own_requests = 0 } };
 
     parse_cl (argc, argv, &cl_req);
 
@@ -474,6 +511,7 @@ int main (int argc, char *argv[])
 	peer_t *peers;
 
 	pthread_t threads[cl_req.side.recv.nb_threads];
+	thread_param_t thread_params[cl_req.side.recv.nb_threads];
 
 	param_msg.nbsender = 0; /* default value until we receive an actual value from senders */
 
@@ -535,23 +573,32 @@ int main (int argc, char *argv[])
 	}
 
 
-	/* Post the (nb_processes * iter) receives */
-	for (i = 0; i < param_msg.nbsender * param_msg.iter; i++)
-	    try_omx (ret = omx_irecv (ep, NULL, 0, 0, 0, NULL, &req),
-		     fprintf (stderr, "Failed to irecv null message %d (%s)\n", i, omx_strerror(ret)),
-		     out);
+	/* Post the (nb_processes * iter) receives, unless threads post their own */
+	if (!cl_req.side.recv.own_requests)
+	    for (i = 0; i < param_msg.nbsender * param_msg.iter; i++)
+		try_omx (ret = omx_irecv (ep, NULL, 0, 0, 0, NULL, &req),
+			 fprintf (stderr, "Failed to irecv null message %d (%s)\n", i, omx_strerror(ret)),
+			 out);
 
 	printf("Starting %u receiver threads\n", cl_req.side.recv.nb_threads);
 
 	div_t nb_thread_iter = div (param_msg.nbsender * param_msg.iter,
 				    cl_req.side.recv.nb_threads);
-	thread_param_t thread_param = { .ep		= ep,
-					.nb_thread_iter = nb_thread_iter.quot };
-	for (i = 0; i < cl_req.side.recv.nb_threads; i++)
-	    pthread_create (&threads[i], NULL, thread_receive, &thread_param);
+	for (i = 0; i < cl_req.side.recv.nb_threads; i++) {
+	    thread_params[i].cl_req	    = &cl_req;
+	    thread_params[i].ep		    = ep;
+	    thread_params[i].nb_thread_iter = nb_thread_iter.quot;
+	    thread_params[i].total_us	    = 0;
+	    thread_params[i].max_us	    = 0;
+	    pthread_create (&threads[i], NULL, thread_receive, &thread_params[i]);
+	}
 
-	for (i = 0; i < cl_req.side.recv.nb_threads; i++)
+	for (i = 0; i < cl_req.side.recv.nb_threads; i++) {
 	    pthread_join (threads[i], NULL);
+	    printf ("Thread %d slept %lld us per message on average, at most %lld us\n",
+		    i, nb_thread_iter.quot ? thread_params[i].total_us / nb_thread_iter.quot : 0ULL,
+		    thread_params[i].max_us);
+	}
 
 
 	/* Send the 'goodbye' messages */
@@ -45,6 +45,7 @@
 #define SYNC 0
 #define YIELD 0
 #define PAUSE_MS 100
+#define COMPUTE_US 0
 
 static unsigned long long
 next_length(unsigned long long length, unsigned long long multiplier, unsigned long long increment)
@@ -57,6 +58,18 @@ next_length(unsigned long long length, unsigned long long multiplier, unsigned l
     return 1;
 }
 
+static void
+compute(int us)
+{
+  struct timeval tv1, tv2;
+
+  /* busy loop without entering the library */
+  gettimeofday(&tv1, NULL);
+  do
+    gettimeofday(&tv2, NULL);
+  while ((tv2.tv_sec-tv1.tv_sec)*1000000LL+(tv2.tv_usec-tv1.tv_usec) < us);
+}
+
 static inline omx_return_t
 omx_test_or_wait(int wait, int yield,
 		 omx_endpoint_t ep, omx_request_t * request,
@@ -115,6 +128,7 @@ usage(int argc, char *argv[])
   fprintf(stderr, " -P <n>\tpause (in milliseconds) between lengths [%d]\n", PAUSE_MS);
   fprintf(stderr, " -U\tswitch to undirectional mode (receiver sends 0-byte replies)\n");
   fprintf(stderr, " -Y\tswitch to synchronous communication mode\n");
+  fprintf(stderr, " -C <n>\tcompute during <n> microseconds between posting and completing communications\n");
 }
 
 struct param {
@@ -170,8 +184,9 @@ int main(int argc, char *argv[])
   int align = 0;
   int wait = 0;
   int pause_ms = PAUSE_MS;
+  int compute_us = COMPUTE_US;
 
-  while ((c = getopt(argc, argv, "e:r:d:b:S:E:M:I:N:W:P:swUYyvah")) != -1)
+  while ((c = getopt(argc, argv, "e:r:d:b:S:E:M:I:N:W:P:C:swUYyvah")) != -1)
     switch (c) {
     case 'b':
       bid = atoi(optarg);
@@ -208,6 +223,9 @@ int main(int argc, char *argv[])
     case 'P':
       pause_ms = atoi(optarg);
       break;
+    case 'C':
+      compute_us = atoi(optarg);
+      break;
     case 's':
       slave = 1;
       break;
@@ -287,14 +305,15 @@ int main(int argc, char *argv[])
   if (sender) {
     /* sender */
 
-    omx_request_t req;
+    omx_request_t req, rreq;
     omx_status_t status;
     uint32_t result;
     omx_endpoint_addr_t addr;
     struct param param;
-    struct timeval tv1, tv2;
+    struct timeval tv1, tv2, tv3;
     unsigned long long us;
     unsigned long long length;
+    int total_iter;
     int i;
 
     printf("Starting sender to '%s'...\n", dest_hostname);
@@ -306,8 +325,11 @@ int main(int argc, char *argv[])
 	goto out_with_ep;
     }
 
+    /* in overlap mode, a first half of iterations without computation is used as a reference */
+    total_iter = compute_us ? 2*iter : iter;
+
     /* send the param message */
-    param.iter = htonl(iter);
+    param.iter = htonl(total_iter);
     param.warmup = htonl(warmup);
     HTON_DU32(param.min_low, param.min_high, min);
     HTON_DU32(param.max_low, param.max_high, max);
@@ -377,12 +399,26 @@ int main(int argc, char *argv[])
 	goto out_with_ep;
       }
 
-      for(i=0; i<iter+warmup; i++) {
+      for(i=0; i<total_iter+warmup; i++) {
 	if (verbose)
-	  printf("Iteration %d/%d\n", i-warmup, iter);
+	  printf("Iteration %d/%d\n", i-warmup, total_iter);
 
 	if (i == warmup)
 	  gettimeofday(&tv1, NULL);
+	if (compute_us && i == warmup+iter)
+	  gettimeofday(&tv2, NULL);
+
+	if (compute_us) {
+	  /* post the receive first so that the reply may arrive while computing */
+	  ret = omx_irecv(ep, recvbuffer, unidir ? 0 : length,
+			  0, 0,
+			  NULL, &rreq);
+	  if (ret != OMX_SUCCESS) {
+	    fprintf(stderr, "Failed to irecv (%s)\n",
+		    omx_strerror(ret));
+	    goto out_with_ep;
+	  }
+	}
 
 	/* sending a message */
 	ret = omx_isend_or_issend(sync,
@@ -394,6 +430,10 @@ int main(int argc, char *argv[])
 		  omx_strerror(ret));
 	  goto out_with_ep;
 	}
+
+	if (compute_us && i >= warmup+iter)
+	  compute(compute_us);
+
 	ret = omx_test_or_wait(wait, yield, ep, &req, &status, &result);
 	if (ret != OMX_SUCCESS || !result) {
 	  fprintf(stderr, "Failed to wait (%s)\n",
@@ -406,16 +446,18 @@ int main(int argc, char *argv[])
 		  goto out_with_ep;
 	}
 
-	/* wait for an incoming message */
-	ret = omx_irecv(ep, recvbuffer, unidir ? 0 : length,
-			0, 0,
-			NULL, &req);
-	if (ret != OMX_SUCCESS) {
-	  fprintf(stderr, "Failed to irecv (%s)\n",
-		  omx_strerror(ret));
-	  goto out_with_ep;
+	if (!compute_us) {
+	  /* wait for an incoming message */
+	  ret = omx_irecv(ep, recvbuffer, unidir ? 0 : length,
+			  0, 0,
+			  NULL, &rreq);
+	  if (ret != OMX_SUCCESS) {
+	    fprintf(stderr, "Failed to irecv (%s)\n",
+		    omx_strerror(ret));
+	    goto out_with_ep;
+	  }
 	}
-	ret = omx_test_or_wait(wait, yield, ep, &req, &status, &result);
+	ret = omx_test_or_wait(wait, yield, ep, &rreq, &status, &result);
 	if (ret != OMX_SUCCESS || !result) {
 	  fprintf(stderr, "Failed to wait (%s)\n",
 		  omx_strerror(ret));
@@ -429,15 +471,32 @@ int main(int argc, char *argv[])
 
       }
       if (verbose)
-	printf("Iteration %d/%d\n", i-warmup, iter);
-
-      gettimeofday(&tv2, NULL);
-      us = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
-      if (verbose)
-	printf("Total Duration: %lld us\n", us);
-      printf("length % 9lld:\t%.3f us\t%.2f MB/s\t %.2f MiB/s\n",
-	     length, ((float) us)/(2.-unidir)/iter,
-	     (2.-unidir)*iter*length/us, (2.-unidir)*iter*length/us/1.048576);
+	printf("Iteration %d/%d\n", i-warmup, total_iter);
+
+      gettimeofday(&tv3, NULL);
+      if (compute_us) {
+	/* compare the time of communication alone with the time of communication with computation */
+	float comm_us, overlap_us, overlap;
+	us = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
+	comm_us = ((float) us)/iter;
+	us = (tv3.tv_sec-tv2.tv_sec)*1000000ULL+(tv3.tv_usec-tv2.tv_usec);
+	overlap_us = ((float) us)/iter;
+	/* fraction of the shortest of both that was hidden behind the other */
+	overlap = (comm_us + compute_us - overlap_us) / (comm_us < compute_us ? comm_us : compute_us);
+	if (overlap < 0.)
+	  overlap = 0.;
+	else if (overlap > 1.)
+	  overlap = 1.;
+	printf("length % 9lld:\t%.3f us alone\t%.3f us with %d us compute\t%.0f%% overlap\n",
+	       length, comm_us, overlap_us, compute_us, overlap*100.);
+      } else {
+	us = (tv3.tv_sec-tv1.tv_sec)*1000000ULL+(tv3.tv_usec-tv1.tv_usec);
+	if (verbose)
+	  printf("Total Duration: %lld us\n", us);
+	printf("length % 9lld:\t%.3f us\t%.2f MB/s\t %.2f MiB/s\n",
+	       length, ((float) us)/(2.-unidir)/iter,
+	       (2.-unidir)*iter*length/us, (2.-unidir)*iter*length/us/1.048576);
+      }
 
       free(sendbuffer);
       free(recvbuffer);
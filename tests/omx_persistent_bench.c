@@ -0,0 +1,252 @@
+/*
+ * Open-MX
+ * Copyright © inria 2007-2011 (see AUTHORS file)
+ *
+ * The development of this software has been funded by Myricom, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Compare the per-message posting overhead of omx_isend/omx_irecv with
+ * persistent requests started by omx_start, for one message length in
+ * each protocol class (tiny, small, medium and large by default).
+ * The messages are sent between two local endpoints.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "open-mx.h"
+#include "omx_bench_common.h"
+
+#define WINDOW 16
+#define ITER 10000
+#define DATA_MATCH_INFO 0x2ULL
+#define OPTIONS OMX_BENCH_LOCAL_OPTIONS
+
+static omx_endpoint_t send_ep, recv_ep;
+static omx_endpoint_addr_t addr;
+static int window = WINDOW;
+static int iter = ITER;
+
+static void
+usage(int argc, char *argv[])
+{
+  fprintf(stderr, "%s [options]\n", argv[0]);
+  omx_bench_usage(OPTIONS, OMX_ANY_ENDPOINT);
+  fprintf(stderr, " -W <n>\tchange number of messages in flight [%d]\n", WINDOW);
+  fprintf(stderr, " -N <n>\tchange number of messages [%d]\n", ITER);
+  fprintf(stderr, " -l <n>\tonly use this message length\n");
+}
+
+/* progress both endpoints until the whole window is completed */
+static omx_return_t
+complete_window(omx_request_t *sreqs, omx_request_t *rreqs, int nr)
+{
+  omx_status_t status;
+  omx_return_t ret;
+  uint32_t result;
+  int i;
+
+  for(i=0; i<nr; i++) {
+    do {
+      omx_progress(send_ep);
+      ret = omx_test(recv_ep, &rreqs[i], &status, &result);
+    } while (ret == OMX_SUCCESS && !result);
+    if (ret != OMX_SUCCESS)
+      return ret;
+    if (status.code != OMX_SUCCESS)
+      return status.code;
+  }
+
+  for(i=0; i<nr; i++) {
+    do {
+      omx_progress(recv_ep);
+      ret = omx_test(send_ep, &sreqs[i], &status, &result);
+    } while (ret == OMX_SUCCESS && !result);
+    if (ret != OMX_SUCCESS)
+      return ret;
+    if (status.code != OMX_SUCCESS)
+      return status.code;
+  }
+
+  return OMX_SUCCESS;
+}
+
+/* run iter messages of the given length, report the time spent posting sends and the total time */
+static omx_return_t
+run(char *sbuf, char *rbuf, size_t length, int persistent,
+    unsigned long long *post_us, unsigned long long *total_us)
+{
+  omx_persistent_request_t *sp = NULL, *rp = NULL;
+  omx_request_t *sreqs, *rreqs;
+  struct timeval tv1, tv2, tv3;
+  omx_return_t ret = OMX_SUCCESS;
+  int i, j;
+
+  sreqs = malloc(window * sizeof(*sreqs));
+  rreqs = malloc(window * sizeof(*rreqs));
+  if (!sreqs || !rreqs)
+    return OMX_NO_RESOURCES;
+
+  if (persistent) {
+    sp = malloc(window * sizeof(*sp));
+    rp = malloc(window * sizeof(*rp));
+    if (!sp || !rp)
+      return OMX_NO_RESOURCES;
+    for(j=0; j<window; j++) {
+      ret = omx_send_init(send_ep, sbuf + j*length, length, addr, DATA_MATCH_INFO, NULL, &sp[j]);
+      if (ret != OMX_SUCCESS)
+	return ret;
+      ret = omx_recv_init(recv_ep, rbuf + j*length, length, DATA_MATCH_INFO, ~0ULL, NULL, &rp[j]);
+      if (ret != OMX_SUCCESS)
+	return ret;
+    }
+  }
+
+  *post_us = 0;
+  gettimeofday(&tv1, NULL);
+
+  for(i=0; i<iter; i+=window) {
+    int nr = iter-i < window ? iter-i : window;
+
+    for(j=0; j<nr; j++) {
+      if (persistent)
+	ret = omx_start(recv_ep, rp[j], &rreqs[j]);
+      else
+	ret = omx_irecv(recv_ep, rbuf + j*length, length, DATA_MATCH_INFO, ~0ULL, NULL, &rreqs[j]);
+      if (ret != OMX_SUCCESS)
+	goto out;
+    }
+
+    gettimeofday(&tv2, NULL);
+    for(j=0; j<nr; j++) {
+      if (persistent)
+	ret = omx_start(send_ep, sp[j], &sreqs[j]);
+      else
+	ret = omx_isend(send_ep, sbuf + j*length, length, addr, DATA_MATCH_INFO, NULL, &sreqs[j]);
+      if (ret != OMX_SUCCESS)
+	goto out;
+    }
+    gettimeofday(&tv3, NULL);
+    *post_us += omx_bench_elapsed_us(&tv2, &tv3);
+
+    ret = complete_window(sreqs, rreqs, nr);
+    if (ret != OMX_SUCCESS)
+      goto out;
+  }
+
+  gettimeofday(&tv2, NULL);
+  *total_us = omx_bench_elapsed_us(&tv1, &tv2);
+
+ out:
+  if (persistent) {
+    for(j=0; j<window; j++) {
+      omx_persistent_free(send_ep, sp[j]);
+      omx_persistent_free(recv_ep, rp[j]);
+    }
+    free(sp);
+    free(rp);
+  }
+  free(sreqs);
+  free(rreqs);
+  return ret;
+}
+
+int main(int argc, char *argv[])
+{
+  static const size_t default_lengths[] = { 16, 1024, 16384, 1024*1024 };
+  static const char *default_names[] = { "tiny", "small", "medium", "large" };
+  const size_t *lengths = default_lengths;
+  const char **names = default_names;
+  int nlengths = sizeof(default_lengths)/sizeof(default_lengths[0]);
+  size_t length;
+  const char *name = "custom";
+  struct omx_bench_options opts;
+  omx_return_t ret;
+  char *sbuf, *rbuf;
+  int c, i;
+
+  omx_bench_options_init(&opts, OMX_ANY_ENDPOINT);
+  while ((c = getopt(argc, argv, OPTIONS "W:N:l:")) != -1)
+    switch (c) {
+    case 'W':
+      window = atoi(optarg);
+      break;
+    case 'N':
+      iter = atoi(optarg);
+      break;
+    case 'l':
+      length = atol(optarg);
+      lengths = &length;
+      names = &name;
+      nlengths = 1;
+      break;
+    default:
+      if (omx_bench_parse_option(&opts, c, optarg) < 0) {
+	usage(argc, argv);
+	exit(-1);
+      }
+      break;
+    }
+
+  ret = omx_init();
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to initialize (%s)\n",
+	    omx_strerror(ret));
+    goto out;
+  }
+
+  if (omx_bench_open_local_pair(&opts, &send_ep, &recv_ep, &addr) < 0)
+    goto out;
+
+  for(i=0; i<nlengths; i++) {
+    unsigned long long post_us[2], total_us[2];
+    int persistent;
+
+    sbuf = malloc(window * lengths[i]);
+    rbuf = malloc(window * lengths[i]);
+    if (!sbuf || !rbuf) {
+      fprintf(stderr, "Failed to allocate buffers for length %ld\n", (unsigned long) lengths[i]);
+      goto out_with_eps;
+    }
+    memset(sbuf, 'a', window * lengths[i]);
+
+    for(persistent=0; persistent<2; persistent++) {
+      ret = run(sbuf, rbuf, lengths[i], persistent, &post_us[persistent], &total_us[persistent]);
+      if (ret != OMX_SUCCESS) {
+	fprintf(stderr, "Failed to run %s messages (%s)\n", names[i], omx_strerror(ret));
+	goto out_with_eps;
+      }
+    }
+
+    printf("%-6s %8ld bytes: isend %.3f us/msg (%.3f total), start %.3f us/msg (%.3f total)\n",
+	   names[i], (unsigned long) lengths[i],
+	   (double) post_us[0] / iter, (double) total_us[0] / iter,
+	   (double) post_us[1] / iter, (double) total_us[1] / iter);
+
+    free(sbuf);
+    free(rbuf);
+  }
+
+  omx_bench_close_local_pair(send_ep, recv_ep);
+  return 0;
+
+ out_with_eps:
+  omx_bench_close_local_pair(send_ep, recv_ep);
+ out:
+  return -1;
+}
@@ -0,0 +1,177 @@
+/*
+ * Open-MX
+ * Copyright © inria 2007-2011 (see AUTHORS file)
+ *
+ * The development of this software has been funded by Myricom, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Check that an endpoint file descriptor becomes readable in poll()
+ * when a connect request or a message arrives, or when omx_wakeup()
+ * is called, and only then.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <getopt.h>
+#include <assert.h>
+#include <poll.h>
+
+#include "open-mx.h"
+
+#define BID 0
+#define TIMEOUT_MS 1000
+
+static void
+usage(int argc, char *argv[])
+{
+  fprintf(stderr, "%s [options]\n", argv[0]);
+  fprintf(stderr, " -b <n>\tchange local board id [%d]\n", BID);
+}
+
+/* arm the endpoint fd and poll it, return 1 if readable */
+static int
+arm_and_poll(omx_endpoint_t ep, int timeout)
+{
+  struct pollfd pfd;
+  omx_return_t ret;
+  uint32_t result;
+  int err;
+
+  ret = omx_arm_endpoint_fd(ep, &result);
+  assert(ret == OMX_SUCCESS);
+  if (result)
+    /* something is already done, no need to sleep */
+    return 1;
+
+  ret = omx_get_endpoint_fd(ep, &pfd.fd);
+  assert(ret == OMX_SUCCESS);
+  pfd.events = POLLIN;
+  err = poll(&pfd, 1, timeout);
+  assert(err >= 0);
+  assert(!(pfd.revents & POLLERR));
+  return err > 0;
+}
+
+int main(int argc, char *argv[])
+{
+  omx_endpoint_t ep1, ep2;
+  omx_endpoint_addr_t addr, addr1;
+  omx_request_t sreq, rreq, creq;
+  omx_status_t status;
+  struct pollfd pfd;
+  uint64_t nic_id;
+  uint32_t eid, result;
+  omx_return_t ret;
+  int board_index = BID;
+  int fd, c;
+
+  while ((c = getopt(argc, argv, "b:h")) != -1)
+    switch (c) {
+    case 'b':
+      board_index = atoi(optarg);
+      break;
+    default:
+      fprintf(stderr, "Unknown option -%c\n", c);
+    case 'h':
+      usage(argc, argv);
+      exit(-1);
+      break;
+    }
+
+  ret = omx_init();
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to initialize (%s)\n",
+	    omx_strerror(ret));
+    goto out;
+  }
+
+  ret = omx_open_endpoint(board_index, OMX_ANY_ENDPOINT, 0x12345678, NULL, 0, &ep1);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to open first endpoint (%s)\n",
+	    omx_strerror(ret));
+    goto out;
+  }
+
+  ret = omx_open_endpoint(board_index, OMX_ANY_ENDPOINT, 0x12345678, NULL, 0, &ep2);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to open second endpoint (%s)\n",
+	    omx_strerror(ret));
+    goto out_with_ep1;
+  }
+
+  ret = omx_get_endpoint_fd(ep1, &fd);
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Cannot poll endpoints (%s)\n",
+	    omx_strerror(ret));
+    goto out_with_ep2;
+  }
+
+  ret = omx_get_endpoint_addr(ep1, &addr);
+  assert(ret == OMX_SUCCESS);
+  ret = omx_decompose_endpoint_addr(addr, &nic_id, &eid);
+  assert(ret == OMX_SUCCESS);
+
+  /* nothing pending yet */
+  assert(!arm_and_poll(ep1, 0));
+  printf("Idle endpoint is not readable\n");
+
+  /* the connect request must make the first endpoint readable */
+  ret = omx_iconnect(ep2, nic_id, eid, 0x12345678, 0, NULL, &creq);
+  assert(ret == OMX_SUCCESS);
+  assert(arm_and_poll(ep1, TIMEOUT_MS));
+  printf("Connect request made the endpoint readable\n");
+  /* let the arming reply to the request */
+  (void) arm_and_poll(ep1, 0);
+  ret = omx_wait(ep2, &creq, &status, &result, OMX_TIMEOUT_INFINITE);
+  assert(ret == OMX_SUCCESS && result && status.code == OMX_SUCCESS);
+  addr1 = status.addr;
+
+  /* a posted receive alone does not make it readable */
+  ret = omx_irecv(ep1, NULL, 0, 0x1ULL, ~0ULL, NULL, &rreq);
+  assert(ret == OMX_SUCCESS);
+  assert(!arm_and_poll(ep1, 0));
+
+  /* the incoming message must */
+  ret = omx_isend(ep2, NULL, 0, addr1, 0x1ULL, NULL, &sreq);
+  assert(ret == OMX_SUCCESS);
+  assert(arm_and_poll(ep1, TIMEOUT_MS));
+  ret = omx_arm_endpoint_fd(ep1, &result);
+  assert(ret == OMX_SUCCESS && result);
+  ret = omx_test(ep1, &rreq, &status, &result);
+  assert(ret == OMX_SUCCESS && result);
+  ret = omx_wait(ep2, &sreq, &status, &result, OMX_TIMEOUT_INFINITE);
+  assert(ret == OMX_SUCCESS && result);
+  printf("Incoming message made the endpoint readable\n");
+
+  /* omx_wakeup must wake pollers too, without any new arming */
+  assert(!arm_and_poll(ep1, 0));
+  ret = omx_wakeup(ep1);
+  assert(ret == OMX_SUCCESS);
+  pfd.fd = fd;
+  pfd.events = POLLIN;
+  assert(poll(&pfd, 1, TIMEOUT_MS) == 1);
+  printf("omx_wakeup made the endpoint readable\n");
+
+  omx_close_endpoint(ep2);
+  omx_close_endpoint(ep1);
+  return 0;
+
+ out_with_ep2:
+  omx_close_endpoint(ep2);
+ out_with_ep1:
+  omx_close_endpoint(ep1);
+ out:
+  return -1;
+}
@@ -0,0 +1,153 @@
+/*
+ * Open-MX
+ * Copyright © inria 2007-2011 (see AUTHORS file)
+ *
+ * The development of this software has been funded by Myricom, Inc.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or (at
+ * your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+ *
+ * See the GNU General Public License in COPYING.GPL for more details.
+ */
+
+/*
+ * Measure the cost of an idle progression while many sends to many
+ * partners are waiting to be acked. The receiver opens a range of
+ * endpoints and stops progressing them once the sender is connected,
+ * so that nothing gets acked.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/time.h>
+
+#include "open-mx.h"
+#include "omx_bench_common.h"
+
+#define EID 0
+#define PEERS 1
+#define SENDS 10000
+#define ITER 1000000
+#define OPTIONS OMX_BENCH_REMOTE_OPTIONS
+
+static void
+usage(int argc, char *argv[])
+{
+  fprintf(stderr, "%s [options]\n", argv[0]);
+  omx_bench_usage(OPTIONS, EID);
+  fprintf(stderr, " -P <n>\tchange number of peer endpoints [%d]\n", PEERS);
+  fprintf(stderr, "Sender options:\n");
+  fprintf(stderr, " -S <n>\tchange number of outstanding sends [%d]\n", SENDS);
+  fprintf(stderr, " -N <n>\tchange number of progression iterations [%d]\n", ITER);
+}
+
+int main(int argc, char *argv[])
+{
+  struct omx_bench_options opts;
+  omx_endpoint_t *eps;
+  omx_endpoint_addr_t *addrs;
+  omx_return_t ret;
+  int c, i;
+
+  int peers = PEERS;
+  int sends = SENDS;
+  int iter = ITER;
+
+  omx_bench_options_init(&opts, EID);
+  while ((c = getopt(argc, argv, OPTIONS "P:S:N:")) != -1)
+    switch (c) {
+    case 'P':
+      peers = atoi(optarg);
+      break;
+    case 'S':
+      sends = atoi(optarg);
+      break;
+    case 'N':
+      iter = atoi(optarg);
+      break;
+    default:
+      if (omx_bench_parse_option(&opts, c, optarg) < 0) {
+	usage(argc, argv);
+	exit(-1);
+      }
+      break;
+    }
+
+  /* make sure messages go through the wire and need to be acked */
+  setenv("OMX_DISABLE_SHARED", "1", 1);
+  setenv("OMX_DISABLE_SELF", "1", 1);
+
+  ret = omx_init();
+  if (ret != OMX_SUCCESS) {
+    fprintf(stderr, "Failed to initialize (%s)\n",
+	    omx_strerror(ret));
+    goto out;
+  }
+
+  eps = malloc(peers * sizeof(*eps));
+  addrs = malloc(peers * sizeof(*addrs));
+  if (!eps || !addrs) {
+    fprintf(stderr, "Failed to allocate arrays for %d peers\n", peers);
+    goto out;
+  }
+
+  if (opts.dest_hostname) {
+    /* sender */
+    struct timeval tv1, tv2;
+    unsigned long long us;
+    omx_request_t req;
+
+    if (omx_bench_connect_peers(&opts, peers, &eps[0], addrs) < 0)
+      goto out;
+
+    for(i=0; i<sends; i++) {
+      ret = omx_isend(eps[0], NULL, 0, addrs[i % peers], 0x2ULL, NULL, &req);
+      if (ret != OMX_SUCCESS) {
+	fprintf(stderr, "Failed to post isend (%s)\n", omx_strerror(ret));
+	goto out_with_ep;
+      }
+    }
+
+    gettimeofday(&tv1, NULL);
+    for(i=0; i<iter; i++)
+      omx_progress(eps[0]);
+    gettimeofday(&tv2, NULL);
+
+    us = omx_bench_elapsed_us(&tv1, &tv2);
+    printf("%d sends to %d peers: %lld ns per progression (%lld us for %d iter)\n",
+	   sends, peers, us*1000ULL/iter, us, iter);
+
+    omx_close_endpoint(eps[0]);
+
+  } else {
+    /* receiver */
+
+    if (omx_bench_open_peer_endpoints(&opts, peers, eps) < 0)
+      goto out;
+
+    /* reply to the connect request of each endpoint and stop progressing */
+    if (omx_bench_wait_peers_ready(&opts, peers, eps) < 0) {
+      omx_bench_close_endpoints(eps, peers);
+      goto out;
+    }
+    printf("Opened %d endpoints, waiting forever without progressing\n", peers);
+    while (1)
+      pause();
+  }
+
+  return 0;
+
+ out_with_ep:
+  omx_close_endpoint(eps[0]);
+ out:
+  return -1;
+}
@@ -29,6 +29,7 @@
 #define ITER 10
 #define PARALLEL 4
 #define LENGTH 1048576
+#define SWEEP_ITER 100
 
 static int verbose = 0;
 
@@ -146,6 +147,81 @@ one_iteration(omx_endpoint_t ep, omx_endpoint_addr_t addr,
   return OMX_BAD_ERROR;
 }
 
+/*
+ * Cycle over a growing number of send/recv buffer pairs so that the
+ * regcache has to look through more and more cached regions.
+ */
+static omx_return_t
+sweep_cached_regions(omx_endpoint_t ep, omx_endpoint_addr_t addr,
+		     int length, int max)
+{
+  struct timeval tv1, tv2;
+  omx_request_t sreq, rreq;
+  omx_status_t status;
+  omx_return_t ret;
+  uint32_t result;
+  char **buffers;
+  int nr, iter, i;
+
+  buffers = calloc(2*max, sizeof(*buffers));
+  if (!buffers)
+    return OMX_BAD_ERROR;
+
+  for(i=0; i<2*max; i++) {
+    buffers[i] = malloc(length);
+    if (!buffers[i]) {
+      ret = OMX_BAD_ERROR;
+      goto out_with_buffers;
+    }
+  }
+
+  for(nr=1; nr<=max; nr*=2) {
+    unsigned long long us;
+
+    /* the first iteration only fills the regcache */
+    for(iter=0; iter<=SWEEP_ITER; iter++) {
+      if (iter == 1)
+	gettimeofday(&tv1, NULL);
+
+      for(i=0; i<nr; i++) {
+	ret = omx_irecv(ep, buffers[2*i+1], length, 0, 0, NULL, &rreq);
+	if (ret != OMX_SUCCESS) {
+	  fprintf(stderr, "Failed to post recv (%s)\n", omx_strerror(ret));
+	  goto out_with_buffers;
+	}
+	ret = omx_isend(ep, buffers[2*i], length, addr, 0x1234567887654321ULL, NULL, &sreq);
+	if (ret != OMX_SUCCESS) {
+	  fprintf(stderr, "Failed to post send (%s)\n", omx_strerror(ret));
+	  goto out_with_buffers;
+	}
+	ret = omx_wait(ep, &rreq, &status, &result, OMX_TIMEOUT_INFINITE);
+	if (ret != OMX_SUCCESS || !result) {
+	  fprintf(stderr, "Failed to wait for recv completion (%s)\n", omx_strerror(ret));
+	  goto out_with_buffers;
+	}
+	ret = omx_wait(ep, &sreq, &status, &result, OMX_TIMEOUT_INFINITE);
+	if (ret != OMX_SUCCESS || !result) {
+	  fprintf(stderr, "Failed to wait for send completion (%s)\n", omx_strerror(ret));
+	  goto out_with_buffers;
+	}
+      }
+    }
+    gettimeofday(&tv2, NULL);
+
+    us = (tv2.tv_sec-tv1.tv_sec)*1000000ULL+(tv2.tv_usec-tv1.tv_usec);
+    printf("%4d buffer pairs (%4d regions): %lld us per message (%d bytes)\n",
+	   nr, 2*nr, us/(SWEEP_ITER*nr), length);
+  }
+
+  ret = OMX_SUCCESS;
+
+ out_with_buffers:
+  for(i=0; i<2*max; i++)
+    free(buffers[i]);
+  free(buffers);
+  return ret;
+}
+
 static void
 usage(int argc, char *argv[])
 {
@@ -155,6 +231,7 @@ usage(int argc, char *argv[])
   fprintf(stderr, " -l <n>\tuse length [%d]\n", LENGTH);
   fprintf(stderr, " -P <n>\tsend multiple messages in parallel [%d]\n", PARALLEL);
   fprintf(stderr, " -R\tdo not enable regcache\n");
+  fprintf(stderr, " -C <n>\tsweep the number of cached buffer pairs up to <n> instead\n");
   fprintf(stderr, " -s\tuse shared communication instead of native networking\n");
   fprintf(stderr, " -S\tuse self communication instead of shared or native networking\n");
   fprintf(stderr, " -v\tenable verbose messages\n");
@@ -180,11 +257,12 @@ int main(int argc, char *argv[])
   int self = 0;
   int shared = 0;
   int parallel = PARALLEL;
+  int sweep = 0;
   int c;
   int i;
   omx_return_t ret;
 
-  while ((c = getopt(argc, argv, "e:b:l:P:RsSvh")) != -1)
+  while ((c = getopt(argc, argv, "e:b:l:P:RC:sSvh")) != -1)
     switch (c) {
     case 'b':
       board_index = atoi(optarg);
@@ -201,6 +279,9 @@ int main(int argc, char *argv[])
     case 'R':
       rcache = 0;
       break;
+    case 'C':
+      sweep = atoi(optarg);
+      break;
     case 's':
       shared = 1;
       break;
@@ -273,6 +354,14 @@ int main(int argc, char *argv[])
     goto out_with_ep;
   }
 
+  if (sweep) {
+    ret = sweep_cached_regions(ep, addr, length, sweep);
+    if (ret != OMX_SUCCESS)
+      goto out_with_ep;
+    omx_close_endpoint(ep);
+    return 0;
+  }
+
   gettimeofday(&tv1, NULL);
   for(i=0; i<ITER; i++) {
     /* send a large message */
@@ -27,6 +27,10 @@
 
 #define BID 0
 #define EID OMX_ANY_ENDPOINT
+#define STRESS_KEYS 16
+#define STRESS_LAST_MATCH_INFO 0xffffULL
+
+#define STRESS_MATCH_INFO(key) ((((uint64_t) (key)+1) << 32) | 0x10ULL)
 
 static void
 usage(int argc, char *argv[])
@@ -37,6 +41,102 @@ usage(int argc, char *argv[])
   fprintf(stderr, " -s\tuse shared communication instead of native networking\n");
   fprintf(stderr, " -S\tuse self communication instead of shared or native networking\n");
   fprintf(stderr, " -l <n>\t length of messages [0]\n");
+  fprintf(stderr, " -n <n>\t stress with <n> unexpected messages [0]\n");
+}
+
+static int
+stress_recv(omx_endpoint_t ep, uint64_t match_info, uint64_t match_mask)
+{
+  omx_request_t req;
+  omx_status_t status;
+  uint32_t result;
+  uint32_t index;
+  omx_return_t ret;
+
+  ret = omx_irecv(ep, &index, sizeof(index), match_info, match_mask, NULL, &req);
+  assert(ret == OMX_SUCCESS);
+  ret = omx_wait(ep, &req, &status, &result, OMX_TIMEOUT_INFINITE);
+  assert(ret == OMX_SUCCESS);
+  assert(result);
+  assert(status.code == OMX_SUCCESS);
+  assert(status.xfer_length == sizeof(index));
+  return index;
+}
+
+/*
+ * Queue many unexpected messages spread across a few match infos,
+ * then check that exact and wildcard probes and receives still
+ * match them in arrival order.
+ */
+static void
+stress(omx_endpoint_t ep, omx_endpoint_addr_t addr, int nr)
+{
+  uint32_t *indexes;
+  int *next;
+  omx_status_t status;
+  uint32_t result;
+  omx_return_t ret;
+  int i, key, index;
+
+  indexes = malloc(nr * sizeof(*indexes));
+  next = malloc(STRESS_KEYS * sizeof(*next));
+  assert(indexes && next);
+
+  for(i=0; i<nr; i++) {
+    indexes[i] = i;
+    ret = omx_isend(ep, &indexes[i], sizeof(indexes[i]), addr, STRESS_MATCH_INFO(i % STRESS_KEYS), NULL, NULL);
+    assert(ret == OMX_SUCCESS);
+  }
+  ret = omx_isend(ep, NULL, 0, addr, STRESS_LAST_MATCH_INFO, NULL, NULL);
+  assert(ret == OMX_SUCCESS);
+  printf("posted %d sends\n", nr);
+
+  /* messages from a single peer are matched in order, once the last one is there, all are */
+  ret = omx_probe(ep, STRESS_LAST_MATCH_INFO, -1ULL, &status, &result, OMX_TIMEOUT_INFINITE);
+  assert(ret == OMX_SUCCESS);
+  assert(result);
+  ret = omx_irecv(ep, NULL, 0, STRESS_LAST_MATCH_INFO, -1ULL, NULL, NULL);
+  assert(ret == OMX_SUCCESS);
+  printf("all %d messages are unexpected\n", nr);
+
+  for(key=0; key<STRESS_KEYS; key++) {
+    next[key] = key;
+    ret = omx_iprobe(ep, STRESS_MATCH_INFO(key), -1ULL, &status, &result);
+    assert(ret == OMX_SUCCESS);
+    assert(!result == (key >= nr));
+  }
+  printf("iprobe found exact matches\n");
+
+  /* drain the first half, alternating exact and wildcard receives on each key */
+  for(i=0; i<nr/2; i++) {
+    key = i % STRESS_KEYS;
+    if (i & 1)
+      /* wildcard on the low bits, still specific to the key */
+      index = stress_recv(ep, STRESS_MATCH_INFO(key) & ~0xffULL, ~0xffULL);
+    else
+      index = stress_recv(ep, STRESS_MATCH_INFO(key), -1ULL);
+    assert(index == next[key]);
+    next[key] += STRESS_KEYS;
+  }
+  printf("exact and wildcard recv matched in order\n");
+
+  /* drain the remaining messages with a full wildcard, they must come in arrival order */
+  for(i=0; i<nr; i++) {
+    key = i % STRESS_KEYS;
+    if (i < next[key])
+      continue;
+    index = stress_recv(ep, 0, 0);
+    assert(index == i);
+    next[key] += STRESS_KEYS;
+  }
+
+  ret = omx_iprobe(ep, 0, 0, &status, &result);
+  assert(ret == OMX_SUCCESS);
+  assert(!result);
+  printf("full wildcard recv drained the remaining in order\n");
+
+  free(next);
+  free(indexes);
 }
 
 int main(int argc, char *argv[])
@@ -55,9 +155,10 @@ int main(int argc, char *argv[])
   omx_status_t status;
   uint32_t result;
   int length = 0;
+  int stress_nr = 0;
   char *sbuf = NULL, *rbuf = NULL;
 
-  while ((c = getopt(argc, argv, "e:b:l:sSh")) != -1)
+  while ((c = getopt(argc, argv, "e:b:l:n:sSh")) != -1)
     switch (c) {
     case 'b':
       board_index = atoi(optarg);
@@ -68,6 +169,9 @@ int main(int argc, char *argv[])
     case 'l':
       length = atoi(optarg);
       break;
+    case 'n':
+      stress_nr = atoi(optarg);
+      break;
     case 's':
       shared = 1;
       break;
@@ -173,6 +277,9 @@ int main(int argc, char *argv[])
   assert(!result);
   printf("iprobe cannot found match with mask anymore\n");
 
+  if (stress_nr)
+    stress(ep, addr, stress_nr);
+
   free(sbuf);
   free(rbuf);
 
@@ -82,6 +82,9 @@ do_one_board(uint32_t board_index, uint32_t emax, int strict, int verbose)
     if (!get_endpoint_info.info.closed) {
       printf("  %d\topen by pid %ld (%s)\n", i,
 	     (unsigned long) get_endpoint_info.info.pid, get_endpoint_info.info.command);
+      printf("  \t%ld partners using %ld kB\n",
+	     (unsigned long) get_endpoint_info.info.partners_nr,
+	     (unsigned long) (get_endpoint_info.info.partners_memory + 1023) >> 10);
       count++;
     } else if (verbose)
       printf("  %d\tnot open\n", i);